@@ -0,0 +1,64 @@
+import aiocoap
+import asyncio
+import struct
+import sys
+import zlib
+
+DATA_PAYLOAD_FMT = "<HHfffffffIIQ" # ReportedData: data, sequence, elapsed_ms, capture time in device clock ms
+PREDICTION_PAYLOAD_FMT = "<fi"
+INFERENCE_PAYLOAD_FMT = DATA_PAYLOAD_FMT + "fiIIB" # sample, prediction, model version, inference us, has prediction
+SECTOR_SIZE = 4096
+SECTOR_HEADER_FMT = "<IIIIII" # magic, sequence, first id, acked, crc, reserved
+SECTOR_MAGIC = 0x474F4C53
+RECORD_HEADER_FMT = "<HBBIII" # length, type, reserved, id, stamp, crc
+LOG_ACK, LOG_DATA, LOG_PREDICTION, LOG_INFERENCE = 0, 1, 2, 3
+
+def parse_log(raw: bytes):
+    """Yields (sector sequence, id, type, stamp, payload) of the intact records of lib/flashlog sectors,
+    stamp is the Unix time in s when the record was logged (0 if the device clock wasn't synced)"""
+    for start in range(0, len(raw), SECTOR_SIZE):
+        sector = raw[start:start + SECTOR_SIZE]
+        if len(sector) < struct.calcsize(SECTOR_HEADER_FMT):
+            break
+        magic, sequence, first_id, acked, crc, reserved = struct.unpack_from(SECTOR_HEADER_FMT, sector)
+        header = struct.pack(SECTOR_HEADER_FMT, magic, sequence, first_id, acked, 0, reserved)
+        if magic != SECTOR_MAGIC or zlib.crc32(header) != crc:
+            continue
+        offset = struct.calcsize(SECTOR_HEADER_FMT)
+        while offset + struct.calcsize(RECORD_HEADER_FMT) <= len(sector):
+            length, kind, reserved, record_id, stamp, crc = struct.unpack_from(RECORD_HEADER_FMT, sector, offset)
+            if length == 0xFFFF:
+                break
+            payload = sector[offset + 16:offset + 16 + length]
+            header = struct.pack(RECORD_HEADER_FMT, length, kind, reserved, record_id, stamp, 0)
+            if len(payload) != length or zlib.crc32(header + payload) != crc:
+                print(f"Damaged record in sector {sequence} at {offset}, rest of the sector skipped")
+                break
+            yield sequence, record_id, kind, stamp, payload
+            offset += (16 + length + 3) & ~3
+
+# Downloads the sample log of the device (GET /log, block-wise) and prints its records
+# Usage: python download_log.py <device ip> [port] [raw output file]
+async def main():
+    host = sys.argv[1] if len(sys.argv) > 1 else "127.0.0.1"
+    port = int(sys.argv[2]) if len(sys.argv) > 2 else 5683
+    context = await aiocoap.Context.create_client_context()
+    response = await context.request(aiocoap.Message(code=aiocoap.GET, uri=f"coap://{host}:{port}/log")).response
+    print(f"Downloaded {len(response.payload)} bytes:", response.code)
+    if len(sys.argv) > 3:
+        with open(sys.argv[3], "wb") as f:
+            f.write(response.payload)
+    acked = 0
+    for sequence, record_id, kind, stamp, payload in parse_log(response.payload):
+        if kind == LOG_ACK:
+            acked = max(acked, struct.unpack_from("<I", payload)[0])
+        elif kind == LOG_DATA:
+            print(record_id, stamp, "data", struct.unpack_from(DATA_PAYLOAD_FMT, payload))
+        elif kind == LOG_PREDICTION:
+            print(record_id, stamp, "prediction", struct.unpack_from(PREDICTION_PAYLOAD_FMT, payload))
+        elif kind == LOG_INFERENCE:
+            print(record_id, stamp, "inference", struct.unpack_from(INFERENCE_PAYLOAD_FMT, payload))
+    print("Confirmed up to id", acked)
+
+if __name__ == "__main__":
+    asyncio.run(main())
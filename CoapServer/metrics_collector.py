@@ -0,0 +1,115 @@
+import aiocoap
+import asyncio
+import sys
+import time
+
+# Keys of the GET /metrics map (lib/metrics/metrics.h)
+METRIC_NAMES = ["uptime_s", "heap_free", "heap_min_free", "heap_largest_block", "tasks", "runtime_total", "rssi",
+    "i2c_errors", "dht_errors", "coap_transmissions", "coap_retransmissions", "coap_failed", "inferences",
+    "inference_us", "energy", "energy_window_s", "power_management"]
+METRIC_TASKS, METRIC_RUNTIME_TOTAL, METRIC_INFERENCE_US, METRIC_ENERGY, METRIC_POWER_MANAGEMENT = 4, 5, 13, 14, 16
+PM_MODES = ["fixed", "dfs", "dfs_light_sleep"] # lib/power/pm.h
+SCALAR_COLUMNS = [name for name in METRIC_NAMES
+    if name not in ("tasks", "runtime_total", "inference_us", "energy", "power_management")]
+CSV_COLUMNS = SCALAR_COLUMNS + ["inference_last_us", "inference_p50_us", "inference_p99_us", "inference_max_us",
+    "pm_mode", "pm_min_mhz", "pm_max_mhz"]
+
+def decode_cbor(data: bytes, offset: int = 0):
+    """Returns (value, next offset) of the CBOR item at offset, the subset lib/metrics/cbor.h writes:
+    unsigned and negative integers, text strings, arrays and maps of definite length"""
+    major, info = data[offset] >> 5, data[offset] & 31
+    offset += 1
+    if info < 24:
+        value = info
+    elif info <= 27:
+        size = 1 << (info - 24)
+        value = int.from_bytes(data[offset:offset + size], "big")
+        offset += size
+    else:
+        raise ValueError(f"Unsupported CBOR item {data[offset - 1]:#x} at {offset - 1}")
+    if major == 0:
+        return value, offset
+    if major == 1:
+        return -1 - value, offset
+    if major == 3:
+        return data[offset:offset + value].decode(), offset + value
+    if major == 4:
+        items = []
+        for _ in range(value):
+            item, offset = decode_cbor(data, offset)
+            items.append(item)
+        return items, offset
+    if major == 5:
+        items = {}
+        for _ in range(value):
+            key, offset = decode_cbor(data, offset)
+            items[key], offset = decode_cbor(data, offset)
+        return items, offset
+    raise ValueError(f"Unsupported CBOR major type {major} at {offset - 1}")
+
+def cpu_usage(previous: dict, metrics: dict):
+    """CPU % per task between two polls, from the run time counters (empty without configGENERATE_RUN_TIME_STATS)"""
+    if not previous or METRIC_RUNTIME_TOTAL not in metrics or METRIC_RUNTIME_TOTAL not in previous:
+        return {}
+    total = (metrics[METRIC_RUNTIME_TOTAL] - previous[METRIC_RUNTIME_TOTAL]) & 0xFFFFFFFF
+    before = {task[0]: task[2] for task in previous[METRIC_TASKS] if len(task) > 2}
+    usage = {}
+    for task in metrics[METRIC_TASKS]:
+        if len(task) > 2 and task[0] in before and total:
+            usage[task[0]] = 100.0 * ((task[2] - before[task[0]]) & 0xFFFFFFFF) / total
+    return usage
+
+def print_metrics(metrics: dict, usage: dict):
+    last, p50, p99, worst = metrics.get(METRIC_INFERENCE_US, [0, 0, 0, 0])
+    print(f"uptime {metrics.get(0)} s, heap {metrics.get(1)} B free, {metrics.get(2)} B minimum, "
+          f"{metrics.get(3)} B largest block, RSSI {metrics.get(6)} dBm")
+    print(f"  errors: I2C {metrics.get(7)}, DHT {metrics.get(8)}; CoAP {metrics.get(9)} sent, "
+          f"{metrics.get(10)} retransmitted, {metrics.get(11)} failed")
+    print(f"  inferences {metrics.get(12)}, us last {last} p50 {p50} p99 {p99} max {worst}")
+    for task in metrics.get(METRIC_TASKS, []):
+        cpu = f", CPU {usage[task[0]]:.1f} %" if task[0] in usage else ""
+        print(f"  task {task[0]}: {task[1]} B stack free at the high-water mark{cpu}")
+    if METRIC_ENERGY in metrics:
+        energy = metrics[METRIC_ENERGY]
+        print(f"  energy over {metrics.get(15, 0) / 3600:.2f} h: {sum(ua for _, ua in energy) / 1000:.3f} mA average, " +
+              ", ".join(f"{name} {ua / 1000:.3f}" for name, ua in energy))
+    if METRIC_POWER_MANAGEMENT in metrics:
+        mode, min_mhz, max_mhz = metrics[METRIC_POWER_MANAGEMENT]
+        ma = sum(ua for _, ua in metrics.get(METRIC_ENERGY, [])) / 1000
+        # charge of the whole device per inference, comparable between configurations at the same poll interval
+        per_inference = ma * metrics.get(15, 0) / 3.6 / metrics[12] if metrics.get(12) else 0
+        print(f"  power management {PM_MODES[mode] if mode < len(PM_MODES) else mode} {min_mhz}-{max_mhz} MHz: "
+              f"Invoke p50 {p50} us, {ma:.3f} mA average, {per_inference:.1f} uAh per inference")
+
+# Polls the health metrics of the device (GET /metrics, CBOR, block-wise) and prints them, optionally as CSV rows
+# Usage: python metrics_collector.py <device ip> [port] [interval s] [csv file]
+async def main():
+    host = sys.argv[1] if len(sys.argv) > 1 else "127.0.0.1"
+    port = int(sys.argv[2]) if len(sys.argv) > 2 else 5683
+    interval = float(sys.argv[3]) if len(sys.argv) > 3 else 10
+    csv = open(sys.argv[4], "a") if len(sys.argv) > 4 else None
+    if csv and csv.tell() == 0:
+        csv.write(",".join(["time"] + CSV_COLUMNS) + "\n")
+    context = await aiocoap.Context.create_client_context()
+    previous = None
+    while True:
+        try:
+            request = aiocoap.Message(code=aiocoap.GET, uri=f"coap://{host}:{port}/metrics")
+            response = await context.request(request).response
+            metrics, _ = decode_cbor(response.payload)
+        except Exception as e:
+            print("Poll failed:", e)
+            await asyncio.sleep(interval)
+            continue
+        print_metrics(metrics, cpu_usage(previous, metrics))
+        if csv:
+            values = [metrics.get(METRIC_NAMES.index(name), "") for name in SCALAR_COLUMNS]
+            values += metrics.get(METRIC_INFERENCE_US, ["", "", "", ""])
+            values += metrics.get(METRIC_POWER_MANAGEMENT, ["", "", ""])
+            csv.write(",".join(str(value) for value in [int(time.time())] + values) + "\n")
+            csv.flush()
+        previous = metrics
+        await asyncio.sleep(interval)
+
+if __name__ == "__main__":
+    asyncio.run(main())
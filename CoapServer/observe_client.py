@@ -0,0 +1,29 @@
+import aiocoap
+import asyncio
+import struct
+import sys
+import time
+
+PREDICTION_PAYLOAD_FMT = "<fi"
+
+# Observes /occupancy on the device (or host/coap_observe_demo) and prints every notification with its age
+# Usage: python observe_client.py <device ip> [port]
+async def main():
+    host = sys.argv[1] if len(sys.argv) > 1 else "127.0.0.1"
+    port = int(sys.argv[2]) if len(sys.argv) > 2 else 5683
+    context = await aiocoap.Context.create_client_context()
+    request = aiocoap.Message(code=aiocoap.GET, uri=f"coap://{host}:{port}/occupancy", observe=0)
+    pr = context.request(request)
+    start = time.monotonic()
+    last = start
+
+    response = await pr.response
+    print("Registered:", response.code, "observe" if response.opt.observe is not None else "not observing")
+    async for notification in pr.observation:
+        now = time.monotonic()
+        human_count, ventilation = struct.unpack_from(PREDICTION_PAYLOAD_FMT, notification.payload)
+        print(f"{now - start:8.2f} s  +{now - last:6.2f} s  seq {notification.opt.observe}  "
+              f"human count {human_count:.2f}, ventilation {ventilation}")
+        last = now
+
+asyncio.run(main())
@@ -4,12 +4,22 @@ import aiocoap.error as error
 import asyncio
 import socket
 import struct
+import sys
 import sqlite3 as sql
 import os
+import time
+import datetime
 
 DATA_PAYLOAD_FMT = "<HHfffffff"
+REPORT_META_FMT = "<IIQ" # sequence, elapsed_ms, capture time in Unix ms (0 if the device clock isn't synced)
 PREDICTION_PAYLOAD_FMT = "<fi"
-IPADDR = socket.gethostbyname(socket.gethostname())
+INFERENCE_META_FMT = "<IIB" # model version (CRC32 of the .tflite file), inference time in us, has prediction
+BATCH_VERSION = 2
+BATCH_UNIX_TIME = 0x80
+BATCH_HEADER_FMT = "<BBQII" # version, count, time and sequence of the first sample, ms from it to the encoding
+BATCH_SCALES = (1, 1, 100, 10, 100, 100, 10, 10, 100) # fixed point per data field, same as lib/tsbatch
+BATCH_NAN = -0x40000000 # quantized value of a failed read
+IPADDR = sys.argv[1] if len(sys.argv) > 1 else socket.gethostbyname(socket.gethostname()) # e.g. 127.0.0.1 for host/firmware
 latest_prediction = {}
 
 def connect_to_db(dbname: str):
@@ -33,21 +43,59 @@ def connect_to_db(dbname: str):
         timestamp DATETIME DEFAULT CURRENT_TIMESTAMP
     )"""
     cursor.execute(create_db)
+    # series metadata of report by exception samples, gaps in sequence hold the previous values
+    columns = [row[1] for row in cursor.execute("PRAGMA table_info(sensor_data)")]
+    for column in ("sequence INTEGER", "elapsed_ms INTEGER", "received DATETIME"):
+        if column.split()[0] not in columns:
+            cursor.execute(f"ALTER TABLE sensor_data ADD COLUMN {column}")
+    # a window that wasn't confirmed is replayed from the device log, samples stored the first time are skipped
+    try:
+        cursor.execute("CREATE UNIQUE INDEX IF NOT EXISTS sensor_data_sample ON sensor_data(sequence, timestamp)")
+    except sql.IntegrityError:
+        print("sensor_data already holds replayed duplicates, they are not skipped until those are removed")
+    # predictions of inference mode polls, next to the sample they were reported with
+    cursor.execute("""
+    CREATE TABLE IF NOT EXISTS predictions (
+        id INTEGER PRIMARY KEY AUTOINCREMENT,
+        sensor_id INTEGER REFERENCES sensor_data(id),
+        human_count FLOAT,
+        ventilation_state INTEGER,
+        model_version TEXT,
+        inference_us INTEGER,
+        timestamp DATETIME DEFAULT CURRENT_TIMESTAMP
+    )""")
     cursor.close()
     conn.commit()
     return conn
 
+def format_timestamp(unix_ms: float):
+    """Same layout as CURRENT_TIMESTAMP (UTC), with milliseconds"""
+    return datetime.datetime.utcfromtimestamp(unix_ms / 1000).strftime("%Y-%m-%d %H:%M:%S.%f")[:-3]
+
 class Data(resource.Resource):
 
     def __init__(self, conn):
         super().__init__()
         self.conn = conn
+        self.last_sequence = None
 
     async def render_post(self, request):
         try:
             data = tuple(round(measurement, 2) for measurement in struct.unpack_from(DATA_PAYLOAD_FMT, request.payload))
-            print("Received data:", data)
-            query = f"""INSERT INTO sensor_data
+            meta = (None, None)
+            received = format_timestamp(time.time() * 1000)
+            timestamp = received
+            if len(request.payload) >= struct.calcsize(DATA_PAYLOAD_FMT) + struct.calcsize(REPORT_META_FMT):
+                sequence, elapsed, device_ms = struct.unpack_from(REPORT_META_FMT, request.payload,
+                                                                   struct.calcsize(DATA_PAYLOAD_FMT))
+                meta = (sequence, elapsed)
+                if device_ms:
+                    timestamp = format_timestamp(device_ms)
+                if self.last_sequence is not None and sequence > self.last_sequence + 1:
+                    print(f"{sequence - self.last_sequence - 1} samples held the previous values")
+                self.last_sequence = sequence
+            print("Received data:", data, "sequence/elapsed ms:", meta, "taken at", timestamp)
+            query = """INSERT OR IGNORE INTO sensor_data
             (   co2_ppm,
                 tvoc_ppm, 
                 bmp280_temperature, 
@@ -56,10 +104,14 @@ class Data(resource.Resource):
                 mlx_ambient_temperature, 
                 humidity_dht, 
                 temperature_dht,
-                pir_uptime  )
-            VALUES {data}"""
+                pir_uptime,
+                sequence,
+                elapsed_ms,
+                timestamp,
+                received  )
+            VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"""
             cursor = self.conn.cursor()
-            cursor.execute(query)
+            cursor.execute(query, data + meta + (timestamp, received))
             cursor.execute("SELECT * FROM sensor_data")
             db_view = cursor.fetchall()
             for row in db_view:
@@ -72,6 +124,81 @@ class Data(resource.Resource):
         finally:
             cursor.close()
     
+def decode_batch(payload: bytes):
+    """Decodes a lib/tsbatch batch into (unix time flag, ms from the first sample to the encoding,
+    [(time ms, sequence, data tuple)]), times are Unix ms with the flag, else device clock ms"""
+    version, count, device_ms, sequence, encoded_after = struct.unpack_from(BATCH_HEADER_FMT, payload)
+    unix_time = bool(version & BATCH_UNIX_TIME)
+    if version & ~BATCH_UNIX_TIME != BATCH_VERSION:
+        raise ValueError(f"Unknown batch version {version}")
+    bits = int.from_bytes(payload[struct.calcsize(BATCH_HEADER_FMT):], "big")
+    remaining = (len(payload) - struct.calcsize(BATCH_HEADER_FMT)) * 8
+
+    def read(width):
+        nonlocal remaining
+        if width > remaining:
+            raise ValueError("Truncated batch")
+        remaining -= width
+        return (bits >> remaining) & ((1 << width) - 1)
+
+    def read_value():
+        ones = 0
+        while ones < 4 and read(1):
+            ones += 1
+        z = read((0, 4, 8, 16, 32)[ones]) if ones else 0
+        return (z >> 1) ^ -(z & 1)
+
+    samples = []
+    delta = 0
+    values = [0] * len(BATCH_SCALES)
+    for index in range(count):
+        delta += read_value()
+        gap = read_value()
+        if index:
+            device_ms += delta
+            sequence += 1 + gap
+        for channel in range(len(BATCH_SCALES)):
+            values[channel] += read_value()
+        samples.append((device_ms, sequence, tuple(float("nan") if v == BATCH_NAN else round(v / scale, 2)
+                                                   for v, scale in zip(values, BATCH_SCALES))))
+    return unix_time, encoded_after, samples
+
+class Batch(resource.Resource):
+    """Compressed samples of one transmit window, stamped with the device time. Batches of a device without
+    Unix time are placed by their arrival, with the device clock for the spacing."""
+
+    def __init__(self, conn):
+        super().__init__()
+        self.conn = conn
+
+    async def render_post(self, request):
+        try:
+            unix_time, encoded_after, samples = decode_batch(request.payload)
+            received_ms = time.time() * 1000
+            first_ms = samples[0][0] if samples else 0
+            cursor = self.conn.cursor()
+            previous = None
+            stored = 0
+            for device_ms, sequence, data in samples:
+                elapsed = device_ms - previous if previous is not None else None
+                previous = device_ms
+                unix_ms = device_ms if unix_time else received_ms - encoded_after + (device_ms - first_ms)
+                cursor.execute("""INSERT OR IGNORE INTO sensor_data
+                (co2_ppm, tvoc_ppm, bmp280_temperature, bmp280_pressure, mlx_object_temperature,
+                mlx_ambient_temperature, humidity_dht, temperature_dht, pir_uptime, sequence, elapsed_ms, timestamp,
+                received)
+                VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)""",
+                data + (sequence, elapsed, format_timestamp(unix_ms), format_timestamp(received_ms)))
+                stored += cursor.rowcount
+            self.conn.commit()
+            cursor.close()
+            print(f"Received batch: {len(samples)} samples in {len(request.payload)} bytes, "
+                  f"{len(samples) - stored} already stored")
+            return aiocoap.Message(code=aiocoap.CHANGED)
+        except Exception as e:
+            print(e)
+            raise error.NotAcceptable("Payload was not accepted.")
+
 class Predictions(resource.Resource):
         async def render_post(self, request):
             try:
@@ -84,11 +211,74 @@ class Predictions(resource.Resource):
                 print(e)
                 raise error.NotAcceptable("Payload was not accepted.")
 
+class Inference(resource.Resource):
+    """Sample and prediction of one inference mode poll in one datagram, both go into the database in one
+    transaction. Polls without a prediction (window warm up, inference task still busy) only store the sample."""
+
+    def __init__(self, conn):
+        super().__init__()
+        self.conn = conn
+
+    async def render_post(self, request):
+        try:
+            offset = 0
+            data = tuple(round(measurement, 2) for measurement in struct.unpack_from(DATA_PAYLOAD_FMT, request.payload))
+            offset += struct.calcsize(DATA_PAYLOAD_FMT)
+            sequence, elapsed, device_ms = struct.unpack_from(REPORT_META_FMT, request.payload, offset)
+            offset += struct.calcsize(REPORT_META_FMT)
+            human_count, ventilation = struct.unpack_from(PREDICTION_PAYLOAD_FMT, request.payload, offset)
+            offset += struct.calcsize(PREDICTION_PAYLOAD_FMT)
+            model_version, inference_us, has_prediction = struct.unpack_from(INFERENCE_META_FMT, request.payload, offset)
+            received = format_timestamp(time.time() * 1000)
+            timestamp = format_timestamp(device_ms) if device_ms else received
+            cursor = self.conn.cursor()
+            cursor.execute("""INSERT OR IGNORE INTO sensor_data
+            (co2_ppm, tvoc_ppm, bmp280_temperature, bmp280_pressure, mlx_object_temperature,
+            mlx_ambient_temperature, humidity_dht, temperature_dht, pir_uptime, sequence, elapsed_ms, timestamp,
+            received)
+            VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)""", data + (sequence, elapsed, timestamp, received))
+            duplicate = cursor.rowcount == 0
+            if has_prediction and not duplicate:
+                cursor.execute("""INSERT INTO predictions
+                (sensor_id, human_count, ventilation_state, model_version, inference_us, timestamp)
+                VALUES (?, ?, ?, ?, ?, ?)""",
+                (cursor.lastrowid, round(human_count, 2), ventilation, f"{model_version:08x}", inference_us, timestamp))
+                latest_prediction["human_count"] = round(human_count, 2)
+                latest_prediction["ventilation_state"] = ventilation
+            self.conn.commit()
+            cursor.close()
+            print("Received inference poll:" if not duplicate else "Received inference poll again:", data,
+                  "sequence", sequence, "taken at", timestamp,
+                  f"prediction ({human_count:.2f}, {ventilation}) by model {model_version:08x} in {inference_us} us"
+                  if has_prediction else "without prediction")
+            return aiocoap.Message(code=aiocoap.CHANGED)
+        except Exception as e:
+            print(e)
+            raise error.NotAcceptable("Payload was not accepted.")
+
+class Blob(resource.Resource):
+    """Stores one payload of any size, aiocoap reassembles Block1 uploads and splits GET responses into Block2"""
+
+    def __init__(self):
+        super().__init__()
+        self.content = b""
+
+    async def render_post(self, request):
+        self.content = request.payload
+        print("Received blob:", len(self.content), "bytes")
+        return aiocoap.Message(code=aiocoap.CHANGED)
+
+    async def render_get(self, request):
+        return aiocoap.Message(payload=self.content)
+
 async def main():
     conn = connect_to_db("data.db")
     root = resource.Site()
     root.add_resource(['data'], Data(conn))
     root.add_resource(['predictions'], Predictions())
+    root.add_resource(['blob'], Blob())
+    root.add_resource(['batch'], Batch(conn))
+    root.add_resource(['inference'], Inference(conn))
     await aiocoap.Context.create_server_context(root, bind=(IPADDR, 5683))
     print(f"CoAP Server running on coap://{IPADDR}:5683")
     await asyncio.get_running_loop().create_future()
@@ -0,0 +1,111 @@
+import asyncio
+import json
+import os
+import struct
+import sys
+
+# Binary dump of GET /trace or the TRACE lines of Trace::print() (lib/perf/trace.h)
+TRACE_MAGIC = 0x31435254
+HEADER_FMT = "<IIIIHHBBH" # magic, cpu MHz, dropped core 0/1, events core 0/1, cores, tasks, reserved
+EVENT_FMT = "<IIBBBB" # ccount, us, type, event, task, arg
+TASK_NAME = 16
+TASK_OTHER, TASK_ISR = 0xFE, 0xFF
+TRACE_BEGIN, TRACE_END, TRACE_INSTANT = 1, 2, 3
+EVENT_NAMES = ["wait_data_set", "wait_prediction", "set_data_set", "set_prediction_ready", "bmp280_read",
+    "mlx90614_read", "ccs811_read", "dht_read", "udp_send", "udp_receive", "invoke", "wifi_event", "button"]
+RESYNC_US = 2 # CCOUNT time further than this from esp_timer (frequency change, wrap) restarts from the us
+
+def parse_dumps(raw: bytes):
+    """Yields (header dict, task names, [(core, ccount, us, type, event, task, arg)]) of each dump in raw"""
+    offset = 0
+    while offset + struct.calcsize(HEADER_FMT) <= len(raw):
+        magic, mhz, dropped0, dropped1, events0, events1, cores, tasks, _ = struct.unpack_from(HEADER_FMT, raw, offset)
+        if magic != TRACE_MAGIC:
+            raise ValueError(f"No trace header at {offset}")
+        offset += struct.calcsize(HEADER_FMT)
+        names = [raw[offset + i * TASK_NAME:offset + (i + 1) * TASK_NAME].split(b"\0")[0].decode() for i in range(tasks)]
+        offset += tasks * TASK_NAME
+        events = []
+        for core, count in enumerate([events0, events1][:cores]):
+            for _ in range(count):
+                events.append((core,) + struct.unpack_from(EVENT_FMT, raw, offset))
+                offset += struct.calcsize(EVENT_FMT)
+        header = {"cpu_mhz": mhz, "dropped": [dropped0, dropped1][:cores]}
+        yield header, names, events
+
+def read_input(path: str) -> bytes:
+    """Raw dump file, or a serial log whose TRACE lines carry it as hex (one dump per upload)"""
+    with open(path, "rb") as f:
+        raw = f.read()
+    if raw[:4] == struct.pack("<I", TRACE_MAGIC):
+        return raw
+    return b"".join(bytes.fromhex(line.split(b"TRACE ", 1)[1].strip().decode())
+        for line in raw.splitlines() if b"TRACE " in line)
+
+def timestamps(events, mhz: int):
+    """us per event: esp_timer us unwrapped per core, refined by the cycle counter while both agree"""
+    times = []
+    cores = {} # core: last us as recorded, unwrapped, its time and ccount
+    for core, ccount, us, *_ in events:
+        if core not in cores:
+            full_us = time = us
+        else:
+            raw_us, last_us, last_time, last_ccount = cores[core]
+            delta = (us - raw_us) & 0xFFFFFFFF
+            full_us = last_us + (delta - (1 << 32) if delta >= 1 << 31 else delta)
+            refined = last_time + ((ccount - last_ccount) & 0xFFFFFFFF) / mhz if mhz else full_us
+            time = refined if abs(refined - full_us) <= RESYNC_US else full_us
+        cores[core] = (us, full_us, time, ccount)
+        times.append(time)
+    return times
+
+def convert(raw: bytes):
+    trace = []
+    dropped = []
+    thread_names = {}
+    for header, names, events in parse_dumps(raw):
+        dropped.append(header["dropped"])
+        for index, name in enumerate(names):
+            thread_names[index] = name
+        for (core, ccount, us, kind, event, task, arg), time in zip(events, timestamps(events, header["cpu_mhz"])):
+            name = EVENT_NAMES[event] if event < len(EVENT_NAMES) else f"event_{event}"
+            record = {"name": name, "ts": time, "pid": 1, "tid": task, "args": {"core": core}}
+            if kind == TRACE_BEGIN:
+                record["ph"] = "B"
+            elif kind == TRACE_END:
+                record["ph"] = "E"
+            elif kind == TRACE_INSTANT:
+                record.update(ph="i", s="t")
+                record["args"]["arg"] = arg
+            else:
+                continue
+            trace.append(record)
+    for tid, name in list(thread_names.items()) + [(TASK_ISR, "ISR"), (TASK_OTHER, "other tasks")]:
+        trace.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": tid, "args": {"name": name}})
+    trace.append({"name": "process_name", "ph": "M", "pid": 1, "args": {"name": "ESP32Inference"}})
+    last = dropped[-1] if dropped else []
+    return {"traceEvents": trace, "displayTimeUnit": "ns", "otherData": {"dropped_events_per_core": last}}, last
+
+async def download(host: str, port: int) -> bytes:
+    import aiocoap
+    context = await aiocoap.Context.create_client_context()
+    response = await context.request(aiocoap.Message(code=aiocoap.GET, uri=f"coap://{host}:{port}/trace")).response
+    print(f"Downloaded {len(response.payload)} bytes:", response.code)
+    return response.payload
+
+# Converts the event trace of the device into Chrome/Perfetto JSON (open it in ui.perfetto.dev or chrome://tracing).
+# The input is a raw dump or a serial log with TRACE lines, anything else is taken as the device to download from.
+# Usage: python trace_to_perfetto.py <device ip | trace.bin | serial log> [output json] [port]
+def main():
+    source = sys.argv[1] if len(sys.argv) > 1 else "127.0.0.1"
+    output = sys.argv[2] if len(sys.argv) > 2 else "trace.json"
+    port = int(sys.argv[3]) if len(sys.argv) > 3 else 5683
+    raw = read_input(source) if os.path.exists(source) else asyncio.run(download(source, port))
+    trace, dropped = convert(raw)
+    with open(output, "w") as f:
+        json.dump(trace, f)
+    events = sum(1 for record in trace["traceEvents"] if record["ph"] != "M")
+    print(f"{events} events to {output}, dropped since boot per core: {dropped}")
+
+if __name__ == "__main__":
+    main()
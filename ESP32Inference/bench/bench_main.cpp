@@ -0,0 +1,25 @@
+// Firmware of env:bench, runs every benchmark once after boot and prints the CSV of microbench.h over the serial
+// monitor, e.g. pio run -e bench -t upload -t monitor
+#include <Arduino.h>
+#include "microbench.h"
+
+static void report(const bench::Result &result)
+{
+    char line[160];
+    bench::formatCsv(result, line, sizeof(line));
+    Serial.println(line);
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    delay(2000); //monitor attached
+    Serial.println(MICROBENCH_CSV_HEADER);
+    bench::runAll(nullptr, MICROBENCH_MIN_MS, report);
+    Serial.println("# done");
+}
+
+void loop()
+{
+    delay(1000);
+}
@@ -0,0 +1,241 @@
+// Hot paths of the firmware: sensor conversions, the DHT frame, CoAP encoding and parsing, inference preprocessing
+// and the interpreter. Inputs are fixed so host and target numbers are comparable.
+#include <string.h>
+#include "microbench.h"
+#include "BMP280.h"
+#include "MLX90614.h"
+#include "DHT.h"
+#include "coap-simple.h"
+#include "infer.h"
+
+#define PAYLOAD_SIZE 32 //sizeof(Data)
+
+// BMP280 datasheet example calibration, 0x88..0x9F
+static const uint8_t bmp_calibration[24] = {
+    0x70, 0x6B, 0x43, 0x67, 0x18, 0xFC, 0x7D, 0x8E, 0x43, 0xD6, 0xD0, 0x0B,
+    0x27, 0x0B, 0x8C, 0x00, 0xF9, 0xFF, 0x8C, 0x3C, 0xF8, 0xC6, 0x70, 0x17};
+
+static void BMP280_compensate(bench::State &state)
+{
+    static BMP280 bmp;
+    bmp.SetCalibration(bmp_calibration);
+    for(auto _ : state)
+    {
+        uint32_t i = state.counter++ & 0xFF; //near the datasheet example 519888/415148
+        bmp.compensate(519888 + i, 415148 - i);
+        float temperature = bmp.getTemperature();
+        bench::doNotOptimize(temperature);
+    }
+}
+BENCHMARK(BMP280_compensate);
+
+static void MLX90614_crc8(bench::State &state)
+{
+    uint8_t frame[5] = {0x5A << 1, 0x07, (0x5A << 1) | 1, 0x00, 0x3A}; //read word of TOBJ1
+    for(auto _ : state)
+    {
+        frame[3] = state.counter++;
+        uint8_t pec = MLX90614::crc8(frame, sizeof(frame));
+        bench::doNotOptimize(pec);
+    }
+}
+BENCHMARK(MLX90614_crc8);
+
+static void DHT_decode(bench::State &state)
+{
+    static rmt_item32_t items[41];
+    const uint8_t frame[5] = {45, 0, 23, 4, 72}; //45.0 %, 23.4 degC
+    items[0].duration0 = 80;
+    for(int i = 1; i < 41; i++)
+    {
+        items[i].level0 = 0; //high time of the bit as the receive channel reports it
+        items[i].duration0 = (frame[(i - 1) / 8] >> (7 - (i - 1) % 8)) & 1 ? 70 : 27;
+        items[i].level1 = 1;
+        items[i].duration1 = 50;
+    }
+    float humidity, temperature;
+    for(auto _ : state)
+    {
+        bool valid = DHT::decode(items, &humidity, &temperature);
+        bench::doNotOptimize(valid);
+        bench::doNotOptimize(temperature);
+    }
+}
+BENCHMARK(DHT_decode);
+
+// Socket that keeps the last datagram sent and returns a prepared one to parsePacket() once per pending()
+class BenchUDP : public UDP {
+
+    uint8_t rx[COAP_BUF_MAX_SIZE];
+    size_t rx_len = 0;
+    size_t rx_pos = 0;
+    bool rx_pending = false;
+
+    public:
+        uint8_t tx[COAP_BUF_MAX_SIZE];
+        size_t tx_len = 0;
+
+        void receive(const uint8_t *datagram, size_t len) { memcpy(rx, datagram, len); rx_len = len; }
+        void pending() { rx_pending = true; }
+
+        uint8_t begin(uint16_t port) { return 1; }
+        void stop() {}
+        int beginPacket(IPAddress ip, uint16_t port) { tx_len = 0; return 1; }
+        int beginPacket(const char *host, uint16_t port) { tx_len = 0; return 1; }
+        int endPacket() { return 1; }
+        size_t write(uint8_t byte) { return write(&byte, 1); }
+        size_t write(const uint8_t *buffer, size_t size)
+        {
+            size = tx_len + size > sizeof(tx) ? sizeof(tx) - tx_len : size;
+            memcpy(tx + tx_len, buffer, size);
+            tx_len += size;
+            return size;
+        }
+        int parsePacket()
+        {
+            rx_pos = 0;
+            bool deliver = rx_pending;
+            rx_pending = false;
+            return deliver ? rx_len : 0;
+        }
+        int available() { return rx_len - rx_pos; }
+        int read() { return rx_pos < rx_len ? rx[rx_pos++] : -1; }
+        int read(unsigned char *buffer, size_t len)
+        {
+            len = len > rx_len - rx_pos ? rx_len - rx_pos : len;
+            memcpy(buffer, rx + rx_pos, len);
+            rx_pos += len;
+            return len;
+        }
+        int read(char *buffer, size_t len) { return read((unsigned char *)buffer, len); }
+        int peek() { return rx_pos < rx_len ? rx[rx_pos] : -1; }
+        void flush() {}
+        IPAddress remoteIP() { return IPAddress(192, 168, 0, 10); }
+        uint16_t remotePort() { return COAP_DEFAULT_PORT; }
+};
+
+static const IPAddress server(192, 168, 0, 10);
+static const uint8_t token[4] = {1, 2, 3, 4};
+
+// Uplink of a Data record encoded from scratch (Communication::post before the template exists)
+static void Coap_send(bench::State &state)
+{
+    static BenchUDP udp;
+    static Coap coap(udp);
+    uint8_t payload[PAYLOAD_SIZE] = {};
+    for(auto _ : state)
+    {
+        uint16_t id = coap.send(server, COAP_DEFAULT_PORT, "data", COAP_CON, COAP_POST, token, sizeof(token),
+            payload, PAYLOAD_SIZE, COAP_NONE, state.counter++);
+        bench::doNotOptimize(id);
+    }
+}
+BENCHMARK(Coap_send);
+
+// Uplink of a Data record from the prepared request template of Communication::post
+static void Coap_send_template(bench::State &state)
+{
+    static BenchUDP udp;
+    static Coap coap(udp);
+    static CoapTemplate request;
+    uint8_t payload[PAYLOAD_SIZE] = {};
+    coap.prepare(request, server, COAP_DEFAULT_PORT, "data", COAP_CON, COAP_POST, sizeof(token));
+    for(auto _ : state)
+    {
+        uint16_t id = coap.send(request, state.counter++, token, payload, PAYLOAD_SIZE);
+        bench::doNotOptimize(id);
+    }
+}
+BENCHMARK(Coap_send_template);
+
+// Piggybacked 2.04 ACK of an uplink, the datagram the firmware receives most
+static void Coap_loop_ack(bench::State &state)
+{
+    static BenchUDP udp;
+    static Coap coap(udp);
+    static uint32_t responses = 0;
+    coap.response([](CoapPacket &packet, IPAddress ip, int port) { responses++; });
+    coap.sendResponse(server, COAP_DEFAULT_PORT, 0x1234, NULL, 0, COAP_CHANGED, COAP_NONE, token, sizeof(token));
+    udp.receive(udp.tx, udp.tx_len);
+    for(auto _ : state)
+    {
+        udp.pending();
+        coap.loop();
+    }
+    bench::doNotOptimize(responses);
+}
+BENCHMARK(Coap_loop_ack);
+
+// Request with Uri-Path options and a payload dispatched to a route, parseOption for every option
+static void Coap_loop_request(bench::State &state)
+{
+    static BenchUDP udp;
+    static Coap coap(udp);
+    static uint32_t requests = 0;
+    uint8_t payload[PAYLOAD_SIZE] = {};
+    coap.server([](CoapPacket &packet, IPAddress ip, int port) { requests++; }, "data");
+    coap.send(server, COAP_DEFAULT_PORT, "data", COAP_CON, COAP_POST, token, sizeof(token), payload,
+        PAYLOAD_SIZE, COAP_NONE, 0x1234);
+    udp.receive(udp.tx, udp.tx_len);
+    for(auto _ : state)
+    {
+        udp.pending();
+        coap.loop();
+    }
+    bench::doNotOptimize(requests);
+}
+BENCHMARK(Coap_loop_request);
+
+static Inference *model = nullptr;
+static Data window[SEQUENCE_LENGTH];
+static SensorDataBatch sequence;
+
+// A plausible indoor window, the model is built on first use so its allocations stay out of the other benchmarks
+static Inference &inference()
+{
+    if(model)
+        return *model;
+    model = new Inference();
+    for(int k = 0; k < SEQUENCE_LENGTH; k++)
+    {
+        window[k] = {(uint16_t)(600 + 10 * k), (uint16_t)(40 + k), 22.5f + 0.01f * k, 99800 + 0.5f * k, 23.1f, 22.8f,
+            41.0f, 22.0f, k % 3 ? 0.0f : 2.5f};
+        sequence[0][k] = &window[k];
+    }
+    model->SetDefaultLabels(0, 0);
+    model->SetSequences(sequence);
+    model->ComputeSensorDeltas();
+    model->ScaleData();
+    model->SetInputBuffers();
+    return *model;
+}
+
+// After the first call the reference row is zero and the deltas no longer change, the timing is that of a fresh
+// window since the loop has no data dependent branches
+static void Inference_ComputeSensorDeltas(bench::State &state)
+{
+    Inference &model = inference();
+    for(auto _ : state)
+        model.ComputeSensorDeltas();
+}
+BENCHMARK(Inference_ComputeSensorDeltas);
+
+// Repeated scaling converges to a finite fixed point, no denormals
+static void Inference_ScaleData(bench::State &state)
+{
+    Inference &model = inference();
+    for(auto _ : state)
+        model.ScaleData();
+}
+BENCHMARK(Inference_ScaleData);
+
+static void Inference_Invoke(bench::State &state)
+{
+    Inference &model = inference();
+    for(auto _ : state)
+    {
+        bool ok = model.Invoke();
+        bench::doNotOptimize(ok);
+    }
+}
+BENCHMARK(Inference_Invoke);
@@ -0,0 +1,106 @@
+#include "microbench.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef MICROBENCH_HOST
+#include <chrono>
+#else
+#include <Arduino.h>
+#include "esp_cpu.h"
+#endif
+
+namespace bench {
+
+typedef struct {
+    const char *name;
+    Function function;
+} Benchmark;
+
+static Benchmark benchmarks[MICROBENCH_MAX];
+static int count = 0;
+
+Registration::Registration(const char *name, Function function)
+{
+    if(count < MICROBENCH_MAX)
+        benchmarks[count++] = {name, function};
+}
+
+#ifdef MICROBENCH_HOST
+#define PLATFORM "host"
+
+static uint64_t ticks()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t cpuMhz() { return 0; }
+static double ticksToNs(uint64_t ticks) { return (double)ticks; }
+#else
+#define PLATFORM "esp32"
+
+// Cycles, CCOUNT wraps after 17 s at 240 MHz, far longer than one run
+static uint64_t ticks()
+{
+    return esp_cpu_get_ccount();
+}
+
+static uint32_t cpuMhz() { return getCpuFrequencyMhz(); }
+static double ticksToNs(uint64_t ticks) { return ticks * 1000.0 / cpuMhz(); }
+#endif
+
+static uint64_t run(Function function, uint32_t iterations)
+{
+    State state(iterations);
+    uint64_t start = ticks();
+    function(state);
+#ifdef MICROBENCH_HOST
+    return ticks() - start;
+#else
+    return (uint32_t)(ticks() - start);
+#endif
+}
+
+// Grows the iterations until one run lasts min_ms, like google-benchmark
+static Result measure(const Benchmark &benchmark, uint32_t min_ms)
+{
+    run(benchmark.function, 1); //warm up caches and first use allocations
+    uint32_t iterations = 1;
+    double ns;
+    while(true)
+    {
+        ns = ticksToNs(run(benchmark.function, iterations));
+        if(ns >= min_ms * 1e6 || iterations >= MICROBENCH_MAX_ITERATIONS)
+            break;
+        double grow = ns > 0 ? min_ms * 1e6 * 1.4 / ns : 10;
+        grow = grow > 10 ? 10 : grow < 2 ? 2 : grow;
+        iterations = iterations * grow > MICROBENCH_MAX_ITERATIONS ? MICROBENCH_MAX_ITERATIONS : iterations * grow;
+    }
+    Result result = {PLATFORM, benchmark.name, iterations, ns / iterations, 0, cpuMhz()};
+    if(result.cpu_mhz)
+        result.cycles_per_iter = result.ns_per_iter * result.cpu_mhz / 1000;
+    return result;
+}
+
+int runAll(const char *filter, uint32_t min_ms, void (*report)(const Result &result))
+{
+    int ran = 0;
+    for(int i = 0; i < count; i++)
+    {
+        if(filter && !strstr(benchmarks[i].name, filter))
+            continue;
+        report(measure(benchmarks[i], min_ms));
+        ran++;
+    }
+    return ran;
+}
+
+void formatCsv(const Result &result, char *line, size_t size)
+{
+    if(result.cpu_mhz)
+        snprintf(line, size, "%s,%s,%u,%.3f,%.1f,%u", result.platform, result.name, result.iterations,
+            result.ns_per_iter, result.cycles_per_iter, result.cpu_mhz);
+    else
+        snprintf(line, size, "%s,%s,%u,%.3f,,", result.platform, result.name, result.iterations, result.ns_per_iter);
+}
+
+}
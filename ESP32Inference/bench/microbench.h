@@ -0,0 +1,72 @@
+#pragma once
+// Microbenchmark harness in the style of google-benchmark for the firmware hot paths (benchmarks.cpp). The same
+// benchmarks run on the ESP32 (env:bench of platformio.ini, bench_main.cpp) timed with the CPU cycle counter and
+// on Linux (host/microbench.cpp, MICROBENCH_HOST) timed with steady_clock. Both print the same CSV:
+//   platform,benchmark,iterations,ns_per_iter,cycles_per_iter,cpu_mhz
+// cycles_per_iter and cpu_mhz are empty on the host.
+#include <stdint.h>
+#include <stddef.h>
+
+#define MICROBENCH_MAX 32
+#define MICROBENCH_MIN_MS 200        //each benchmark runs at least this long
+#define MICROBENCH_MAX_ITERATIONS 100000000
+#define MICROBENCH_CSV_HEADER "platform,benchmark,iterations,ns_per_iter,cycles_per_iter,cpu_mhz"
+
+namespace bench {
+
+// Iterations of one run, for(auto _ : state) { ... } times the loop body
+class State {
+
+    uint32_t iterations;
+
+    public:
+        struct __attribute__((unused)) Value {}; // the loop variable is never read
+
+        class Iterator {
+
+            uint32_t left;
+
+            public:
+                Iterator(uint32_t left) : left(left) {}
+                bool operator!=(const Iterator &end) const { return left != end.left; }
+                void operator++() { left--; }
+                Value operator*() const { return Value(); }
+        };
+
+        uint32_t counter = 0; // free for the benchmark, e.g. to vary the input per iteration
+
+        State(uint32_t iterations) : iterations(iterations) {}
+        Iterator begin() { return Iterator(iterations); }
+        Iterator end() { return Iterator(0); }
+        uint32_t maxIterations() { return iterations; }
+};
+
+typedef void (*Function)(State &state);
+
+typedef struct {
+    const char *platform;
+    const char *name;
+    uint32_t iterations;
+    double ns_per_iter;
+    double cycles_per_iter;  // 0 on the host
+    uint32_t cpu_mhz;        // 0 on the host
+} Result;
+
+// Keeps the compiler from dropping a computation whose result is otherwise unused
+template <typename T> inline void doNotOptimize(T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Registration {
+    Registration(const char *name, Function function);
+};
+
+// Runs every benchmark whose name contains filter (all for nullptr), calls report after each one
+int runAll(const char *filter, uint32_t min_ms, void (*report)(const Result &result));
+// CSV line of MICROBENCH_CSV_HEADER without the newline
+void formatCsv(const Result &result, char *line, size_t size);
+
+}
+
+#define BENCHMARK(function) static bench::Registration bench_##function(#function, function)
@@ -0,0 +1,129 @@
+// Compressed batch format of lib/tsbatch over AIDA/sensor_data_export.csv: bytes per sample for several batch sizes,
+// every sample and with the report by exception filter in front, encode time per sample, and a decode check
+// (times and sequence exact, values equal after quantization). Times are Unix ms like a synced device sends.
+// --dump writes one batch for decoder tests.
+// Usage: batch_bench [csv] [--dump file]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "tsbatch.h"
+#include "uplinkfilter.h"
+#include "sensor_export.h"
+
+// Splits the series into batches of at most payload bytes, true if every batch decodes back to the input
+static bool encodeAll(std::vector<ReportedData> &samples, size_t payload, size_t *bytes, size_t *batches, FILE *dump)
+{
+    std::vector<uint8_t> buffer(payload);
+    *bytes = 0;
+    *batches = 0;
+    size_t next = 0;
+    while(next < samples.size())
+    {
+        BatchEncoder encoder(buffer.data(), payload);
+        size_t first = next;
+        while(next < samples.size() && encoder.add(&samples[next]))
+            next++;
+        size_t len = encoder.finish(samples[next - 1].time_ms, true);
+        if(!len)
+            return false;
+        *bytes += len;
+        (*batches)++;
+        if(dump && *batches == 1)
+            fwrite(buffer.data(), 1, len, dump);
+
+        BatchDecoder decoder(buffer.data(), len);
+        ReportedData decoded;
+        if(!decoder.unixTime())
+            return false;
+        for(size_t i = first; i < next; i++)
+        {
+            if(!decoder.next(&decoded) || decoded.time_ms != samples[i].time_ms || decoded.sequence != samples[i].sequence)
+                return false;
+            for(uint8_t c = 0; c < BATCH_CHANNELS; c++)
+                if(BatchEncoder::quantize(&decoded.data, c) != BatchEncoder::quantize(&samples[i].data, c))
+                    return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = AIDA_DIR "/sensor_data_export.csv";
+    const char *dump_path = NULL;
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--dump") == 0 && i + 1 < argc)
+            dump_path = argv[++i];
+        else
+            path = argv[i];
+    }
+    std::vector<ExportRow> rows;
+    if(!loadSensorExport(path, &rows))
+    {
+        printf("Can't read %s\n", path);
+        return 1;
+    }
+
+    std::vector<ReportedData> all, filtered;
+    UplinkFilter filter(300000);
+    for(size_t i = 0; i < rows.size(); i++)
+    {
+        ReportedData sample;
+        sample.data = rows[i].data;
+        sample.sequence = i;
+        sample.elapsed_ms = 0;
+        sample.time_ms = rows[i].unix_ms;
+        all.push_back(sample);
+        if(filter.filter(&rows[i].data, rows[i].unix_ms, &sample))
+            filtered.push_back(sample);
+    }
+
+    printf("%zu samples, %zu after the report by exception filter, raw ReportedData is %zu bytes\n", all.size(),
+        filtered.size(), sizeof(ReportedData));
+    printf("series     payload   batches   samples/batch   bytes/sample   ratio\n");
+    FILE *dump = dump_path ? fopen(dump_path, "wb") : NULL;
+    int failures = 0;
+    size_t payloads[] = {80, 256, 1024};
+    for(int s = 0; s < 2; s++)
+    {
+        std::vector<ReportedData> &series = s ? filtered : all;
+        for(size_t payload : payloads)
+        {
+            size_t bytes, batches;
+            bool ok = encodeAll(series, payload, &bytes, &batches, s == 0 && payload == 80 ? dump : NULL);
+            failures += !ok;
+            printf("%-9s %8zu   %7zu   %13.1f   %12.2f   %4.1fx%s\n", s ? "filtered" : "all", payload, batches,
+                (double)series.size() / batches, (double)bytes / series.size(),
+                sizeof(ReportedData) * series.size() / (double)bytes, ok ? "" : "   DECODE FAILED");
+        }
+    }
+    if(dump)
+        fclose(dump);
+
+    // encode time, 80 byte batches like the firmware
+    uint8_t buffer[80];
+    uint32_t rounds = 200;
+    size_t encoded = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t r = 0; r < rounds; r++)
+    {
+        BatchEncoder encoder(buffer, sizeof(buffer));
+        for(ReportedData &sample : all)
+        {
+            if(!encoder.add(&sample))
+            {
+                encoder.finish(sample.time_ms, true);
+                encoder.begin();
+                encoder.add(&sample);
+            }
+            encoded++;
+        }
+        encoder.finish(0, true);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / encoded;
+    printf("encode: %.1f ns/sample on this host\n", ns);
+    return failures ? 1 : 0;
+}
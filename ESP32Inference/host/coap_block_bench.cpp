@@ -0,0 +1,126 @@
+// Block-wise transfer throughput of lib/coap-simple over real UDP: uploads a payload to /blob with Block1
+// and reads it back with Block2 for every block size, checks the content and prints the throughput.
+// The server is CoapServer/server.py (aiocoap), or this tool itself in serve mode for a loopback run.
+// Usage: coap_block_bench [server ip] [port] [payload bytes]
+//        coap_block_bench serve [port] [buffer bytes], 128 behaves like the firmware
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "HostUDP.h"
+#include "coap-simple.h"
+
+#define BENCH_BUF_SIZE (COAP_BLOCK_SIZE(COAP_BLOCK_SZX_MAX) + COAP_BLOCK_OVERHEAD)
+#define BENCH_TIMEOUT_MS 5000
+#define BENCH_PAYLOAD 8192
+
+static int serve(int port, int buffer_size)
+{
+    HostUDP udp;
+    Coap coap(udp, buffer_size);
+    std::vector<uint8_t> blob;
+    coap.serverBlock("blob",
+        [&](uint32_t offset, const uint8_t *block, size_t len, bool more) {
+            if(offset > blob.size())
+                return false; //a block is missing
+            blob.resize(offset);
+            blob.insert(blob.end(), block, block + len);
+            return true;
+        },
+        [&](uint32_t offset, uint8_t *block, size_t size, bool *more) {
+            size_t len = offset < blob.size() ? blob.size() - offset : 0;
+            len = len > size ? size : len;
+            memcpy(block, blob.data() + offset, len);
+            *more = offset + len < blob.size();
+            return len;
+        });
+    if(!coap.start(port))
+    {
+        printf("Can't bind port %d\n", port);
+        return 1;
+    }
+    printf("Serving /blob on port %d\n", port);
+    while(true)
+    {
+        coap.loop();
+        delay(1);
+    }
+}
+
+// Runs the client until the transfer finished, false on timeout or an error code
+static bool run(Coap *coap, bool *finished, uint8_t *code)
+{
+    uint32_t start = millis();
+    while(!*finished && millis() - start < BENCH_TIMEOUT_MS)
+        coap->loop();
+    if(!*finished)
+        coap->abortTransfer();
+    return *code >= RESPONSE_CODE(2, 0) && *code < RESPONSE_CODE(3, 0);
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1 && strcmp(argv[1], "serve") == 0)
+        return serve(argc > 2 ? atoi(argv[2]) : COAP_DEFAULT_PORT, argc > 3 ? atoi(argv[3]) : BENCH_BUF_SIZE);
+
+    IPAddress server(127, 0, 0, 1);
+    if(argc > 1 && !server.fromString(argv[1]))
+    {
+        printf("Invalid server address %s\n", argv[1]);
+        return 1;
+    }
+    int port = argc > 2 ? atoi(argv[2]) : COAP_DEFAULT_PORT;
+    size_t size = argc > 3 ? atoi(argv[3]) : BENCH_PAYLOAD;
+
+    HostUDP udp;
+    Coap coap(udp, BENCH_BUF_SIZE);
+    coap.start(0);
+    std::vector<uint8_t> payload(size);
+    for(size_t i = 0; i < size; i++)
+        payload[i] = rand();
+
+    printf("%u bytes to %d.%d.%d.%d:%d/blob\n", (unsigned)size, server[0], server[1], server[2], server[3], port);
+    printf("block   upload KB/s   download KB/s   check\n");
+    int failures = 0;
+    for(uint8_t szx = 0; szx <= COAP_BLOCK_SZX_MAX; szx++)
+    {
+        uint8_t token[2] = {0xB1, szx};
+        bool finished = false;
+        uint8_t code = 0;
+        auto done = [&](uint8_t response, uint32_t bytes) { code = response; finished = true; };
+
+        uint32_t start = micros();
+        coap.upload(server, port, "blob", token, sizeof(token), szx,
+            [&](uint32_t offset, uint8_t *block, size_t block_size, bool *more) {
+                size_t len = offset < size ? size - offset : 0;
+                len = len > block_size ? block_size : len;
+                memcpy(block, payload.data() + offset, len);
+                *more = offset + len < size;
+                return len;
+            }, done);
+        bool uploaded = run(&coap, &finished, &code);
+        uint32_t upload_us = micros() - start;
+
+        std::vector<uint8_t> received;
+        finished = false;
+        code = 0;
+        token[0] = 0xB2;
+        start = micros();
+        coap.download(server, port, "blob", token, sizeof(token), szx,
+            [&](uint32_t offset, const uint8_t *block, size_t len, bool more) {
+                received.resize(offset);
+                received.insert(received.end(), block, block + len);
+                return true;
+            }, done);
+        bool downloaded = run(&coap, &finished, &code);
+        uint32_t download_us = micros() - start;
+
+        bool ok = uploaded && downloaded && received == payload;
+        failures += !ok;
+        printf("%5d   %11.1f   %13.1f   %s\n", COAP_BLOCK_SIZE(szx),
+            uploaded ? size * 1000.0 / 1024 / (upload_us / 1000.0) : 0,
+            downloaded ? size * 1000.0 / 1024 / (download_us / 1000.0) : 0,
+            ok ? "ok" : (!uploaded ? "upload failed" : (!downloaded ? "download failed" : "mismatch")));
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+// Server dispatch cost per request of lib/coap-simple: inbound requests are replayed through Coap::loop() against
+// a constexpr route table, for a match, a two segment match and a 4.04, and every heap allocation during dispatch
+// is counted (has to be 0). The lookup alone is compared with the String based one coap-simple used before,
+// the shim String keeps short strings inline, so the Arduino String allocates more often than counted here.
+// Usage: coap_dispatch_bench [requests]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <new>
+#include "coap-simple.h"
+
+static size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static constexpr CoapRoute routes[] = {
+    COAP_ROUTE("occupancy"),
+    COAP_ROUTE("metrics"),
+    COAP_ROUTE("config"),
+    COAP_ROUTE("config/interval"),
+    COAP_ROUTE("config/window"),
+    COAP_ROUTE("sensors/bmp280"),
+    COAP_ROUTE("sensors/mlx90614"),
+    COAP_ROUTE("status"),
+};
+static_assert(routes[0].hash == coapPathHash("occupancy"), "route hashes are computed at compile time");
+
+// Delivers the same request datagram a number of times, responses are dropped
+class ReplayUDP : public UDP {
+
+    public:
+        uint8_t datagram[COAP_BUF_MAX_SIZE];
+        size_t len = 0;
+        uint32_t remaining = 0;
+        size_t sent = 0;
+
+        uint8_t begin(uint16_t port) override { return 1; }
+        void stop() override {}
+        int beginPacket(IPAddress ip, uint16_t port) override { return 1; }
+        int endPacket() override { sent++; return 1; }
+        size_t write(const uint8_t *buffer, size_t size) override { return size; }
+        int parsePacket() override { return remaining ? remaining--, len : 0; }
+        int read(uint8_t *buffer, size_t size) override { memcpy(buffer, datagram, size); return size; }
+        IPAddress remoteIP() override { return IPAddress(192, 168, 0, 2); }
+        uint16_t remotePort() override { return COAP_DEFAULT_PORT; }
+};
+
+// Request encoded by coap-simple itself, captured from the transmit hook
+static void encodeRequest(const char *url, ReplayUDP *udp)
+{
+    Coap client(*udp);
+    client.transmitter([&](const uint8_t *datagram, size_t len, IPAddress ip, int port) {
+        memcpy(udp->datagram, datagram, len);
+        udp->len = len;
+        return true;
+    });
+    uint8_t token[4] = {1, 2, 3, 4};
+    client.send(IPAddress(192, 168, 0, 10), COAP_DEFAULT_PORT, url, COAP_CON, COAP_GET, token, sizeof(token), NULL, 0,
+        COAP_NONE, 0x1234);
+}
+
+// Path lookup of coap-simple before the route table: a String per request and String compares
+static bool legacyDispatch(CoapPacket &packet, String *urls, int count)
+{
+    String url = "";
+    for (int i = 0; i < packet.optionnum; i++) {
+        if (packet.options[i].number == COAP_URI_PATH && packet.options[i].length > 0) {
+            char urlname[packet.options[i].length + 1];
+            memcpy(urlname, packet.options[i].buffer, packet.options[i].length);
+            urlname[packet.options[i].length] = 0;
+            if(url.length() > 0)
+              url += "/";
+            url += (const char *)urlname;
+        }
+    }
+    for (int i = 0; i < count; i++)
+        if (urls[i].equals(url))
+            return true;
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t requests = argc > 1 ? atoi(argv[1]) : 1000000;
+    const char *paths[] = {"occupancy", "sensors/mlx90614", "missing"};
+    const int route_count = sizeof(routes) / sizeof(routes[0]);
+    String urls[route_count];
+    for(int i = 0; i < route_count; i++)
+        urls[i] = routes[i].path;
+
+    ReplayUDP udp;
+    Coap coap(udp);
+    uint32_t handled = 0;
+    for(int i = 0; i < route_count; i++)
+        coap.server([&](CoapPacket &packet, IPAddress ip, int port) { handled++; }, routes[i]);
+
+    printf("%u requests per path, %d routes\n", requests, route_count);
+    printf("path                 loop() ns   allocations   route lookup ns   String lookup ns   allocations\n");
+    int failures = 0;
+    for(const char *path : paths)
+    {
+        encodeRequest(path, &udp);
+        handled = 0;
+        udp.sent = 0;
+        udp.remaining = requests;
+        size_t before = allocations;
+        auto start = std::chrono::steady_clock::now();
+        coap.loop();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / requests;
+        size_t dispatch_allocations = allocations - before;
+
+        // same packet parsed once, only the lookup is repeated
+        CoapPacket packet;
+        packet.optionnum = 0;
+        uint8_t *p = udp.datagram + COAP_HEADER_SIZE + (udp.datagram[0] & 0x0F);
+        uint8_t *end = udp.datagram + udp.len;
+        for(uint8_t i = 0; i < COAP_MAX_OPTION_NUM && p < end; i++)
+        {
+            uint8_t delta = p[0] >> 4, len = p[0] & 0x0F;
+            packet.options[i].number = (i ? packet.options[i - 1].number : 0) + delta;
+            packet.options[i].length = len;
+            packet.options[i].buffer = p + 1;
+            packet.optionnum++;
+            p += 1 + len;
+        }
+        start = std::chrono::steady_clock::now();
+        uint32_t matched = 0;
+        for(uint32_t i = 0; i < requests; i++)
+        {
+            uint32_t hash = coapRequestHash(packet);
+            for(int k = 0; k < route_count; k++)
+                if(routes[k].hash == hash && coapRouteMatch(routes[k], packet))
+                {
+                    matched++;
+                    break;
+                }
+        }
+        double route_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / requests;
+
+        before = allocations;
+        start = std::chrono::steady_clock::now();
+        uint32_t found = 0;
+        for(uint32_t i = 0; i < requests; i++)
+            found += legacyDispatch(packet, urls, route_count);
+        double legacy_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / requests;
+        size_t legacy_allocations = allocations - before;
+
+        bool routed = strcmp(path, "missing") != 0;
+        bool ok = dispatch_allocations == 0 && (routed ? handled == requests : udp.sent == requests) &&
+            found == (routed ? requests : 0) && matched == found;
+        failures += !ok;
+        printf("%-18s %11.1f   %11zu   %15.1f   %16.1f   %11zu%s\n", path, ns, dispatch_allocations, route_ns, legacy_ns,
+            legacy_allocations, ok ? "" : "   FAILED");
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,102 @@
+// Encode cost per uplink message of lib/coap-simple: the generic send() that parses the URL and encodes all
+// options every time against a prepared request template, through the socket and through the transmit hook
+// (the retransmission layer path). Both produce the same datagram, which is checked first.
+// Usage: coap_encode_bench [messages]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "coap-simple.h"
+
+#define PAYLOAD_SIZE 32 //sizeof(Data) of the firmware
+
+// Socket that only keeps the last datagram
+class NullUDP : public UDP {
+
+    public:
+        uint8_t last[COAP_BUF_MAX_SIZE];
+        size_t len = 0;
+
+        uint8_t begin(uint16_t port) override { return 1; }
+        void stop() override {}
+        int beginPacket(IPAddress ip, uint16_t port) override { len = 0; return 1; }
+        int endPacket() override { return 1; }
+        size_t write(const uint8_t *buffer, size_t size) override
+        {
+            size = len + size > sizeof(last) ? sizeof(last) - len : size;
+            memcpy(last + len, buffer, size);
+            len += size;
+            return size;
+        }
+        int parsePacket() override { return 0; }
+        int read(uint8_t *buffer, size_t size) override { return 0; }
+        IPAddress remoteIP() override { return IPAddress(); }
+        uint16_t remotePort() override { return 0; }
+};
+
+template <typename F> static double nsPerMessage(uint32_t messages, F send)
+{
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < messages; i++)
+        send(i);
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return (double)ns / messages;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t messages = argc > 1 ? atoi(argv[1]) : 1000000;
+    IPAddress server(192, 168, 0, 10);
+    uint8_t token[4] = {1, 2, 3, 4};
+    uint8_t payload[PAYLOAD_SIZE];
+    for(int i = 0; i < PAYLOAD_SIZE; i++)
+        payload[i] = i;
+
+    NullUDP udp;
+    Coap coap(udp);
+    CoapTemplate request;
+    if(!coap.prepare(request, server, COAP_DEFAULT_PORT, "predictions", COAP_CON, COAP_POST, sizeof(token)))
+    {
+        printf("Template doesn't fit COAP_TEMPLATE_SIZE\n");
+        return 1;
+    }
+
+    coap.send(server, COAP_DEFAULT_PORT, "predictions", COAP_CON, COAP_POST, token, sizeof(token), payload,
+        PAYLOAD_SIZE, COAP_NONE, 0x1234);
+    uint8_t generic[COAP_BUF_MAX_SIZE];
+    size_t generic_len = udp.len;
+    memcpy(generic, udp.last, udp.len);
+    coap.send(request, 0x1234, token, payload, PAYLOAD_SIZE);
+    if(udp.len != generic_len || memcmp(udp.last, generic, generic_len) != 0)
+    {
+        printf("Prepared request differs from send()\n");
+        return 1;
+    }
+    printf("%u byte datagram, %u byte template, %u messages\n", (unsigned)generic_len, request.len, messages);
+
+    double socket_generic = nsPerMessage(messages, [&](uint32_t i) {
+        coap.send(server, COAP_DEFAULT_PORT, "predictions", COAP_CON, COAP_POST, token, sizeof(token), payload,
+            PAYLOAD_SIZE, COAP_NONE, i);
+    });
+    double socket_prepared = nsPerMessage(messages, [&](uint32_t i) {
+        coap.send(request, i, token, payload, PAYLOAD_SIZE);
+    });
+
+    size_t transmitted = 0;
+    coap.transmitter([&](const uint8_t *datagram, size_t len, IPAddress ip, int port) {
+        transmitted += len;
+        return true;
+    });
+    double hook_generic = nsPerMessage(messages, [&](uint32_t i) {
+        coap.send(server, COAP_DEFAULT_PORT, "predictions", COAP_CON, COAP_POST, token, sizeof(token), payload,
+            PAYLOAD_SIZE, COAP_NONE, i);
+    });
+    double hook_prepared = nsPerMessage(messages, [&](uint32_t i) {
+        coap.send(request, i, token, payload, PAYLOAD_SIZE);
+    });
+
+    printf("path        send() ns   prepared ns   speedup\n");
+    printf("socket   %11.1f   %11.1f   %6.1fx\n", socket_generic, socket_prepared, socket_generic / socket_prepared);
+    printf("hook     %11.1f   %11.1f   %6.1fx\n", hook_generic, hook_prepared, hook_generic / hook_prepared);
+    return transmitted ? 0 : 1;
+}
@@ -0,0 +1,232 @@
+// Runs the CoAP message layer of the firmware (lib/coap-reliable) against a simulated lossy UDP link
+// and an aiocoap like server, reports delivery ratio and throughput for several loss rates and NSTART values,
+// then compares CoCoA adaptive timers with fixed RFC 7252 timers on a link whose delay swings like the cube Wi-Fi.
+// Usage: coap_loss_sim [records] [one way latency ms]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "coap-reliable.h"
+
+#define PAYLOAD_SIZE 32 //sizeof(Data) of the firmware
+#define SERVER_ADDR 0x0A00A8C0
+#define CLIENT_ADDR 0x0B00A8C0
+#define COAP_PORT 5683
+#define SIM_LIMIT_MS 7200000
+#define SWING_PERIOD_MS 10000   //delay profile: quiet and peak phases, compressed from hours
+#define SWING_QUIET_MS 2        //one way, ~5 ms RTT
+#define SWING_PEAK_MS 250       //one way, ~500 ms RTT
+
+typedef struct {
+    uint32_t deliver_at;
+    bool to_server;
+    std::vector<uint8_t> datagram;
+} InTransit;
+
+typedef struct {
+    float loss;
+    uint32_t latency;
+    bool swing;                 // latency follows the delay profile instead of the fixed value
+    uint32_t now;
+    uint32_t random_state;
+    std::vector<InTransit> link;
+    uint32_t datagrams;
+    uint32_t lost;
+} Channel;
+
+static uint32_t next_random(Channel *channel)
+{
+    channel->random_state = channel->random_state * 1664525 + 1013904223;
+    return channel->random_state >> 8;
+}
+
+// Both directions lose datagrams independently, latency has up to 50 % jitter
+static void transmit(Channel *channel, const uint8_t *datagram, size_t len, bool to_server)
+{
+    channel->datagrams++;
+    if((next_random(channel) % 10000) < channel->loss * 10000)
+    {
+        channel->lost++;
+        return;
+    }
+    uint32_t latency = channel->latency;
+    if(channel->swing)
+        latency = (channel->now % SWING_PERIOD_MS) < SWING_PERIOD_MS / 2 ? SWING_QUIET_MS : SWING_PEAK_MS;
+    InTransit packet;
+    packet.deliver_at = channel->now + latency + next_random(channel) % (latency / 2 + 1);
+    packet.to_server = to_server;
+    packet.datagram.assign(datagram, datagram + len);
+    channel->link.push_back(packet);
+}
+
+static bool clientSend(const uint8_t *datagram, size_t len, uint32_t addr, uint16_t port, void *ctx)
+{
+    transmit((Channel*)ctx, datagram, len, true);
+    return true;
+}
+
+static bool serverSend(const uint8_t *datagram, size_t len, uint32_t addr, uint16_t port, void *ctx)
+{
+    transmit((Channel*)ctx, datagram, len, false);
+    return true;
+}
+
+static size_t buildMessage(uint8_t *buffer, uint8_t type, uint8_t code, uint16_t message_id,
+    const uint8_t *token, uint8_t token_len, const uint8_t *payload, size_t payload_len)
+{
+    buffer[0] = (1 << 6) | (type << 4) | token_len;
+    buffer[1] = code;
+    buffer[2] = message_id >> 8;
+    buffer[3] = message_id & 0xFF;
+    memcpy(buffer + 4, token, token_len);
+    size_t len = 4 + token_len;
+    if(payload_len)
+    {
+        buffer[len++] = 0xFF;
+        memcpy(buffer + len, payload, payload_len);
+        len += payload_len;
+    }
+    return len;
+}
+
+typedef struct {
+    uint32_t delivered;
+    uint32_t server_duplicates;
+    uint32_t duration;
+    CoapStats client;
+    CoapRttHistogram histogram;
+    uint32_t datagrams;
+} SimResult;
+
+static SimResult simulate(uint32_t records, float loss, uint32_t latency, uint8_t nstart, bool adaptive, bool swing)
+{
+    Channel channel = {loss, latency, swing, 0, 12345, {}, 0, 0};
+    CoapReliable client(&clientSend, &channel, nstart);
+    client.setAdaptive(adaptive);
+    CoapReliable server(&serverSend, &channel);
+    client.seed(1);
+    server.seed(2);
+
+    SimResult result = {};
+    std::vector<bool> seen(records, false);
+    uint32_t offered = 0;
+    uint8_t buffer[COAP_DATAGRAM_SIZE];
+    uint8_t payload[PAYLOAD_SIZE] = {};
+
+    while(channel.now < SIM_LIMIT_MS)
+    {
+        // saturating sender, limited by the pending table like Communication::canSend()
+        while(offered < records && !client.full())
+        {
+            uint8_t token[COAP_TOKEN_LENGTH];
+            uint8_t token_len = client.nextToken(token);
+            memcpy(payload, &offered, sizeof(offered));
+            size_t len = buildMessage(buffer, COAP_TYPE_CON, 0x02, client.nextMessageId(), token, token_len, payload, sizeof(payload));
+            client.enqueue(buffer, len, SERVER_ADDR, COAP_PORT, channel.now);
+            offered++;
+        }
+        if(offered == records && client.queued() == 0)
+            break;
+
+        std::vector<InTransit> arrived;
+        for(size_t i = 0; i < channel.link.size();)
+        {
+            if((int32_t)(channel.now - channel.link[i].deliver_at) >= 0)
+            {
+                arrived.push_back(channel.link[i]);
+                channel.link.erase(channel.link.begin() + i);
+            }
+            else
+                i++;
+        }
+        for(InTransit &packet : arrived)
+        {
+            const uint8_t *datagram = packet.datagram.data();
+            uint8_t type = (datagram[0] >> 4) & 0x03;
+            uint8_t code = datagram[1];
+            uint8_t token_len = datagram[0] & 0x0F;
+            uint16_t message_id = (datagram[2] << 8) | datagram[3];
+            if(packet.to_server)
+            {
+                // duplicates are acknowledged again but stored once, like aiocoap's message layer
+                CoapRx rx = server.received(type, code, message_id, datagram + 4, token_len, CLIENT_ADDR, COAP_PORT, channel.now);
+                if(rx.result == COAP_RX_NEW)
+                {
+                    uint32_t record;
+                    memcpy(&record, datagram + 4 + token_len + 1, sizeof(record));
+                    if(record < records && !seen[record])
+                    {
+                        seen[record] = true;
+                        result.delivered++;
+                    }
+                }
+                else
+                    result.server_duplicates++;
+                size_t len = buildMessage(buffer, COAP_TYPE_ACK, 0x44, message_id, datagram + 4, token_len, nullptr, 0); //2.04 Changed
+                serverSend(buffer, len, CLIENT_ADDR, COAP_PORT, &channel);
+            }
+            else
+                client.received(type, code, message_id, datagram + 4, token_len, SERVER_ADDR, COAP_PORT, channel.now);
+        }
+        client.poll(channel.now);
+        channel.now++;
+    }
+    result.duration = channel.now;
+    result.client = *client.getStats();
+    result.histogram = *client.getRttHistogram();
+    result.datagrams = channel.datagrams;
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t records = argc > 1 ? atoi(argv[1]) : 500;
+    uint32_t latency = argc > 2 ? atoi(argv[2]) : 20;
+    const float losses[] = {0, 0.01, 0.05, 0.1, 0.2, 0.3, 0.4};
+    const uint8_t nstarts[] = {1, COAP_NSTART, 4};
+
+    printf("%u records, %u ms one way latency, ACK_TIMEOUT %u ms, MAX_RETRANSMIT %u\n",
+        records, latency, COAP_ACK_TIMEOUT, COAP_MAX_RETRANSMIT);
+    printf("%6s %6s %9s %10s %8s %8s %7s %6s\n", "loss", "NSTART", "delivery", "records/s", "tx/rec", "retrans", "failed", "dups");
+    for(float loss : losses)
+        for(uint8_t nstart : nstarts)
+        {
+            SimResult result = simulate(records, loss, latency, nstart, true, false);
+            printf("%5.0f%% %6u %8.1f%% %10.2f %8.2f %8u %7u %6u\n", loss * 100, nstart,
+                100.0 * result.delivered / records,
+                result.duration ? 1000.0 * result.delivered / result.duration : 0,
+                result.delivered ? (float)result.client.transmissions / result.delivered : 0,
+                result.client.retransmissions, result.client.failed, result.server_duplicates);
+        }
+
+    // spurious retransmissions show up as server duplicates
+    printf("\nDelay swing %u/%u ms RTT every %u s, NSTART %u\n", 2 * SWING_QUIET_MS, 2 * SWING_PEAK_MS,
+        SWING_PERIOD_MS / 2000, COAP_NSTART);
+    printf("%6s %8s %9s %10s %8s %8s %7s %6s\n", "loss", "timers", "delivery", "records/s", "tx/rec", "retrans", "failed", "dups");
+    const float swing_losses[] = {0, 0.05, 0.2};
+    SimResult adaptive_result = {};
+    for(float loss : swing_losses)
+        for(int adaptive = 0; adaptive <= 1; adaptive++)
+        {
+            SimResult result = simulate(records * 10, loss, 0, COAP_NSTART, adaptive, true);
+            printf("%5.0f%% %8s %8.1f%% %10.2f %8.2f %8u %7u %6u\n", loss * 100, adaptive ? "CoCoA" : "fixed",
+                100.0 * result.delivered / (records * 10),
+                result.duration ? 1000.0 * result.delivered / result.duration : 0,
+                result.delivered ? (float)result.client.transmissions / result.delivered : 0,
+                result.client.retransmissions, result.client.failed, result.server_duplicates);
+            if(adaptive && loss > 0 && loss < 0.1)
+                adaptive_result = result;
+        }
+
+    printf("\nRTT histogram (CoCoA, 5%% loss): %u strong, %u weak samples, min %u ms, max %u ms\n",
+        adaptive_result.histogram.strong, adaptive_result.histogram.weak,
+        adaptive_result.histogram.min, adaptive_result.histogram.max);
+    for(int i = 0; i < COAP_RTT_BUCKETS; i++)
+    {
+        if(i < COAP_RTT_BUCKETS - 1)
+            printf("  < %5u ms: %u\n", CoapReliable::bucketLimit(i), adaptive_result.histogram.buckets[i]);
+        else
+            printf(" >= %5u ms: %u\n", CoapReliable::bucketLimit(i - 1), adaptive_result.histogram.buckets[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+// Serves an observable /occupancy resource with lib/coap-simple on the PC, like the device does, so observer
+// clients (CoapServer/observe_client.py) can be tested without hardware. The human count changes every
+// change_ms, in between the value is republished but only changes reach the observers.
+// Usage: coap_observe_demo [port] [change ms] [max age s]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "HostUDP.h"
+#include "coap-simple.h"
+
+typedef struct {
+    float human_count;
+    int32_t ventilation_tag;
+} __attribute__((packed)) Prediction; //same layout as the firmware
+
+int main(int argc, char **argv)
+{
+    int port = argc > 1 ? atoi(argv[1]) : COAP_DEFAULT_PORT;
+    uint32_t change_ms = argc > 2 ? atoi(argv[2]) : 3000;
+    uint32_t max_age = argc > 3 ? atoi(argv[3]) : 30;
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    HostUDP udp;
+    Coap coap(udp);
+    coap.serverObservable("occupancy", max_age, COAP_APPLICATION_OCTET_STREAM);
+    CoapObservable *occupancy = coap.observable("occupancy");
+    if(!coap.start(port))
+    {
+        printf("Can't bind port %d\n", port);
+        return 1;
+    }
+    printf("Observable /occupancy on port %d, change every %u ms, heartbeat every %u s\n", port, change_ms, max_age);
+
+    Prediction prediction = {0, 1};
+    coap.notify(occupancy, (uint8_t*)&prediction, sizeof(prediction));
+    uint32_t last_change = millis();
+    uint32_t last_publish = millis();
+    while(true)
+    {
+        coap.loop();
+        uint32_t now = millis();
+        if(now - last_publish < 500) //prediction rate, most of them unchanged
+        {
+            delay(1);
+            continue;
+        }
+        last_publish = now;
+        if(now - last_change >= change_ms)
+        {
+            prediction.human_count = (float)(rand() % 5);
+            prediction.ventilation_tag = rand() % 2;
+            last_change = now;
+        }
+        if(memcmp(occupancy->payload, &prediction, sizeof(prediction)) != 0)
+        {
+            uint8_t notified = coap.notify(occupancy, (uint8_t*)&prediction, sizeof(prediction));
+            printf("%u ms: %.0f people, ventilation %d -> %u observers\n", now, prediction.human_count,
+                prediction.ventilation_tag, notified);
+        }
+    }
+}
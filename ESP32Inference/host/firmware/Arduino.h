@@ -0,0 +1,41 @@
+#pragma once
+// Arduino-ESP32 core of the firmware host build: host/shim plus the ESP32 parts the core pulls in
+#include "../shim/Arduino.h"
+#include <sys/types.h>
+#include <stdexcept> //the ESP32 core has it through its C++ headers
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "freertos/FreeRTOS.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define F(string) string
+#define PROGMEM
+#define memcpy_P memcpy
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+
+void delayMicroseconds(uint32_t us);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+int digitalPinToInterrupt(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*isr)(), int mode);
+void detachInterrupt(uint8_t pin);
+uint32_t esp_random();
+uint32_t getCpuFrequencyMhz();
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+void configTime(long gmt_offset_s, int daylight_offset_s, const char *server1, const char *server2 = nullptr,
+    const char *server3 = nullptr);
@@ -0,0 +1,591 @@
+#include "HostEsp.h"
+#include "Arduino.h"
+#include "esp_rom_crc.h"
+#include "soc/rtc.h"
+#include "esp32/rom/rtc.h"
+#include "esp32/rom/ets_sys.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_pm.h"
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "perf.h"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+#define RTC_STATE_MAGIC 0x43545248 //"HRTC"
+#define GPIO_COUNT 40
+
+// RTC slow memory, every RTC_DATA_ATTR variable of the firmware, bounds from the linker
+extern "C" char __start_rtc_data[] __attribute__((weak));
+extern "C" char __stop_rtc_data[] __attribute__((weak));
+
+// rtc.bin, written by deepSleep() and read by the next boot, followed by the RTC memory and the registers
+typedef struct {
+    uint32_t magic;
+    uint32_t rtc_size;
+    uint32_t register_count;
+    uint32_t wake_cause;
+    uint64_t now;
+    uint64_t end;
+    uint64_t unix_base_ms;
+    uint64_t run_start_ns;
+    HostCounters counters;
+} RtcState;
+
+static std::atomic<uint64_t> clock_us(0);
+static uint64_t boot_us = 0;
+static uint64_t end_us = 0;
+static uint64_t unix_base_ms = 0;
+static uint64_t run_start_ns = 0;
+static std::atomic<bool> io_activity(false);
+static std::thread::id loop_thread;
+static char **boot_argv = nullptr;
+static void (*shutdown_report)() = nullptr;
+static std::string state_dir = "firmware_state";
+static HostCounters host_counters;
+
+static esp_sleep_wakeup_cause_t wake_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+static bool timer_wakeup = false;
+static uint64_t timer_wakeup_us = 0;
+
+static uint8_t pin_levels[GPIO_COUNT];
+static uint8_t pin_modes[GPIO_COUNT];
+static void (*pin_isr[GPIO_COUNT])();
+static thread_local bool in_isr = false;
+static int pin_isr_mode[GPIO_COUNT];
+static uint64_t pin_low_start[GPIO_COUNT]; // output pins driven low, SCL held low wakes the MLX90614
+static uint64_t pin_low_end[GPIO_COUNT];
+static bool pin_driven_low[GPIO_COUNT];
+
+static std::map<uint32_t, uint32_t> registers;
+static std::mt19937 rng(std::random_device{}());
+
+static uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts); //system wide, keeps counting through the exec of a deep sleep
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t rtcSize()
+{
+    return __start_rtc_data ? __stop_rtc_data - __start_rtc_data : 0;
+}
+
+// Time
+
+uint64_t host::now()
+{
+    return clock_us.load();
+}
+
+uint64_t host::bootTime()
+{
+    return boot_us;
+}
+
+uint64_t host::unixMs()
+{
+    return unix_base_ms + now() / 1000;
+}
+
+// Wi-Fi and SNTP only change state on the loop thread, like the Arduino event task between two loop() calls
+void host::advance(uint64_t us)
+{
+    clock_us += us;
+    if(std::this_thread::get_id() == loop_thread)
+        pollWiFi();
+}
+
+void host::activity()
+{
+    io_activity = true;
+}
+
+bool host::takeActivity()
+{
+    return io_activity.exchange(false);
+}
+
+uint32_t millis()
+{
+    return (clock_us.fetch_add(HOST_CLOCK_READ_US) - boot_us) / 1000;
+}
+
+uint32_t micros()
+{
+    return clock_us.fetch_add(HOST_CLOCK_READ_US) - boot_us;
+}
+
+void delay(uint32_t ms)
+{
+    host::advance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+    host::advance(us);
+}
+
+void ets_delay_us(uint32_t us)
+{
+    host::advance(us);
+}
+
+// CCOUNT runs on real time, profiling timers (lib/perf) measure what the host CPU spends
+uint32_t esp_cpu_get_ccount()
+{
+    static const auto start = std::chrono::steady_clock::now();
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return ns * HOST_CPU_MHZ / 1000;
+}
+
+uint32_t ets_get_cpu_frequency()
+{
+    return HOST_CPU_MHZ;
+}
+
+// Power management changes the frequency the firmware sees, the host CPU and CCOUNT keep their speed
+struct esp_pm_lock {
+    esp_pm_lock_type_t type;
+    int count;
+};
+static esp_pm_config_esp32_t pm_config = {HOST_CPU_MHZ, HOST_CPU_MHZ, false};
+static std::atomic<int> pm_held[ESP_PM_NO_LIGHT_SLEEP + 1];
+
+uint32_t getCpuFrequencyMhz()
+{
+    if(pm_held[ESP_PM_CPU_FREQ_MAX])
+        return pm_config.max_freq_mhz;
+    if(pm_held[ESP_PM_APB_FREQ_MAX] && pm_config.min_freq_mhz < 80)
+        return 80;
+    return pm_config.min_freq_mhz;
+}
+
+esp_err_t esp_pm_configure(const void *config)
+{
+    const esp_pm_config_esp32_t *pm = (const esp_pm_config_esp32_t*)config;
+    if(pm->min_freq_mhz > pm->max_freq_mhz || pm->max_freq_mhz > HOST_CPU_MHZ)
+        return ESP_ERR_INVALID_ARG;
+    pm_config = *pm;
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t lock_type, int arg, const char *name, esp_pm_lock_handle_t *out_handle)
+{
+    *out_handle = new esp_pm_lock{lock_type, 0};
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle)
+{
+    handle->count++;
+    pm_held[handle->type]++;
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle)
+{
+    if(!handle->count)
+        return ESP_ERR_INVALID_STATE;
+    handle->count--;
+    pm_held[handle->type]--;
+    return ESP_OK;
+}
+
+int64_t esp_timer_get_time()
+{
+    return host::now() - host::bootTime();
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return HOST_HEAP_FREE;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    return HOST_HEAP_MIN_FREE;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return HOST_HEAP_LARGEST_BLOCK;
+}
+
+// System time counts from power on, the RTC timer keeps it through deep sleep
+extern "C" int host_gettimeofday(struct timeval *tv, void *tz)
+{
+    uint64_t us = host::now();
+    tv->tv_sec = us / 1000000;
+    tv->tv_usec = us % 1000000;
+    return 0;
+}
+
+uint64_t rtc_time_get(void)
+{
+    return host::now() * HOST_RTC_HZ / 1000000;
+}
+
+// Power
+
+std::string host::statePath(const char *name)
+{
+    return state_dir + "/" + name;
+}
+
+HostCounters* host::counters()
+{
+    return &host_counters;
+}
+
+bool host::finished()
+{
+    return now() >= end_us;
+}
+
+// Resumes from rtc.bin if the last run went into deep sleep, else powers on (--fresh wipes flash and NVS first)
+bool host::boot(char **argv, const char *dir, bool fresh, uint64_t run_us)
+{
+    boot_argv = argv;
+    state_dir = dir;
+    loop_thread = std::this_thread::get_id();
+    std::filesystem::create_directories(state_dir);
+    registers[RTC_SLOW_CLK_CAL_REG] = (uint32_t)(((uint64_t)1000000 << RTC_CLK_CAL_FRACT) / HOST_RTC_HZ);
+
+    std::string path = statePath("rtc.bin");
+    FILE *f = fopen(path.c_str(), "rb");
+    RtcState state;
+    bool resumed = f && fread(&state, sizeof(state), 1, f) == 1 && state.magic == RTC_STATE_MAGIC &&
+        state.rtc_size == rtcSize() && (!state.rtc_size || fread(__start_rtc_data, state.rtc_size, 1, f) == 1);
+    for(uint32_t i = 0; resumed && i < state.register_count; i++)
+    {
+        uint32_t reg[2];
+        resumed = fread(reg, sizeof(reg), 1, f) == 1;
+        registers[reg[0]] = reg[1];
+    }
+    if(f)
+    {
+        fclose(f);
+        remove(path.c_str()); //a crash before the next deep sleep is a power cycle
+    }
+    if(resumed)
+    {
+        clock_us = state.now;
+        end_us = state.end;
+        unix_base_ms = state.unix_base_ms;
+        run_start_ns = state.run_start_ns;
+        wake_cause = (esp_sleep_wakeup_cause_t)state.wake_cause;
+        host_counters = state.counters;
+    }
+    else
+    {
+        if(fresh)
+        {
+            std::filesystem::remove_all(state_dir);
+            std::filesystem::create_directories(state_dir);
+        }
+        end_us = run_us;
+        unix_base_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        run_start_ns = monotonicNs();
+    }
+    boot_us = clock_us;
+    host_counters.boots++;
+    return resumed;
+}
+
+void host::shutdown(const char *reason)
+{
+    double virtual_s = now() / 1e6;
+    double real_s = (monotonicNs() - run_start_ns) / 1e9;
+    fflush(stdout);
+    fprintf(stderr, "\nEmulated ESP32 stopped: %s\n", reason);
+    fprintf(stderr, "Boots: %u, virtual time: %.2f h, real time: %.1f s, speed-up: %.0fx\n", host_counters.boots,
+        virtual_s / 3600, real_s, real_s > 0 ? virtual_s / real_s : 0);
+    fprintf(stderr, "Loops: %llu, %.2f us real time per loop()\n", (unsigned long long)host_counters.loops,
+        host_counters.loops ? host_counters.real_ns / 1e3 / host_counters.loops : 0);
+    fprintf(stderr, "Datagrams sent: %llu, received: %llu, unanswered: %llu\n",
+        (unsigned long long)host_counters.datagrams_sent, (unsigned long long)host_counters.datagrams_received,
+        (unsigned long long)host_counters.net_timeouts);
+    fprintf(stderr, "I2C transfers: %llu, flash bytes written: %llu, sectors erased: %llu\n",
+        (unsigned long long)host_counters.i2c_transfers, (unsigned long long)host_counters.flash_bytes,
+        (unsigned long long)host_counters.flash_erases);
+    char timers[2048];
+    if(Perf::report(timers, sizeof(timers)) > strlen("timer,count,p50_us,p99_us,max_us,mean_us\n"))
+        fprintf(stderr, "Timers of lib/perf in real time since the last boot:\n%s", timers);
+    if(shutdown_report)
+        shutdown_report();
+    fflush(stderr);
+    _exit(0); //no static destructors, the inference task may still be waiting
+}
+
+void host::onShutdown(void (*report)())
+{
+    shutdown_report = report;
+}
+
+// Saves RTC memory and registers, lets the sleep time pass and boots the same binary again
+void host::deepSleep()
+{
+    if(!timer_wakeup)
+        shutdown("deep sleep without a timer wake up source");
+    if(now() + timer_wakeup_us >= end_us)
+    {
+        clock_us = end_us;
+        shutdown("run finished in deep sleep");
+    }
+    clock_us += timer_wakeup_us;
+
+    RtcState state = {};
+    state.magic = RTC_STATE_MAGIC;
+    state.rtc_size = rtcSize();
+    state.register_count = registers.size();
+    state.wake_cause = ESP_SLEEP_WAKEUP_TIMER;
+    state.now = now();
+    state.end = end_us;
+    state.unix_base_ms = unix_base_ms;
+    state.run_start_ns = run_start_ns;
+    state.counters = host_counters;
+    std::string path = statePath("rtc.bin");
+    FILE *f = fopen(path.c_str(), "wb");
+    bool saved = f && fwrite(&state, sizeof(state), 1, f) == 1 &&
+        (!state.rtc_size || fwrite(__start_rtc_data, state.rtc_size, 1, f) == 1);
+    for(auto &reg : registers)
+    {
+        uint32_t pair[2] = {reg.first, reg.second};
+        saved = saved && fwrite(pair, sizeof(pair), 1, f) == 1;
+    }
+    if(f)
+        saved = fclose(f) == 0 && saved;
+    if(!saved)
+        shutdown("couldn't save RTC memory");
+    fflush(stdout);
+    fflush(stderr);
+    execv("/proc/self/exe", boot_argv);
+    shutdown("reboot failed");
+}
+
+// Sleep
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_us)
+{
+    timer_wakeup = true;
+    timer_wakeup_us = time_us;
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_ext0_wakeup(gpio_num_t gpio, int level)
+{
+    return ESP_OK; //nothing drives the pins during sleep, only the timer wakes up
+}
+
+esp_err_t esp_sleep_enable_ext1_wakeup(uint64_t mask, esp_sleep_ext1_wakeup_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_disable_wakeup_source(esp_sleep_source_t source)
+{
+    if(source == ESP_SLEEP_WAKEUP_TIMER || source == ESP_SLEEP_WAKEUP_ALL)
+        timer_wakeup = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_pd_config(esp_sleep_pd_domain_t domain, esp_sleep_pd_option_t option)
+{
+    return ESP_OK;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause()
+{
+    return wake_cause;
+}
+
+esp_err_t esp_light_sleep_start()
+{
+    if(!timer_wakeup)
+        host::shutdown("light sleep without a timer wake up source");
+    host::advance(timer_wakeup_us);
+    wake_cause = ESP_SLEEP_WAKEUP_TIMER;
+    return ESP_OK;
+}
+
+void esp_deep_sleep_start()
+{
+    host::deepSleep();
+}
+
+// The wake stub would bit-bang the sensors on the RTC pads, on the host every wake is a full boot
+void esp_set_deep_sleep_wake_stub(void (*stub)(void)) {}
+void esp_default_wake_deep_sleep(void) {}
+void set_rtc_memory_crc(void) {}
+
+// Registers
+
+uint32_t host_reg_read(uint32_t reg)
+{
+    uint64_t ticks = rtc_time_get();
+    switch(reg)
+    {
+        case RTC_CNTL_TIME_UPDATE_REG:
+            return registers[reg] | RTC_CNTL_TIME_VALID;
+        case RTC_CNTL_TIME0_REG:
+            return (uint32_t)ticks;
+        case RTC_CNTL_TIME1_REG:
+            return (uint32_t)(ticks >> 32) & 0xffff;
+        default:
+            return registers[reg];
+    }
+}
+
+void host_reg_write(uint32_t reg, uint32_t value)
+{
+    registers[reg] = value;
+}
+
+// GPIO
+
+void host::setPin(uint8_t pin, int level)
+{
+    if(pin >= GPIO_COUNT)
+        return;
+    uint8_t previous = pin_levels[pin];
+    pin_levels[pin] = level ? 1 : 0;
+    if(previous == pin_levels[pin] || !pin_isr[pin])
+        return;
+    int edge = level ? RISING : FALLING;
+    if(pin_isr_mode[pin] == CHANGE || pin_isr_mode[pin] == edge)
+    {
+        in_isr = true;
+        pin_isr[pin]();
+        in_isr = false;
+    }
+}
+
+BaseType_t xPortInIsrContext()
+{
+    return in_isr;
+}
+
+// Length of the last pulse the firmware drove low on the pin, 0 while it still is low
+uint64_t host::lowPulse(uint8_t pin, uint64_t *end)
+{
+    if(pin >= GPIO_COUNT || pin_driven_low[pin])
+        return 0;
+    if(end)
+        *end = pin_low_end[pin];
+    return pin_low_end[pin] - pin_low_start[pin];
+}
+
+static void releasePin(uint8_t pin)
+{
+    if(!pin_driven_low[pin])
+        return;
+    pin_driven_low[pin] = false;
+    pin_low_end[pin] = host::now();
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    if(pin >= GPIO_COUNT)
+        return;
+    pin_modes[pin] = mode;
+    if(mode != OUTPUT)
+        releasePin(pin);
+}
+
+void digitalWrite(uint8_t pin, uint8_t level)
+{
+    if(pin >= GPIO_COUNT || pin_modes[pin] != OUTPUT)
+        return;
+    if(level)
+        releasePin(pin);
+    else if(!pin_driven_low[pin])
+    {
+        pin_driven_low[pin] = true;
+        pin_low_start[pin] = host::now();
+    }
+    host::setPin(pin, level);
+}
+
+int digitalRead(uint8_t pin)
+{
+    return pin < GPIO_COUNT ? pin_levels[pin] : LOW;
+}
+
+int digitalPinToInterrupt(uint8_t pin)
+{
+    return pin < GPIO_COUNT ? pin : -1;
+}
+
+void attachInterrupt(uint8_t pin, void (*isr)(), int mode)
+{
+    if(pin >= GPIO_COUNT)
+        return;
+    pin_isr[pin] = isr;
+    pin_isr_mode[pin] = mode;
+}
+
+void detachInterrupt(uint8_t pin)
+{
+    if(pin < GPIO_COUNT)
+        pin_isr[pin] = nullptr;
+}
+
+esp_err_t gpio_hold_en(gpio_num_t gpio) { return ESP_OK; }
+esp_err_t gpio_hold_dis(gpio_num_t gpio) { return ESP_OK; }
+void gpio_deep_sleep_hold_en(void) {}
+void gpio_deep_sleep_hold_dis(void) {}
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio, gpio_int_type_t intr_type) { return ESP_OK; }
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio) { return ESP_OK; }
+
+// Misc
+
+uint32_t esp_random()
+{
+    return rng();
+}
+
+long random(long max)
+{
+    return max > 0 ? random(0, max) : 0;
+}
+
+long random(long min, long max)
+{
+    if(max <= min)
+        return min;
+    return min + (long)(rng() % (uint32_t)(max - min));
+}
+
+void randomSeed(unsigned long seed)
+{
+    rng.seed(seed);
+}
+
+// Same as zlib crc32()
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+{
+    crc = ~crc;
+    for(uint32_t i = 0; i < len; i++)
+    {
+        crc ^= buf[i];
+        for(int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
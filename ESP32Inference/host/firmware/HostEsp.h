@@ -0,0 +1,59 @@
+#pragma once
+// Emulated ESP32 behind the firmware host build: virtual time, deep sleep as a reboot that keeps RTC memory,
+// flash and NVS in files of a state directory. Only the shims and the loop driver (host_main.cpp) use this.
+#include <stdint.h>
+#include <string>
+
+#define HOST_RTC_HZ 150000        //RTC slow clock, the wake stub converts its ticks
+#define HOST_CLOCK_READ_US 1      //every clock read lets this much time pass, busy waits make progress
+#define HOST_WIFI_SCAN_MS 2500    //scan, association and DHCP
+#define HOST_WIFI_CACHED_MS 400   //known BSSID and channel, static IP
+#define HOST_SNTP_DELAY_MS 150    //first SNTP answer after the link came up
+#define HOST_NET_WAIT_MS 250      //real time a confirmable message waits for its answer, the network is instant
+#define HOST_I2C_HZ 100000
+#define HOST_CPU_MHZ 240        //CCOUNT rate, the cycle counter follows steady_clock
+#define HOST_HEAP_FREE 180000    //heap figures, not modelled: after boot with the model arena allocated
+#define HOST_HEAP_MIN_FREE 165000
+#define HOST_HEAP_LARGEST_BLOCK 110000
+#define HOST_FLASH_PAGE_US 400    //per 256 byte page program, ESP32 external flash typical
+#define HOST_FLASH_ERASE_US 45000 //per 4 KB sector
+
+typedef struct {
+    uint64_t loops = 0;
+    uint64_t real_ns = 0;         // wall time spent in loop()
+    uint32_t boots = 0;
+    uint64_t datagrams_sent = 0;
+    uint64_t datagrams_received = 0;
+    uint64_t net_timeouts = 0;    // confirmable messages the server didn't answer within HOST_NET_WAIT_MS
+    uint64_t i2c_transfers = 0;
+    uint64_t flash_bytes = 0;
+    uint64_t flash_erases = 0;
+} HostCounters;
+
+namespace host {
+
+    // Time
+    uint64_t now();               // virtual us since power on, the RTC timer keeps it through deep sleep
+    uint64_t bootTime();          // now() at the current boot, millis() counts from here
+    uint64_t unixMs();            // wall clock of the emulated world
+    void advance(uint64_t us);    // lets time pass and runs what became due (Wi-Fi events, SNTP)
+    void activity();              // I/O happened, the loop driver keeps the fine step
+    bool takeActivity();
+
+    // Power
+    bool boot(char **argv, const char *state_dir, bool fresh, uint64_t run_us); // true when woken from deep sleep
+    bool finished();
+    [[noreturn]] void deepSleep();
+    [[noreturn]] void shutdown(const char *reason);
+    void onShutdown(void (*report)()); // prints its report after the counters, e.g. the energy estimate
+    std::string statePath(const char *name);
+    HostCounters *counters();
+
+    // Peripherals
+    void setPin(uint8_t pin, int level);
+    uint64_t lowPulse(uint8_t pin, uint64_t *end = nullptr); // last low pulse the firmware drove, its length in us
+    void pollWiFi();
+    void setLocalPort(uint16_t port);
+    uint16_t localPort(uint16_t port);
+    void setDHT(float humidity, float temperature);
+}
@@ -0,0 +1,151 @@
+#include "HostEsp.h"
+#include "esp_partition.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#define FLASH_SECTOR_SIZE 4096
+#define FLASH_PAGE_SIZE 256
+
+typedef struct {
+    esp_partition_t partition;
+    int fd;
+} HostPartition;
+
+static std::vector<HostPartition*> partitions;
+
+static uint8_t subtype(const char *name)
+{
+    static const struct { const char *name; uint8_t value; } known[] = {
+        {"ota", 0x00}, {"phy", 0x01}, {"nvs", 0x02}, {"coredump", 0x03}, {"nvs_keys", 0x04}, {"spiffs", 0x82},
+        {"fat", 0x81}, {"factory", 0x00}, {"ota_0", 0x10}, {"ota_1", 0x11},
+    };
+    for(auto &entry : known)
+        if(!strcmp(name, entry.name))
+            return entry.value;
+    return strtoul(name, nullptr, 0);
+}
+
+// Partition table of the firmware (PARTITIONS_CSV), read on the first lookup
+static void loadPartitions()
+{
+    FILE *f = fopen(PARTITIONS_CSV, "r");
+    if(!f)
+    {
+        fprintf(stderr, "Partition table %s not found\n", PARTITIONS_CSV);
+        return;
+    }
+    char line[256];
+    while(fgets(line, sizeof(line), f))
+    {
+        char fields[5][32] = {};
+        int n = 0;
+        for(char *field = strtok(line, ",\r\n"); field && n < 5; field = strtok(nullptr, ",\r\n"))
+        {
+            while(*field == ' ' || *field == '\t')
+                field++;
+            sscanf(field, "%31s", fields[n++]);
+        }
+        if(n < 5 || fields[0][0] == '#')
+            continue;
+        HostPartition *entry = new HostPartition();
+        snprintf(entry->partition.label, sizeof(entry->partition.label), "%.*s",
+            (int)sizeof(entry->partition.label) - 1, fields[0]); //labels are 16 characters at most
+        entry->partition.type = strcmp(fields[1], "app") ? ESP_PARTITION_TYPE_DATA : ESP_PARTITION_TYPE_APP;
+        entry->partition.subtype = subtype(fields[2]);
+        entry->partition.address = strtoul(fields[3], nullptr, 0);
+        entry->partition.size = strtoul(fields[4], nullptr, 0);
+        entry->fd = -1;
+        partitions.push_back(entry);
+    }
+    fclose(f);
+}
+
+// <label>.bin of the state directory, erased (0xFF) when it is created
+static bool openPartition(HostPartition *entry)
+{
+    if(entry->fd >= 0)
+        return true;
+    std::string path = host::statePath((std::string(entry->partition.label) + ".bin").c_str());
+    entry->fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(entry->fd < 0)
+        return false;
+    if(lseek(entry->fd, 0, SEEK_END) != entry->partition.size)
+    {
+        std::vector<uint8_t> erased(entry->partition.size, 0xFF);
+        if(pwrite(entry->fd, erased.data(), erased.size(), 0) != (ssize_t)erased.size())
+            return false;
+    }
+    return true;
+}
+
+static HostPartition* entryOf(const esp_partition_t *partition)
+{
+    for(HostPartition *entry : partitions)
+        if(&entry->partition == partition)
+            return openPartition(entry) ? entry : nullptr;
+    return nullptr;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+    const char *label)
+{
+    if(partitions.empty())
+        loadPartitions();
+    for(HostPartition *entry : partitions)
+        if(entry->partition.type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY ||
+            entry->partition.subtype == subtype) && (!label || !strcmp(entry->partition.label, label)))
+            return &entry->partition;
+    return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size)
+{
+    HostPartition *entry = entryOf(partition);
+    if(!entry)
+        return ESP_ERR_INVALID_ARG;
+    if(offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    return pread(entry->fd, dst, size, offset) == (ssize_t)size ? ESP_OK : ESP_FAIL;
+}
+
+// NOR flash only clears bits, programming time per touched page
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size)
+{
+    HostPartition *entry = entryOf(partition);
+    if(!entry)
+        return ESP_ERR_INVALID_ARG;
+    if(offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    std::vector<uint8_t> cells(size);
+    if(pread(entry->fd, cells.data(), size, offset) != (ssize_t)size)
+        return ESP_FAIL;
+    for(size_t i = 0; i < size; i++)
+        cells[i] &= ((const uint8_t*)src)[i];
+    if(pwrite(entry->fd, cells.data(), size, offset) != (ssize_t)size)
+        return ESP_FAIL;
+    size_t pages = size ? (offset + size - 1) / FLASH_PAGE_SIZE - offset / FLASH_PAGE_SIZE + 1 : 0;
+    host::counters()->flash_bytes += size;
+    host::advance(pages * HOST_FLASH_PAGE_US);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    HostPartition *entry = entryOf(partition);
+    if(!entry)
+        return ESP_ERR_INVALID_ARG;
+    if(offset % FLASH_SECTOR_SIZE || size % FLASH_SECTOR_SIZE)
+        return ESP_ERR_INVALID_ARG;
+    if(offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    std::vector<uint8_t> erased(size, 0xFF);
+    if(pwrite(entry->fd, erased.data(), size, offset) != (ssize_t)size)
+        return ESP_FAIL;
+    host::counters()->flash_erases += size / FLASH_SECTOR_SIZE;
+    host::advance(size / FLASH_SECTOR_SIZE * HOST_FLASH_ERASE_US);
+    return ESP_OK;
+}
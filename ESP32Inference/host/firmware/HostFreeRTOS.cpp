@@ -0,0 +1,132 @@
+#include "HostEsp.h"
+#include "Arduino.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <pthread.h>
+
+// Blocking waits of the event groups are in real time, the other side is a real thread
+struct HostEventGroup {
+    std::mutex mutex;
+    std::condition_variable changed;
+    EventBits_t bits = 0;
+};
+
+static std::recursive_mutex critical;
+
+void host_enter_critical()
+{
+    critical.lock();
+}
+
+void host_exit_critical()
+{
+    critical.unlock();
+}
+
+// Tasks
+
+BaseType_t xPortGetCoreID()
+{
+    return 0;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters,
+    UBaseType_t priority, TaskHandle_t *created)
+{
+    std::thread thread(task, parameters);
+    if(created)
+        *created = (TaskHandle_t)thread.native_handle();
+    thread.detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters,
+    UBaseType_t priority, TaskHandle_t *created, BaseType_t core)
+{
+    return xTaskCreate(task, name, stack_depth, parameters, priority, created);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if(!task || (pthread_t)task == pthread_self())
+        pthread_exit(nullptr);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    host::advance((uint64_t)ticks * portTICK_PERIOD_MS * 1000);
+    std::this_thread::yield();
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return millis() / portTICK_PERIOD_MS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return (TaskHandle_t)pthread_self();
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    return 0; //host threads have megabytes of stack
+}
+
+// Event groups
+
+EventGroupHandle_t xEventGroupCreate()
+{
+    return new HostEventGroup();
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+    delete group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    std::lock_guard<std::mutex> lock(group->mutex);
+    group->bits |= bits;
+    group->changed.notify_all();
+    return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    std::lock_guard<std::mutex> lock(group->mutex);
+    EventBits_t previous = group->bits;
+    group->bits &= ~bits;
+    return previous;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    std::lock_guard<std::mutex> lock(group->mutex);
+    return group->bits;
+}
+
+// Returns the bits when the wait ended, before clear_on_exit
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+    BaseType_t wait_for_all, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto done = [&]() { return wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0; };
+    bool met;
+    if(ticks == portMAX_DELAY)
+    {
+        group->changed.wait(lock, done);
+        met = true;
+    }
+    else
+        met = group->changed.wait_for(lock, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), done);
+    EventBits_t result = group->bits;
+    if(met && clear_on_exit)
+        group->bits &= ~bits;
+    return result;
+}
@@ -0,0 +1,81 @@
+#include "HostEsp.h"
+#include "Preferences.h"
+#include <filesystem>
+
+std::string Preferences::keyPath(const char *key)
+{
+    return host::statePath("nvs") + "/" + name + "." + key;
+}
+
+bool Preferences::begin(const char *name, bool read_only)
+{
+    std::error_code error;
+    std::filesystem::create_directories(host::statePath("nvs"), error);
+    this->name = name;
+    this->read_only = read_only;
+    opened = !error;
+    return opened;
+}
+
+bool Preferences::clear()
+{
+    if(!opened || read_only)
+        return false;
+    for(auto &entry : std::filesystem::directory_iterator(host::statePath("nvs")))
+        if(entry.path().filename().string().rfind(name + ".", 0) == 0)
+            std::filesystem::remove(entry.path());
+    return true;
+}
+
+bool Preferences::remove(const char *key)
+{
+    return opened && !read_only && ::remove(keyPath(key).c_str()) == 0;
+}
+
+bool Preferences::isKey(const char *key)
+{
+    return opened && std::filesystem::exists(keyPath(key));
+}
+
+// Written to a temporary file and renamed, a crash keeps the old value like the NVS does
+size_t Preferences::putBytes(const char *key, const void *value, size_t len)
+{
+    if(!opened || read_only)
+        return 0;
+    std::string path = keyPath(key);
+    std::string temporary = path + ".tmp";
+    FILE *f = fopen(temporary.c_str(), "wb");
+    if(!f)
+        return 0;
+    bool written = fwrite(value, 1, len, f) == len;
+    written = fclose(f) == 0 && written;
+    if(!written || rename(temporary.c_str(), path.c_str()) != 0)
+        return 0;
+    return len;
+}
+
+size_t Preferences::getBytesLength(const char *key)
+{
+    std::error_code error;
+    size_t len = opened ? std::filesystem::file_size(keyPath(key), error) : 0;
+    return error ? 0 : len;
+}
+
+size_t Preferences::getBytes(const char *key, void *buffer, size_t max_len)
+{
+    size_t len = getBytesLength(key);
+    if(!len || len > max_len)
+        return 0;
+    FILE *f = fopen(keyPath(key).c_str(), "rb");
+    if(!f)
+        return 0;
+    len = fread(buffer, 1, len, f);
+    fclose(f);
+    return len;
+}
+
+uint32_t Preferences::getUInt(const char *key, uint32_t default_value)
+{
+    uint32_t value;
+    return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : default_value;
+}
@@ -0,0 +1,118 @@
+#include "HostEsp.h"
+#include "driver/rmt.h"
+#include <math.h>
+
+#define RMT_CHANNELS 8
+#define DHT_FRAME_ITEMS 41
+#define DHT_FRAME_US 4500
+
+// Captures of the channels, a DHT11 answers every receive with one frame
+struct HostRingbuf {
+    rmt_item32_t items[DHT_FRAME_ITEMS];
+    size_t count;
+    bool taken;
+};
+
+static rmt_config_t configs[RMT_CHANNELS];
+static HostRingbuf *rings[RMT_CHANNELS];
+static float dht_humidity = 45;
+static float dht_temperature = 22;
+
+void host::setDHT(float humidity, float temperature)
+{
+    dht_humidity = humidity;
+    dht_temperature = temperature;
+}
+
+// Response (80 us low, 80 us high) and 40 data bits: 50 us low, then 27 us high for 0 or 70 us for 1
+static void dhtFrame(HostRingbuf *ring)
+{
+    float humidity = dht_humidity < 0 ? 0 : dht_humidity > 99 ? 99 : dht_humidity;
+    float temperature = fabsf(dht_temperature);
+    uint8_t data[5];
+    data[0] = (uint8_t)humidity;
+    data[1] = (uint8_t)((humidity - data[0]) * 10);
+    data[2] = (uint8_t)temperature;
+    data[3] = (uint8_t)((temperature - data[2]) * 10) | (dht_temperature < 0 ? 0x80 : 0);
+    data[4] = data[0] + data[1] + data[2] + data[3];
+
+    ring->items[0] = {80, 0, 80, 1};
+    for(int bit = 0; bit < 40; bit++)
+    {
+        bool one = data[bit / 8] & (0x80 >> (bit % 8));
+        ring->items[1 + bit] = {(uint32_t)(one ? 70 : 27), 1, 50, 0};
+    }
+    ring->count = DHT_FRAME_ITEMS;
+    ring->taken = false;
+}
+
+esp_err_t rmt_config(const rmt_config_t *config)
+{
+    if(config->channel < 0 || config->channel >= RMT_CHANNELS)
+        return ESP_ERR_INVALID_ARG;
+    configs[config->channel] = *config;
+    return ESP_OK;
+}
+
+esp_err_t rmt_driver_install(rmt_channel_t channel, size_t rx_buf_size, int intr_alloc_flags)
+{
+    if(channel < 0 || channel >= RMT_CHANNELS || rings[channel])
+        return ESP_ERR_INVALID_STATE;
+    rings[channel] = new HostRingbuf();
+    return ESP_OK;
+}
+
+esp_err_t rmt_driver_uninstall(rmt_channel_t channel)
+{
+    if(channel < 0 || channel >= RMT_CHANNELS || !rings[channel])
+        return ESP_ERR_INVALID_STATE;
+    delete rings[channel];
+    rings[channel] = nullptr;
+    return ESP_OK;
+}
+
+esp_err_t rmt_get_ringbuf_handle(rmt_channel_t channel, RingbufHandle_t *buf_handle)
+{
+    if(channel < 0 || channel >= RMT_CHANNELS || !rings[channel])
+        return ESP_ERR_INVALID_STATE;
+    *buf_handle = rings[channel];
+    return ESP_OK;
+}
+
+esp_err_t rmt_rx_memory_reset(rmt_channel_t channel)
+{
+    return ESP_OK;
+}
+
+esp_err_t rmt_rx_start(rmt_channel_t channel, bool rx_idx_rst)
+{
+    if(channel < 0 || channel >= RMT_CHANNELS || !rings[channel])
+        return ESP_ERR_INVALID_STATE;
+    dhtFrame(rings[channel]);
+    return ESP_OK;
+}
+
+esp_err_t rmt_rx_stop(rmt_channel_t channel)
+{
+    return ESP_OK;
+}
+
+// The frame is complete after DHT_FRAME_US and the RMT idle threshold
+void *xRingbufferReceive(RingbufHandle_t ring, size_t *size, TickType_t ticks)
+{
+    if(!ring->count || ring->taken)
+    {
+        host::advance((uint64_t)ticks * portTICK_PERIOD_MS * 1000);
+        *size = 0;
+        return nullptr;
+    }
+    host::advance(DHT_FRAME_US + 1000);
+    ring->taken = true;
+    *size = ring->count * sizeof(rmt_item32_t);
+    return ring->items;
+}
+
+void vRingbufferReturnItem(RingbufHandle_t ring, void *item)
+{
+    ring->count = 0;
+}
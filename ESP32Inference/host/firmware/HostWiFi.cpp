@@ -0,0 +1,226 @@
+#include "HostEsp.h"
+#include "WiFi.h"
+#include "esp_sntp.h"
+#include <poll.h>
+
+#define HOST_LOCAL_PORT 56830 //CoAP port of the device, server.py has 5683 on the same host
+
+WiFiClass WiFi;
+
+static const uint8_t bssid[6] = {0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01};
+static uint16_t local_port = 0;
+static bool server_silent = false; //last confirmable went unanswered, don't wait again until something arrives
+
+static bool sntp_enabled = false;
+static uint64_t sntp_next_us = 0;
+static uint32_t sntp_interval_ms = 3600000;
+static sntp_sync_status_t sntp_status = SNTP_SYNC_STATUS_RESET;
+
+// Station
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *pass, int32_t channel, const uint8_t *bssid, bool connect)
+{
+    wifi_mode = WIFI_STA;
+    state = WL_DISCONNECTED;
+    bool cached = channel && bssid && static_ip;
+    connect_at = host::now() + (uint64_t)(cached ? HOST_WIFI_CACHED_MS : HOST_WIFI_SCAN_MS) * 1000;
+    return state;
+}
+
+bool WiFiClass::disconnect(bool wifioff, bool eraseap)
+{
+    if(state == WL_CONNECTED)
+        fire(ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    state = WL_DISCONNECTED;
+    connect_at = 0;
+    if(wifioff)
+        wifi_mode = WIFI_OFF;
+    return true;
+}
+
+bool WiFiClass::mode(wifi_mode_t mode)
+{
+    if(mode == WIFI_OFF)
+        disconnect(true);
+    wifi_mode = mode;
+    return true;
+}
+
+bool WiFiClass::config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2)
+{
+    static_ip = (uint32_t)local_ip != 0;
+    if(!static_ip)
+        return true;
+    ip = local_ip;
+    this->gateway = gateway;
+    this->subnet = subnet;
+    dns = dns1;
+    return true;
+}
+
+int WiFiClass::onEvent(WiFiEventSysCb handler, WiFiEvent_t event)
+{
+    if(handler_count == sizeof(handlers) / sizeof(handlers[0]))
+        return -1;
+    handlers[handler_count] = handler;
+    handler_events[handler_count] = event;
+    return handler_count++;
+}
+
+uint8_t* WiFiClass::BSSID()
+{
+    static uint8_t current[6];
+    memcpy(current, bssid, sizeof(current));
+    return current;
+}
+
+void WiFiClass::fire(WiFiEvent_t event)
+{
+    WiFiEventInfo_t info = {};
+    for(uint8_t i = 0; i < handler_count; i++)
+        if(handler_events[i] == ARDUINO_EVENT_MAX || handler_events[i] == event)
+            handlers[i](event, info);
+}
+
+// Completes a pending join, DHCP hands out the loopback address
+void WiFiClass::poll()
+{
+    if(!connect_at || host::now() < connect_at)
+        return;
+    connect_at = 0;
+    state = WL_CONNECTED;
+    if(!static_ip)
+    {
+        ip = IPAddress(127, 0, 0, 1);
+        gateway = IPAddress(127, 0, 0, 1);
+        subnet = IPAddress(255, 0, 0, 0);
+        dns = IPAddress(127, 0, 0, 1);
+    }
+    host::activity();
+    fire(ARDUINO_EVENT_WIFI_STA_CONNECTED);
+    fire(ARDUINO_EVENT_WIFI_STA_GOT_IP);
+    sntp_next_us = host::now() + HOST_SNTP_DELAY_MS * 1000;
+}
+
+// SNTP
+
+void configTime(long gmt_offset_s, int daylight_offset_s, const char *server1, const char *server2,
+    const char *server3)
+{
+    sntp_enabled = true;
+    sntp_next_us = host::now() + HOST_SNTP_DELAY_MS * 1000;
+}
+
+// IDF default steps the system time, the host keeps it counting from power on
+extern "C" __attribute__((weak)) void sntp_sync_time(struct timeval *tv)
+{
+    sntp_set_sync_status(SNTP_SYNC_STATUS_COMPLETED);
+}
+
+extern "C" void sntp_set_sync_status(sntp_sync_status_t sync_status)
+{
+    sntp_status = sync_status;
+}
+
+extern "C" sntp_sync_status_t sntp_get_sync_status(void)
+{
+    return sntp_status;
+}
+
+extern "C" void sntp_set_sync_interval(uint32_t interval_ms)
+{
+    sntp_interval_ms = interval_ms < 15000 ? 15000 : interval_ms;
+}
+
+extern "C" uint32_t sntp_get_sync_interval(void)
+{
+    return sntp_interval_ms;
+}
+
+void host::pollWiFi()
+{
+    WiFi.poll();
+    if(!sntp_enabled || WiFi.status() != WL_CONNECTED || now() < sntp_next_us)
+        return;
+    sntp_next_us = now() + (uint64_t)sntp_interval_ms * 1000;
+    uint64_t unix_ms = unixMs();
+    struct timeval tv = {(time_t)(unix_ms / 1000), (suseconds_t)(unix_ms % 1000 * 1000)};
+    sntp_sync_time(&tv);
+}
+
+// UDP
+
+void host::setLocalPort(uint16_t port)
+{
+    local_port = port;
+}
+
+uint16_t host::localPort(uint16_t port)
+{
+    if(local_port)
+        return local_port;
+    return port == 5683 ? HOST_LOCAL_PORT : port;
+}
+
+uint8_t WiFiUDP::begin(uint16_t port)
+{
+    return HostUDP::begin(host::localPort(port));
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port)
+{
+    header_pending = true;
+    confirmable = false;
+    return HostUDP::beginPacket(ip, port);
+}
+
+// The first byte of the datagram is the CoAP version and type
+size_t WiFiUDP::write(const uint8_t *buffer, size_t size)
+{
+    if(header_pending && size)
+    {
+        confirmable = (buffer[0] & 0xf0) == 0x40;
+        header_pending = false;
+    }
+    return HostUDP::write(buffer, size);
+}
+
+int WiFiUDP::endPacket()
+{
+    if(WiFi.status() != WL_CONNECTED)
+        return 0;
+    int sent = HostUDP::endPacket();
+    if(sent)
+    {
+        host::counters()->datagrams_sent++;
+        host::activity();
+        if(confirmable)
+            awaiting++;
+    }
+    return sent;
+}
+
+int WiFiUDP::parsePacket()
+{
+    int len = HostUDP::parsePacket();
+    if(!len && awaiting && !server_silent && fd >= 0)
+    {
+        struct pollfd request = {fd, POLLIN, 0};
+        if(poll(&request, 1, HOST_NET_WAIT_MS) > 0)
+            len = HostUDP::parsePacket();
+        else
+        {
+            host::counters()->net_timeouts++;
+            server_silent = true;
+            awaiting = 0;
+        }
+    }
+    if(!len)
+        return 0;
+    host::counters()->datagrams_received++;
+    host::activity();
+    server_silent = false;
+    if(awaiting)
+        awaiting--;
+    return len;
+}
@@ -0,0 +1,151 @@
+#include "HostEsp.h"
+#include "Wire.h"
+
+TwoWire Wire;
+
+bool I2CRegisterDevice::write(const uint8_t *data, size_t len)
+{
+    pointer = data[0];
+    for(size_t i = 1; i < len; i++)
+        registers[pointer++] = data[i];
+    return true;
+}
+
+void I2CRegisterDevice::read(uint8_t *data, size_t len)
+{
+    for(size_t i = 0; i < len; i++)
+        data[i] = registers[pointer++];
+}
+
+TwoWire::TwoWire() : rng(1), clock_hz(HOST_I2C_HZ) {}
+
+bool TwoWire::begin(int sda, int scl, uint32_t frequency)
+{
+    if(frequency)
+        clock_hz = frequency;
+    started = true;
+    return true;
+}
+
+bool TwoWire::end()
+{
+    stop();
+    started = false;
+    return true;
+}
+
+// Address byte plus data bytes, 9 SCL periods each, START/STOP and the clock stretching of the slave
+void TwoWire::transferTime(uint8_t address, size_t bytes)
+{
+    uint64_t us = ((uint64_t)bytes * 9 + 2) * 1000000 / clock_hz + faults[address].stretch_us;
+    host::counters()->i2c_transfers++;
+    stats.transfers++;
+    stats.bus_us += us;
+    host::advance(us);
+}
+
+// START (or repeated START) and the address byte, nullptr if nobody acknowledged it
+I2CDevice *TwoWire::select(uint8_t address, bool read)
+{
+    if(!active)
+        stats.transactions++;
+    stats.bytes_written++;
+    I2CDevice *device = devices[address];
+    if(active && active != device)
+        active->stop(); //repeated START to another slave ends the exchange with the first one
+    std::uniform_real_distribution<float> chance(0, 1);
+    if(!device || (faults[address].nack_rate && chance(rng) < faults[address].nack_rate) || !device->address(read))
+    {
+        stats.nacks++;
+        stop(); //the core sends STOP after a NACK
+        return nullptr;
+    }
+    active = device;
+    return device;
+}
+
+void TwoWire::stop()
+{
+    if(active)
+        active->stop();
+    active = nullptr;
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+    tx_address = address & 0x7f;
+    tx_len = 0;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+    if(tx_len == sizeof(tx))
+        return 0;
+    tx[tx_len++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t len)
+{
+    size_t written = 0;
+    while(written < len && write(data[written]))
+        written++;
+    return written;
+}
+
+// Same codes as the Arduino core: 2 address NACK, 3 data NACK, 4 bus not started
+uint8_t TwoWire::endTransmission(bool send_stop)
+{
+    if(!started)
+        return 4;
+    I2CDevice *device = select(tx_address, false);
+    if(!device)
+    {
+        transferTime(tx_address, 1);
+        return 2;
+    }
+    transferTime(tx_address, 1 + tx_len);
+    if(tx_len && !device->write(tx, tx_len))
+    {
+        stats.nacks++;
+        stop();
+        return 3;
+    }
+    stats.bytes_written += tx_len;
+    if(send_stop)
+        stop();
+    return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t len, bool send_stop)
+{
+    rx_len = rx_pos = 0;
+    if(!started)
+        return 0;
+    address &= 0x7f;
+    I2CDevice *device = select(address, true);
+    if(!device)
+    {
+        transferTime(address, 1);
+        return 0;
+    }
+    rx_len = len < sizeof(rx) ? len : sizeof(rx);
+    transferTime(address, 1 + rx_len);
+    device->read(rx, rx_len);
+    std::uniform_real_distribution<float> chance(0, 1);
+    for(size_t i = 0; faults[address].flip_rate && i < rx_len; i++)
+        if(chance(rng) < faults[address].flip_rate)
+        {
+            rx[i] ^= 1 << (rng() % 8);
+            stats.flipped++;
+        }
+    stats.bytes_read += rx_len;
+    if(send_stop)
+        stop();
+    return rx_len;
+}
+
+int TwoWire::read()
+{
+    return rx_pos < rx_len ? rx[rx_pos++] : -1;
+}
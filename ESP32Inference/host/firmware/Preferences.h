@@ -0,0 +1,23 @@
+#pragma once
+// NVS namespace of the emulated flash, one file per key under nvs/ of the state directory (HostPreferences.cpp)
+#include "Arduino.h"
+
+class Preferences {
+
+    std::string name;
+    bool read_only = true;
+    bool opened = false;
+    std::string keyPath(const char *key);
+
+    public:
+        bool begin(const char *name, bool read_only = false);
+        void end() { opened = false; }
+        bool clear();
+        bool remove(const char *key);
+        bool isKey(const char *key);
+        size_t putBytes(const char *key, const void *value, size_t len);
+        size_t getBytes(const char *key, void *buffer, size_t max_len);
+        size_t getBytesLength(const char *key);
+        size_t putUInt(const char *key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+        uint32_t getUInt(const char *key, uint32_t default_value = 0);
+};
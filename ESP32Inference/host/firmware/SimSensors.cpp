@@ -0,0 +1,517 @@
+#include "HostEsp.h"
+#include "SimSensors.h"
+#include <algorithm>
+#include <math.h>
+
+// Trace
+
+bool SensorTrace::load(const char *path)
+{
+    rows.clear();
+    if(!loadLabeled(path, &rows))
+        return false;
+    span_ms = rows.back().ms + 10000; //one poll interval after the last row the recording starts over
+    return true;
+}
+
+const LabeledRow *SensorTrace::at(uint64_t us)
+{
+    static const LabeledRow silent = {}; //no trace, every sensor reads as disconnected
+    if(rows.empty())
+        return &silent;
+    uint32_t ms = (us / 1000) % span_ms;
+    auto next = std::upper_bound(rows.begin(), rows.end(), ms,
+        [](uint32_t ms, const LabeledRow &row) { return ms < row.ms; });
+    return &*(next - 1);
+}
+
+// BMP280
+
+#define BMP_REG_CALIBRATION 0x88
+#define BMP_REG_ID 0xD0
+#define BMP_REG_RESET 0xE0
+#define BMP_REG_STATUS 0xF3
+#define BMP_REG_CTRL_MEAS 0xF4
+#define BMP_REG_CONFIG 0xF5
+#define BMP_REG_DATA 0xF7
+#define BMP_RESET_WORD 0xB6
+#define BMP_ADC_RESET 0x80000 //data registers before the first conversion and of skipped channels
+
+// dig_T1..dig_P9 of the datasheet example (BST-BMP280-DS001 8.2), little endian words from 0x88
+const uint8_t SimBMP280::calibration[24] = {
+    0x70, 0x6B, 0x43, 0x67, 0x18, 0xFC, 0x7D, 0x8E, 0x43, 0xD6, 0xD0, 0x0B,
+    0x27, 0x0B, 0x8C, 0x00, 0xF9, 0xFF, 0x8C, 0x3C, 0xF8, 0xC6, 0x70, 0x17};
+
+static int32_t calibrationWord(int i, bool is_signed)
+{
+    uint16_t word = SimBMP280::calibration[2 * i] | (SimBMP280::calibration[2 * i + 1] << 8);
+    return is_signed ? (int32_t)(int16_t)word : (int32_t)word;
+}
+
+// bmp280_compensate_T_int32 and bmp280_compensate_P_int64 of the datasheet, 0.01 degC and Q24.8 Pa
+static int32_t compensateT(int32_t adc_T, int32_t *t_fine)
+{
+    int32_t T1 = calibrationWord(0, false), T2 = calibrationWord(1, true), T3 = calibrationWord(2, true);
+    int32_t var1 = ((((adc_T >> 3) - (T1 << 1))) * T2) >> 11;
+    int32_t var2 = (((((adc_T >> 4) - T1) * ((adc_T >> 4) - T1)) >> 12) * T3) >> 14;
+    *t_fine = var1 + var2;
+    return (*t_fine * 5 + 128) >> 8;
+}
+
+static int64_t compensateP(int32_t adc_P, int32_t t_fine)
+{
+    int64_t P[10];
+    for(int i = 1; i <= 9; i++)
+        P[i] = calibrationWord(2 + i, i != 1);
+    int64_t var1 = (int64_t)t_fine - 128000;
+    int64_t var2 = var1 * var1 * P[6];
+    var2 = var2 + ((var1 * P[5]) << 17);
+    var2 = var2 + (P[4] << 35);
+    var1 = ((var1 * var1 * P[3]) >> 8) + ((var1 * P[2]) << 12);
+    var1 = (((int64_t)1 << 47) + var1) * P[1] >> 33;
+    if(var1 == 0)
+        return 0;
+    int64_t p = 1048576 - adc_P;
+    p = (((p << 31) - var2) * 3125) / var1;
+    var1 = (P[9] * (p >> 13) * (p >> 13)) >> 25;
+    var2 = (P[8] * p) >> 19;
+    return ((p + var1 + var2) >> 8) + (P[7] << 4);
+}
+
+// Raw 20 bit ADC words that compensate to the closest values, temperature rises and pressure falls with the ADC
+void SimBMP280::encode(float temperature, float pressure, int32_t *adc_T, int32_t *adc_P)
+{
+    int32_t t_fine;
+    int32_t target_T = lroundf(temperature * 100);
+    int32_t low = 0, high = (1 << 20) - 1;
+    while(low < high)
+    {
+        int32_t middle = (low + high) / 2;
+        if(compensateT(middle, &t_fine) < target_T)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if(low && abs(compensateT(low - 1, &t_fine) - target_T) <= abs(compensateT(low, &t_fine) - target_T))
+        low--;
+    *adc_T = low == BMP_ADC_RESET ? low + 1 : low;
+    compensateT(*adc_T, &t_fine);
+
+    int64_t target_P = llround((double)pressure * 256);
+    low = 0, high = (1 << 20) - 1;
+    while(low < high)
+    {
+        int32_t middle = (low + high) / 2;
+        if(compensateP(middle, t_fine) > target_P)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if(low && llabs(compensateP(low - 1, t_fine) - target_P) <= llabs(compensateP(low, t_fine) - target_P))
+        low--;
+    *adc_P = low == BMP_ADC_RESET ? low + 1 : low;
+}
+
+// Datasheet 3.8.1 maximum measurement time, standby of config t_sb in normal mode
+uint32_t SimBMP280::measureUs()
+{
+    uint8_t osrs_t = (state->ctrl_meas >> 5) & 0x07;
+    uint8_t osrs_p = (state->ctrl_meas >> 2) & 0x07;
+    uint32_t us = 1250;
+    if(osrs_t)
+        us += 2300 * (1 << ((osrs_t > 5 ? 5 : osrs_t) - 1));
+    if(osrs_p)
+        us += 2300 * (1 << ((osrs_p > 5 ? 5 : osrs_p) - 1)) + 575;
+    return us;
+}
+
+uint32_t SimBMP280::cycleUs()
+{
+    const uint32_t standby_us[8] = {500, 62500, 125000, 250000, 500000, 1000000, 2000000, 4000000};
+    return measureUs() + standby_us[(state->config >> 5) & 0x07];
+}
+
+// Results of the conversion that ended at us, skipped channels read the reset value
+void SimBMP280::convert(uint64_t us)
+{
+    const LabeledRow *row = trace->at(us);
+    int32_t adc[2];
+    encode(row->data.bmp280_temperature, row->data.bmp280_pressure, &adc[1], &adc[0]);
+    bool enabled[2] = {((state->ctrl_meas >> 2) & 0x07) != 0, ((state->ctrl_meas >> 5) & 0x07) != 0};
+    for(int i = 0; i < 2; i++)
+    {
+        int32_t value = enabled[i] ? adc[i] : BMP_ADC_RESET;
+        state->data[3 * i] = value >> 12;
+        state->data[3 * i + 1] = value >> 4;
+        state->data[3 * i + 2] = (value & 0x0f) << 4;
+    }
+}
+
+// Catches up with the conversions that finished since the last access
+void SimBMP280::update()
+{
+    if(!state->powered)
+    {
+        *state = {};
+        state->powered = true;
+        uint8_t reset[6] = {0x80, 0x00, 0x00, 0x80, 0x00, 0x00};
+        memcpy(state->data, reset, sizeof(reset));
+    }
+    uint64_t now = host::now();
+    if(!state->next_us || now < state->next_us)
+        return;
+    if((state->ctrl_meas & 0x03) == 0x03)
+    {
+        uint64_t cycle = cycleUs();
+        uint64_t end = state->next_us + (now - state->next_us) / cycle * cycle;
+        convert(end);
+        state->next_us = end + cycle;
+    }
+    else
+    {
+        convert(state->next_us); //forced conversion done, back to sleep mode
+        state->next_us = 0;
+        state->ctrl_meas &= ~0x03;
+    }
+}
+
+uint8_t SimBMP280::reg(uint8_t address)
+{
+    if(address >= BMP_REG_CALIBRATION && address < BMP_REG_CALIBRATION + sizeof(calibration))
+        return calibration[address - BMP_REG_CALIBRATION];
+    if(address >= BMP_REG_DATA && address < BMP_REG_DATA + sizeof(state->data))
+        return state->data[address - BMP_REG_DATA];
+    switch(address)
+    {
+        case BMP_REG_ID: return SIM_BMP280_CHIP_ID;
+        case BMP_REG_CTRL_MEAS: return state->ctrl_meas;
+        case BMP_REG_CONFIG: return state->config;
+        case BMP_REG_STATUS:
+        {
+            bool normal = (state->ctrl_meas & 0x03) == 0x03;
+            bool measuring = state->next_us && (!normal || host::now() + measureUs() >= state->next_us);
+            return measuring ? 0x08 : 0x00;
+        }
+        default: return 0x00;
+    }
+}
+
+bool SimBMP280::address(bool read)
+{
+    return trace->at(host::now())->data.bmp280_pressure != 0;
+}
+
+// Register address and data pairs, writes don't auto increment
+bool SimBMP280::write(const uint8_t *data, size_t len)
+{
+    update();
+    state->pointer = data[0];
+    for(size_t i = 0; i + 1 < len; i += 2)
+    {
+        uint8_t value = data[i + 1];
+        switch(data[i])
+        {
+            case BMP_REG_RESET:
+                if(value == BMP_RESET_WORD)
+                    state->powered = false;
+                update();
+                break;
+            case BMP_REG_CONFIG:
+                state->config = value;
+                break;
+            case BMP_REG_CTRL_MEAS:
+            {
+                bool was_normal = (state->ctrl_meas & 0x03) == 0x03;
+                state->ctrl_meas = value;
+                uint8_t mode = value & 0x03;
+                if(mode == 0x00)
+                    state->next_us = 0;
+                else if(mode != 0x03 || !was_normal)
+                    state->next_us = host::now() + measureUs();
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+void SimBMP280::read(uint8_t *data, size_t len)
+{
+    update();
+    for(size_t i = 0; i < len; i++)
+        data[i] = reg(state->pointer++);
+}
+
+// MLX90614
+
+#define MLX_CMD_RAM 0x00
+#define MLX_CMD_EEPROM 0x20
+#define MLX_CMD_SLEEP 0xFF
+#define MLX_RAM_TA 0x06
+#define MLX_RAM_TOBJ1 0x07
+
+uint8_t SimMLX90614::crc8(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0;
+    while(len--)
+    {
+        crc ^= *data++;
+        for(int i = 0; i < 8; i++)
+            crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+// Factory EEPROM of an MLX90614ESF-BAA: To range, PWM, Ta range, emissivity 1.0, config, address and ID
+void SimMLX90614::powerOn()
+{
+    *state = {};
+    state->powered = true;
+    state->eeprom[0x00] = 0x9993;
+    state->eeprom[0x01] = 0x62E3;
+    state->eeprom[0x02] = 0x0201;
+    state->eeprom[0x03] = 0xF71C;
+    state->eeprom[0x04] = 0xFFFF;
+    state->eeprom[0x05] = 0x9FB4;
+    state->eeprom[0x0E] = addr;
+    uint16_t id[4] = {0x2A3C, 0x1E0B, 0x9741, 0x0C5D};
+    memcpy(&state->eeprom[0x1C], id, sizeof(id));
+    state->ready_us = host::now() + SIM_MLX_SETTLE_MS * 1000;
+}
+
+uint16_t SimMLX90614::word(uint8_t command)
+{
+    if((command & 0xE0) == MLX_CMD_EEPROM)
+        return state->eeprom[command & 0x1F];
+    if(command != MLX_RAM_TA && command != MLX_RAM_TOBJ1)
+        return 0;
+    if(host::now() < state->ready_us)
+        return 0; //no measurement yet
+    const LabeledRow *row = trace->at(host::now());
+    float celsius = command == MLX_RAM_TA ? row->data.mlx_ambient_temperature : row->data.mlx_object_temperature;
+    return lroundf((celsius + 273.15f) / 0.02f);
+}
+
+// Asleep it only answers after the master held SCL low, the first measurement follows after the settling time
+bool SimMLX90614::address(bool read)
+{
+    if(!state->powered)
+        powerOn();
+    if(!state->asleep)
+        return true;
+    uint64_t end;
+    if(host::lowPulse(scl, &end) < SIM_MLX_WAKE_MS * 1000 || end < state->sleep_us)
+        return false;
+    state->asleep = false;
+    state->ready_us = end + SIM_MLX_SETTLE_MS * 1000;
+    return true;
+}
+
+// Command byte, then for EEPROM writes the word and the PEC, a wrong PEC isn't acknowledged
+bool SimMLX90614::write(const uint8_t *data, size_t len)
+{
+    state->command = data[0];
+    state->has_command = true;
+    uint8_t frame[4] = {(uint8_t)(addr << 1), data[0]};
+    if(len == 1)
+        return true;
+    if(data[0] == MLX_CMD_SLEEP)
+    {
+        if(len != 2 || data[1] != crc8(frame, 2))
+            return false;
+        state->asleep = true;
+        state->sleep_us = host::now();
+        return true;
+    }
+    if((data[0] & 0xE0) != MLX_CMD_EEPROM || len != 4)
+        return false;
+    frame[2] = data[1];
+    frame[3] = data[2];
+    if(data[3] != crc8(frame, 4))
+        return false;
+    uint16_t value = data[1] | (data[2] << 8);
+    uint16_t *cell = &state->eeprom[data[0] & 0x1F];
+    if(!*cell || !value) //a cell has to be erased (written with 0) before it takes a new value
+        *cell = value;
+    return true;
+}
+
+// Read word: LSB, MSB and the PEC over the whole frame including both address bytes
+void SimMLX90614::read(uint8_t *data, size_t len)
+{
+    memset(data, 0xFF, len);
+    if(!state->has_command)
+        return;
+    uint16_t value = word(state->command);
+    uint8_t frame[5] = {(uint8_t)(addr << 1), state->command, (uint8_t)((addr << 1) | 1), (uint8_t)value,
+        (uint8_t)(value >> 8)};
+    uint8_t reply[3] = {frame[3], frame[4], crc8(frame, 5)};
+    memcpy(data, reply, len < sizeof(reply) ? len : sizeof(reply));
+}
+
+// CCS811
+
+#define CCS_STATUS 0x00
+#define CCS_MEAS_MODE 0x01
+#define CCS_ALG_RESULT_DATA 0x02
+#define CCS_RAW_DATA 0x03
+#define CCS_ENV_DATA 0x05
+#define CCS_THRESHOLDS 0x10
+#define CCS_BASELINE 0x11
+#define CCS_HW_ID 0x20
+#define CCS_HW_VERSION 0x21
+#define CCS_FW_BOOT_VERSION 0x23
+#define CCS_FW_APP_VERSION 0x24
+#define CCS_ERROR_ID 0xE0
+#define CCS_APP_ERASE 0xF1
+#define CCS_APP_VERIFY 0xF3
+#define CCS_APP_START 0xF4
+#define CCS_SW_RESET 0xFF
+#define CCS_WRITE_REG_INVALID 0x01
+#define CCS_READ_REG_INVALID 0x02
+#define CCS_MEASMODE_INVALID 0x04
+
+static uint32_t drivePeriodMs(uint8_t meas_mode)
+{
+    const uint32_t period_ms[5] = {0, 1000, 10000, 60000, 250};
+    uint8_t drive = (meas_mode >> 4) & 0x07;
+    return drive < 5 ? period_ms[drive] : 0;
+}
+
+// Mailboxes of the running firmware, the bootloader only has the common ones and the application update ones
+static bool validMailbox(uint8_t mailbox, bool app)
+{
+    switch(mailbox)
+    {
+        case CCS_STATUS: case CCS_HW_ID: case CCS_HW_VERSION: case CCS_FW_BOOT_VERSION: case CCS_FW_APP_VERSION:
+        case CCS_ERROR_ID: case CCS_SW_RESET:
+            return true;
+        case CCS_MEAS_MODE: case CCS_ALG_RESULT_DATA: case CCS_RAW_DATA: case CCS_ENV_DATA: case CCS_THRESHOLDS:
+        case CCS_BASELINE:
+            return app;
+        default:
+            return !app && mailbox >= CCS_APP_ERASE && mailbox <= CCS_APP_START;
+    }
+}
+
+void SimCCS811::reset()
+{
+    *state = {};
+    state->powered = true;
+}
+
+uint8_t SimCCS811::status()
+{
+    return (state->error_id ? 0x01 : 0) | (state->data_ready ? 0x08 : 0) | 0x10 | (state->app ? 0x80 : 0);
+}
+
+// Samples of the drive mode that became due, the newest one is in ALG_RESULT_DATA
+void SimCCS811::update()
+{
+    uint64_t now = host::now();
+    uint32_t period_ms = drivePeriodMs(state->meas_mode);
+    if(!state->app || !period_ms || !state->next_us || now < state->next_us)
+        return;
+    uint64_t period = (uint64_t)period_ms * 1000;
+    uint64_t sample = state->next_us + (now - state->next_us) / period * period;
+    const LabeledRow *row = trace->at(sample);
+    state->eco2 = row->data.co2_ppm;
+    state->tvoc = row->data.tvoc_ppm;
+    state->data_ready = true;
+    state->next_us = sample + period;
+}
+
+bool SimCCS811::address(bool read)
+{
+    if(nwake >= 0 && digitalRead(nwake) == HIGH)
+        return false;
+    if(!state->powered)
+        reset();
+    return true;
+}
+
+bool SimCCS811::write(const uint8_t *data, size_t len)
+{
+    update();
+    uint8_t mailbox = data[0];
+    const uint8_t *payload = data + 1;
+    size_t size = len - 1;
+    state->mailbox = mailbox;
+    if(!validMailbox(mailbox, state->app))
+    {
+        if(size)
+            state->error_id |= CCS_WRITE_REG_INVALID;
+        return true;
+    }
+    const uint8_t sw_reset[4] = {0x11, 0xE5, 0x72, 0x8A};
+    switch(mailbox)
+    {
+        case CCS_SW_RESET:
+            if(size == sizeof(sw_reset) && !memcmp(payload, sw_reset, size))
+                reset();
+            break;
+        case CCS_APP_START:
+            state->app = true;
+            break;
+        case CCS_MEAS_MODE:
+            if(!size)
+                break;
+            if(((payload[0] >> 4) & 0x07) > 4)
+                state->error_id |= CCS_MEASMODE_INVALID;
+            else if(payload[0] != state->meas_mode)
+            {
+                state->meas_mode = payload[0];
+                uint32_t period_ms = drivePeriodMs(payload[0]);
+                state->next_us = period_ms ? host::now() + (uint64_t)period_ms * 1000 : 0;
+            }
+            break;
+        case CCS_ENV_DATA:
+            memcpy(state->env, payload, size < sizeof(state->env) ? size : sizeof(state->env));
+            break;
+        case CCS_BASELINE:
+            memcpy(state->baseline, payload, size < sizeof(state->baseline) ? size : sizeof(state->baseline));
+            break;
+        case CCS_THRESHOLDS: case CCS_APP_ERASE: case CCS_APP_ERASE + 1: case CCS_APP_VERIFY:
+            break;
+        default:
+            if(size)
+                state->error_id |= CCS_WRITE_REG_INVALID; //read only
+    }
+    return true;
+}
+
+// The raw sensor current and voltage aren't in the trace, RAW_DATA reads as zero
+void SimCCS811::read(uint8_t *data, size_t len)
+{
+    update();
+    uint8_t reply[8] = {};
+    uint8_t mailbox = state->mailbox;
+    if(!validMailbox(mailbox, state->app))
+        state->error_id |= CCS_READ_REG_INVALID;
+    else switch(mailbox)
+    {
+        case CCS_STATUS: reply[0] = status(); break;
+        case CCS_MEAS_MODE: reply[0] = state->meas_mode; break;
+        case CCS_ALG_RESULT_DATA:
+            reply[0] = state->eco2 >> 8;
+            reply[1] = state->eco2;
+            reply[2] = state->tvoc >> 8;
+            reply[3] = state->tvoc;
+            reply[4] = status();
+            reply[5] = state->error_id;
+            state->data_ready = false;
+            break;
+        case CCS_BASELINE: memcpy(reply, state->baseline, sizeof(state->baseline)); break;
+        case CCS_HW_ID: reply[0] = SIM_CCS_HW_ID; break;
+        case CCS_HW_VERSION: reply[0] = SIM_CCS_HW_VERSION; break;
+        case CCS_FW_BOOT_VERSION: reply[0] = SIM_CCS_BOOT_VERSION >> 8; reply[1] = SIM_CCS_BOOT_VERSION & 0xff; break;
+        case CCS_FW_APP_VERSION: reply[0] = app_version >> 8; reply[1] = app_version; break;
+        case CCS_ERROR_ID:
+            reply[0] = state->error_id;
+            state->error_id = 0;
+            break;
+    }
+    memcpy(data, reply, len < sizeof(reply) ? len : sizeof(reply));
+    if(len > sizeof(reply))
+        memset(data + sizeof(reply), 0, len - sizeof(reply));
+}
@@ -0,0 +1,129 @@
+#pragma once
+// Register level models of the sensors on the I2C bus of main.cpp, their readings come from a recorded trace
+// (AIDA/labeled.csv). Each model keeps its state in a plain struct that can live in RTC memory, the sensors stay
+// powered while the emulated ESP32 is in deep sleep.
+#include <vector>
+#include "Wire.h"
+#include "labeled_trace.h"
+
+#define SIM_BMP280_CHIP_ID 0x58
+#define SIM_MLX_SETTLE_MS 250     //first object and ambient reading after power on or wake up
+#define SIM_MLX_WAKE_MS 33        //SCL low this long wakes the MLX90614 from sleep
+#define SIM_CCS_HW_ID 0x81
+#define SIM_CCS_HW_VERSION 0x12
+#define SIM_CCS_BOOT_VERSION 0x1000
+#define SIM_CCS_APP_VERSION 0x2000
+
+// Rows of the trace by time since power on, the recording repeats when the run is longer
+class SensorTrace {
+
+    std::vector<LabeledRow> rows;
+    uint64_t span_ms = 0;
+
+    public:
+        bool load(const char *path);
+        const LabeledRow *at(uint64_t us);
+        size_t size() { return rows.size(); }
+        uint64_t spanUs() { return span_ms * 1000; }
+        const LabeledRow &row(size_t i) { return rows[i]; }
+};
+
+typedef struct {
+    bool powered;
+    uint8_t pointer;
+    uint8_t ctrl_meas;
+    uint8_t config;
+    uint8_t data[6];      // press_msb .. temp_xlsb, 0xF7 to 0xFC
+    uint64_t next_us;     // end of the running conversion
+} SimBMP280State;
+
+// BMP280: calibration words, ctrl_meas/config, forced and normal mode conversions on the virtual clock. The raw
+// ADC words are searched so that the compensation formulas of the datasheet give back the trace values. The IIR
+// filter is not modelled. A row without pressure is a sensor that didn't answer when it was recorded.
+class SimBMP280 : public I2CDevice {
+
+    SensorTrace *trace;
+    SimBMP280State own = {};
+    SimBMP280State *state = &own;
+    void update();
+    void convert(uint64_t us);
+    uint32_t measureUs();
+    uint32_t cycleUs();
+    uint8_t reg(uint8_t address);
+
+    public:
+        SimBMP280(SensorTrace *trace) : trace(trace) {}
+        void keep(SimBMP280State *rtc) { state = rtc; }
+        bool address(bool read) override;
+        bool write(const uint8_t *data, size_t len) override;
+        void read(uint8_t *data, size_t len) override;
+        static const uint8_t calibration[24];
+        static void encode(float temperature, float pressure, int32_t *adc_T, int32_t *adc_P);
+};
+
+typedef struct {
+    bool powered;
+    bool asleep;
+    bool has_command;     // command byte seen in this transaction
+    uint8_t command;
+    uint64_t ready_us;    // first valid measurement
+    uint64_t sleep_us;
+    uint16_t eeprom[32];
+} SimMLXState;
+
+// MLX90614: SMBus read word with PEC, EEPROM writes only with a valid PEC, sleep command and the SCL wake up
+class SimMLX90614 : public I2CDevice {
+
+    SensorTrace *trace;
+    uint8_t addr;
+    uint8_t scl;
+    SimMLXState own = {};
+    SimMLXState *state = &own;
+    uint16_t word(uint8_t command);
+    void powerOn();
+
+    public:
+        SimMLX90614(SensorTrace *trace, uint8_t addr, uint8_t scl) : trace(trace), addr(addr), scl(scl) {}
+        void keep(SimMLXState *rtc) { state = rtc; }
+        bool address(bool read) override;
+        bool write(const uint8_t *data, size_t len) override;
+        void read(uint8_t *data, size_t len) override;
+        void stop() override { state->has_command = false; }
+        static uint8_t crc8(const uint8_t *data, size_t len);
+};
+
+typedef struct {
+    bool powered;
+    bool app;
+    uint8_t mailbox;
+    uint8_t meas_mode;
+    uint8_t error_id;
+    bool data_ready;
+    uint16_t eco2;
+    uint16_t tvoc;
+    uint8_t env[4];
+    uint8_t baseline[2];
+    uint64_t next_us;     // next sample of the drive mode
+} SimCCSState;
+
+// CCS811: boot and application mode, mailbox reads and writes, drive modes with ALG_RESULT_DATA and DATA_READY.
+// I2C is only served while nWAKE is low.
+class SimCCS811 : public I2CDevice {
+
+    SensorTrace *trace;
+    int nwake;
+    SimCCSState own = {};
+    SimCCSState *state = &own;
+    void update();
+    void reset();
+    uint8_t status();
+
+    public:
+        uint16_t app_version = SIM_CCS_APP_VERSION; // below 0x2000 the driver reads STATUS before the results
+
+        SimCCS811(SensorTrace *trace, int nwake) : trace(trace), nwake(nwake) {}
+        void keep(SimCCSState *rtc) { state = rtc; }
+        bool address(bool read) override;
+        bool write(const uint8_t *data, size_t len) override;
+        void read(uint8_t *data, size_t len) override;
+};
@@ -0,0 +1,79 @@
+#pragma once
+// Station of the emulated network (HostWiFi.cpp): joins after HOST_WIFI_SCAN_MS, or HOST_WIFI_CACHED_MS with a
+// known BSSID and channel, events are fired from the loop thread like the Arduino event task would
+#include "Arduino.h"
+#include "WiFiUdp.h"
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6,
+} wl_status_t;
+
+typedef enum {
+    WIFI_OFF = 0,
+    WIFI_STA = 1,
+} wifi_mode_t;
+
+typedef enum {
+    WIFI_PS_NONE,
+    WIFI_PS_MIN_MODEM,
+    WIFI_PS_MAX_MODEM,
+} wifi_ps_type_t;
+
+typedef enum {
+    ARDUINO_EVENT_WIFI_STA_START,
+    ARDUINO_EVENT_WIFI_STA_CONNECTED,
+    ARDUINO_EVENT_WIFI_STA_GOT_IP,
+    ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+    ARDUINO_EVENT_WIFI_STA_LOST_IP,
+    ARDUINO_EVENT_MAX,
+} arduino_event_id_t;
+
+typedef arduino_event_id_t WiFiEvent_t;
+typedef struct {
+    int reason;
+} WiFiEventInfo_t;
+typedef void (*WiFiEventSysCb)(WiFiEvent_t event, WiFiEventInfo_t info);
+
+class WiFiClass {
+
+    wl_status_t state = WL_IDLE_STATUS;
+    wifi_mode_t wifi_mode = WIFI_OFF;
+    wifi_ps_type_t power_save = WIFI_PS_MIN_MODEM;
+    uint64_t connect_at = 0;        //virtual us when the pending join completes, 0 if none
+    IPAddress ip, gateway, subnet, dns;
+    bool static_ip = false;
+    WiFiEventSysCb handlers[4] = {};
+    WiFiEvent_t handler_events[4];
+    uint8_t handler_count = 0;
+    void fire(WiFiEvent_t event);
+
+    public:
+        wl_status_t begin(const char *ssid, const char *pass, int32_t channel = 0, const uint8_t *bssid = nullptr,
+            bool connect = true);
+        wl_status_t status() { return state; }
+        bool disconnect(bool wifioff = false, bool eraseap = false);
+        bool mode(wifi_mode_t mode);
+        wifi_mode_t getMode() { return wifi_mode; }
+        bool setAutoReconnect(bool reconnect) { return true; }
+        bool setSleep(bool enabled) { return setSleep(enabled ? WIFI_PS_MIN_MODEM : WIFI_PS_NONE); }
+        bool setSleep(wifi_ps_type_t type) { power_save = type; return true; }
+        wifi_ps_type_t getSleep() { return power_save; }
+        bool config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress((uint32_t)0),
+            IPAddress dns2 = IPAddress((uint32_t)0));
+        int onEvent(WiFiEventSysCb handler, WiFiEvent_t event = ARDUINO_EVENT_MAX);
+        uint8_t* BSSID();
+        int32_t channel() { return 6; }
+        int8_t RSSI() { return state == WL_CONNECTED ? -58 : 0; }
+        IPAddress localIP() { return state == WL_CONNECTED ? ip : IPAddress(); }
+        IPAddress gatewayIP() { return gateway; }
+        IPAddress subnetMask() { return subnet; }
+        IPAddress dnsIP(uint8_t index = 0) { return dns; }
+        void poll(); //called by host::pollWiFi()
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,19 @@
+#pragma once
+#include "../shim/HostUDP.h"
+
+// UDP socket of the emulated station. The network answers in real time while the virtual clock runs much faster,
+// so the socket runs in lockstep with the server: after a confirmable CoAP message parsePacket() waits up to
+// HOST_NET_WAIT_MS of real time for a datagram before it lets the firmware see an empty socket.
+class WiFiUDP : public HostUDP {
+
+    uint32_t awaiting = 0;       //confirmable messages sent and not answered yet
+    bool header_pending = false; //next write starts a datagram
+    bool confirmable = false;
+
+    public:
+        uint8_t begin(uint16_t port) override;
+        int beginPacket(IPAddress ip, uint16_t port) override;
+        int endPacket() override;
+        size_t write(const uint8_t *buffer, size_t size) override;
+        int parsePacket() override;
+};
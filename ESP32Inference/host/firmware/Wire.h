@@ -0,0 +1,89 @@
+#pragma once
+// I2C master of the emulated board (HostWire.cpp). Devices are attached by address, a transfer to an address
+// nobody answers ends with a NACK, every byte costs 9 SCL periods of virtual time. Faults can be injected per
+// address and the bus counts what the drivers send, reset the stats around a driver call to get its cost.
+#include "Arduino.h"
+#include <random>
+
+#define I2C_BUFFER_LENGTH 128
+
+// Slave on the bus, write() gets the bytes of a write transfer and returns false to NACK them
+class I2CDevice {
+
+    public:
+        virtual ~I2CDevice() {}
+        virtual bool write(const uint8_t *data, size_t len) = 0;
+        virtual void read(uint8_t *data, size_t len) = 0;
+        virtual bool address(bool read) { return true; } // ACK of the address byte, e.g. a sleeping sensor NACKs
+        virtual void stop() {}                           // STOP, a repeated start keeps the transaction going
+};
+
+// Plain register file with an auto incrementing register pointer, the first byte of a write selects it
+class I2CRegisterDevice : public I2CDevice {
+
+    uint8_t pointer = 0;
+
+    public:
+        uint8_t registers[256] = {};
+
+        bool write(const uint8_t *data, size_t len) override;
+        void read(uint8_t *data, size_t len) override;
+};
+
+typedef struct {
+    uint32_t stretch_us = 0;  // clock stretching per transfer, conversion or EEPROM latency of the slave
+    float nack_rate = 0;      // probability that the address byte is not acknowledged
+    float flip_rate = 0;      // probability of one flipped bit per byte read, SDA glitches
+} I2CFaults;
+
+typedef struct {
+    uint32_t transactions = 0; // START to STOP
+    uint32_t transfers = 0;    // address phases, a repeated start adds one to the transaction
+    uint32_t bytes_written = 0; // address bytes included
+    uint32_t bytes_read = 0;
+    uint32_t nacks = 0;
+    uint32_t flipped = 0;
+    uint64_t bus_us = 0;
+} I2CStats;
+
+class TwoWire {
+
+    I2CDevice *devices[128] = {};
+    I2CFaults faults[128];
+    std::mt19937 rng;
+    I2CStats stats;
+    I2CDevice *active = nullptr; // slave of the transaction that didn't see its STOP yet
+    uint32_t clock_hz;
+    uint8_t tx_address = 0;
+    uint8_t tx[I2C_BUFFER_LENGTH];
+    size_t tx_len = 0;
+    uint8_t rx[I2C_BUFFER_LENGTH];
+    size_t rx_len = 0;
+    size_t rx_pos = 0;
+    bool started = false;
+    void transferTime(uint8_t address, size_t bytes);
+    I2CDevice *select(uint8_t address, bool read);
+    void stop();
+
+    public:
+        TwoWire();
+        void attach(uint8_t address, I2CDevice *device) { devices[address & 0x7f] = device; }
+        void setFaults(uint8_t address, I2CFaults faults) { this->faults[address & 0x7f] = faults; }
+        void seed(uint32_t seed) { rng.seed(seed); }
+        const I2CStats &getStats() { return stats; }
+        void resetStats() { stats = I2CStats(); }
+        bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0);
+        bool end();
+        void setClock(uint32_t frequency) { clock_hz = frequency; }
+        void beginTransmission(uint8_t address);
+        void beginTransmission(int address) { beginTransmission((uint8_t)address); }
+        uint8_t endTransmission(bool send_stop = true);
+        size_t write(uint8_t data);
+        size_t write(const uint8_t *data, size_t len);
+        uint8_t requestFrom(uint8_t address, uint8_t len, bool send_stop = true);
+        uint8_t requestFrom(int address, int len) { return requestFrom((uint8_t)address, (uint8_t)len); }
+        int available() { return rx_len - rx_pos; }
+        int read();
+};
+
+extern TwoWire Wire;
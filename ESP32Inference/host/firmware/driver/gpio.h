@@ -0,0 +1,19 @@
+#pragma once
+#include "esp_err.h"
+#include "esp_sleep.h"
+
+typedef enum {
+    GPIO_INTR_DISABLE,
+    GPIO_INTR_POSEDGE,
+    GPIO_INTR_NEGEDGE,
+    GPIO_INTR_ANYEDGE,
+    GPIO_INTR_LOW_LEVEL,
+    GPIO_INTR_HIGH_LEVEL,
+} gpio_int_type_t;
+
+esp_err_t gpio_hold_en(gpio_num_t gpio);
+esp_err_t gpio_hold_dis(gpio_num_t gpio);
+void gpio_deep_sleep_hold_en(void);
+void gpio_deep_sleep_hold_dis(void);
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio, gpio_int_type_t intr_type);
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio);
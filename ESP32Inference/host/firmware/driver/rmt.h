@@ -0,0 +1,45 @@
+#pragma once
+// RMT receive channel with a simulated DHT11 on it (HostRmt.cpp), every capture returns one DHT frame
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_sleep.h"
+#include "freertos/ringbuf.h"
+
+typedef int rmt_channel_t;
+#define RMT_CHANNEL_0 0
+#define RMT_CHANNEL_1 1
+
+typedef struct {
+    uint32_t duration0 : 15;
+    uint32_t level0 : 1;
+    uint32_t duration1 : 15;
+    uint32_t level1 : 1;
+} rmt_item32_s;
+
+typedef rmt_item32_s rmt_item32_t;
+
+typedef struct {
+    uint16_t idle_threshold;
+    uint8_t filter_ticks_thresh;
+    bool filter_en;
+} rmt_rx_config_t;
+
+typedef struct {
+    int rmt_mode;
+    rmt_channel_t channel;
+    gpio_num_t gpio_num;
+    uint8_t clk_div;
+    uint8_t mem_block_num;
+    rmt_rx_config_t rx_config;
+} rmt_config_t;
+
+#define RMT_DEFAULT_CONFIG_RX(gpio, channel_id) { 1, channel_id, gpio, 80, 1, {12000, 100, true} }
+
+esp_err_t rmt_config(const rmt_config_t *config);
+esp_err_t rmt_driver_install(rmt_channel_t channel, size_t rx_buf_size, int intr_alloc_flags);
+esp_err_t rmt_driver_uninstall(rmt_channel_t channel);
+esp_err_t rmt_get_ringbuf_handle(rmt_channel_t channel, RingbufHandle_t *buf_handle);
+esp_err_t rmt_rx_memory_reset(rmt_channel_t channel);
+esp_err_t rmt_rx_start(rmt_channel_t channel, bool rx_idx_rst);
+esp_err_t rmt_rx_stop(rmt_channel_t channel);
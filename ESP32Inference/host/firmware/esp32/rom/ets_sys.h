@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+
+void ets_delay_us(uint32_t us);
+uint32_t ets_get_cpu_frequency(); // MHz
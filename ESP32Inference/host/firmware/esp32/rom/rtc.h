@@ -0,0 +1,7 @@
+#pragma once
+#include "soc/rtc_cntl_reg.h"
+
+#define RTC_ENTRY_ADDR_REG RTC_CNTL_STORE7_REG
+#define RTC_SLOW_CLK_CAL_REG RTC_CNTL_STORE1_REG
+
+void set_rtc_memory_crc(void);
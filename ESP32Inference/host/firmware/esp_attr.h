@@ -0,0 +1,9 @@
+#pragma once
+// RTC memory is one linker section, an emulated deep sleep saves it and the reboot restores it (HostEsp.cpp)
+#define RTC_DATA_ATTR __attribute__((section("rtc_data")))
+#define RTC_NOINIT_ATTR __attribute__((section("rtc_data")))
+#define RTC_FAST_ATTR __attribute__((section("rtc_data")))
+#define RTC_IRAM_ATTR
+#define RTC_RODATA_ATTR
+#define IRAM_ATTR
+#define DRAM_ATTR
@@ -0,0 +1,4 @@
+#pragma once
+#include <stdint.h>
+
+uint32_t esp_cpu_get_ccount(); // HOST_CPU_MHZ cycles of real time (HostEsp.cpp)
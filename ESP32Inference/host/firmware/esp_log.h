@@ -0,0 +1,12 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+
+// Same layout as the IDF log, on stderr so --quiet (Serial) keeps the errors
+uint32_t millis();
+#define HOST_LOG(letter, tag, format, ...) fprintf(stderr, letter " (%u) %s: " format "\n", millis(), tag, ##__VA_ARGS__)
+#define ESP_LOGE(tag, format, ...) HOST_LOG("E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG("W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG("I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) do { } while(0)
+#define ESP_LOGV(tag, format, ...) do { } while(0)
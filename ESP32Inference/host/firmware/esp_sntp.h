@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+#include <sys/time.h>
+
+// SNTP client of the emulated network: syncs once the link is up, then every sync interval (HostWiFi.cpp)
+typedef enum {
+    SNTP_SYNC_STATUS_RESET,
+    SNTP_SYNC_STATUS_COMPLETED,
+    SNTP_SYNC_STATUS_IN_PROGRESS,
+} sntp_sync_status_t;
+
+extern "C" {
+void sntp_set_sync_status(sntp_sync_status_t sync_status);
+sntp_sync_status_t sntp_get_sync_status(void);
+void sntp_set_sync_interval(uint32_t interval_ms);
+uint32_t sntp_get_sync_interval(void);
+void sntp_sync_time(struct timeval *tv);
+}
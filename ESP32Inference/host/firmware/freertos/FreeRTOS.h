@@ -0,0 +1,36 @@
+#pragma once
+// FreeRTOS on threads (HostFreeRTOS.cpp): tasks are std::threads, event groups a mutex and a condition
+// variable, one tick is one ms of virtual time, blocking waits are in real time
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t EventBits_t;
+typedef struct HostEventGroup* EventGroupHandle_t;
+typedef void* TaskHandle_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffffUL
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms) / portTICK_PERIOD_MS)
+
+typedef struct {
+    int owner;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+
+BaseType_t xPortGetCoreID();      // 0, the threads aren't pinned
+BaseType_t xPortInIsrContext();   // pdTRUE while a pin ISR runs (HostEsp.cpp)
+
+void host_enter_critical();
+void host_exit_critical();
+#define portENTER_CRITICAL(mux) ((void)(mux), host_enter_critical())
+#define portEXIT_CRITICAL(mux) ((void)(mux), host_exit_critical())
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux), host_enter_critical())
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux), host_exit_critical())
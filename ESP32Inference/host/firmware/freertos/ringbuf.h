@@ -0,0 +1,7 @@
+#pragma once
+#include "FreeRTOS.h"
+
+typedef struct HostRingbuf* RingbufHandle_t;
+
+void *xRingbufferReceive(RingbufHandle_t ring, size_t *size, TickType_t ticks);
+void vRingbufferReturnItem(RingbufHandle_t ring, void *item);
@@ -0,0 +1,164 @@
+// Runs the firmware (src/main.cpp and lib/) as a Linux process: setup() once per boot, then loop() while the
+// virtual clock steps forward. A step starts at --tick-ms and doubles while loop() does no I/O, up to --max-tick-ms,
+// so idle polling costs no real time. Deep sleep reboots the process with the RTC memory kept, flash and NVS are
+// files in the state directory. CoAP goes to COAP_IP (default 127.0.0.1:5683, e.g. CoapServer/server.py 127.0.0.1).
+// The sensors replay AIDA/labeled.csv from power on (SimSensors.h), --i2c-errors injects NACKs and bit flips.
+// Usage: firmware [--hours N | --days N] [--state DIR] [--fresh] [--inference] [--quiet] [--port N]
+//                 [--tick-ms N] [--max-tick-ms N] [--trace CSV] [--i2c-errors RATE]
+#include <chrono>
+#include "HostEsp.h"
+#include "Arduino.h"
+#include "esp_attr.h"
+#include "Wire.h"
+#include "SimSensors.h"
+#include "energy.h"
+#include "pm.h"
+
+// Pins and addresses of main.cpp
+#define SCL_PIN 26
+#define NWAKE_PIN 27
+#define PIR_PIN 33
+#define BMP_ADDR 0x76
+#define MPU_ADDR 0x68
+#define MLX_ADDR 0x5A
+#define CCS_ADDR 0x5B
+
+extern bool inference_mode;
+void setup();
+void loop();
+
+// Sensors answering on the bus of main.cpp, the MPU9250 is only put to sleep so a register file does
+static SensorTrace trace;
+static SimBMP280 bmp280(&trace);
+static SimMLX90614 mlx90614(&trace, MLX_ADDR, SCL_PIN);
+static SimCCS811 ccs811(&trace, NWAKE_PIN);
+static I2CRegisterDevice mpu9250;
+RTC_DATA_ATTR static SimBMP280State bmp280_state;
+RTC_DATA_ATTR static SimMLXState mlx90614_state;
+RTC_DATA_ATTR static SimCCSState ccs811_state;
+
+static void attachSensors(float error_rate)
+{
+    bmp280.keep(&bmp280_state);
+    mlx90614.keep(&mlx90614_state);
+    ccs811.keep(&ccs811_state);
+    Wire.attach(BMP_ADDR, &bmp280);
+    Wire.attach(MPU_ADDR, &mpu9250);
+    Wire.attach(MLX_ADDR, &mlx90614);
+    Wire.attach(CCS_ADDR, &ccs811);
+    I2CFaults faults;
+    faults.nack_rate = faults.flip_rate = error_rate;
+    for(uint8_t address : {BMP_ADDR, MLX_ADDR, CCS_ADDR})
+        Wire.setFaults(address, faults);
+    Wire.seed(host::counters()->boots);
+}
+
+// Estimate of lib/power/energy.h over the whole run, the coefficients are the ESP32 ones, not the host's
+static void energyReport()
+{
+    char energy[ENERGY_REPORT_SIZE];
+    if(ENERGY_ACCOUNTING && Energy::report(energy, sizeof(energy)))
+        fprintf(stderr, "Energy estimate since power on, power management %s:\n%s",
+            PowerLocks::name(PowerLocks::getMode()), energy);
+}
+
+// DHT11 and PIR of the current row, the PIR output is high for the row's pir_uptime
+static void replayPins()
+{
+    static const LabeledRow *current = nullptr;
+    static uint64_t pir_low_us = 0;
+    const LabeledRow *row = trace.at(host::now());
+    if(row != current)
+    {
+        current = row;
+        host::setDHT(row->data.humidity_dht, row->data.temperature_dht);
+        if(row->data.pir_uptime > 0)
+        {
+            host::setPin(PIR_PIN, HIGH);
+            pir_low_us = host::now() + (uint64_t)(row->data.pir_uptime * 1e6);
+        }
+    }
+    if(pir_low_us && host::now() >= pir_low_us)
+    {
+        host::setPin(PIR_PIN, LOW);
+        pir_low_us = 0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double hours = 1;
+    const char *state = "firmware_state";
+    bool fresh = false;
+    bool inference = false;
+    uint32_t tick_ms = 1;
+    uint32_t max_tick_ms = 100;
+    const char *trace_path = AIDA_DIR "/labeled.csv";
+    float error_rate = 0;
+    for(int i = 1; i < argc; i++)
+    {
+        bool value = i + 1 < argc;
+        if(!strcmp(argv[i], "--hours") && value)
+            hours = atof(argv[++i]);
+        else if(!strcmp(argv[i], "--days") && value)
+            hours = atof(argv[++i]) * 24;
+        else if(!strcmp(argv[i], "--state") && value)
+            state = argv[++i];
+        else if(!strcmp(argv[i], "--fresh"))
+            fresh = true;
+        else if(!strcmp(argv[i], "--inference"))
+            inference = true;
+        else if(!strcmp(argv[i], "--quiet"))
+            Serial.muted = true;
+        else if(!strcmp(argv[i], "--port") && value)
+            host::setLocalPort(atoi(argv[++i]));
+        else if(!strcmp(argv[i], "--tick-ms") && value)
+            tick_ms = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--max-tick-ms") && value)
+            max_tick_ms = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--trace") && value)
+            trace_path = argv[++i];
+        else if(!strcmp(argv[i], "--i2c-errors") && value)
+            error_rate = atof(argv[++i]);
+        else
+        {
+            fprintf(stderr, "Usage: %s [--hours N | --days N] [--state DIR] [--fresh] [--inference] [--quiet] "
+                "[--port N] [--tick-ms N] [--max-tick-ms N] [--trace CSV] [--i2c-errors RATE]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(tick_ms < 1)
+        tick_ms = 1;
+    if(max_tick_ms < tick_ms)
+        max_tick_ms = tick_ms;
+
+    if(!trace.load(trace_path))
+    {
+        fprintf(stderr, "Can't read %s\n", trace_path);
+        return 1;
+    }
+    if(!host::boot(argv, state, fresh, (uint64_t)(hours * 3600e6)))
+        inference_mode = inference; //power on, a wake keeps the mode of RTC memory
+    host::onShutdown(&energyReport);
+    attachSensors(error_rate);
+    replayPins();
+    setup();
+
+    HostCounters *counters = host::counters();
+    uint32_t tick = tick_ms;
+    while(!host::finished())
+    {
+        auto start = std::chrono::steady_clock::now();
+        counters->loops++; //counted before, a deep sleep doesn't return
+        replayPins();
+        loop();
+        counters->real_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        tick = host::takeActivity() ? tick_ms : (tick * 2 < max_tick_ms ? tick * 2 : max_tick_ms);
+        if(PowerLocks::getMode() != PM_FIXED)
+            PowerLocks::idle(tick); //loop() ends blocked, the step is part of that wait (automatic light sleep)
+        else
+            host::advance((uint64_t)tick * 1000);
+    }
+    host::shutdown("run finished");
+}
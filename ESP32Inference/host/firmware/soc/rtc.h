@@ -0,0 +1,6 @@
+#pragma once
+#include <stdint.h>
+
+#define RTC_CLK_CAL_FRACT 19
+
+uint64_t rtc_time_get(void); // RTC slow clock ticks of the virtual clock, HOST_RTC_HZ
@@ -0,0 +1,50 @@
+#pragma once
+// RTC controller registers of the wake stub, a register file on the host (HostEsp.cpp). The RTC timer registers
+// read the virtual clock, the rest keep what was written.
+#include <stdint.h>
+
+uint32_t host_reg_read(uint32_t reg);
+void host_reg_write(uint32_t reg, uint32_t value);
+
+#define BIT(n) (1UL << (n))
+#define REG_WRITE(reg, value) host_reg_write((uint32_t)(reg), (uint32_t)(value))
+#define REG_READ(reg) host_reg_read((uint32_t)(reg))
+#define WRITE_PERI_REG(reg, value) REG_WRITE(reg, value)
+#define READ_PERI_REG(reg) REG_READ(reg)
+#define SET_PERI_REG_MASK(reg, mask) REG_WRITE(reg, REG_READ(reg) | (mask))
+#define CLEAR_PERI_REG_MASK(reg, mask) REG_WRITE(reg, REG_READ(reg) & ~(mask))
+#define GET_PERI_REG_MASK(reg, mask) (REG_READ(reg) & (mask))
+#define REG_SET_BIT(reg, bit) SET_PERI_REG_MASK(reg, bit)
+#define REG_GET_FIELD(reg, field) ((REG_READ(reg) >> field##_S) & field##_V)
+#define REG_SET_FIELD(reg, field, value) \
+    REG_WRITE(reg, (REG_READ(reg) & ~(field##_V << field##_S)) | (((value) & field##_V) << field##_S))
+
+#define RTC_CNTL_SLP_TIMER0_REG 0x3ff48004
+#define RTC_CNTL_SLP_TIMER1_REG 0x3ff48008
+#define RTC_CNTL_TIME_UPDATE_REG 0x3ff4800c
+#define RTC_CNTL_TIME_UPDATE BIT(31)
+#define RTC_CNTL_TIME_VALID BIT(30)
+#define RTC_CNTL_TIME0_REG 0x3ff48010
+#define RTC_CNTL_TIME1_REG 0x3ff48014
+#define RTC_CNTL_STATE0_REG 0x3ff48018
+#define RTC_CNTL_SLEEP_EN BIT(31)
+#define RTC_CNTL_WAKEUP_STATE_REG 0x3ff48034
+#define RTC_CNTL_WAKEUP_ENA_V 0x7ff
+#define RTC_CNTL_WAKEUP_ENA_S 20
+#define RTC_CNTL_WAKEUP_CAUSE_V 0x7ff
+#define RTC_CNTL_WAKEUP_CAUSE_S 0
+#define RTC_CNTL_INT_CLR_REG 0x3ff48048
+#define RTC_CNTL_TIME_VALID_INT_CLR BIT(10)
+#define RTC_CNTL_STORE1_REG 0x3ff48050
+#define RTC_CNTL_EXT_WAKEUP_CONF_REG 0x3ff48060
+#define RTC_CNTL_EXT_WAKEUP1_LV_V 1
+#define RTC_CNTL_EXT_WAKEUP1_LV_S 31
+#define RTC_CNTL_STORE7_REG 0x3ff480b4
+#define RTC_CNTL_EXT_WAKEUP1_REG 0x3ff480cc
+#define RTC_CNTL_EXT_WAKEUP1_SEL_V 0x3ffff
+#define RTC_CNTL_EXT_WAKEUP1_SEL_S 0
+#define RTC_CNTL_EXT_WAKEUP1_STATUS_CLR BIT(18)
+
+#define RTC_EXT0_TRIG_EN BIT(0)
+#define RTC_EXT1_TRIG_EN BIT(1)
+#define RTC_TIMER_TRIG_EN BIT(3)
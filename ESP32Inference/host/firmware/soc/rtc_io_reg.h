@@ -0,0 +1,19 @@
+#pragma once
+#include "soc/rtc_cntl_reg.h"
+
+#define RTC_GPIO_OUT_W1TS_REG 0x3ff48404
+#define RTC_GPIO_OUT_W1TC_REG 0x3ff48408
+#define RTC_GPIO_ENABLE_W1TS_REG 0x3ff48410
+#define RTC_GPIO_ENABLE_W1TC_REG 0x3ff48414
+#define RTC_GPIO_IN_REG 0x3ff48424
+#define RTC_GPIO_OUT_DATA_W1TS_S 14
+#define RTC_GPIO_IN_NEXT_S 14
+#define RTC_IO_PAD_DAC1_REG 0x3ff48484
+#define RTC_IO_PAD_DAC2_REG 0x3ff48488
+#define RTC_IO_XTAL_32K_PAD_REG 0x3ff4848c
+#define RTC_IO_PDAC1_MUX_SEL BIT(17)
+#define RTC_IO_PDAC1_FUN_IE BIT(13)
+#define RTC_IO_PDAC2_MUX_SEL BIT(17)
+#define RTC_IO_PDAC2_FUN_IE BIT(13)
+#define RTC_IO_X32N_MUX_SEL BIT(17)
+#define RTC_IO_X32N_FUN_IE BIT(13)
@@ -0,0 +1,9 @@
+#pragma once
+// System time of the emulated chip: counts from power on and keeps counting through deep sleep
+#include_next <sys/time.h>
+
+#ifdef __cplusplus
+extern "C"
+#endif
+int host_gettimeofday(struct timeval *tv, void *tz);
+#define gettimeofday host_gettimeofday
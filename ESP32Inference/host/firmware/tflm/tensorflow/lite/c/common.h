@@ -0,0 +1,37 @@
+#pragma once
+// Tensor types of the TFLM stand-in the firmware host build uses without a tflite-micro checkout (TFLM_DIR)
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    kTfLiteOk = 0,
+    kTfLiteError = 1,
+} TfLiteStatus;
+
+typedef enum {
+    kTfLiteNoType = 0,
+    kTfLiteFloat32 = 1,
+    kTfLiteInt32 = 2,
+    kTfLiteUInt8 = 3,
+    kTfLiteInt8 = 9,
+} TfLiteType;
+
+typedef struct {
+    int size;
+    int data[4];
+} TfLiteIntArray;
+
+typedef union {
+    int32_t *i32;
+    float *f;
+    int8_t *int8;
+    uint8_t *uint8;
+    void *raw;
+} TfLitePtrUnion;
+
+typedef struct {
+    TfLiteType type;
+    TfLitePtrUnion data;
+    TfLiteIntArray *dims;
+    size_t bytes;
+} TfLiteTensor;
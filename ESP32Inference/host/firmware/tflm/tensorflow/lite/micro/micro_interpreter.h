@@ -0,0 +1,28 @@
+#pragma once
+// Stand-in for the TFLM interpreter: the input and output tensors of the occupancy model live in the arena,
+// Invoke() writes zeros to the outputs. Build with TFLM_DIR for the real kernels.
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+#include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
+
+namespace tflite {
+
+    class MicroInterpreter {
+
+        uint8_t *arena;
+        size_t arena_size;
+        size_t used = 0;
+        TfLiteTensor tensors[5];
+        TfLiteIntArray dims[5];
+
+        public:
+            template <unsigned int tOpCount> MicroInterpreter(const Model *model,
+                const MicroMutableOpResolver<tOpCount> &resolver, uint8_t *arena, size_t arena_size)
+                : arena(arena), arena_size(arena_size) {}
+            TfLiteStatus AllocateTensors();
+            size_t arena_used_bytes() const { return used; }
+            TfLiteTensor* input(size_t index) { return index < 3 ? &tensors[index] : nullptr; }
+            TfLiteTensor* output(size_t index) { return index < 2 ? &tensors[3 + index] : nullptr; }
+            TfLiteStatus Invoke();
+    };
+}
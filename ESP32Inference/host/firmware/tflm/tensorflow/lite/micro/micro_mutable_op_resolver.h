@@ -0,0 +1,25 @@
+#pragma once
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/micro/tflite_bridge/micro_error_reporter.h"
+
+namespace tflite {
+
+    // Only records which kernels the firmware registers, the stand-in interpreter has none
+    template <unsigned int tOpCount> class MicroMutableOpResolver {
+
+        unsigned int ops = 0;
+        TfLiteStatus add() { return ops++ < tOpCount ? kTfLiteOk : kTfLiteError; }
+
+        public:
+            TfLiteStatus AddCast() { return add(); }
+            TfLiteStatus AddGather() { return add(); }
+            TfLiteStatus AddConcatenation() { return add(); }
+            TfLiteStatus AddDequantize() { return add(); }
+            TfLiteStatus AddQuantize() { return add(); }
+            TfLiteStatus AddUnidirectionalSequenceLSTM() { return add(); }
+            TfLiteStatus AddStridedSlice() { return add(); }
+            TfLiteStatus AddFullyConnected() { return add(); }
+            TfLiteStatus AddLogistic() { return add(); }
+            TfLiteStatus AddRelu() { return add(); }
+    };
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <stdarg.h>
+#include <stdio.h>
+
+namespace tflite {
+
+    class ErrorReporter {
+
+        public:
+            virtual ~ErrorReporter() {}
+            virtual int Report(const char *format, va_list args) = 0;
+            int Report(const char *format, ...) __attribute__((format(printf, 2, 3)))
+            {
+                va_list args;
+                va_start(args, format);
+                int n = Report(format, args);
+                va_end(args);
+                return n;
+            }
+    };
+
+    class MicroErrorReporter : public ErrorReporter {
+
+        public:
+            int Report(const char *format, va_list args) override
+            {
+                int n = vfprintf(stderr, format, args);
+                fputc('\n', stderr);
+                return n;
+            }
+    };
+}
+
+#define TF_LITE_REPORT_ERROR(reporter, ...) (reporter)->Report(__VA_ARGS__)
@@ -0,0 +1,16 @@
+#pragma once
+#include <stdint.h>
+
+#define TFLITE_SCHEMA_VERSION 3
+
+namespace tflite {
+
+    // .tflite flatbuffer, only the schema version is read
+    class Model {
+
+        public:
+            uint32_t version() const;
+    };
+
+    const Model* GetModel(const void *buffer);
+}
@@ -0,0 +1,298 @@
+// Sample log of lib/flashlog on a file backed NOR flash emulator: writes can only clear bits, erases set a whole
+// sector to 0xFF. Power cuts are injected at random points inside writes and erases (the interrupted operation is
+// left half done), after each cut the log is mounted again and checked: confirmed records stay confirmed, every
+// committed unconfirmed record is replayed intact and in order, no damaged record comes back, ids are not reused
+// and appending works again. Then appends are timed and the flash time on the ESP32 is estimated.
+// Usage: flashlog_sim [trials] [image file]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "flashlog.h"
+
+#define SIM_SECTORS 16            // small partition, so the trials wrap around a lot
+#define SIM_CUTS 5                // power cuts per trial
+#define SIM_ACK_LAG 200           // records the server confirmation trails behind, a few sectors
+#define FLASH_PROGRAM_MS 0.4      // per 256 byte page, ESP32 external flash typical
+#define FLASH_ERASE_MS 45.0       // per 4 KB sector
+#define FLASH_CYCLES 100000       // erase endurance
+#define SAMPLE_INTERVAL_S 10
+
+struct PowerCut {};
+
+class FileFlash : public FlashDevice {
+
+    FILE *file;
+    uint32_t bytes;
+    std::mt19937 *random;
+    long budget = -1;             // bytes programmed (erase counts a sector) until the cut, -1 never
+
+    public:
+        uint64_t read_bytes = 0;
+        uint64_t written = 0;
+        uint32_t erases = 0;
+
+        FileFlash(const char *path, uint32_t size, std::mt19937 *random): bytes(size), random(random)
+        {
+            file = fopen(path, "w+b");
+            std::vector<uint8_t> erased(size, 0xFF);
+            fwrite(erased.data(), 1, size, file);
+        }
+        ~FileFlash() { fclose(file); }
+        void cutAfter(long units) { budget = units; }
+        uint32_t size() override { return bytes; }
+
+        bool read(uint32_t address, void *buffer, size_t len) override
+        {
+            if(address + len > bytes)
+                return false;
+            fseek(file, address, SEEK_SET);
+            read_bytes += len;
+            return fread(buffer, 1, len, file) == len;
+        }
+
+        bool write(uint32_t address, const void *buffer, size_t len) override
+        {
+            if(address + len > bytes)
+                return false;
+            std::vector<uint8_t> cells(len);
+            fseek(file, address, SEEK_SET);
+            if(fread(cells.data(), 1, len, file) != len)
+                return false;
+            size_t programmed = len;
+            bool cut = budget >= 0 && (size_t)budget < len;
+            if(cut)
+                programmed = budget;
+            for(size_t i = 0; i < programmed; i++)
+                cells[i] &= ((const uint8_t *)buffer)[i];
+            if(cut) //the byte being programmed loses some of its bits
+                cells[programmed] &= ((const uint8_t *)buffer)[programmed] | (uint8_t)(*random)();
+            fseek(file, address, SEEK_SET);
+            fwrite(cells.data(), 1, len, file);
+            if(cut)
+            {
+                budget = -1;
+                throw PowerCut();
+            }
+            if(budget >= 0)
+                budget -= len;
+            written += len;
+            return true;
+        }
+
+        bool erase(uint32_t address) override
+        {
+            if(address % LOG_SECTOR_SIZE || address + LOG_SECTOR_SIZE > bytes)
+                return false;
+            std::vector<uint8_t> cells(LOG_SECTOR_SIZE, 0xFF);
+            bool cut = budget >= 0 && budget < LOG_SECTOR_SIZE;
+            if(cut) //partly erased, the rest keeps random leftovers
+            {
+                fseek(file, address, SEEK_SET);
+                if(fread(cells.data(), 1, LOG_SECTOR_SIZE, file) != LOG_SECTOR_SIZE)
+                    return false;
+                size_t done = (*random)() % LOG_SECTOR_SIZE;
+                for(size_t i = 0; i < LOG_SECTOR_SIZE; i++)
+                    cells[i] = i < done ? 0xFF : cells[i] | (uint8_t)(*random)();
+            }
+            fseek(file, address, SEEK_SET);
+            fwrite(cells.data(), 1, LOG_SECTOR_SIZE, file);
+            if(cut)
+            {
+                budget = -1;
+                throw PowerCut();
+            }
+            if(budget >= 0)
+                budget -= LOG_SECTOR_SIZE;
+            erases++;
+            return true;
+        }
+};
+
+// Payload derived from the id and a salt in its first bytes, a data sample or a prediction sized record.
+// The salt makes an append after a reset differ from the torn one at the same place.
+static uint16_t payloadFor(uint32_t id, uint32_t salt, uint8_t *payload)
+{
+    uint16_t len = id % 7 ? 44 : 8;
+    memcpy(payload, &salt, sizeof(salt));
+    for(uint16_t i = sizeof(salt); i < len; i++)
+        payload[i] = (uint8_t)(id * 31 + i + salt);
+    return len;
+}
+
+typedef struct {
+    uint32_t committed_until = 0; // last id append() returned for
+    uint32_t acked_ok = 0;        // last ack() that returned
+    uint32_t ack_attempt = 0;
+} Reference;
+
+typedef struct {
+    uint32_t cuts = 0;
+    uint32_t torn_appends = 0;    // record cut short came back complete
+    uint32_t failures = 0;
+} Result;
+
+static bool fail(Result *result, const char *what, uint32_t a, uint32_t b)
+{
+    if(result->failures++ < 10)
+        printf("  FAIL: %s (%u, %u)\n", what, a, b);
+    return false;
+}
+
+// Appends with trailing confirmations until the flash loses power
+static void workload(FlashLog *log, Reference *ref, long appends, std::mt19937 *random)
+{
+    uint8_t payload[LOG_MAX_PAYLOAD];
+    for(long i = 0; i < appends; i++)
+    {
+        uint32_t id = log->nextId();
+        uint16_t len = payloadFor(id, (*random)(), payload);
+        uint32_t got = 0;
+        if(log->append(id % 7 ? LOG_DATA : LOG_PREDICTION, payload, len, 0, &got))
+            ref->committed_until = got;
+        if(got % 10 == 0 && got > SIM_ACK_LAG)
+        {
+            ref->ack_attempt = got - SIM_ACK_LAG;
+            if(log->ack(got - SIM_ACK_LAG))
+                ref->acked_ok = got - SIM_ACK_LAG;
+        }
+    }
+}
+
+// Everything committed and not confirmed has to come back, in order and intact
+static bool verify(FlashLog *log, Reference *ref, Result *result)
+{
+    uint32_t acked = log->ackedId();
+    if(acked < ref->acked_ok || acked > ref->ack_attempt)
+        return fail(result, "acknowledgement lost or invented", acked, ref->acked_ok);
+    if(log->nextId() <= ref->committed_until)
+        return fail(result, "id reused", log->nextId(), ref->committed_until);
+    LogCursor cursor = log->begin();
+    LogRecordHeader header;
+    uint8_t payload[LOG_MAX_PAYLOAD], expected[LOG_MAX_PAYLOAD];
+    uint32_t want = acked + 1;
+    while(log->next(&cursor, 0, &header, payload, sizeof(payload)))
+    {
+        uint32_t salt;
+        memcpy(&salt, payload, sizeof(salt));
+        uint16_t len = payloadFor(header.id, salt, expected);
+        if(header.length != len || memcmp(payload, expected, len))
+            return fail(result, "damaged record replayed", header.id, len);
+        if(header.id != want)
+        {
+            if(header.id < want || header.id <= ref->committed_until)
+                return fail(result, "record missing or out of order", header.id, want);
+        }
+        if(header.id > ref->committed_until)
+        {
+            if(header.id != ref->committed_until + 1)
+                return fail(result, "record never appended", header.id, ref->committed_until);
+            result->torn_appends++;
+            ref->committed_until = header.id;
+        }
+        want = header.id + 1;
+    }
+    if(want <= ref->committed_until)
+        return fail(result, "committed record missing", want, ref->committed_until);
+    return true;
+}
+
+static void powerCutTrials(int trials, const char *path)
+{
+    std::mt19937 random(7);
+    Result result;
+    uint32_t corrupt = 0;
+    for(int trial = 0; trial < trials; trial++)
+    {
+        FileFlash flash(path, SIM_SECTORS * LOG_SECTOR_SIZE, &random);
+        Reference ref;
+        for(int cut = 0; cut < SIM_CUTS; cut++)
+        {
+            FlashLog log(&flash, 0);
+            if(!log.mount())
+            {
+                fail(&result, "mount failed", trial, cut);
+                break;
+            }
+            corrupt += log.getStats()->corrupt;
+            if(!verify(&log, &ref, &result))
+                break;
+            flash.cutAfter(random() % (3 * SIM_SECTORS * LOG_SECTOR_SIZE));
+            try
+            {
+                workload(&log, &ref, 1000000, &random);
+            }
+            catch(PowerCut&)
+            {
+                result.cuts++;
+            }
+            if(log.getStats()->dropped)
+                fail(&result, "unconfirmed records overwritten", log.getStats()->dropped, 0);
+        }
+    }
+    printf("Power cuts: %d trials, %u cuts, %u damaged records found at mount, %u cut appends survived, %u failures\n",
+        trials, result.cuts, corrupt, result.torn_appends, result.failures);
+}
+
+// Age based retention only skips records with a known time stamp
+static void retentionCheck(const char *path)
+{
+    std::mt19937 random(1);
+    FileFlash flash(path, SIM_SECTORS * LOG_SECTOR_SIZE, &random);
+    FlashLog log(&flash, 3600);
+    log.mount();
+    uint8_t payload[8] = {};
+    log.append(LOG_DATA, payload, sizeof(payload), 1000, nullptr);
+    log.append(LOG_DATA, payload, sizeof(payload), 0, nullptr);
+    log.append(LOG_DATA, payload, sizeof(payload), 4000, nullptr);
+    LogCursor cursor = log.begin();
+    LogRecordHeader header;
+    int replayed = 0;
+    while(log.next(&cursor, 5000, &header, payload, sizeof(payload)))
+        replayed++;
+    printf("Retention: %d of 3 records replayed, %u expired (expected 2 and 1)\n", replayed, log.getStats()->expired);
+}
+
+static void throughput(const char *path)
+{
+    const uint32_t sectors = 352;  // samplelog partition of partitions.csv
+    const long records = 200000;
+    std::mt19937 random(3);
+    FileFlash flash(path, sectors * LOG_SECTOR_SIZE, &random);
+    FlashLog log(&flash, 0);
+    log.mount();
+    Reference ref;
+    auto start = std::chrono::steady_clock::now();
+    workload(&log, &ref, records, &random);
+    double host_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double program_ms = flash.written / 256.0 * FLASH_PROGRAM_MS;
+    double erase_ms = flash.erases * FLASH_ERASE_MS;
+    printf("Throughput: %ld records (%.1f MB, %u erases) in %.2f s on the host, %.0f records/s, %.1f MB/s\n",
+        records, flash.written / 1e6, flash.erases, host_s, records / host_s, flash.written / host_s / 1e6);
+    printf("  ESP32 estimate: %.2f ms flash time per record (%.2f program, %.2f erase), %.1f bytes/record\n",
+        (program_ms + erase_ms) / records, program_ms / records, erase_ms / records, (double)flash.written / records);
+    double erases_per_day = (double)flash.erases / records * 86400 / SAMPLE_INTERVAL_S;
+    printf("  one record per %d s: %.0f erases/day, sector endurance %.0f years, %.1f days of backlog\n",
+        SAMPLE_INTERVAL_S, erases_per_day, FLASH_CYCLES * sectors / erases_per_day / 365,
+        (double)records / flash.erases * (sectors - 1) * SAMPLE_INTERVAL_S / 86400);
+
+    FlashLog again(&flash, 0);
+    flash.read_bytes = 0;
+    start = std::chrono::steady_clock::now();
+    again.mount();
+    double mount_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("  mount: %.1f ms on the host, %.1f KB read\n", mount_ms, flash.read_bytes / 1024.0);
+}
+
+int main(int argc, char **argv)
+{
+    int trials = argc > 1 ? atoi(argv[1]) : 500;
+    const char *path = argc > 2 ? argv[2] : "flashlog_sim.bin";
+    powerCutTrials(trials, path);
+    retentionCheck(path);
+    throughput(path);
+    remove(path);
+    return 0;
+}
@@ -0,0 +1,192 @@
+// Runs the BMP280, MLX90614 and CCS811 drivers of the firmware against the register level sensor models of
+// firmware/SimSensors.cpp on the emulated bus. Prints the bus transactions, bytes and time of every driver call,
+// the round trip error between AIDA/labeled.csv and what the drivers read back, then how many samples fail or come
+// back silently corrupted with NACKs and bit flips injected. The MLX90614 is also read the way the wake stub does,
+// with the PEC byte checked.
+// Usage: i2c_driver_bench [csv]
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <functional>
+#include "HostEsp.h"
+#include "Wire.h"
+#include "SimSensors.h"
+#include "BMP280.h"
+#include "MLX90614.h"
+#include "CCS811.h"
+
+#define SDA_PIN 25
+#define SCL_PIN 26
+#define NWAKE_PIN 27
+#define BMP_ADDR 0x76
+#define MPU_ADDR 0x68
+#define MLX_ADDR 0x5A
+#define CCS_ADDR 0x5B
+#define SAMPLE_AFTER_ROW_MS 1500 //a CCS811 1 s sample and a BMP280 normal mode conversion of the row exist by then
+#define BMP_T_TOLERANCE 0.006    //0.01 degC resolution of the compensation
+#define BMP_P_TOLERANCE 0.1      //one pressure ADC step is ~0.16 Pa
+#define MLX_TOLERANCE 0.011      //0.02 K per LSB
+
+static SensorTrace trace;
+static SimBMP280 sim_bmp(&trace);
+static SimMLX90614 sim_mlx(&trace, MLX_ADDR, SCL_PIN);
+static SimCCS811 sim_ccs(&trace, NWAKE_PIN);
+static I2CRegisterDevice sim_mpu;
+static BMP280 bmp;
+static MLX90614 mlx;
+static CCS811 ccs(NWAKE_PIN, CCS_ADDR);
+
+static void measure(const char *name, std::function<void()> call)
+{
+    Wire.resetStats();
+    uint64_t start = host::now();
+    call();
+    const I2CStats &stats = Wire.getStats();
+    printf("%-28s %6u %6u %8u %8u %8llu %10llu\n", name, stats.transactions, stats.transfers, stats.bytes_written,
+        stats.bytes_read, (unsigned long long)stats.bus_us, (unsigned long long)(host::now() - start));
+}
+
+// Read word as the wake stub does it, object temperature with the PEC over both address bytes checked
+static bool readMLXChecked(float *celsius)
+{
+    Wire.beginTransmission(MLX_ADDR);
+    Wire.write(MLX90614_TOBJ1);
+    if(Wire.endTransmission(false) || Wire.requestFrom((uint8_t)MLX_ADDR, (uint8_t)3) != 3)
+        return false;
+    uint8_t frame[5] = {MLX_ADDR << 1, MLX90614_TOBJ1, (MLX_ADDR << 1) | 1};
+    frame[3] = Wire.read();
+    frame[4] = Wire.read();
+    if(Wire.read() != SimMLX90614::crc8(frame, 5))
+        return false;
+    *celsius = MLX90614::rawToC(frame[3] | (frame[4] << 8));
+    return !isnan(*celsius);
+}
+
+typedef struct {
+    uint32_t reads;
+    uint32_t failed;     // the driver reported it
+    uint32_t corrupted;  // reported fine, value differs from the trace
+} Outcome;
+
+static void count(Outcome *outcome, bool ok, bool correct)
+{
+    outcome->reads++;
+    if(!ok)
+        outcome->failed++;
+    else if(!correct)
+        outcome->corrupted++;
+}
+
+// Advances to SAMPLE_AFTER_ROW_MS into every row of one pass over the trace that lasts long enough
+template <typename F> static void eachRow(F sample)
+{
+    uint64_t pass = (host::now() / trace.spanUs() + 1) * trace.spanUs();
+    for(size_t i = 0; i + 1 < trace.size(); i++)
+    {
+        const LabeledRow &row = trace.row(i);
+        if(trace.row(i + 1).ms - row.ms < SAMPLE_AFTER_ROW_MS + 500)
+            continue;
+        uint64_t at = pass + (uint64_t)(row.ms + SAMPLE_AFTER_ROW_MS) * 1000;
+        if(at > host::now())
+            host::advance(at - host::now());
+        sample(row);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : AIDA_DIR "/labeled.csv";
+    if(!trace.load(path))
+    {
+        printf("Can't read %s\n", path);
+        return 1;
+    }
+    Serial.muted = true;
+    Wire.attach(BMP_ADDR, &sim_bmp);
+    Wire.attach(MPU_ADDR, &sim_mpu);
+    Wire.attach(MLX_ADDR, &sim_mlx);
+    Wire.attach(CCS_ADDR, &sim_ccs);
+    Wire.begin(SDA_PIN, SCL_PIN);
+    printf("%zu rows over %.1f h from %s, I2C at %d Hz\n\n", trace.size(), trace.spanUs() / 3600e6, path, HOST_I2C_HZ);
+
+    printf("%-28s %6s %6s %8s %8s %8s %10s\n", "driver call", "trans", "xfers", "written", "read", "bus us", "call us");
+    measure("CCS811 begin", [] { ccs.begin(); });
+    measure("CCS811 start 1 s", [] { ccs.start(CCS811_MODE_1SEC); });
+    measure("BMP280 begin", [] { bmp.begin(BMP_ADDR, &Wire, ConfigPresets::ElevatorFloor_ChangeDetection.config,
+        ConfigPresets::ElevatorFloor_ChangeDetection.ctrl_meas); });
+    measure("BMP280 MPUToSleep", [] { bmp.MPUToSleep(MPU_ADDR); });
+    measure("MLX90614 begin", [] { mlx.begin(MLX_ADDR, &Wire); });
+    host::advance(1000000);
+    measure("BMP280 read", [] { bmp.read(false); });
+    measure("BMP280 read forced", [] { bmp.read(true); });
+    measure("BMP280 SetOperationMode", [] { bmp.SetOperationMode(NORM); });
+    measure("MLX90614 readObjectTempC", [] { mlx.readObjectTempC(); });
+    measure("MLX90614 readAmbientTempC", [] { mlx.readAmbientTempC(); });
+    measure("MLX90614 read with PEC", [] { float celsius; readMLXChecked(&celsius); });
+    measure("CCS811 read", [] { ccs.read(nullptr, nullptr, nullptr, nullptr); });
+    measure("MLX90614 sleep", [] { mlx.sleep(); });
+    measure("MLX90614 awake", [] { mlx.awake(SDA_PIN, SCL_PIN); });
+    measure("CCS811 resume", [] { ccs.resume(); });
+
+    // Round trip, every value the drivers read against the row it was encoded from
+    host::advance(SIM_MLX_SETTLE_MS * 1000);
+    double error[6] = {};
+    uint32_t samples = 0, absent = 0, ccs_mismatch = 0;
+    Wire.resetStats();
+    eachRow([&](const LabeledRow &row) {
+        uint16_t co2, tvoc, errstat;
+        bool bmp_ok = bmp.read(false);
+        double values[4] = {bmp.getTemperature(), bmp.getPressure(), mlx.readObjectTempC(), mlx.readAmbientTempC()};
+        double expected[4] = {row.data.bmp280_temperature, row.data.bmp280_pressure, row.data.mlx_object_temperature,
+            row.data.mlx_ambient_temperature};
+        ccs.read(&co2, &tvoc, &errstat, nullptr);
+        samples++;
+        if(!bmp_ok)
+            absent++;
+        for(int i = bmp_ok ? 0 : 2; i < 4; i++)
+            error[i] = fmax(error[i], fabs(values[i] - expected[i]));
+        if(errstat != CCS811_ERRSTAT_OK || co2 != row.data.co2_ppm || tvoc != row.data.tvoc_ppm)
+            ccs_mismatch++;
+    });
+    const I2CStats &stats = Wire.getStats();
+    printf("\nRound trip over %u samples (BMP280 absent in %u rows of the recording):\n", samples, absent);
+    printf("  max error: BMP280 %.4f degC %.4f Pa, MLX90614 object %.4f degC ambient %.4f degC, "
+        "CCS811 %u samples differ\n", error[0], error[1], error[2], error[3], ccs_mismatch);
+    printf("  per sample: %.1f transactions, %.1f bytes, %.0f us on the bus\n", (double)stats.transactions / samples,
+        (double)(stats.bytes_written + stats.bytes_read) / samples, (double)stats.bus_us / samples);
+    int failures = error[0] > BMP_T_TOLERANCE || error[1] > BMP_P_TOLERANCE || error[2] > MLX_TOLERANCE ||
+        error[3] > MLX_TOLERANCE || ccs_mismatch;
+
+    // Injected faults, the same rate of address NACKs and flipped bits on every sensor
+    printf("\n%-8s %-10s %8s %8s %10s\n", "rate", "sensor", "reads", "failed", "corrupted");
+    for(float rate : {0.001f, 0.01f, 0.05f})
+    {
+        I2CFaults faults;
+        faults.nack_rate = faults.flip_rate = rate;
+        for(uint8_t address : {BMP_ADDR, MLX_ADDR, CCS_ADDR})
+            Wire.setFaults(address, faults);
+        Outcome outcomes[4] = {};
+        eachRow([&](const LabeledRow &row) {
+            if(row.data.bmp280_pressure)
+            {
+                bool ok = bmp.read(false);
+                count(&outcomes[0], ok, fabs(bmp.getTemperature() - row.data.bmp280_temperature) <= BMP_T_TOLERANCE &&
+                    fabs(bmp.getPressure() - row.data.bmp280_pressure) <= BMP_P_TOLERANCE);
+            }
+            double object = mlx.readObjectTempC();
+            count(&outcomes[1], !isnan(object), fabs(object - row.data.mlx_object_temperature) <= MLX_TOLERANCE);
+            float checked;
+            bool ok = readMLXChecked(&checked);
+            count(&outcomes[2], ok, fabs(checked - row.data.mlx_object_temperature) <= MLX_TOLERANCE);
+            uint16_t co2, tvoc, errstat;
+            ccs.read(&co2, &tvoc, &errstat, nullptr);
+            count(&outcomes[3], errstat == CCS811_ERRSTAT_OK, co2 == row.data.co2_ppm && tvoc == row.data.tvoc_ppm);
+        });
+        const char *names[4] = {"BMP280", "MLX90614", "MLX+PEC", "CCS811"};
+        for(int i = 0; i < 4; i++)
+            printf("%-8g %-10s %8u %8u %10u\n", rate, names[i], outcomes[i].reads, outcomes[i].failed,
+                outcomes[i].corrupted);
+    }
+    printf("\nThe drivers only check the transfer lengths, a flipped bit passes unless a checksum covers it\n");
+    return failures ? 1 : 0;
+}
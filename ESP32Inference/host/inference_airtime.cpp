@@ -0,0 +1,137 @@
+// Airtime per inference mode poll: the sample and the prediction as two confirmable posts (/data and
+// /predictions) against one InferenceRecord post to /inference. Datagram sizes come from the prepared requests
+// of lib/coap-simple, the same encoder the firmware sends with. Each exchange is the uplink frame and its 802.11
+// ACK, then the piggybacked CoAP ACK from the server and the device's 802.11 ACK for it, every frame after DIFS
+// and the mean backoff of an idle channel. WPA2 (CCMP) data frames, no aggregation.
+// Usage: inference_airtime
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "coap-simple.h"
+#include "records.h"
+
+#define COAP_TOKEN_LENGTH 4   //lib/coap-reliable
+#define WIFI_OVERHEAD 82      //QoS MAC header 26, CCMP header 8, LLC/SNAP 8, IPv4 20, UDP 8, MIC 8, FCS 4
+#define WIFI_ACK_BYTES 14
+#define TX_MA 190.0           //ESP32 datasheet, 802.11g/n transmit at 16 dBm
+#define RX_MA 100.0
+#define SUPPLY_V 3.3
+#define POLLS_PER_DAY 8640    //10 s poll interval
+
+// Socket that only keeps the length of the last datagram
+class NullUDP : public UDP {
+
+    public:
+        size_t len = 0;
+
+        uint8_t begin(uint16_t port) override { return 1; }
+        void stop() override {}
+        int beginPacket(IPAddress ip, uint16_t port) override { len = 0; return 1; }
+        int endPacket() override { return 1; }
+        size_t write(const uint8_t *buffer, size_t size) override { len += size; return size; }
+        int parsePacket() override { return 0; }
+        int read(uint8_t *buffer, size_t size) override { return 0; }
+        IPAddress remoteIP() override { return IPAddress(); }
+        uint16_t remotePort() override { return 0; }
+};
+
+typedef struct {
+    const char *name;
+    bool dsss;            //802.11b long preamble, else OFDM (ERP or HT mixed)
+    double bits_per_us;
+    double preamble_us;
+    double ack_bits_per_us; //control response rate
+    double slot_us;
+    double sifs_us;
+    double cw_min;
+} Phy;
+
+static const Phy phys[] = {
+    {"802.11b 1 Mbps", true, 1, 192, 1, 20, 10, 31},
+    {"802.11g 6 Mbps", false, 6, 20, 6, 9, 16, 15},      //SIFS includes the 6 us signal extension
+    {"802.11g 24 Mbps", false, 24, 20, 24, 9, 16, 15},
+    {"802.11g 54 Mbps", false, 54, 20, 24, 9, 16, 15},
+    {"802.11n MCS7 65 Mbps", false, 65, 36, 24, 9, 16, 15},
+};
+
+static double frameUs(const Phy *phy, double bits_per_us, double preamble_us, size_t bytes)
+{
+    if(phy->dsss)
+        return preamble_us + bytes * 8 / bits_per_us;
+    double bits_per_symbol = bits_per_us * 4;
+    return preamble_us + 4 * ceil((16 + 8 * bytes + 6) / bits_per_symbol); //SERVICE and tail bits
+}
+
+typedef struct {
+    double channel_us;
+    double tx_us;         //device transmitting
+    double rx_us;         //device receiving frames addressed to it
+} Airtime;
+
+// One data frame with its 802.11 ACK after DIFS and the mean backoff
+static void frame(const Phy *phy, size_t payload, bool uplink, Airtime *airtime)
+{
+    double difs = phy->sifs_us + 2 * phy->slot_us;
+    double data = frameUs(phy, phy->bits_per_us, phy->preamble_us, payload + WIFI_OVERHEAD);
+    double ack = frameUs(phy, phy->ack_bits_per_us, phy->dsss ? 192 : 20, WIFI_ACK_BYTES);
+    airtime->channel_us += difs + phy->cw_min / 2 * phy->slot_us + data + phy->sifs_us + ack;
+    airtime->tx_us += uplink ? data : ack;
+    airtime->rx_us += uplink ? ack : data;
+}
+
+// Confirmable post and the piggybacked empty 2.04 response (header and token)
+static void exchange(const Phy *phy, size_t datagram, Airtime *airtime)
+{
+    frame(phy, datagram, true, airtime);
+    frame(phy, 4 + COAP_TOKEN_LENGTH, false, airtime);
+}
+
+static size_t datagramSize(Coap *coap, NullUDP *udp, const char *resource, size_t payload)
+{
+    static uint8_t zeros[COAP_BUF_MAX_SIZE];
+    uint8_t token[COAP_TOKEN_LENGTH] = {1, 2, 3, 4};
+    CoapTemplate request;
+    if(!coap->prepare(request, IPAddress(192, 168, 1, 178), COAP_DEFAULT_PORT, resource, COAP_CON, COAP_POST,
+        COAP_TOKEN_LENGTH))
+        return 0;
+    coap->send(request, 0x1234, token, zeros, payload);
+    return udp->len;
+}
+
+static double microjoules(const Airtime *airtime)
+{
+    return (airtime->tx_us * TX_MA + airtime->rx_us * RX_MA) * SUPPLY_V / 1000;
+}
+
+int main()
+{
+    NullUDP udp;
+    Coap coap(udp);
+    size_t data = datagramSize(&coap, &udp, "data", sizeof(ReportedData));
+    size_t prediction = datagramSize(&coap, &udp, "predictions", sizeof(Prediction));
+    size_t combined = datagramSize(&coap, &udp, "inference", sizeof(InferenceRecord));
+    if(!data || !prediction || !combined)
+    {
+        printf("Template doesn't fit COAP_TEMPLATE_SIZE\n");
+        return 1;
+    }
+    printf("CoAP datagrams: data %zu + predictions %zu = %zu bytes, inference %zu bytes\n",
+        data, prediction, data + prediction, combined);
+    printf("On air with %d bytes of 802.11/IP overhead each: %zu bytes separate, %zu bytes combined\n\n",
+        WIFI_OVERHEAD, data + prediction + 2 * WIFI_OVERHEAD, combined + WIFI_OVERHEAD);
+
+    printf("%-22s %12s %12s %8s %12s %12s %14s\n", "PHY", "separate us", "combined us", "saved",
+        "separate uJ", "combined uJ", "saved J/day");
+    for(const Phy &phy : phys)
+    {
+        Airtime separate = {}, single = {};
+        exchange(&phy, data, &separate);
+        exchange(&phy, prediction, &separate);
+        exchange(&phy, combined, &single);
+        printf("%-22s %12.0f %12.0f %7.0f%% %12.1f %12.1f %14.2f\n", phy.name, separate.channel_us, single.channel_us,
+            100 * (1 - single.channel_us / separate.channel_us), microjoules(&separate), microjoules(&single),
+            (microjoules(&separate) - microjoules(&single)) * POLLS_PER_DAY / 1e6);
+    }
+    printf("\nRadio energy only counts the frames, the wake up and tail of a transmit window is shared by both\n");
+    return 0;
+}
@@ -0,0 +1,280 @@
+// Streams AIDA/labeled.csv through lib/Inference in the order of run_model in main.cpp: the first 20 rows warm up
+// the window with labels 0, then every row is one window, SetSequences, ComputeSensorDeltas, ScaleData,
+// SetInputBuffers, Predict and ShiftSequences (which feeds the prediction back as the newest label) before the row
+// takes the freed slot. Prints MAE of the human count, accuracy of the ventilation tag against the row that ends
+// the window, windows/s and the time per stage (best of --repeat runs), then compares with the golden file:
+// the CRC of the input tensors and the raw outputs of every window, and the throughput within --speed-tolerance.
+// The throughput is recorded as windows per run of a fixed calibration loop timed in the same process, so the
+// golden file holds on other machines. A difference fails the run, --update writes the golden file instead.
+// Without TFLM_DIR the interpreter is the stand-in of firmware/tflm, it predicts zeros, so MAE and accuracy mean
+// nothing and its golden file only guards the pipeline around the model.
+// Usage: inference_replay [--csv FILE] [--golden FILE] [--update] [--repeat N] [--speed-tolerance F]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include "esp_rom_crc.h"
+#include "infer.h"
+#include "labeled_trace.h"
+
+#define OUTPUT_TOLERANCE 1e-5
+#define STAGES 6
+#define CALIBRATION_ROUNDS 2000 //passes over one window of floats, about as long as a few hundred windows
+
+static const char *stage_names[STAGES] = {"SetSequences", "ComputeSensorDeltas", "ScaleData", "SetInputBuffers",
+    "Predict", "ShiftSequences"};
+
+typedef struct {
+    uint32_t row_id;      // 1 based row of the csv that ends the window
+    uint32_t input_crc;   // all three input tensors after SetInputBuffers
+    float human_count;    // raw outputs of the model
+    float ventilation;
+} Window;
+
+typedef struct {
+    std::vector<Window> windows;
+    double stage_ns[STAGES];     // total over all windows
+    double stage_max_ns[STAGES];
+    double windows_per_s;
+    double calibrations_per_s;   // same process, next to the replay
+    double count_error;
+    uint32_t ventilation_hits;
+} Replay;
+
+static Inference model;
+static Data window_data[BATCH_SIZE][SEQUENCE_LENGTH];
+static SensorDataBatch data_pointer_array;
+
+static uint32_t tensorCrc(uint32_t crc, const TfLiteTensor *tensor)
+{
+    return esp_rom_crc32_le(crc, (const uint8_t *)tensor->data.raw, tensor->bytes);
+}
+
+// Scale and difference passes like the preprocessing stages, a machine independent unit for the throughput
+volatile float calibration_sink; //keeps the loop from being optimized away
+
+static double calibrate()
+{
+    typedef std::chrono::steady_clock Clock;
+    float values[SEQUENCE_LENGTH * SENSORS];
+    for(int i = 0; i < SEQUENCE_LENGTH * SENSORS; i++)
+        values[i] = i;
+    Clock::time_point start = Clock::now();
+    for(int round = 0; round < CALIBRATION_ROUNDS; round++)
+    {
+        for(int i = SEQUENCE_LENGTH * SENSORS - 1; i >= SENSORS; i--)
+            values[i] = (values[i] - values[i - SENSORS]) * 0.5f + 1.0f;
+        calibration_sink = values[SEQUENCE_LENGTH * SENSORS - 1];
+    }
+    return 1e9 / std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+static void replay(const std::vector<LabeledRow> &rows, Replay *result)
+{
+    *result = {};
+    for(int k = 0; k < SEQUENCE_LENGTH; k++)
+        data_pointer_array[0][k] = &window_data[0][k];
+    model.SetRecentPrediction(Prediction());
+    typedef std::chrono::steady_clock Clock;
+    double total_ns = 0;
+    for(size_t i = 0; i < rows.size(); i++)
+    {
+        if(i < SEQUENCE_LENGTH)
+        {
+            *data_pointer_array[0][i] = rows[i].data;
+            if(i == SEQUENCE_LENGTH - 1)
+                model.SetDefaultLabels(0, 0);
+            continue;
+        }
+        *data_pointer_array[0][SEQUENCE_LENGTH - 1] = rows[i].data;
+        Clock::time_point marks[STAGES + 1];
+        marks[0] = Clock::now();
+        model.SetSequences(data_pointer_array);
+        marks[1] = Clock::now();
+        model.ComputeSensorDeltas();
+        marks[2] = Clock::now();
+        model.ScaleData();
+        marks[3] = Clock::now();
+        model.SetInputBuffers();
+        marks[4] = Clock::now();
+        bool ok = model.Predict();
+        marks[5] = Clock::now();
+        Window window = {(uint32_t)i + 1, 0, model.GetOutputTensor(1)->data.f[0],
+            model.GetOutputTensor(0)->data.f[0]};
+        for(int t = 0; t < 3; t++) //outside the timed stages
+            window.input_crc = tensorCrc(window.input_crc, model.GetInputTensor(t));
+        Clock::time_point shift_start = Clock::now();
+        model.ShiftSequences(data_pointer_array);
+        Clock::time_point shift_end = Clock::now();
+        if(!ok)
+        {
+            printf("Predict failed at row %u\n", window.row_id);
+            exit(1);
+        }
+        for(int s = 0; s < STAGES; s++)
+        {
+            double ns = s < STAGES - 1 ? std::chrono::duration<double, std::nano>(marks[s + 1] - marks[s]).count()
+                : std::chrono::duration<double, std::nano>(shift_end - shift_start).count();
+            result->stage_ns[s] += ns;
+            result->stage_max_ns[s] = fmax(result->stage_max_ns[s], ns);
+            total_ns += ns;
+        }
+        Prediction prediction = model.GetRecentPrediction();
+        result->count_error += fabsf(prediction.human_count - rows[i].human_count);
+        result->ventilation_hits += prediction.ventilation_tag == rows[i].ventilation_on;
+        result->windows.push_back(window);
+    }
+    result->windows_per_s = result->windows.size() / (total_ns / 1e9);
+}
+
+static bool writeGolden(const char *path, const Replay &result)
+{
+    FILE *file = fopen(path, "w");
+    if(!file)
+        return false;
+    fprintf(file, "# inference_replay golden file: backend, model CRC32, windows per calibration loop, then one line per"
+        " window\n");
+    fprintf(file, "# row_id input_crc human_count ventilation\n");
+    fprintf(file, "backend %s\n", INFERENCE_BACKEND);
+    fprintf(file, "model 0x%08x\n", model.GetModelVersion());
+    fprintf(file, "windows_per_calibration %.3f\n", result.windows_per_s / result.calibrations_per_s);
+    for(const Window &window : result.windows)
+        fprintf(file, "%u 0x%08x %.6f %.6f\n", window.row_id, window.input_crc, window.human_count,
+            window.ventilation);
+    fclose(file);
+    return true;
+}
+
+// Number of differences to the golden file, -1 if it can't be read
+static int compareGolden(const char *path, const Replay &result, float speed_tolerance)
+{
+    FILE *file = fopen(path, "r");
+    if(!file)
+        return -1;
+    char line[256], backend[32] = "";
+    uint32_t model_version = 0;
+    double windows_per_calibration = 0;
+    std::vector<Window> golden;
+    while(fgets(line, sizeof(line), file))
+    {
+        Window window;
+        if(line[0] == '#')
+            continue;
+        if(sscanf(line, "backend %31s", backend) == 1 || sscanf(line, "model %x", &model_version) == 1 ||
+            sscanf(line, "windows_per_calibration %lf", &windows_per_calibration) == 1)
+            continue;
+        if(sscanf(line, "%u %x %f %f", &window.row_id, &window.input_crc, &window.human_count,
+            &window.ventilation) == 4)
+            golden.push_back(window);
+    }
+    fclose(file);
+
+    int differences = 0;
+    if(strcmp(backend, INFERENCE_BACKEND) || model_version != model.GetModelVersion())
+    {
+        printf("golden file is for %s, model 0x%08x, this build is %s, model 0x%08x\n", backend, model_version,
+            INFERENCE_BACKEND, model.GetModelVersion());
+        return 1;
+    }
+    if(golden.size() != result.windows.size())
+    {
+        printf("%zu windows, golden file has %zu\n", result.windows.size(), golden.size());
+        differences++;
+    }
+    for(size_t i = 0; i < golden.size() && i < result.windows.size(); i++)
+    {
+        const Window &a = result.windows[i], &b = golden[i];
+        bool same = a.row_id == b.row_id && a.input_crc == b.input_crc &&
+            fabsf(a.human_count - b.human_count) <= OUTPUT_TOLERANCE &&
+            fabsf(a.ventilation - b.ventilation) <= OUTPUT_TOLERANCE;
+        if(same)
+            continue;
+        if(differences++ < 5)
+            printf("row %u: input 0x%08x outputs %.6f %.6f, golden 0x%08x %.6f %.6f\n", a.row_id, a.input_crc,
+                a.human_count, a.ventilation, b.input_crc, b.human_count, b.ventilation);
+    }
+    double speed = result.windows_per_s / result.calibrations_per_s;
+    if(speed < windows_per_calibration * (1 - speed_tolerance))
+    {
+        printf("%.3f windows per calibration loop, golden %.3f, more than %.0f%% slower\n", speed,
+            windows_per_calibration, speed_tolerance * 100);
+        differences++;
+    }
+    return differences;
+}
+
+int main(int argc, char **argv)
+{
+    const char *csv = AIDA_DIR "/labeled.csv";
+    const char *golden = INFERENCE_GOLDEN;
+    bool update = false;
+    int repeat = 5;
+    float speed_tolerance = 0.5; //shared machines, only a slowdown of this size is a regression
+    for(int i = 1; i < argc; i++)
+    {
+        bool value = i + 1 < argc;
+        if(!strcmp(argv[i], "--csv") && value)
+            csv = argv[++i];
+        else if(!strcmp(argv[i], "--golden") && value)
+            golden = argv[++i];
+        else if(!strcmp(argv[i], "--update"))
+            update = true;
+        else if(!strcmp(argv[i], "--repeat") && value)
+            repeat = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--speed-tolerance") && value)
+            speed_tolerance = atof(argv[++i]);
+        else
+        {
+            printf("Usage: %s [--csv FILE] [--golden FILE] [--update] [--repeat N] [--speed-tolerance F]\n", argv[0]);
+            return 1;
+        }
+    }
+    std::vector<LabeledRow> rows;
+    if(!loadLabeled(csv, &rows) || rows.size() <= SEQUENCE_LENGTH)
+    {
+        printf("Can't read %s\n", csv);
+        return 1;
+    }
+    Serial.muted = true; //SetSequences and Predict print every window
+
+    Replay best = {}, run = {};
+    double calibrations_per_s = 0;
+    for(int r = 0; r < (repeat > 0 ? repeat : 1); r++)
+    {
+        calibrations_per_s = fmax(calibrations_per_s, calibrate());
+        replay(rows, &run);
+        if(!r || run.windows_per_s > best.windows_per_s)
+            best = run;
+    }
+    best.calibrations_per_s = calibrations_per_s;
+    size_t windows = best.windows.size();
+    printf("%zu rows, %zu windows of %d, %s interpreter, model 0x%08x\n", rows.size(), windows, SEQUENCE_LENGTH,
+        INFERENCE_BACKEND, model.GetModelVersion());
+    printf("human count MAE %.3f, ventilation accuracy %.1f%%\n", best.count_error / windows,
+        100.0 * best.ventilation_hits / windows);
+    printf("%.0f windows/s, %.3f per calibration loop (best of %d)\n\n%-20s %10s %10s\n", best.windows_per_s,
+        best.windows_per_s / calibrations_per_s, repeat, "stage", "mean us", "max us");
+    for(int s = 0; s < STAGES; s++)
+        printf("%-20s %10.3f %10.3f\n", stage_names[s], best.stage_ns[s] / windows / 1000, best.stage_max_ns[s] / 1000);
+
+    if(update)
+    {
+        if(!writeGolden(golden, best))
+        {
+            printf("\nCan't write %s\n", golden);
+            return 1;
+        }
+        printf("\nWrote %s\n", golden);
+        return 0;
+    }
+    int differences = compareGolden(golden, best, speed_tolerance);
+    if(differences < 0)
+    {
+        printf("\nNo golden file %s, run with --update to create it\n", golden);
+        return 0;
+    }
+    printf("\n%s: %d differences to %s\n", differences ? "FAIL" : "PASS", differences, golden);
+    return differences ? 1 : 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+// Loader for AIDA/labeled.csv, the recorded sensor series with the occupancy labels the model was trained on
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+#include "records.h"
+
+typedef struct {
+    uint32_t ms;   // since the first row
+    uint64_t unix_ms;
+    Data data;
+    float human_count;
+    int32_t ventilation_on;
+    int32_t door_closed;
+} LabeledRow;
+
+inline bool loadLabeled(const char *path, std::vector<LabeledRow> *rows)
+{
+    FILE *file = fopen(path, "r");
+    if(!file)
+        return false;
+    char line[512];
+    fgets(line, sizeof(line), file); //header
+    time_t first = 0;
+    while(fgets(line, sizeof(line), file))
+    {
+        int id;
+        float co2, tvoc;
+        char timestamp[32];
+        LabeledRow row;
+        if(sscanf(line, "%d;%f;%f;%f;%f;%f;%f;%f;%f;%f;%31[^;];%f;%d;%d", &id, &co2, &tvoc,
+            &row.data.bmp280_temperature, &row.data.bmp280_pressure, &row.data.mlx_object_temperature,
+            &row.data.mlx_ambient_temperature, &row.data.humidity_dht, &row.data.temperature_dht, &row.data.pir_uptime,
+            timestamp, &row.human_count, &row.ventilation_on, &row.door_closed) != 14)
+            continue;
+        row.data.co2_ppm = co2;
+        row.data.tvoc_ppm = tvoc;
+        struct tm tm = {};
+        if(!strptime(timestamp, "%Y-%m-%d %H:%M:%S", &tm))
+            continue;
+        time_t t = timegm(&tm);
+        if(rows->empty())
+            first = t;
+        row.ms = (uint32_t)(t - first) * 1000;
+        row.unix_ms = (uint64_t)t * 1000;
+        rows->push_back(row);
+    }
+    fclose(file);
+    return !rows->empty();
+}
@@ -0,0 +1,43 @@
+// Host side of the microbenchmark suite (../bench), the same benchmarks as env:bench on the ESP32 with the same
+// CSV on stdout, so the two can be tracked side by side. Without TFLM_DIR Inference_Invoke times the stand-in.
+// Usage: microbench [--filter NAME] [--min-ms MS]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Arduino.h"
+#include "microbench.h"
+
+static void report(const bench::Result &result)
+{
+    char line[160];
+    bench::formatCsv(result, line, sizeof(line));
+    printf("%s\n", line);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    const char *filter = nullptr;
+    uint32_t min_ms = MICROBENCH_MIN_MS;
+    for(int i = 1; i < argc; i++)
+    {
+        bool value = i + 1 < argc;
+        if(!strcmp(argv[i], "--filter") && value)
+            filter = argv[++i];
+        else if(!strcmp(argv[i], "--min-ms") && value)
+            min_ms = atoi(argv[++i]);
+        else
+        {
+            printf("Usage: %s [--filter NAME] [--min-ms MS]\n", argv[0]);
+            return 1;
+        }
+    }
+    Serial.muted = true; //the Inference setup prints its buffers
+    printf("%s\n", MICROBENCH_CSV_HEADER);
+    if(!bench::runAll(filter, min_ms, report))
+    {
+        fprintf(stderr, "No benchmark matches %s\n", filter);
+        return 1;
+    }
+    return 0;
+}
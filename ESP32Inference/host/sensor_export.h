@@ -0,0 +1,46 @@
+#pragma once
+// Loader for AIDA/sensor_data_export.csv, the server database export the host replays run on
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+#include "records.h"
+
+typedef struct {
+    uint32_t ms;   // since the first row
+    uint64_t unix_ms;
+    Data data;
+} ExportRow;
+
+static bool loadSensorExport(const char *path, std::vector<ExportRow> *rows)
+{
+    FILE *file = fopen(path, "r");
+    if(!file)
+        return false;
+    char line[512];
+    fgets(line, sizeof(line), file); //header
+    time_t first = 0;
+    while(fgets(line, sizeof(line), file))
+    {
+        int id;
+        float co2, tvoc;
+        char timestamp[32];
+        ExportRow row;
+        if(sscanf(line, "%d,%f,%f,%f,%f,%f,%f,%f,%f,%f,%31[^\n]", &id, &co2, &tvoc, &row.data.bmp280_temperature,
+            &row.data.bmp280_pressure, &row.data.mlx_object_temperature, &row.data.mlx_ambient_temperature,
+            &row.data.humidity_dht, &row.data.temperature_dht, &row.data.pir_uptime, timestamp) != 11)
+            continue;
+        row.data.co2_ppm = co2;
+        row.data.tvoc_ppm = tvoc;
+        struct tm tm = {};
+        if(!strptime(timestamp, "%Y-%m-%d %H:%M:%S", &tm))
+            continue;
+        time_t t = timegm(&tm);
+        if(rows->empty())
+            first = t;
+        row.ms = (uint32_t)(t - first) * 1000;
+        row.unix_ms = (uint64_t)t * 1000;
+        rows->push_back(row);
+    }
+    fclose(file);
+    return !rows->empty();
+}
@@ -0,0 +1,41 @@
+#include "Arduino.h"
+#include <arpa/inet.h>
+#include <stdarg.h>
+
+HardwareSerial Serial;
+
+int HardwareSerial::printf(const char *format, ...)
+{
+    if(muted)
+        return 0;
+    va_list args;
+    va_start(args, format);
+    int len = vprintf(format, args);
+    va_end(args);
+    return len;
+}
+
+void HardwareSerial::print(double value, int digits)
+{
+    if(!muted)
+        ::printf("%.*f", digits, value);
+}
+
+void HardwareSerial::print(long value, int base)
+{
+    if(muted)
+        return;
+    if(base == 16)
+        ::printf("%lX", value);
+    else
+        ::printf("%ld", value);
+}
+
+bool IPAddress::fromString(const char *address)
+{
+    in_addr addr;
+    if(inet_pton(AF_INET, address, &addr) != 1)
+        return false;
+    memcpy(octets, &addr.s_addr, 4);
+    return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+// Minimal Arduino core for building firmware libraries on the PC (host/), only what they use
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+
+#define DEC 10
+#define HEX 16
+
+class HardwareSerial {
+
+    public:
+        bool muted = false; //drops the output, e.g. for benchmarks
+
+        void begin(unsigned long baud) {}
+        void flush() { fflush(stdout); }
+        int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+        void print(const char *str) { if(!muted) fputs(str, stdout); }
+        void print(double value, int digits = 2);
+        void print(long value, int base);
+        void print(int value, int base = DEC) { print((long)value, base); }
+        void print(unsigned int value, int base = DEC) { print((long)value, base); }
+        void print(long unsigned int value, int base = DEC) { print((long)value, base); }
+        template <typename T> void println(T value) { print(value); print("\n"); }
+        template <typename T> void println(T value, int format) { print(value, format); print("\n"); }
+        void println() { print("\n"); }
+};
+
+extern HardwareSerial Serial;
+
+class String {
+
+    std::string s;
+
+    public:
+        String() {}
+        String(const char *str) : s(str ? str : "") {}
+        String(const std::string &str) : s(str) {}
+        String& operator=(const char *str) { s = str ? str : ""; return *this; }
+        String& operator+=(const char *str) { s += str; return *this; }
+        String& operator+=(const String &str) { s += str.s; return *this; }
+        bool equals(const String &str) const { return s == str.s; }
+        bool operator==(const String &str) const { return s == str.s; }
+        unsigned int length() const { return s.length(); }
+        const char* c_str() const { return s.c_str(); }
+};
+
+class IPAddress {
+
+    uint8_t octets[4] = {0, 0, 0, 0};
+
+    public:
+        IPAddress() {}
+        IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : octets{a, b, c, d} {}
+        IPAddress(uint32_t addr) { memcpy(octets, &addr, 4); } //network order, same as the ESP32 core
+        operator uint32_t() const { uint32_t addr; memcpy(&addr, octets, 4); return addr; }
+        uint8_t operator[](int index) const { return octets[index]; }
+        uint8_t& operator[](int index) { return octets[index]; }
+        bool fromString(const char *address);
+};
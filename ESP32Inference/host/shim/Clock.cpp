@@ -0,0 +1,21 @@
+#include "Arduino.h"
+#include <chrono>
+#include <thread>
+
+// Wall clock time, the firmware build (host/firmware) replaces this file with a virtual clock
+static const auto start = std::chrono::steady_clock::now();
+
+uint32_t millis()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+uint32_t micros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void delay(uint32_t ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
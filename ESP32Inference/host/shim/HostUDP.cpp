@@ -0,0 +1,87 @@
+#include "HostUDP.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+bool HostUDP::open()
+{
+    if(fd >= 0)
+        return true;
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0); //not inherited by an emulated reboot (exec)
+    if(fd < 0)
+        return false;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+uint8_t HostUDP::begin(uint16_t port)
+{
+    if(!open())
+        return 0;
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(port);
+    return bind(fd, (sockaddr*)&local, sizeof(local)) == 0;
+}
+
+void HostUDP::stop()
+{
+    if(fd >= 0)
+        close(fd);
+    fd = -1;
+}
+
+int HostUDP::beginPacket(IPAddress ip, uint16_t port)
+{
+    tx_ip = ip;
+    tx_port = port;
+    tx_len = 0;
+    return open();
+}
+
+size_t HostUDP::write(const uint8_t *buffer, size_t size)
+{
+    if(tx_len + size > sizeof(tx))
+        size = sizeof(tx) - tx_len;
+    memcpy(tx + tx_len, buffer, size);
+    tx_len += size;
+    return size;
+}
+
+int HostUDP::endPacket()
+{
+    sockaddr_in remote = {};
+    remote.sin_family = AF_INET;
+    remote.sin_addr.s_addr = (uint32_t)tx_ip;
+    remote.sin_port = htons(tx_port);
+    return sendto(fd, tx, tx_len, 0, (sockaddr*)&remote, sizeof(remote)) == (ssize_t)tx_len;
+}
+
+// Whole datagram is buffered, the size is reported like the ESP32 core does even if the caller reads less
+int HostUDP::parsePacket()
+{
+    if(!open())
+        return 0;
+    sockaddr_in remote = {};
+    socklen_t remote_len = sizeof(remote);
+    ssize_t len = recvfrom(fd, rx, sizeof(rx), 0, (sockaddr*)&remote, &remote_len);
+    if(len <= 0)
+        return 0;
+    rx_len = len;
+    rx_pos = 0;
+    remote_ip = IPAddress((uint32_t)remote.sin_addr.s_addr);
+    remote_port = ntohs(remote.sin_port);
+    return len;
+}
+
+int HostUDP::read(uint8_t *buffer, size_t len)
+{
+    if(len > rx_len - rx_pos)
+        len = rx_len - rx_pos;
+    memcpy(buffer, rx + rx_pos, len);
+    rx_pos += len;
+    return len;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "Udp.h"
+
+// Non-blocking POSIX socket behind the Arduino UDP interface
+class HostUDP : public UDP {
+
+    uint8_t rx[65536];
+    size_t rx_len = 0;
+    size_t rx_pos = 0;
+    uint8_t tx[65536];
+    size_t tx_len = 0;
+    IPAddress tx_ip;
+    uint16_t tx_port = 0;
+    IPAddress remote_ip;
+    uint16_t remote_port = 0;
+
+    protected:
+        int fd = -1;
+        bool open();
+
+    public:
+        ~HostUDP() { stop(); }
+        uint8_t begin(uint16_t port) override;
+        void stop() override;
+        int beginPacket(IPAddress ip, uint16_t port) override;
+        int endPacket() override;
+        size_t write(const uint8_t *buffer, size_t size) override;
+        int parsePacket() override;
+        int read(uint8_t *buffer, size_t len) override;
+        IPAddress remoteIP() override { return remote_ip; }
+        uint16_t remotePort() override { return remote_port; }
+};
@@ -0,0 +1,72 @@
+// Replays AIDA/sensor_data_export.csv through the report by exception filter of the firmware (lib/uplinkfilter),
+// prints the message rate reduction per maximum silence interval, why samples were sent, and the largest error
+// of the series the server reconstructs by holding the last reported values over the sequence gaps.
+// Usage: uplink_replay [csv]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "uplinkfilter.h"
+#include "sensor_export.h"
+
+static float fieldError(Data *a, Data *b, int field)
+{
+    switch(field)
+    {
+        case 0: return fabsf((float)a->co2_ppm - b->co2_ppm);
+        case 1: return fabsf((float)a->tvoc_ppm - b->tvoc_ppm);
+        case 2: return fabsf(a->bmp280_pressure - b->bmp280_pressure);
+        case 3: return fabsf(a->bmp280_temperature - b->bmp280_temperature);
+        case 4: return fabsf(a->mlx_object_temperature - b->mlx_object_temperature);
+        case 5: return fabsf(a->mlx_ambient_temperature - b->mlx_ambient_temperature);
+        case 6: return fabsf(a->temperature_dht - b->temperature_dht);
+        default: return fabsf(a->humidity_dht - b->humidity_dht);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : AIDA_DIR "/sensor_data_export.csv";
+    std::vector<ExportRow> rows;
+    if(!loadSensorExport(path, &rows))
+    {
+        printf("Can't read %s\n", path);
+        return 1;
+    }
+    Deadbands deadbands;
+    printf("%zu samples over %.1f h from %s\n", rows.size(), rows.back().ms / 3600000.0, path);
+    printf("deadbands: co2 %.0f ppm, tvoc %.0f ppm, pressure %.0f Pa, temperatures %.1f degC, humidity %.0f %%\n",
+        deadbands.co2_ppm, deadbands.tvoc_ppm, deadbands.pressure_pa, deadbands.temperature, deadbands.humidity);
+    printf("max silence   sent   of samples   reduction   first  PIR  deadband  silence   max error co2/tvoc/Pa/T/RH\n");
+
+    uint32_t silences[] = {0, 60000, 300000, 900000}; //0 sends every sample
+    int failures = 0;
+    for(uint32_t silence : silences)
+    {
+        UplinkFilter filter(silence);
+        Data held = {};
+        float max_error[8] = {};
+        for(ExportRow &row : rows)
+        {
+            ReportedData report;
+            if(filter.filter(&row.data, row.ms, &report))
+                held = report.data;
+            for(int f = 0; f < 8; f++)
+            {
+                float error = fieldError(&held, &row.data, f);
+                max_error[f] = error > max_error[f] ? error : max_error[f];
+            }
+        }
+        float temperature_error = fmaxf(fmaxf(max_error[3], max_error[4]), fmaxf(max_error[5], max_error[6]));
+        // held values may be off by less than the deadband only
+        if(max_error[0] >= deadbands.co2_ppm || max_error[1] >= deadbands.tvoc_ppm ||
+            max_error[2] >= deadbands.pressure_pa || temperature_error >= deadbands.temperature ||
+            max_error[7] >= deadbands.humidity)
+            failures++;
+        printf("%9u s   %4u   %10zu   %8.1f%%   %5u %4u  %8u  %7u   %.0f/%.0f/%.1f/%.2f/%.1f\n", silence / 1000,
+            filter.reportedCount(), rows.size(), 100.0 - 100.0 * filter.reportedCount() / rows.size(),
+            filter.reasonCount(UPLINK_FIRST), filter.reasonCount(UPLINK_PIR), filter.reasonCount(UPLINK_DEADBAND),
+            filter.reasonCount(UPLINK_SILENCE), max_error[0], max_error[1], max_error[2], temperature_error, max_error[7]);
+    }
+    return failures ? 1 : 0;
+}
@@ -1,4 +1,8 @@
 #include "BMP280.h"
+#include "perf.h"
+#include "trace.h"
+#include "energy.h"
+#include "pm.h"
 #include "esp_log.h"
 static const char* TAG = "BMP280";
 
@@ -68,14 +72,22 @@ bool BMP280::write8u(uint8_t data, uint8_t reg)
     _wire->beginTransmission(_addr);
     _wire->write(reg);
     _wire->write(data);
-    if(_wire->endTransmission() == 0)
-      return true;
-    return false;
+    if(_wire->endTransmission() != 0)
+      return false;
+    if(reg == CONFIG_REG || reg == CTRL_MEAS_REG)
+    {
+      (reg == CONFIG_REG ? _config : _ctrl_meas) = data;
+      ENERGY_STATE(bmp280(_config, _ctrl_meas));
+    }
+    return true;
 }
 
 
 bool BMP280::read(bool forced_mode)
 { 
+  PERF_SCOPE(PERF_BMP280_READ);
+  TRACE_SCOPE(TRACE_BMP280_READ);
+  PM_APB_SCOPE();
   if (forced_mode)
   {
     SetOperationMode(FORCED);
@@ -91,6 +103,14 @@ bool BMP280::read(bool forced_mode)
     return false;
   BMP280_S32_t adc_P = ((BMP280_S32_t)_wire->read() << 12) | ((BMP280_S32_t)_wire->read() << 4) | ((BMP280_S32_t)_wire->read() >> 4);
   BMP280_S32_t adc_T = ((BMP280_S32_t)_wire->read() << 12) | ((BMP280_S32_t)_wire->read() << 4) | ((BMP280_S32_t)_wire->read() >> 4);
+  return compensate(adc_T, adc_P);
+}
+
+// Converts raw ADC values (e.g. sampled by the deep sleep wake stub) with the calibration of this sensor
+bool BMP280::compensate(BMP280_S32_t adc_T, BMP280_S32_t adc_P)
+{
+  if(adc_P == 0x80000 || adc_T == 0x80000) // reset values, no measurement has completed yet (e.g. right after wake up)
+    return false;
   temperature = bmp280_compensate_T_int32(adc_T);
   pressure = bmp280_compensate_P_int32(adc_P);
   return true;
@@ -100,10 +120,15 @@ void BMP280::MPUToSleep(uint8_t MPU_ADDR)
 {
   uint8_t reg_value;
   #define PWR_MGMT 0x6B
+  uint8_t bmp_addr = _addr;
+  _addr = MPU_ADDR; // register helpers talk to _addr
   reg_value = (uint8_t)read8s(PWR_MGMT);
   reg_value |= (1 << 6);
-  write8u(reg_value, PWR_MGMT);
-  Wire.endTransmission();
+  if(!write8u(reg_value, PWR_MGMT))
+    ESP_LOGE(TAG, "Failed to put MPU to sleep");
+  else
+    ENERGY_STATE(mpu9250(false));
+  _addr = bmp_addr;
 }
 
 
@@ -127,18 +152,27 @@ void BMP280::SetConfig(uint8_t config_data, uint8_t ctrl_meas_data)
 
 bool BMP280::GetCalibrationValues(void)
 {
-   int16_t *values[12] = {(int16_t*)(&dig_T1), &dig_T2, &dig_T3, (int16_t*)(&dig_P1), &dig_P2, &dig_P3, &dig_P4, &dig_P5, &dig_P6, &dig_P7, &dig_P8, &dig_P9}; //technically it is enough to use only dig_T1 address so write all the values, since they should be contignous in the memory.
+   uint8_t registers[24];
    _wire->beginTransmission(_addr);
    _wire->write(COMPENSTATION_REG);
    _wire->endTransmission(false);
    if(_wire->requestFrom(_addr, (uint8_t)24) != 24)
     return false;
-   for(int i = 0; i < 12; i++)
-      *values[i] = read16s_bigendian(false);
+   for(int i = 0; i < 24; i++)
+      registers[i] = _wire->read();
+   SetCalibration(registers);
    delay(5);
    return true;
 }
 
+// The 24 bytes from COMPENSTATION_REG, e.g. to convert values without the sensor on the bus
+void BMP280::SetCalibration(const uint8_t *registers)
+{
+   int16_t *values[12] = {(int16_t*)(&dig_T1), &dig_T2, &dig_T3, (int16_t*)(&dig_P1), &dig_P2, &dig_P3, &dig_P4, &dig_P5, &dig_P6, &dig_P7, &dig_P8, &dig_P9};
+   for(int i = 0; i < 12; i++)
+      *values[i] = registers[2 * i] | (registers[2 * i + 1] << 8); //lsb first
+}
+
 
 #define ID_REG 0xD0
 uint8_t BMP280::readId()
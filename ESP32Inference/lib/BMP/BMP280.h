@@ -1,3 +1,4 @@
+#pragma once
 #include <Wire.h>
 #include <Arduino.h>
 
@@ -60,7 +61,9 @@ namespace ConfigPresets{
 class BMP280{
     private:
     uint8_t _addr;
-    TwoWire *_wire;
+    TwoWire *_wire = nullptr;
+    uint8_t _config = 0;      // last written, for the energy estimate
+    uint8_t _ctrl_meas = 0;
     BMP280_S32_t t_fine;
     uint16_t dig_T1, dig_P1;
     int16_t dig_T2, dig_T3, dig_P2, dig_P3, dig_P4, dig_P5, dig_P6, dig_P7, dig_P8, dig_P9;
@@ -75,7 +78,7 @@ class BMP280{
     int32_t pressure;
 
     public: 
-        ~BMP280() { _wire->end(); }
+        ~BMP280() { if(_wire) _wire->end(); }
         void SetConfig(uint8_t config_data, uint8_t ctrl_meas_data);
         bool begin(uint8_t address, TwoWire *wire, uint8_t config, uint8_t ctrl_meas);
         void i2cScanner(TwoWire &wire);
@@ -85,7 +88,11 @@ class BMP280{
         bool SetDelay(uint8_t mode);
         bool SetInterface(bool spi);
         bool SetOperationMode(uint8_t mode);
+        uint8_t GetConfig() { return (uint8_t)read8s(CONFIG_REG); }
+        uint8_t GetCtrlMeas() { return (uint8_t)read8s(CTRL_MEAS_REG); }
         bool read(bool forced_mode);
+        bool compensate(BMP280_S32_t adc_T, BMP280_S32_t adc_P);
+        void SetCalibration(const uint8_t *registers);
         float getTemperature() { return (float)temperature/100; }
         double getPressure() { return (double)pressure/256; }
         void MPUToSleep(uint8_t MPU_ADDR);
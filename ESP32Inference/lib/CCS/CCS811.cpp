@@ -16,6 +16,10 @@
 
 
 #include <Arduino.h>
+#include "perf.h"
+#include "trace.h"
+#include "energy.h"
+#include "pm.h"
 #include <Wire.h>
 #include "CCS811.h"
 
@@ -109,6 +113,7 @@ bool CCS811::begin( void ) {
       goto abort_begin;
     }
     delayMicroseconds(CCS811_WAIT_AFTER_RESET_US);
+    ENERGY_STATE(ccs811(CCS811_MODE_IDLE));
 
     // Check that HW_ID is 0x81
     ok= i2cread(CCS811_HW_ID,1,&hw_id);
@@ -187,18 +192,38 @@ abort_begin:
 }
 
 
+// Reattach to a CCS811 still in app mode (e.g. after host deep sleep) without the reset of begin(). Returns false if not in app mode.
+// A reset restarts the algorithm, so a CCS811 left measuring during host sleep would lose its warm up.
+bool CCS811::resume( void ) {
+  uint8_t status;
+  uint8_t app_version[2];
+  bool ok;
+  wake_up();
+  ok= i2cread(CCS811_STATUS,1,&status);
+  if( ok && !(status & CCS811_ERRSTAT_FW_MODE) ) ok= false;
+  if( ok ) ok= i2cread(CCS811_FW_APP_VERSION,2,app_version);
+  if( ok ) _appversion= app_version[0]*256+app_version[1];
+  wake_down();
+  return ok;
+}
+
+
 // Switch CCS811 to `mode`, use constants CCS811_MODE_XXX. Returns false on I2C problems.
 bool CCS811::start( int mode ) {
   uint8_t meas_mode[]= {(uint8_t)(mode<<4)};
   wake_up();
   bool ok = i2cwrite(CCS811_MEAS_MODE,1,meas_mode);
   wake_down();
+  if( ok ) ENERGY_STATE(ccs811(mode));
   return ok;
 }
 
 
 // Get measurement results from the CCS811 (all args may be NULL), check status via errstat, e.g. ccs811_errstat(errstat)
 void CCS811::read( uint16_t*eco2, uint16_t*etvoc, uint16_t*errstat,uint16_t*raw) {
+  PERF_SCOPE(PERF_CCS811_READ);
+  TRACE_SCOPE(TRACE_CCS811_READ);
+  PM_APB_SCOPE();
   bool    ok;
   uint8_t buf[8];
   uint8_t stat;
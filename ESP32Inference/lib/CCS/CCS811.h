@@ -68,6 +68,7 @@ class CCS811 {
   public: // Main interface
     CCS811(int nwake=-1, int slaveaddr=CCS811_SLAVEADDR_0);                   // Pin number connected to nWAKE (nWAKE can also be bound to GND, then pass -1), slave address (5A or 5B)
     bool begin( void );                                                       // Reset the CCS811, switch to app mode and check HW_ID. Returns false on problems.
+    bool resume( void );                                                      // Reattach to a CCS811 still in app mode (e.g. after host deep sleep) without the reset of begin(). Returns false if not in app mode.
     bool start( int mode );                                                   // Switch CCS811 to `mode`, use constants CCS811_MODE_XXX. Returns false on I2C problems.
     void read( uint16_t*eco2, uint16_t*etvoc, uint16_t*errstat,uint16_t*raw); // Get measurement results from the CCS811 (all args may be NULL), check status via errstat, e.g. ccs811_errstat(errstat)
     const char * errstat_str(uint16_t errstat);                               // Returns a string version of an errstat. Note, each call, this string is updated.
@@ -1,4 +1,7 @@
 #include "DHT.h"
+#include "perf.h"
+#include "trace.h"
+#include "pm.h"
 #define WAKE_UP_DELAY 20//in milliseconds (20ms)
 #define MICROSECONDS_TO_ABP_TICKS(ms) ms*80
 #define SENSOR_TIMEOUT_MS 2000
@@ -43,13 +46,15 @@ RingbufHandle_t DHT::init_rx_channel(rmt_channel_t channel)
 
 bool DHT::recieve_and_decode()
 {
+    PERF_SCOPE(PERF_DHT_READ);
+    TRACE_SCOPE(TRACE_DHT_READ);
+    PM_APB_SCOPE(); //RMT ticks are APB cycles
     if (rxBuffer == nullptr)
         return false;
     
     rmt_rx_memory_reset(rx_channel);
     start();
     rmt_rx_start(rx_channel,true);
-    byte data[5] = {0};
     size_t buf_size = 0;
     rmt_item32_s *items = (rmt_item32_s*)xRingbufferReceive(rxBuffer, &buf_size, (TickType_t)pdMS_TO_TICKS(15)); //wait at most for 15 ms
     rmt_rx_stop(rx_channel);
@@ -62,32 +67,41 @@ bool DHT::recieve_and_decode()
         return false;
     }
 
+    bool valid = decode(items, &humidity, &temperature);
+    vRingbufferReturnItem(rxBuffer, items);
+    if (!valid) {
+        Serial.printf("Checksum mismatch\n", buf_size);
+        return false;
+    }
+    return true;
+}
+
+// Bits from the high time of the pulses, false on a checksum mismatch
+bool DHT::decode(const rmt_item32_t *items, float *humidity, float *temperature)
+{
+    byte data[5] = {0};
     for (int i=1; i < 41; i++) // ignore the first one (sensor's response low+high for start signal)
     { 
         data[(i-1) / 8] <<= 1;
         data[(i-1) / 8] |= (items[i].duration0) < 33 ? 0 : 1; //might need to be adjusted in case of bugs
     }
 
-    vRingbufferReturnItem(rxBuffer, items);
-
-    if (!(data[4] == ((data[0] + data[1] + data[2] + data[3]) & 0xFF))) {
-        Serial.printf("Checksum mismatch\n", buf_size);
+    if (!(data[4] == ((data[0] + data[1] + data[2] + data[3]) & 0xFF)))
         return false;
-    }
 
-    humidity = data[0] + data[1] * 0.1;
-    temperature = data[2];
+    *humidity = data[0] + data[1] * 0.1;
+    *temperature = data[2];
     if (data[3] & 0x80) {
-        temperature = -1 - temperature;
+        *temperature = -1 - *temperature;
       }
-    temperature += (data[3] & 0x0f) * 0.1;
+    *temperature += (data[3] & 0x0f) * 0.1;
     return true;
 }
 
 bool DHT::read()
 {
     int current_time = millis();
-    if(current_time - last_read > SENSOR_TIMEOUT_MS)
+    if(last_read < 0 || current_time - last_read > SENSOR_TIMEOUT_MS) //first read right after boot/wake up is allowed
        {
         last_read = current_time;
         if(recieve_and_decode())
@@ -19,4 +19,5 @@ class DHT {
         bool read();
         float getTemperature() {return temperature;}
         float getHumidity() {return humidity;}
+        static bool decode(const rmt_item32_t *items, float *humidity, float *temperature); // 41 received items
 };
\ No newline at end of file
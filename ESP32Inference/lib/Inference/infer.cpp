@@ -1,4 +1,7 @@
 #include "infer.h"
+#include "perf.h"
+#include "trace.h"
+#include "esp_rom_crc.h"
 
 const u_int32_t kArenaSize = 20 * 1024;
 
@@ -7,6 +10,7 @@ Inference::Inference()
     error_reporter = new tflite::MicroErrorReporter();
 
     model = tflite::GetModel(model_quant_tflite);
+    model_version = esp_rom_crc32_le(0, model_quant_tflite, model_quant_tflite_len); //same as zlib.crc32 of the .tflite file
     if (model->version() != TFLITE_SCHEMA_VERSION)
     {
         TF_LITE_REPORT_ERROR(error_reporter, "Model provided is schema version %d not equal to supported version %d.", model->version(), TFLITE_SCHEMA_VERSION);
@@ -78,6 +82,7 @@ TfLiteTensor** Inference::GetInputBuffers()
 
 void Inference::SetSequences(SensorDataBatch raw_data_sequence)
 {
+    PERF_SCOPE(PERF_MODEL_SET_SEQUENCES);
     for (int i = 0; i < BATCH_SIZE; i++)
         for(int k = 0; k < SEQUENCE_LENGTH; k++)
         {
@@ -104,9 +109,20 @@ void Inference::SetShiftedOutputs(float **counts, int32_t **ventilation)
         }
 }
 
+void Inference::GetShiftedOutputs(float **counts, int32_t **ventilation)
+{
+    for (int i = 0; i < BATCH_SIZE; i++)
+        for(int k = 0; k < SEQUENCE_LENGTH; k++)
+        {
+            counts[i][k] = human_counts[i][k][0];
+            ventilation[i][k] = ventilation_tags[i][k];
+        }
+}
+
 // shifts pointers in data sequences
 void Inference::ShiftSequences(SensorDataBatch sensor_data_sequence)
 {
+     PERF_SCOPE(PERF_MODEL_SHIFT);
      for (int i = 0; i < BATCH_SIZE; i++)
      {
         Data *first_element = sensor_data_sequence[i][0];
@@ -124,6 +140,7 @@ void Inference::ShiftSequences(SensorDataBatch sensor_data_sequence)
 
 void Inference::SetInputBuffers()
 {
+    PERF_SCOPE(PERF_MODEL_SET_INPUTS);
     for (int i = 0; i < BATCH_SIZE; i++)
         for(int k = 0; k < SEQUENCE_LENGTH; k++)
         {
@@ -136,6 +153,7 @@ void Inference::SetInputBuffers()
 
 void Inference::ScaleData()
 {
+    PERF_SCOPE(PERF_MODEL_SCALE);
     for (int i = 0; i < BATCH_SIZE; i++)
         for(int k = 0; k < SEQUENCE_LENGTH; k++)
             for(int j = 0; j < SENSORS; j++)
@@ -144,6 +162,7 @@ void Inference::ScaleData()
 
 void Inference::ComputeSensorDeltas()
 {
+    PERF_SCOPE(PERF_MODEL_DELTAS);
     for (int i = 0; i < BATCH_SIZE; i++)
     {
         float first_row[SENSORS];
@@ -154,14 +173,26 @@ void Inference::ComputeSensorDeltas()
     }
 }
 
-bool Inference::Predict()
+// Runs the model on the input tensors without reading the outputs
+bool Inference::Invoke()
 {
-    
-    if(interpreter->Invoke() != kTfLiteOk)
+    PERF_SCOPE(PERF_MODEL_INVOKE);
+    TRACE_SCOPE(TRACE_INVOKE);
+    uint32_t start = micros();
+    TfLiteStatus status = interpreter->Invoke();
+    latency_us = micros() - start;
+    if(status != kTfLiteOk)
     {
        TF_LITE_REPORT_ERROR(error_reporter, "Interpreter invokation error\n");
        return false;
     }
+    return true;
+}
+
+bool Inference::Predict()
+{
+    if(!Invoke())
+        return false;
     for (int i = 0; i < BATCH_SIZE; i++)
     {
         prediction[i].human_count = roundf(output[1]->data.f[i]);
@@ -221,6 +252,7 @@ void Inference::printCountBuffer(uint32_t batch_ind)
 
 void Inference::PrintBuffers()
 {
+    PERF_SCOPE(PERF_MODEL_PRINT_BUFFERS);
     for (int i = 0; i < BATCH_SIZE; i++)
     {   
         Serial.print("(");
@@ -246,4 +278,8 @@ Prediction Inference::GetRecentPrediction()
     return prediction[BATCH_SIZE - 1];
 }
 
-
+// restores the label ShiftSequences feeds back, e.g. after a reboot
+void Inference::SetRecentPrediction(Prediction pred)
+{
+    prediction[BATCH_SIZE - 1] = pred;
+}
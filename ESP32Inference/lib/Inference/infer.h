@@ -35,6 +35,8 @@ private:
     float human_counts[BATCH_SIZE][SEQUENCE_LENGTH][1];
     int32_t ventilation_tags[BATCH_SIZE][SEQUENCE_LENGTH];
     Prediction prediction[BATCH_SIZE];
+    uint32_t model_version = 0;
+    uint32_t latency_us = 0;
     void printTagBuffer(uint32_t batch_ind);
     void printSensorBuffer(uint32_t batch_ind);
     void printCountBuffer(uint32_t batch_ind);
@@ -45,12 +47,19 @@ public:
     TfLiteTensor** GetInputBuffers();
     void SetSequences(SensorDataBatch raw_data);
     void SetShiftedOutputs(float **human_counts, int32_t** ventilation);
+    void GetShiftedOutputs(float **human_counts, int32_t** ventilation);
     void ShiftSequences(SensorDataBatch raw_data);
     void SetInputBuffers();
     void ScaleData();
     void ComputeSensorDeltas();
+    bool Invoke();
     bool Predict();
     void PrintBuffers();
     void SetDefaultLabels(float human_count, int32_t ventilation_tag);
     Prediction GetRecentPrediction();
+    void SetRecentPrediction(Prediction pred);
+    uint32_t GetModelVersion() { return model_version; }
+    uint32_t GetLatencyUs() { return latency_us; }
+    const TfLiteTensor *GetInputTensor(int index) { return input[index]; }   // e.g. host/inference_replay.cpp
+    const TfLiteTensor *GetOutputTensor(int index) { return output[index]; }
 };
@@ -1,4 +1,8 @@
 #include "MLX90614.h"
+#include "perf.h"
+#include "trace.h"
+#include "energy.h"
+#include "pm.h"
 
 MLX90614::~MLX90614() { _wire->end(); }
 
@@ -96,9 +100,20 @@ double MLX90614::readAmbientTempC(void) {
 }
 
 float MLX90614::readTemp(uint8_t reg) {
-  float temp;
+  PERF_SCOPE(PERF_MLX90614_READ);
+  TRACE_SCOPE(TRACE_MLX90614_READ);
+  PM_APB_SCOPE();
+  return rawToC(read16(reg));
+}
 
-  temp = read16(reg);
+/**
+ * @brief Convert a raw temperature register value to degrees Celcius
+ *
+ * @param raw Register value in 0.02 K steps
+ * @return float The temperature in degrees Celcius or NAN if the value is 0
+ */
+float MLX90614::rawToC(uint16_t raw) {
+  float temp = raw;
   if (temp == 0)
     return NAN;
   temp *= .02;
@@ -121,7 +136,7 @@ uint16_t MLX90614::read16(uint8_t a) {
   return uint16_t(buffer[0]) | (uint16_t(buffer[1]) << 8);
 }
 
-byte MLX90614::crc8(byte *addr, byte len)
+byte MLX90614::crc8(const byte *addr, byte len)
 // The PEC calculation includes all bits except the START, REPEATED START, STOP,
 // ACK, and NACK bits. The PEC is a CRC-8 with polynomial X8+X2+X1+1.
 {
@@ -157,20 +172,23 @@ void MLX90614::write16(uint8_t a, uint16_t v) {
 }
 
 void MLX90614::sleep(void){
-  byte crc = crc8(0, _addr << 1);
-  crc = crc8(&crc, SLEEP_CODE);
+  byte buffer[2] = {(byte)(_addr << 1), SLEEP_CODE};
+  byte crc = crc8(buffer, 2);
   _wire->beginTransmission(_addr);
   _wire->write(SLEEP_CODE);
   _wire->write(crc);
-  _wire->endTransmission();
+  if(_wire->endTransmission() == 0)
+    ENERGY_STATE(mlx90614(false));
   _wire->end();
 }
 
-void MLX90614::awake(uint8_t SCL_PIN){
+void MLX90614::awake(uint8_t SDA_PIN, uint8_t SCL_PIN){
+  _wire->end();               // release SCL from the I2C peripheral
   pinMode(SCL_PIN, OUTPUT);
   digitalWrite(SCL_PIN, LOW);
   delay(40);
   pinMode(SCL_PIN, INPUT);  // let Wire control it
-  _wire->begin();             // reinitialize I2C
+  _wire->begin(SDA_PIN, SCL_PIN); // reinitialize I2C
   delay(5);
+  ENERGY_STATE(mlx90614(true));
 }
\ No newline at end of file
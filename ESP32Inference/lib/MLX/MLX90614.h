@@ -1,6 +1,7 @@
 /***************************************************
   Written by Limor Fried/Ladyada for Adafruit in any redistribution
  ****************************************************/
+#pragma once
 
 #include <Wire.h>
 #include <Arduino.h>
@@ -44,14 +45,15 @@ public:
   double readEmissivity(void);
   void writeEmissivity(double emissivity);
   void sleep(void);
-  void awake(uint8_t SCL_PIN);
+  void awake(uint8_t SDA_PIN, uint8_t SCL_PIN);
+  static float rawToC(uint16_t raw);
+  static byte crc8(const byte *addr, byte len); // SMBus PEC
 
 private:
   
   float readTemp(uint8_t reg);
-  TwoWire *_wire;
+  TwoWire *_wire = &Wire; // awake() runs before begin() after a deep sleep wake
   uint16_t read16(uint8_t addr);
   void write16(uint8_t addr, uint16_t data);
-  byte crc8(byte *addr, byte len);
   uint8_t _addr;
 };
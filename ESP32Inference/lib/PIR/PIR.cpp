@@ -1,4 +1,5 @@
 #include "PIR.h"
+#include "perf.h"
 
 void PIR::update()
 {
@@ -14,6 +15,7 @@ void PIR::update()
 
 u_int32_t PIR::read()
 {
+    PERF_SCOPE(PERF_PIR_READ);
     u_int32_t uptime = accumulated_uptime;
     accumulated_uptime = 0;
     return uptime;
@@ -1,9 +1,15 @@
 #include "button.h"
+#include "trace.h"
+#include "energy.h"
+#include "pm.h"
 
 volatile bool button_update;
+static uint8_t button_pin;
 
 void IRAM_ATTR ButtonISR()
 {
+    TRACE_INSTANT(TRACE_BUTTON, 0);
+    PowerLocks::wakeOnChange(button_pin); //no-op unless the pin wakes automatic light sleep
     if(!button_update) button_update = true;
 }
 
@@ -36,16 +42,24 @@ Button::Button(uint8_t pin, uint32_t wake_up_delay) : pin(pin), timer(0), wake_u
     pinMode(pin, INPUT);
 } 
 
-void Button::system_start()
+// resume_sleep_us re-arms the timer of an interrupted duty cycle sleep if the press was too short
+void Button::system_start(uint64_t resume_sleep_us)
 {
     esp_sleep_enable_ext0_wakeup((gpio_num_t)pin, 1);
     esp_sleep_wakeup_cause_t wake_up_reason = esp_sleep_get_wakeup_cause();
     if(wake_up_reason == ESP_SLEEP_WAKEUP_EXT0)
     {  
         if (!wake_up(wake_up_delay))
+        {
+            if(resume_sleep_us)
+                esp_sleep_enable_timer_wakeup(resume_sleep_us);
+            ENERGY_STATE(cpu(CPU_DEEP_SLEEP));
             esp_deep_sleep_start();
+        }
     }
+    button_pin = pin;
     attachInterrupt(digitalPinToInterrupt(pin), &ButtonISR, CHANGE);
+    PowerLocks::wakeOnChange(pin); //attachInterrupt() set the edge again
 }
 
 void Button::buttonCtrl(uint32_t click_time, bool *flag, uint32_t *calibration_counter)
@@ -71,6 +85,9 @@ void Button::buttonCtrl(uint32_t click_time, bool *flag, uint32_t *calibration_c
             {
                 digitalWrite(1, HIGH);
                 Serial.println("Goining to sleep....");
+                if(sleep_callback)
+                    sleep_callback();
+                ENERGY_STATE(cpu(CPU_DEEP_SLEEP));
                 esp_deep_sleep_start();
             }
             if(click_count == 2)
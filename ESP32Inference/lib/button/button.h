@@ -5,9 +5,11 @@ class Button {
     uint32_t wake_up_delay;
     uint32_t timer;
     uint8_t pin;
+    void (*sleep_callback)() = nullptr;
     public:
         Button(uint8_t pin, uint32_t wake_up_delay);
-        void system_start();
+        void system_start(uint64_t resume_sleep_us = 0);
+        void onSleep(void (*callback)()) { sleep_callback = callback; }
         void startTimer();
         uint32_t getTimer();
         bool wake_up(uint32_t time_to_hold);
@@ -0,0 +1,338 @@
+#include "coap-reliable.h"
+#include <string.h>
+
+CoapReliable::CoapReliable(CoapDatagramSend send, void *ctx, uint8_t nstart):
+    nstart(nstart ? nstart : 1),
+    send(send),
+    ctx(ctx)
+{
+    clear();
+    seed(1);
+    memset(seen, 0, sizeof(seen));
+    memset(peers, 0, sizeof(peers));
+    memset(&histogram, 0, sizeof(histogram));
+}
+
+// Initial message ID and token should be random (RFC 7252 4.4, 5.3.1), both are sequential afterwards
+void CoapReliable::seed(uint32_t seed)
+{
+    random_state = seed ? seed : 1;
+    message_id = random();
+    token = random();
+}
+
+uint32_t CoapReliable::random()
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+uint16_t CoapReliable::nextMessageId()
+{
+    if(++message_id == 0) //coap-simple returns 0 on errors
+        message_id = 1;
+    return message_id;
+}
+
+uint8_t CoapReliable::nextToken(uint8_t *buffer)
+{
+    token++;
+    for(int i = 0; i < COAP_TOKEN_LENGTH; i++)
+        buffer[i] = token >> (8 * (COAP_TOKEN_LENGTH - 1 - i));
+    return COAP_TOKEN_LENGTH;
+}
+
+// Takes a copy of an encoded confirmable message, it is sent once a NSTART slot is free
+bool CoapReliable::enqueue(const uint8_t *datagram, size_t len, uint32_t addr, uint16_t port, uint32_t now)
+{
+    uint8_t tokenlen = len ? datagram[0] & 0x0F : 0;
+    if(len < 4 || len > COAP_DATAGRAM_SIZE || tokenlen > COAP_TOKEN_MAX || 4u + tokenlen > len)
+        return false;
+    for(int i = 0; i < COAP_MAX_PENDING; i++)
+    {
+        CoapExchange *exchange = &pending[i];
+        if(exchange->used)
+            continue;
+        exchange->used = true;
+        exchange->in_flight = false;
+        exchange->request = datagram[1] >= 0x01 && datagram[1] <= 0x1F; //class 0, not empty
+        exchange->separate = false;
+        exchange->message_id = (datagram[2] << 8) | datagram[3];
+        exchange->tokenlen = tokenlen;
+        memcpy(exchange->token, datagram + 4, tokenlen);
+        exchange->retransmits = 0;
+        exchange->addr = addr;
+        exchange->port = port;
+        exchange->len = len;
+        memcpy(exchange->datagram, datagram, len);
+        stats.requests++;
+        poll(now);
+        return true;
+    }
+    stats.rejected++;
+    return false;
+}
+
+void CoapReliable::transmit(CoapExchange *exchange, uint32_t now)
+{
+    send(exchange->datagram, exchange->len, exchange->addr, exchange->port, ctx);
+    stats.transmissions++;
+    exchange->next_send = now + exchange->timeout;
+}
+
+// Only a success response confirms the delivery of a request, 4.xx and 5.xx mean the server didn't take it
+void CoapReliable::finish(CoapExchange *exchange, bool completed, uint8_t code)
+{
+    exchange->used = false;
+    if(completed)
+        stats.completed++;
+    else
+    {
+        stats.failed++;
+        if(exchange->request)
+            stats.failed_requests++;
+        if(failed)
+            failed(exchange->message_id, code, exchange->addr, exchange->port, ctx);
+    }
+}
+
+// Matches ACK/RST to the outstanding request by endpoint and message ID, separate responses by endpoint and token,
+// remembers CON/NON message IDs per endpoint to drop duplicates
+CoapRx CoapReliable::received(uint8_t type, uint8_t code, uint16_t id, const uint8_t *token, uint8_t tokenlen,
+    uint32_t addr, uint16_t port, uint32_t now)
+{
+    CoapRx rx = {COAP_RX_UNMATCHED, id, 0, 0};
+    if(type == COAP_TYPE_ACK || type == COAP_TYPE_RST)
+    {
+        for(int i = 0; i < COAP_MAX_PENDING; i++)
+        {
+            CoapExchange *exchange = &pending[i];
+            if(!exchange->used || !exchange->in_flight || exchange->separate || exchange->message_id != id ||
+                exchange->addr != addr || exchange->port != port)
+                continue;
+            rx.result = COAP_RX_NEW;
+            rx.rtt = now - exchange->first_send;
+            rx.retransmits = exchange->retransmits;
+            if(type == COAP_TYPE_RST)
+            {
+                finish(exchange, false, 0);
+                poll(now); //next queued request can go out
+                return rx;
+            }
+            updateRto(findPeer(addr, port, now), rx.rtt, rx.retransmits, now);
+            // an empty ACK, or a piggybacked response for another token, only ends the retransmission of a request
+            bool response = code != 0 && exchange->tokenlen == tokenlen && !memcmp(exchange->token, token, tokenlen);
+            if(exchange->request && !response)
+            {
+                exchange->separate = true;
+                exchange->next_send = now + COAP_SEPARATE_TIMEOUT;
+                poll(now); //no longer counts toward NSTART
+                return rx;
+            }
+            finish(exchange, COAP_CLASS(code) == 2 || !exchange->request, code);
+            poll(now);
+            return rx;
+        }
+        stats.duplicates++; //late ACK of a retransmitted request
+        return rx;
+    }
+
+    for(int i = 0; i < COAP_DEDUP_SIZE; i++)
+        if(seen[i].time && seen[i].message_id == id && seen[i].addr == addr && seen[i].port == port &&
+            now - seen[i].time < COAP_EXCHANGE_LIFETIME)
+        {
+            stats.duplicates++;
+            rx.result = COAP_RX_DUPLICATE;
+            return rx;
+        }
+    seen[seen_next].message_id = id;
+    seen[seen_next].addr = addr;
+    seen[seen_next].port = port;
+    seen[seen_next].time = now ? now : 1;
+    seen_next = (seen_next + 1) % COAP_DEDUP_SIZE;
+    rx.result = COAP_RX_NEW;
+
+    for(int i = 0; i < COAP_MAX_PENDING && code != 0; i++)
+    {
+        CoapExchange *exchange = &pending[i];
+        // a separate response that overtakes the empty ACK also ends the retransmission
+        if(!exchange->used || !exchange->in_flight || !exchange->request || exchange->addr != addr || exchange->port != port ||
+            exchange->tokenlen != tokenlen || memcmp(exchange->token, token, tokenlen))
+            continue;
+        rx.message_id = exchange->message_id;
+        rx.rtt = now - exchange->first_send;
+        rx.retransmits = exchange->retransmits;
+        finish(exchange, COAP_CLASS(code) == 2, code);
+        poll(now);
+        break;
+    }
+    return rx;
+}
+
+// Retransmits with exponential backoff and starts queued requests while fewer than NSTART are outstanding
+void CoapReliable::poll(uint32_t now)
+{
+    for(int i = 0; i < COAP_MAX_PENDING; i++)
+    {
+        CoapExchange *exchange = &pending[i];
+        if(!exchange->used || !exchange->in_flight || (int32_t)(now - exchange->next_send) < 0)
+            continue;
+        if(exchange->separate || exchange->retransmits >= COAP_MAX_RETRANSMIT)
+        {
+            finish(exchange, false, 0);
+            continue;
+        }
+        exchange->retransmits++;
+        exchange->timeout = exchange->timeout * exchange->backoff;
+        if(exchange->timeout > COAP_RTO_MAX * 2)
+            exchange->timeout = COAP_RTO_MAX * 2;
+        stats.retransmissions++;
+        transmit(exchange, now);
+    }
+
+    uint8_t outstanding = inFlight();
+    for(int i = 0; i < COAP_MAX_PENDING && outstanding < nstart; i++)
+    {
+        CoapExchange *exchange = &pending[i];
+        if(!exchange->used || exchange->in_flight)
+            continue;
+        exchange->in_flight = true;
+        exchange->first_send = now;
+        // initial timeout is random between RTO and RTO * ACK_RANDOM_FACTOR
+        uint32_t rto = COAP_ACK_TIMEOUT;
+        exchange->backoff = 2;
+        if(adaptive)
+        {
+            CoapPeer *peer = findPeer(exchange->addr, exchange->port, now);
+            agePeer(peer, now);
+            rto = peer->rto;
+            // variable backoff factor, short RTOs back off faster, long ones slower
+            exchange->backoff = rto < 1000 ? 3 : (rto > 3000 ? 1.5 : 2);
+        }
+        exchange->timeout = rto + random() % (rto * (COAP_ACK_RANDOM_FACTOR - 100) / 100 + 1);
+        transmit(exchange, now);
+        outstanding++;
+    }
+}
+
+uint8_t CoapReliable::queued()
+{
+    uint8_t count = 0;
+    for(int i = 0; i < COAP_MAX_PENDING; i++)
+        count += pending[i].used;
+    return count;
+}
+
+uint8_t CoapReliable::inFlight()
+{
+    uint8_t count = 0;
+    for(int i = 0; i < COAP_MAX_PENDING; i++)
+        count += pending[i].used && pending[i].in_flight && !pending[i].separate;
+    return count;
+}
+
+// Least recently used entry is replaced by a new destination
+CoapPeer* CoapReliable::findPeer(uint32_t addr, uint16_t port, uint32_t now)
+{
+    CoapPeer *oldest = &peers[0];
+    for(int i = 0; i < COAP_PEERS; i++)
+    {
+        CoapPeer *peer = &peers[i];
+        if(peer->used && peer->addr == addr && peer->port == port)
+        {
+            peer->last_used = now;
+            return peer;
+        }
+        if(!peer->used || (oldest->used && (int32_t)(peer->last_used - oldest->last_used) < 0))
+            oldest = peer;
+    }
+    memset(oldest, 0, sizeof(CoapPeer));
+    oldest->used = true;
+    oldest->addr = addr;
+    oldest->port = port;
+    oldest->rto = COAP_ACK_TIMEOUT;
+    oldest->updated = now;
+    oldest->last_used = now;
+    return oldest;
+}
+
+// Estimates that are not refreshed drift back toward the default
+void CoapReliable::agePeer(CoapPeer *peer, uint32_t now)
+{
+    uint32_t idle = now - peer->updated;
+    if(peer->rto < 1000 && idle > 16 * peer->rto)
+    {
+        peer->rto *= 2;
+        peer->updated = now;
+    }
+    else if(peer->rto > 3000 && idle > 4 * peer->rto)
+    {
+        peer->rto = 1000 + peer->rto / 2;
+        peer->updated = now;
+    }
+}
+
+static void rttEstimate(float *srtt, float *rttvar, float rtt)
+{
+    if(*srtt == 0)
+    {
+        *srtt = rtt;
+        *rttvar = rtt / 2;
+        return;
+    }
+    float error = *srtt > rtt ? *srtt - rtt : rtt - *srtt;
+    *rttvar = 0.75f * *rttvar + 0.25f * error;
+    *srtt = 0.875f * *srtt + 0.125f * rtt;
+}
+
+// Strong samples come from exchanges without retransmission, weak ones are ambiguous about which copy was acknowledged
+void CoapReliable::updateRto(CoapPeer *peer, uint32_t rtt, uint8_t retransmits, uint32_t now)
+{
+    uint8_t bucket = 0;
+    while(bucket < COAP_RTT_BUCKETS - 1 && rtt >= bucketLimit(bucket))
+        bucket++;
+    histogram.buckets[bucket]++;
+    histogram.sum += rtt;
+    if(!histogram.max || rtt > histogram.max)
+        histogram.max = rtt;
+    if(!histogram.min || rtt < histogram.min)
+        histogram.min = rtt;
+
+    float measured = rtt ? rtt : 1;
+    if(retransmits == 0)
+    {
+        histogram.strong++;
+        rttEstimate(&peer->srtt_strong, &peer->rttvar_strong, measured);
+        float rto_strong = peer->srtt_strong + COAP_K_STRONG * peer->rttvar_strong;
+        peer->rto = 0.5f * rto_strong + 0.5f * peer->rto;
+    }
+    else if(retransmits <= COAP_WEAK_MAX_RETRANSMIT)
+    {
+        histogram.weak++;
+        rttEstimate(&peer->srtt_weak, &peer->rttvar_weak, measured);
+        float rto_weak = peer->srtt_weak + COAP_K_WEAK * peer->rttvar_weak;
+        peer->rto = 0.25f * rto_weak + 0.75f * peer->rto;
+    }
+    else
+        return;
+    if(peer->rto < COAP_RTO_MIN)
+        peer->rto = COAP_RTO_MIN;
+    else if(peer->rto > COAP_RTO_MAX)
+        peer->rto = COAP_RTO_MAX;
+    peer->updated = now;
+}
+
+uint32_t CoapReliable::rto(uint32_t addr, uint16_t port)
+{
+    for(int i = 0; i < COAP_PEERS; i++)
+        if(peers[i].used && peers[i].addr == addr && peers[i].port == port)
+            return peers[i].rto;
+    return COAP_ACK_TIMEOUT;
+}
+
+void CoapReliable::clear()
+{
+    memset(pending, 0, sizeof(pending));
+}
@@ -0,0 +1,168 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// RFC 7252 message layer for coap-simple: confirmable retransmission, sequential message IDs and tokens,
+// duplicate detection and CoCoA adaptive retransmission timeouts (draft-ietf-core-cocoa).
+// Platform independent, so the host simulator runs the same code (host/).
+
+// Transmission parameters, RFC 7252 section 4.8
+#ifndef COAP_ACK_TIMEOUT
+#define COAP_ACK_TIMEOUT 2000        //ms
+#endif
+#define COAP_ACK_RANDOM_FACTOR 150   //percent
+#define COAP_MAX_RETRANSMIT 4
+#ifndef COAP_NSTART
+#define COAP_NSTART 2                //outstanding exchanges, RFC default is 1
+#endif
+#define COAP_EXCHANGE_LIFETIME 247000 //ms a message ID is remembered for duplicate detection
+
+#ifndef COAP_MAX_PENDING
+#define COAP_MAX_PENDING 8           //queued plus outstanding confirmable requests
+#endif
+#ifndef COAP_DATAGRAM_SIZE
+#define COAP_DATAGRAM_SIZE 128       //same as COAP_BUF_MAX_SIZE of coap-simple
+#endif
+#define COAP_DEDUP_SIZE 8
+#define COAP_TOKEN_LENGTH 4
+#define COAP_TOKEN_MAX 8
+#ifndef COAP_SEPARATE_TIMEOUT
+#define COAP_SEPARATE_TIMEOUT 30000  //ms a separate response may take after the empty ACK
+#endif
+
+// CoCoA, RTT estimators per destination
+#ifndef COAP_PEERS
+#define COAP_PEERS 4
+#endif
+#define COAP_K_STRONG 4              //RTO = SRTT + K * RTTVAR, ACK without retransmission
+#define COAP_K_WEAK 1                //ACK after 1 or 2 retransmissions, measured from the first transmission
+#define COAP_WEAK_MAX_RETRANSMIT 2
+#define COAP_RTO_MIN 50              //ms
+#define COAP_RTO_MAX 32000
+#define COAP_RTT_BUCKETS 12          //histogram buckets, powers of two from < 4 ms to >= 4096 ms
+
+// Message types, same values as COAP_TYPE of coap-simple
+#define COAP_TYPE_CON 0
+#define COAP_TYPE_NON 1
+#define COAP_TYPE_ACK 2
+#define COAP_TYPE_RST 3
+#define COAP_CLASS(code) ((code) >> 5) //2 for success responses
+
+// Results of received()
+#define COAP_RX_NEW 0          // first copy, to be processed
+#define COAP_RX_DUPLICATE 1    // already seen, a CON has to be acknowledged again but not processed
+#define COAP_RX_UNMATCHED 2    // ACK/RST or response for an unknown or finished exchange
+
+typedef bool (*CoapDatagramSend)(const uint8_t *datagram, size_t len, uint32_t addr, uint16_t port, void *ctx);
+typedef void (*CoapExchangeFailed)(uint16_t message_id, uint8_t code, uint32_t addr, uint16_t port, void *ctx); // code 0: no ACK or RST
+
+typedef struct {
+    bool used;
+    uint32_t addr;
+    uint16_t port;
+    float rto;                 // RTO_overall
+    float srtt_strong;
+    float rttvar_strong;
+    float srtt_weak;
+    float rttvar_weak;
+    uint32_t updated;          // last RTO change, for aging
+    uint32_t last_used;
+} CoapPeer;
+
+typedef struct {
+    uint32_t buckets[COAP_RTT_BUCKETS];
+    uint32_t strong;           // samples per estimator
+    uint32_t weak;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} CoapRttHistogram;
+
+typedef struct {
+    bool used;
+    bool in_flight;            // sent at least once, counts toward NSTART
+    bool request;              // an empty ACK announces a separate response
+    bool separate;             // empty ACK received, no retransmission, waiting for the response
+    uint16_t message_id;
+    uint8_t tokenlen;
+    uint8_t token[COAP_TOKEN_MAX];
+    uint8_t retransmits;
+    uint32_t timeout;          // current backoff
+    float backoff;             // CoCoA variable backoff factor, 2 with fixed timers
+    uint32_t next_send;
+    uint32_t first_send;
+    uint32_t addr;
+    uint16_t port;
+    uint16_t len;
+    uint8_t datagram[COAP_DATAGRAM_SIZE];
+} CoapExchange;
+
+typedef struct {
+    uint16_t message_id;
+    uint32_t addr;
+    uint16_t port;
+    uint32_t time;
+} CoapSeen;
+
+typedef struct {
+    uint8_t result;
+    uint16_t message_id;       // matched request for ACK/RST and separate responses
+    uint32_t rtt;              // ms since the first transmission
+    uint8_t retransmits;
+} CoapRx;
+
+typedef struct {
+    uint32_t requests;
+    uint32_t transmissions;
+    uint32_t retransmissions;
+    uint32_t completed;        // acknowledged, requests only with a 2.xx response
+    uint32_t failed;           // no ACK, RST or an error response
+    uint32_t failed_requests;  // of those, requests sent by this endpoint (notifications are left out)
+    uint32_t duplicates;
+    uint32_t rejected;         // table full
+} CoapStats;
+
+class CoapReliable {
+
+    CoapExchange pending[COAP_MAX_PENDING];
+    CoapSeen seen[COAP_DEDUP_SIZE];
+    uint8_t seen_next = 0;
+    uint8_t nstart;
+    uint16_t message_id;
+    uint32_t token;
+    uint32_t random_state;
+    CoapDatagramSend send;
+    CoapExchangeFailed failed = nullptr;
+    void *ctx;
+    CoapStats stats = {};
+    bool adaptive = true;
+    CoapPeer peers[COAP_PEERS];
+    CoapRttHistogram histogram;
+
+    uint32_t random();
+    void transmit(CoapExchange *exchange, uint32_t now);
+    void finish(CoapExchange *exchange, bool completed, uint8_t code);
+    CoapPeer* findPeer(uint32_t addr, uint16_t port, uint32_t now);
+    void agePeer(CoapPeer *peer, uint32_t now);
+    void updateRto(CoapPeer *peer, uint32_t rtt, uint8_t retransmits, uint32_t now);
+
+    public:
+        CoapReliable(CoapDatagramSend send, void *ctx, uint8_t nstart = COAP_NSTART);
+        void seed(uint32_t seed);
+        void onFailed(CoapExchangeFailed callback) { failed = callback; }
+        void setAdaptive(bool enable) { adaptive = enable; } // false: RFC 7252 fixed timers
+        uint16_t nextMessageId();
+        uint8_t nextToken(uint8_t *token);
+        bool enqueue(const uint8_t *datagram, size_t len, uint32_t addr, uint16_t port, uint32_t now);
+        CoapRx received(uint8_t type, uint8_t code, uint16_t message_id, const uint8_t *token, uint8_t tokenlen,
+            uint32_t addr, uint16_t port, uint32_t now);
+        void poll(uint32_t now);
+        uint8_t queued();
+        uint8_t inFlight();
+        bool full() { return queued() >= COAP_MAX_PENDING; }
+        void clear();
+        const CoapStats* getStats() { return &stats; }
+        const CoapRttHistogram* getRttHistogram() { return &histogram; }
+        static uint32_t bucketLimit(uint8_t bucket) { return 4u << bucket; } // upper bound in ms, last bucket is open
+        uint32_t rto(uint32_t addr, uint16_t port);
+};
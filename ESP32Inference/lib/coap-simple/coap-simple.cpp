@@ -1,4 +1,6 @@
 #include "coap-simple.h"
+#include "perf.h"
+#include "trace.h"
 #include "Arduino.h"
 
 #define LOGGING
@@ -13,6 +15,39 @@ void CoapPacket::addOption(uint8_t number, uint8_t length, uint8_t *opt_payload)
 }
 
 
+// Same hash as coapPathHash() over the Uri-Path segments joined with '/'
+uint32_t coapRequestHash(CoapPacket &packet) {
+    uint32_t hash = COAP_HASH_SEED;
+    bool first = true;
+    for (int i = 0; i < packet.optionnum; i++) {
+        if (packet.options[i].number != COAP_URI_PATH || packet.options[i].length == 0)
+            continue;
+        if (!first)
+            hash = COAP_HASH_STEP(hash, '/');
+        for (int k = 0; k < packet.options[i].length; k++)
+            hash = COAP_HASH_STEP(hash, packet.options[i].buffer[k]);
+        first = false;
+    }
+    return hash;
+}
+
+// Compares the route path segment by segment with the Uri-Path options, rules out hash collisions
+bool coapRouteMatch(const CoapRoute &route, CoapPacket &packet) {
+    const char *p = route.path;
+    bool first = true;
+    for (int i = 0; i < packet.optionnum; i++) {
+        if (packet.options[i].number != COAP_URI_PATH || packet.options[i].length == 0)
+            continue;
+        if (!first && *p++ != '/')
+            return false;
+        for (int k = 0; k < packet.options[i].length; k++, p++)
+            if (*p == 0 || *p != (char)packet.options[i].buffer[k])
+                return false;
+        first = false;
+    }
+    return *p == 0;
+}
+
 Coap::Coap(
     UDP& udp,
     int coap_buf_size  /* default value is COAP_BUF_MAX_SIZE */
@@ -46,7 +81,25 @@ uint16_t Coap::sendPacket(CoapPacket &packet, IPAddress ip) {
 }
 
 uint16_t Coap::sendPacket(CoapPacket &packet, IPAddress ip, int port) {
-    uint8_t *p = this->tx_buffer;
+    PERF_SCOPE(PERF_COAP_SEND);
+    TRACE_SCOPE(TRACE_UDP_SEND);
+    uint16_t packetSize = encodePacket(packet, this->tx_buffer, coap_buf_size);
+    if (packetSize == 0)
+        return 0;
+
+    if (transmit) {
+        if (!transmit(this->tx_buffer, packetSize, ip, port))
+            return 0;
+    } else {
+        sendDatagram(this->tx_buffer, packetSize, ip, port);
+    }
+
+    return packet.messageid;
+}
+
+// Header, token, options and payload into buffer, 0 if it doesn't fit
+uint16_t Coap::encodePacket(CoapPacket &packet, uint8_t *buffer, size_t buffer_size) {
+    uint8_t *p = buffer;
     uint16_t running_delta = 0;
     uint16_t packetSize = 0;
 
@@ -57,7 +110,7 @@ uint16_t Coap::sendPacket(CoapPacket &packet, IPAddress ip, int port) {
     *p++ = packet.code;
     *p++ = (packet.messageid >> 8);
     *p++ = (packet.messageid & 0xFF);
-    p = this->tx_buffer + COAP_HEADER_SIZE;
+    p = buffer + COAP_HEADER_SIZE;
     packetSize += 4;
 
     // make token
@@ -67,12 +120,21 @@ uint16_t Coap::sendPacket(CoapPacket &packet, IPAddress ip, int port) {
         packetSize += packet.tokenlen;
     }
 
+    // options are delta encoded, so they have to go out in ascending order
+    for (int i = 1; i < packet.optionnum; i++) {
+        for (int k = i; k > 0 && packet.options[k - 1].number > packet.options[k].number; k--) {
+            CoapOption option = packet.options[k];
+            packet.options[k] = packet.options[k - 1];
+            packet.options[k - 1] = option;
+        }
+    }
+
     // make option header
     for (int i = 0; i < packet.optionnum; i++)  {
         uint32_t optdelta;
         uint8_t len, delta;
 
-        if (packetSize + 5 + packet.options[i].length >= coap_buf_size) {
+        if ((size_t)(packetSize + 5 + packet.options[i].length) >= buffer_size) {
             return 0;
         }
         optdelta = packet.options[i].number - running_delta;
@@ -104,7 +166,7 @@ uint16_t Coap::sendPacket(CoapPacket &packet, IPAddress ip, int port) {
 
     // make payload
     if (packet.payloadlen > 0) {
-        if ((packetSize + 1 + packet.payloadlen) >= coap_buf_size) {
+        if ((packetSize + 1 + packet.payloadlen) >= buffer_size) {
             return 0;
         }
         *p++ = 0xFF;
@@ -112,11 +174,83 @@ uint16_t Coap::sendPacket(CoapPacket &packet, IPAddress ip, int port) {
         packetSize += 1 + packet.payloadlen;
     }
 
+    return packetSize;
+}
+
+// Encodes everything except message ID, token and payload once, for requests repeated with the same options
+bool Coap::prepare(CoapTemplate &request, IPAddress ip, int port, const char *url, COAP_TYPE type, COAP_METHOD method,
+        uint8_t tokenlen, COAP_CONTENT_TYPE content_type) {
+    CoapPacket packet;
+    uint8_t token[8] = {0};
+    if (tokenlen > sizeof(token))
+        return false;
+    packet.type = type;
+    packet.code = method;
+    packet.token = token;
+    packet.tokenlen = tokenlen;
+
+    char ipaddress[16] = "";
+    sprintf(ipaddress, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+    addUriOptions(packet, ipaddress, url);
+    uint8_t optionBuffer[2] {0};
+    if (content_type != COAP_NONE) {
+        optionBuffer[0] = ((uint16_t)content_type & 0xFF00) >> 8;
+        optionBuffer[1] = ((uint16_t)content_type & 0x00FF) ;
+        packet.addOption(COAP_CONTENT_FORMAT, 2, optionBuffer);
+    }
+
+    request.len = encodePacket(packet, request.header, COAP_TEMPLATE_SIZE);
+    request.tokenlen = tokenlen;
+    request.ip = ip;
+    request.port = port;
+    return request.len != 0;
+}
+
+// Only the message ID and token are patched, the payload goes to the socket as a second segment
+uint16_t Coap::send(CoapTemplate &request, uint16_t messageid, const uint8_t *token, const uint8_t *payload, size_t payloadlen) {
+    PERF_SCOPE(PERF_COAP_SEND); //same timer as sendPacket, both encode and hand over one message
+    TRACE_SCOPE(TRACE_UDP_SEND);
+    if (request.len == 0 || request.len + 1 + payloadlen >= (size_t)coap_buf_size)
+        return 0;
+    request.header[2] = messageid >> 8;
+    request.header[3] = messageid & 0xFF;
+    memcpy(request.header + COAP_HEADER_SIZE, token, request.tokenlen);
+
+    if (transmit) {
+        // the retransmission layer keeps its own copy, so it needs one contiguous datagram
+        memcpy(this->tx_buffer, request.header, request.len);
+        size_t len = request.len;
+        if (payloadlen > 0) {
+            this->tx_buffer[len++] = COAP_PAYLOAD_MARKER;
+            memcpy(this->tx_buffer + len, payload, payloadlen);
+            len += payloadlen;
+        }
+        return transmit(this->tx_buffer, len, request.ip, request.port) ? messageid : 0;
+    }
+
+    static const uint8_t marker = COAP_PAYLOAD_MARKER;
+    _udp->beginPacket(request.ip, request.port);
+    _udp->write(request.header, request.len);
+    if (payloadlen > 0) {
+        _udp->write(&marker, 1);
+        _udp->write(payload, payloadlen);
+    }
+    return _udp->endPacket() ? messageid : 0;
+}
+
+bool Coap::sendDatagram(const uint8_t *datagram, size_t len, IPAddress ip, int port) {
     _udp->beginPacket(ip, port);
-    _udp->write(this->tx_buffer, packetSize);
-    _udp->endPacket();
+    _udp->write(datagram, len);
+    return _udp->endPacket();
+}
 
-    return packet.messageid;
+// empty ACK/RST, e.g. for a separate response
+uint16_t Coap::sendEmpty(IPAddress ip, int port, COAP_TYPE type, uint16_t messageid) {
+    CoapPacket packet;
+    packet.type = type;
+    packet.code = 0;
+    packet.messageid = messageid;
+    return this->sendPacket(packet, ip, port);
 }
 
 uint16_t Coap::get(IPAddress ip, int port, const char *url) {
@@ -136,7 +270,7 @@ uint16_t Coap::send(IPAddress ip, int port, const char *url, COAP_TYPE type, COA
 }
 
 uint16_t Coap::send(IPAddress ip, int port, const char *url, COAP_TYPE type, COAP_METHOD method, const uint8_t *token, uint8_t tokenlen, const uint8_t *payload, size_t payloadlen, COAP_CONTENT_TYPE content_type) {
-    return this->send(ip, port, url, type, method, token, tokenlen, payload, payloadlen, content_type, rand());
+    return this->send(ip, port, url, type, method, token, tokenlen, payload, payloadlen, content_type, nextMessageId());
 }
 
 uint16_t Coap::send(IPAddress ip, int port, const char *url, COAP_TYPE type, COAP_METHOD method, const uint8_t *token, uint8_t tokenlen, const uint8_t *payload, size_t payloadlen, COAP_CONTENT_TYPE content_type, uint16_t messageid) {
@@ -156,7 +290,22 @@ uint16_t Coap::send(IPAddress ip, int port, const char *url, COAP_TYPE type, COA
     // use URI_HOST UIR_PATH
     char ipaddress[16] = "";
     sprintf(ipaddress, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
-    packet.addOption(COAP_URI_HOST, strlen(ipaddress), (uint8_t *)ipaddress);
+    addUriOptions(packet, ipaddress, url);
+
+	// if Content-Format option
+	uint8_t optionBuffer[2] {0};
+	if (content_type != COAP_NONE) {
+		optionBuffer[0] = ((uint16_t)content_type & 0xFF00) >> 8;
+		optionBuffer[1] = ((uint16_t)content_type & 0x00FF) ;
+		packet.addOption(COAP_CONTENT_FORMAT, 2, optionBuffer);
+	}
+
+    // send packet
+    return this->sendPacket(packet, ip, port);
+}
+
+void Coap::addUriOptions(CoapPacket &packet, const char *host, const char *url) {
+    packet.addOption(COAP_URI_HOST, strlen(host), (uint8_t *)host);
 
     /*
         Add Query Support
@@ -165,8 +314,9 @@ uint16_t Coap::send(IPAddress ip, int port, const char *url, COAP_TYPE type, COA
 
     // parse url
     size_t idx = 0;
+    size_t urllen = strlen(url);
     bool hasQuery = false;
-    for (size_t i = 0; i < strlen(url); i++) {
+    for (size_t i = 0; i < urllen; i++) {
         // The reserved characters "/"  "?"  "&"
         if (url[i] == '/') {
             packet.addOption(COAP_URI_PATH, i-idx, (uint8_t *)(url + idx)); //one URI_PATH (terminated by '/')
@@ -181,11 +331,11 @@ uint16_t Coap::send(IPAddress ip, int port, const char *url, COAP_TYPE type, COA
         }
     }
 
-    if (idx <= strlen(url)) {
+    if (idx <= urllen) {
         if (hasQuery) {
-            packet.addOption(COAP_URI_QUERY, strlen(url)-idx, (uint8_t *)(url + idx)); //the last URI_QUERY (between &/? and the end)
+            packet.addOption(COAP_URI_QUERY, urllen-idx, (uint8_t *)(url + idx)); //the last URI_QUERY (between &/? and the end)
         } else {
-            packet.addOption(COAP_URI_PATH, strlen(url)-idx, (uint8_t *)(url + idx)); //the last URI_PATH (between / and the end)
+            packet.addOption(COAP_URI_PATH, urllen-idx, (uint8_t *)(url + idx)); //the last URI_PATH (between / and the end)
         }
     }
     
@@ -194,17 +344,6 @@ uint16_t Coap::send(IPAddress ip, int port, const char *url, COAP_TYPE type, COA
         Adding query support ends
         Date: 2024.03.03
     */
-
-	// if Content-Format option
-	uint8_t optionBuffer[2] {0};
-	if (content_type != COAP_NONE) {
-		optionBuffer[0] = ((uint16_t)content_type & 0xFF00) >> 8;
-		optionBuffer[1] = ((uint16_t)content_type & 0x00FF) ;
-		packet.addOption(COAP_CONTENT_FORMAT, 2, optionBuffer);
-	}
-
-    // send packet
-    return this->sendPacket(packet, ip, port);
 }
 
 int Coap::parseOption(CoapOption *option, uint16_t *running_delta, uint8_t **buf, size_t buflen) {
@@ -253,9 +392,12 @@ int Coap::parseOption(CoapOption *option, uint16_t *running_delta, uint8_t **buf
 }
 
 bool Coap::loop() {
+    PERF_SCOPE(PERF_COAP_LOOP);
     int32_t packetlen = _udp->parsePacket();
 
     while (packetlen > 0) {
+        TRACE_INSTANT(TRACE_UDP_RECEIVE, packetlen > 255 ? 255 : packetlen);
+        bool truncated = packetlen > coap_buf_size;
         packetlen = _udp->read(this->rx_buffer, packetlen >= coap_buf_size ? coap_buf_size : packetlen);
 
         CoapPacket packet;
@@ -279,6 +421,16 @@ bool Coap::loop() {
             continue;
         }
 
+        // larger than the buffer: a request is answered with the block size that fits (RFC 7959 2.9.3), the rest is dropped
+        if (truncated) {
+            if (packet.type == COAP_CON && packet.code > 0 && packet.code < RESPONSE_CODE(2, 0)) {
+                sendBlockResponse(_udp->remoteIP(), _udp->remotePort(), packet, COAP_REQUEST_ENTITY_TOO_LARGE,
+                    COAP_BLOCK1, 0, false, maxBlockSzx(), NULL, 0);
+            }
+            packetlen = _udp->parsePacket();
+            continue;
+        }
+
         // parse packet options/payload
         if (COAP_HEADER_SIZE + packet.tokenlen < packetlen) {
             int optionIndex = 0;
@@ -302,30 +454,39 @@ bool Coap::loop() {
             }
         }
 
-        if (packet.type == COAP_ACK) {
-            // call response function
-            resp(packet, _udp->remoteIP(), _udp->remotePort());
+        if (packet.type == COAP_ACK || packet.type == COAP_RESET || packet.code >= RESPONSE_CODE(2, 0)) {
+            // call response function, also for separate (CON/NON) responses
+            if (resp)
+                resp(packet, _udp->remoteIP(), _udp->remotePort());
+            handleTransferResponse(packet);
+            if (packet.type == COAP_RESET)
+                dropObserver(_udp->remoteIP(), _udp->remotePort(), packet.messageid); //observer rejected a notification
 
         } else {
 
-            String url = "";
             // call endpoint url function
-            for (int i = 0; i < packet.optionnum; i++) {
-                if (packet.options[i].number == COAP_URI_PATH && packet.options[i].length > 0) {
-                    char urlname[packet.options[i].length + 1];
-                    memcpy(urlname, packet.options[i].buffer, packet.options[i].length);
-                    urlname[packet.options[i].length] = 0;
-                    if(url.length() > 0)
-                      url += "/";
-                    url += (const char *)urlname;
-                }
-            }
-
-            if (!uri.find(url)) {
+            uint32_t hash = coapRequestHash(packet);
+            CoapBlockResource *block = NULL;
+            for (int i = 0; i < COAP_MAX_BLOCK_RESOURCES; i++)
+                if ((block_resources[i].sink || block_resources[i].source) && block_resources[i].route.hash == hash &&
+                        coapRouteMatch(block_resources[i].route, packet))
+                    block = &block_resources[i];
+
+            CoapObservable *observed = NULL;
+            for (int i = 0; i < COAP_MAX_OBSERVABLES; i++)
+                if (observables[i].route.path && observables[i].route.hash == hash && coapRouteMatch(observables[i].route, packet))
+                    observed = &observables[i];
+
+            CoapCallback *callback = block || observed ? NULL : uri.find(packet, hash);
+            if (block) {
+                handleBlockRequest(block, packet, _udp->remoteIP(), _udp->remotePort());
+            } else if (observed) {
+                handleObserveRequest(observed, packet, _udp->remoteIP(), _udp->remotePort());
+            } else if (!callback) {
                 sendResponse(_udp->remoteIP(), _udp->remotePort(), packet.messageid, NULL, 0,
                         COAP_NOT_FOUNT, COAP_NONE, NULL, 0);
             } else {
-                uri.find(url)(packet, _udp->remoteIP(), _udp->remotePort());
+                (*callback)(packet, _udp->remoteIP(), _udp->remotePort());
             }
         }
 
@@ -340,6 +501,7 @@ bool Coap::loop() {
         packetlen = _udp->parsePacket();
     }
 
+    observeHeartbeat();
     return true;
 }
 
@@ -378,3 +540,387 @@ uint16_t Coap::sendResponse(IPAddress ip, int port, uint16_t messageid, const ch
 
     return this->sendPacket(packet, ip, port);
 }
+
+uint16_t Coap::nextMessageId() {
+    return message_id ? message_id() : rand();
+}
+
+// uint option value, big endian without leading zero bytes, up to 3 bytes
+uint8_t Coap::encodeUint(uint32_t value, uint8_t *buffer) {
+    uint8_t len = value > 0xFFFF ? 3 : (value > 0xFF ? 2 : (value ? 1 : 0));
+    for (int i = 0; i < len; i++)
+        buffer[i] = value >> (8 * (len - 1 - i));
+    return len;
+}
+
+// Block option value: NUM, M and SZX in 0 to 3 bytes
+uint8_t Coap::encodeBlock(uint32_t num, bool more, uint8_t szx, uint8_t *buffer) {
+    return encodeUint((num << 4) | (more ? 0x08 : 0) | (szx & 0x07), buffer);
+}
+
+bool Coap::parseBlock(CoapPacket &packet, uint8_t number, uint32_t *num, bool *more, uint8_t *szx) {
+    for (int i = 0; i < packet.optionnum; i++) {
+        if (packet.options[i].number != number || packet.options[i].length > 3)
+            continue;
+        uint32_t value = 0;
+        for (int k = 0; k < packet.options[i].length; k++)
+            value = (value << 8) | packet.options[i].buffer[k];
+        *num = value >> 4;
+        *more = value & 0x08;
+        *szx = value & 0x07;
+        if (*szx > COAP_BLOCK_SZX_MAX)
+            *szx = COAP_BLOCK_SZX_MAX; //7 is reserved
+        return true;
+    }
+    return false;
+}
+
+// Largest block that fits into the buffer next to header and options
+uint8_t Coap::maxBlockSzx() {
+    uint8_t szx = 0;
+    while (szx < COAP_BLOCK_SZX_MAX && COAP_BLOCK_SIZE(szx + 1) + COAP_BLOCK_OVERHEAD <= coap_buf_size)
+        szx++;
+    return szx;
+}
+
+bool Coap::serverBlock(const char *url, CoapBlockSink sink, CoapBlockSource source) {
+    for (int i = 0; i < COAP_MAX_BLOCK_RESOURCES; i++) {
+        if (block_resources[i].sink || block_resources[i].source)
+            continue;
+        block_resources[i].route = CoapRoute{url, coapPathHash(url)};
+        block_resources[i].sink = sink;
+        block_resources[i].source = source;
+        return true;
+    }
+    return false;
+}
+
+uint16_t Coap::sendBlockResponse(IPAddress ip, int port, CoapPacket &request, COAP_RESPONSE_CODE code,
+        uint8_t option, uint32_t num, bool more, uint8_t szx, const uint8_t *payload, size_t payloadlen) {
+    CoapPacket packet;
+    packet.type = request.type == COAP_CON ? COAP_ACK : COAP_NONCON;
+    packet.code = code;
+    packet.token = request.token;
+    packet.tokenlen = request.tokenlen;
+    packet.payload = payload;
+    packet.payloadlen = payloadlen;
+    packet.messageid = request.type == COAP_CON ? request.messageid : nextMessageId();
+
+    uint8_t block[3];
+    packet.addOption(option, encodeBlock(num, more, szx, block), block);
+    return this->sendPacket(packet, ip, port);
+}
+
+// Server side: Block1 requests go block by block into the sink, GET is answered from the source with Block2
+void Coap::handleBlockRequest(CoapBlockResource *resource, CoapPacket &packet, IPAddress ip, int port) {
+    uint32_t num = 0;
+    bool more = false;
+    uint8_t szx = maxBlockSzx();
+
+    if ((packet.code == COAP_POST || packet.code == COAP_PUT) && resource->sink) {
+        bool has_block = parseBlock(packet, COAP_BLOCK1, &num, &more, &szx);
+        uint32_t offset = has_block ? num * COAP_BLOCK_SIZE(szx) : 0;
+        if (!resource->sink(offset, packet.payload, packet.payloadlen, more)) {
+            sendBlockResponse(ip, port, packet, COAP_REQUEST_ENTITY_INCOMPLETE, COAP_BLOCK1, num, false, szx, NULL, 0);
+            return;
+        }
+        // a smaller SZX in the response asks the client for smaller blocks from now on
+        uint8_t next_szx = szx < maxBlockSzx() ? szx : maxBlockSzx();
+        sendBlockResponse(ip, port, packet, more ? COAP_CONTINUE : COAP_CHANGED, COAP_BLOCK1, num, more, next_szx, NULL, 0);
+    } else if (packet.code == COAP_GET && resource->source) {
+        if (parseBlock(packet, COAP_BLOCK2, &num, &more, &szx) && szx > maxBlockSzx()) {
+            num = num * COAP_BLOCK_SIZE(szx) / COAP_BLOCK_SIZE(maxBlockSzx());
+            szx = maxBlockSzx();
+        }
+        uint8_t block[COAP_BLOCK_SIZE(COAP_BLOCK_SZX_MAX)]; //szx is at most maxBlockSzx() here
+        more = false;
+        size_t len = resource->source(num * COAP_BLOCK_SIZE(szx), block, COAP_BLOCK_SIZE(szx), &more);
+        sendBlockResponse(ip, port, packet, COAP_CONTENT, COAP_BLOCK2, num, more, szx, block, len);
+    } else {
+        sendResponse(ip, port, packet.messageid, NULL, 0, COAP_METHOD_NOT_ALLOWD, COAP_NONE, packet.token, packet.tokenlen);
+    }
+}
+
+uint16_t Coap::sendBlockRequest(COAP_METHOD method, uint8_t option, bool more, const uint8_t *payload, size_t payloadlen) {
+    CoapPacket packet;
+    packet.type = COAP_CON;
+    packet.code = method;
+    packet.token = transfer.token;
+    packet.tokenlen = transfer.tokenlen;
+    packet.payload = payload;
+    packet.payloadlen = payloadlen;
+    packet.messageid = nextMessageId();
+
+    char ipaddress[16] = "";
+    sprintf(ipaddress, "%d.%d.%d.%d", transfer.ip[0], transfer.ip[1], transfer.ip[2], transfer.ip[3]);
+    addUriOptions(packet, ipaddress, transfer.url);
+    uint8_t block[3];
+    packet.addOption(option, encodeBlock(transfer.num, more, transfer.szx, block), block);
+
+    transfer.messageid = this->sendPacket(packet, transfer.ip, transfer.port);
+    return transfer.messageid;
+}
+
+bool Coap::sendUploadBlock() {
+    uint8_t block[COAP_BLOCK_SIZE(COAP_BLOCK_SZX_MAX)];
+    bool more = false;
+    size_t len = transfer.source(transfer.num * COAP_BLOCK_SIZE(transfer.szx), block, COAP_BLOCK_SIZE(transfer.szx), &more);
+    transfer.more = more;
+    transfer.bytes = transfer.num * COAP_BLOCK_SIZE(transfer.szx) + len;
+    return sendBlockRequest(COAP_POST, COAP_BLOCK1, more, block, len) != 0;
+}
+
+// Client side: POST with Block1, the next block goes out when the previous one was confirmed with 2.31 Continue
+bool Coap::upload(IPAddress ip, int port, const char *url, const uint8_t *token, uint8_t tokenlen, uint8_t szx,
+        CoapBlockSource source, CoapTransferDone done) {
+    if (transfer.active || strlen(url) >= COAP_BLOCK_URL_SIZE || tokenlen > 8)
+        return false;
+    transfer.active = true;
+    transfer.upload = true;
+    transfer.ip = ip;
+    transfer.port = port;
+    strcpy(transfer.url, url);
+    memcpy(transfer.token, token, tokenlen);
+    transfer.tokenlen = tokenlen;
+    transfer.num = 0;
+    transfer.szx = szx < maxBlockSzx() ? szx : maxBlockSzx();
+    transfer.bytes = 0;
+    transfer.source = source;
+    transfer.done = done;
+    if (!sendUploadBlock()) {
+        transfer.active = false;
+        return false;
+    }
+    return true;
+}
+
+// Client side: GET with Block2, every block is handed to the sink before the next one is requested
+bool Coap::download(IPAddress ip, int port, const char *url, const uint8_t *token, uint8_t tokenlen, uint8_t szx,
+        CoapBlockSink sink, CoapTransferDone done) {
+    if (transfer.active || strlen(url) >= COAP_BLOCK_URL_SIZE || tokenlen > 8)
+        return false;
+    transfer.active = true;
+    transfer.upload = false;
+    transfer.ip = ip;
+    transfer.port = port;
+    strcpy(transfer.url, url);
+    memcpy(transfer.token, token, tokenlen);
+    transfer.tokenlen = tokenlen;
+    transfer.num = 0;
+    transfer.szx = szx < maxBlockSzx() ? szx : maxBlockSzx();
+    transfer.bytes = 0;
+    transfer.sink = sink;
+    transfer.done = done;
+    if (!sendBlockRequest(COAP_GET, COAP_BLOCK2, false, NULL, 0)) {
+        transfer.active = false;
+        return false;
+    }
+    return true;
+}
+
+void Coap::finishTransfer(uint8_t code) {
+    transfer.active = false;
+    if (transfer.done)
+        transfer.done(code, transfer.bytes);
+}
+
+// Called when the exchange carrying a block failed, e.g. after the last retransmission
+void Coap::abortTransfer(uint16_t messageid) {
+    if (transfer.active && transfer.messageid == messageid)
+        finishTransfer(0);
+}
+
+// Responses of an older block (duplicates, late ACKs) don't match the current block number and are ignored
+void Coap::handleTransferResponse(CoapPacket &packet) {
+    if (!transfer.active || packet.code == 0 || packet.tokenlen != transfer.tokenlen ||
+            memcmp(packet.token, transfer.token, transfer.tokenlen) != 0)
+        return;
+
+    uint32_t num;
+    bool more;
+    uint8_t szx;
+    if (transfer.upload) {
+        bool has_block = parseBlock(packet, COAP_BLOCK1, &num, &more, &szx);
+        if (has_block && num != transfer.num)
+            return;
+        if (packet.code == COAP_CONTINUE && transfer.more) {
+            if (has_block && szx < transfer.szx)
+                transfer.szx = szx;
+            transfer.num = transfer.bytes / COAP_BLOCK_SIZE(transfer.szx);
+            if (!sendUploadBlock())
+                finishTransfer(0);
+            return;
+        }
+        if (packet.code == COAP_REQUEST_ENTITY_TOO_LARGE && has_block && szx < transfer.szx && transfer.num == 0) {
+            transfer.szx = szx; //server buffer is smaller, start over with the size it asked for
+            if (!sendUploadBlock())
+                finishTransfer(0);
+            return;
+        }
+        finishTransfer(packet.code);
+        return;
+    }
+
+    if (packet.code != COAP_CONTENT) {
+        finishTransfer(packet.code);
+        return;
+    }
+    if (!parseBlock(packet, COAP_BLOCK2, &num, &more, &szx)) {
+        // whole representation in one response
+        bool ok = transfer.sink(0, packet.payload, packet.payloadlen, false);
+        transfer.bytes = packet.payloadlen;
+        finishTransfer(ok ? packet.code : 0);
+        return;
+    }
+    if (num * COAP_BLOCK_SIZE(szx) != transfer.num * COAP_BLOCK_SIZE(transfer.szx))
+        return;
+    uint32_t offset = num * COAP_BLOCK_SIZE(szx);
+    if (!transfer.sink(offset, packet.payload, packet.payloadlen, more)) {
+        finishTransfer(0);
+        return;
+    }
+    transfer.bytes = offset + packet.payloadlen;
+    if (!more) {
+        finishTransfer(packet.code);
+        return;
+    }
+    transfer.szx = szx; //server may answer with smaller blocks than requested
+    transfer.num = num + 1;
+    if (!sendBlockRequest(COAP_GET, COAP_BLOCK2, false, NULL, 0))
+        finishTransfer(0);
+}
+
+bool Coap::serverObservable(const char *url, uint32_t max_age, COAP_CONTENT_TYPE content_type) {
+    for (int i = 0; i < COAP_MAX_OBSERVABLES; i++) {
+        if (observables[i].route.path)
+            continue;
+        observables[i].route = CoapRoute{url, coapPathHash(url)};
+        observables[i].max_age = max_age;
+        observables[i].content_type = content_type;
+        observables[i].last_notify = millis();
+        return true;
+    }
+    return false;
+}
+
+CoapObservable* Coap::observable(const char *url) {
+    uint32_t hash = coapPathHash(url);
+    for (int i = 0; i < COAP_MAX_OBSERVABLES; i++)
+        if (observables[i].route.path && observables[i].route.hash == hash && strcmp(observables[i].route.path, url) == 0)
+            return &observables[i];
+    return NULL;
+}
+
+// Observe 0 registers (or renews) endpoint and token, 1 deregisters, without a free slot the GET is answered
+// without the Observe option, which tells the client it isn't observing (RFC 7641 4.1)
+void Coap::handleObserveRequest(CoapObservable *resource, CoapPacket &packet, IPAddress ip, int port) {
+    COAP_TYPE type = packet.type == COAP_CON ? COAP_ACK : COAP_NONCON;
+    uint16_t messageid = packet.type == COAP_CON ? packet.messageid : nextMessageId();
+    if (packet.code != COAP_GET) {
+        sendResponse(ip, port, packet.messageid, NULL, 0, COAP_METHOD_NOT_ALLOWD, COAP_NONE, packet.token, packet.tokenlen);
+        return;
+    }
+
+    int32_t observe = -1;
+    for (int i = 0; i < packet.optionnum; i++) {
+        if (packet.options[i].number != COAP_OBSERVE || packet.options[i].length > 3)
+            continue;
+        observe = 0;
+        for (int k = 0; k < packet.options[i].length; k++)
+            observe = (observe << 8) | packet.options[i].buffer[k];
+    }
+
+    CoapObserver *observer = NULL;
+    for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+        CoapObserver *o = &resource->observers[i];
+        if (o->used && o->ip == ip && o->port == port && o->tokenlen == packet.tokenlen &&
+                memcmp(o->token, packet.token, packet.tokenlen) == 0)
+            observer = o;
+    }
+    if (observe == 0 && !observer) {
+        for (int i = 0; i < COAP_MAX_OBSERVERS && !observer; i++)
+            if (!resource->observers[i].used)
+                observer = &resource->observers[i];
+        if (observer) {
+            observer->used = true;
+            observer->ip = ip;
+            observer->port = port;
+            observer->tokenlen = packet.tokenlen;
+            memcpy(observer->token, packet.token, packet.tokenlen);
+        }
+    } else if (observe == 1 && observer) {
+        observer->used = false;
+        observer = NULL;
+    }
+
+    if (observer)
+        observer->messageid = messageid;
+    sendObserveResponse(resource, ip, port, type, messageid, packet.token, packet.tokenlen, observe == 0 && observer);
+}
+
+uint16_t Coap::sendObserveResponse(CoapObservable *resource, IPAddress ip, int port, COAP_TYPE type, uint16_t messageid,
+        const uint8_t *token, uint8_t tokenlen, bool observe) {
+    CoapPacket packet;
+    packet.type = type;
+    packet.code = COAP_CONTENT;
+    packet.token = token;
+    packet.tokenlen = tokenlen;
+    packet.payload = resource->payload;
+    packet.payloadlen = resource->payloadlen;
+    packet.messageid = messageid;
+
+    uint8_t sequence[3];
+    if (observe)
+        packet.addOption(COAP_OBSERVE, encodeUint(resource->sequence & 0xFFFFFF, sequence), sequence);
+    uint8_t format[2];
+    if (resource->content_type != COAP_NONE)
+        packet.addOption(COAP_CONTENT_FORMAT, encodeUint((uint16_t)resource->content_type, format), format);
+    uint8_t max_age[3];
+    packet.addOption(COAP_MAX_AGE, encodeUint(resource->max_age + COAP_OBSERVE_MAX_AGE_MARGIN, max_age), max_age);
+    return this->sendPacket(packet, ip, port);
+}
+
+// Sends the representation to every observer if it changed or confirmable is set, returns the number notified
+uint8_t Coap::notify(CoapObservable *resource, const uint8_t *payload, size_t payloadlen, bool confirmable) {
+    if (payloadlen > COAP_OBSERVE_PAYLOAD_SIZE)
+        return 0;
+    if (payload != resource->payload) {
+        memcpy(resource->payload, payload, payloadlen);
+        resource->payloadlen = payloadlen;
+    }
+    resource->sequence = (resource->sequence + 1) & 0xFFFFFF;
+    resource->last_notify = millis();
+
+    uint8_t notified = 0;
+    for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+        CoapObserver *observer = &resource->observers[i];
+        if (!observer->used)
+            continue;
+        uint16_t messageid = nextMessageId();
+        if (sendObserveResponse(resource, observer->ip, observer->port, confirmable ? COAP_CON : COAP_NONCON, messageid,
+                observer->token, observer->tokenlen, true) == 0)
+            continue;
+        observer->messageid = messageid;
+        notified++;
+        resource->notifications++;
+    }
+    return notified;
+}
+
+// Message IDs are only unique per endpoint, another client may use the same one
+void Coap::dropObserver(IPAddress ip, int port, uint16_t messageid) {
+    for (int i = 0; i < COAP_MAX_OBSERVABLES; i++)
+        for (int k = 0; k < COAP_MAX_OBSERVERS; k++) {
+            CoapObserver *o = &observables[i].observers[k];
+            if (o->used && o->ip == ip && o->port == port && o->messageid == messageid)
+                o->used = false;
+        }
+}
+
+// Confirmable notification of the unchanged value after max_age, observers that are gone never acknowledge it
+void Coap::observeHeartbeat() {
+    uint32_t now = millis();
+    for (int i = 0; i < COAP_MAX_OBSERVABLES; i++)
+        if (observables[i].route.path && observables[i].count() && now - observables[i].last_notify >= observables[i].max_age * 1000)
+            notify(&observables[i], observables[i].payload, observables[i].payloadlen, true);
+}
@@ -39,6 +39,31 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #endif
 #define COAP_DEFAULT_PORT 5683
 
+// Block-wise transfer (RFC 7959)
+#define COAP_BLOCK_SIZE(szx) (16 << (szx))
+#define COAP_BLOCK_SZX_MAX 6          // 1024 bytes
+#define COAP_BLOCK_OVERHEAD 48        // header, token and options next to a block payload
+#ifndef COAP_BLOCK_URL_SIZE
+#define COAP_BLOCK_URL_SIZE 32
+#endif
+#ifndef COAP_TEMPLATE_SIZE
+#define COAP_TEMPLATE_SIZE 48         // prepared request header, token and options
+#endif
+// Observe (RFC 7641)
+#ifndef COAP_MAX_OBSERVABLES
+#define COAP_MAX_OBSERVABLES 2
+#endif
+#ifndef COAP_MAX_OBSERVERS
+#define COAP_MAX_OBSERVERS 4          // per resource
+#endif
+#ifndef COAP_OBSERVE_PAYLOAD_SIZE
+#define COAP_OBSERVE_PAYLOAD_SIZE 32  // current representation kept for registrations and heartbeats
+#endif
+#define COAP_OBSERVE_MAX_AGE_MARGIN 10 // s added to Max-Age, so a heartbeat arrives before the value goes stale
+#ifndef COAP_MAX_BLOCK_RESOURCES
+#define COAP_MAX_BLOCK_RESOURCES 4
+#endif
+
 #define RESPONSE_CODE(class, detail) ((class << 5) | (detail))
 #define COAP_OPTION_DELTA(v, n) (v < 13 ? (*n = (0xFF & v)) : (v <= 0xFF + 13 ? (*n = 13) : (*n = 14)))
 
@@ -62,6 +87,7 @@ typedef enum {
     COAP_VALID = RESPONSE_CODE(2, 3),
     COAP_CHANGED = RESPONSE_CODE(2, 4),
     COAP_CONTENT = RESPONSE_CODE(2, 5),
+    COAP_CONTINUE = RESPONSE_CODE(2, 31),
     COAP_BAD_REQUEST = RESPONSE_CODE(4, 0),
     COAP_UNAUTHORIZED = RESPONSE_CODE(4, 1),
     COAP_BAD_OPTION = RESPONSE_CODE(4, 2),
@@ -69,6 +95,7 @@ typedef enum {
     COAP_NOT_FOUNT = RESPONSE_CODE(4, 4),
     COAP_METHOD_NOT_ALLOWD = RESPONSE_CODE(4, 5),
     COAP_NOT_ACCEPTABLE = RESPONSE_CODE(4, 6),
+    COAP_REQUEST_ENTITY_INCOMPLETE = RESPONSE_CODE(4, 8),
     COAP_PRECONDITION_FAILED = RESPONSE_CODE(4, 12),
     COAP_REQUEST_ENTITY_TOO_LARGE = RESPONSE_CODE(4, 13),
     COAP_UNSUPPORTED_CONTENT_FORMAT = RESPONSE_CODE(4, 15),
@@ -85,6 +112,7 @@ typedef enum {
     COAP_URI_HOST = 3,
     COAP_E_TAG = 4,
     COAP_IF_NONE_MATCH = 5,
+    COAP_OBSERVE = 6,
     COAP_URI_PORT = 7,
     COAP_LOCATION_PATH = 8,
     COAP_URI_PATH = 11,
@@ -93,8 +121,12 @@ typedef enum {
     COAP_URI_QUERY = 15,
     COAP_ACCEPT = 17,
     COAP_LOCATION_QUERY = 20,
+    COAP_BLOCK2 = 23,
+    COAP_BLOCK1 = 27,
+    COAP_SIZE2 = 28,
     COAP_PROXY_URI = 35,
-    COAP_PROXY_SCHEME = 39
+    COAP_PROXY_SCHEME = 39,
+    COAP_SIZE1 = 60
 } COAP_OPTION_NUMBER;
 
 typedef enum {
@@ -130,43 +162,142 @@ class CoapPacket {
 		void addOption(uint8_t number, uint8_t length, uint8_t *opt_payload);
 };
 
-#if defined(ESP8266)
-#include <functional>
-typedef std::function<void(CoapPacket &, IPAddress, int)> CoapCallback;
-#elif defined(ESP32)
+// Route of a server resource, path segments joined with '/', the path has to be a static string.
+// The hash is FNV-1a over the path, with COAP_ROUTE it is computed at compile time for constexpr tables.
+#define COAP_HASH_SEED 2166136261u
+#define COAP_HASH_STEP(hash, c) (((hash) ^ (uint8_t)(c)) * 16777619u)
+constexpr uint32_t coapPathHash(const char *path, uint32_t hash = COAP_HASH_SEED) {
+    return *path ? coapPathHash(path + 1, COAP_HASH_STEP(hash, *path)) : hash;
+}
+
+struct CoapRoute {
+    const char *path;
+    uint32_t hash;
+};
+#define COAP_ROUTE(path) CoapRoute{path, coapPathHash(path)}
+
+// Matching works on the Uri-Path options of the packet, no path string is built
+uint32_t coapRequestHash(CoapPacket &packet);
+bool coapRouteMatch(const CoapRoute &route, CoapPacket &packet);
+
+// Block callbacks stream through caller owned buffers:
+// a source fills up to size bytes at offset and sets *more, a sink takes one block and returns false to abort,
+// done gets the final response code (0 if aborted) and the number of transferred bytes.
+#if defined(ESP8266) || defined(ESP32) || defined(COAP_HOST)
 #include <functional>
 typedef std::function<void(CoapPacket &, IPAddress, int)> CoapCallback;
+typedef std::function<bool(const uint8_t *, size_t, IPAddress, int)> CoapTransmit;
+typedef std::function<uint16_t()> CoapMessageId;
+typedef std::function<size_t(uint32_t, uint8_t *, size_t, bool *)> CoapBlockSource;
+typedef std::function<bool(uint32_t, const uint8_t *, size_t, bool)> CoapBlockSink;
+typedef std::function<void(uint8_t, uint32_t)> CoapTransferDone;
 #else
 typedef void (*CoapCallback)(CoapPacket &, IPAddress, int);
+typedef bool (*CoapTransmit)(const uint8_t *, size_t, IPAddress, int);
+typedef uint16_t (*CoapMessageId)();
+typedef size_t (*CoapBlockSource)(uint32_t, uint8_t *, size_t, bool *);
+typedef bool (*CoapBlockSink)(uint32_t, const uint8_t *, size_t, bool);
+typedef void (*CoapTransferDone)(uint8_t, uint32_t);
 #endif
 
+// Server resource handled block-wise: sink for POST/PUT (Block1), source for GET (Block2)
+class CoapBlockResource {
+    public:
+        CoapRoute route = {NULL, 0};
+        CoapBlockSink sink = NULL;
+        CoapBlockSource source = NULL;
+};
+
+// Client side block-wise transfer, one at a time
+class CoapTransfer {
+    public:
+        bool active = false;
+        bool upload = false;
+        bool more = false;
+        IPAddress ip;
+        int port = 0;
+        char url[COAP_BLOCK_URL_SIZE];
+        uint8_t token[8];
+        uint8_t tokenlen = 0;
+        uint32_t num = 0;
+        uint8_t szx = 0;
+        uint32_t bytes = 0;
+        uint16_t messageid = 0;
+        CoapBlockSource source = NULL;
+        CoapBlockSink sink = NULL;
+        CoapTransferDone done = NULL;
+};
+
+// Prepared request: header and options encoded once, message ID and token are patched per send
+class CoapTemplate {
+    public:
+        uint8_t header[COAP_TEMPLATE_SIZE];
+        uint8_t len = 0;       // 0 until prepared
+        uint8_t tokenlen = 0;
+        IPAddress ip;
+        int port = 0;
+};
+
+class CoapObserver {
+    public:
+        bool used = false;
+        IPAddress ip;
+        int port = 0;
+        uint8_t token[8];
+        uint8_t tokenlen = 0;
+        uint16_t messageid = 0;  // last notification, an RST or a failed CON for it removes the observer
+};
+
+// Observable resource: GET with Observe 0 registers, notify() pushes a new representation to every observer,
+// confirmable heartbeats go out every max_age seconds without a change
+class CoapObservable {
+    public:
+        CoapRoute route = {NULL, 0};
+        CoapObserver observers[COAP_MAX_OBSERVERS];
+        uint8_t payload[COAP_OBSERVE_PAYLOAD_SIZE];
+        size_t payloadlen = 0;
+        COAP_CONTENT_TYPE content_type = COAP_NONE;
+        uint32_t max_age = 60;    // s
+        uint32_t sequence = 0;    // Observe option value, 24 bit
+        uint32_t last_notify = 0;
+        uint32_t notifications = 0;
+
+        uint8_t count() {
+            uint8_t n = 0;
+            for (int i = 0; i < COAP_MAX_OBSERVERS; i++) n += observers[i].used;
+            return n;
+        }
+};
+
 class CoapUri {
     private:
-        String u[COAP_MAX_CALLBACK];
+        CoapRoute r[COAP_MAX_CALLBACK];
         CoapCallback c[COAP_MAX_CALLBACK];
     public:
         CoapUri() {
             for (int i = 0; i < COAP_MAX_CALLBACK; i++) {
-                u[i] = "";
+                r[i] = {NULL, 0};
                 c[i] = NULL;
             }
         };
-        void add(CoapCallback call, String url) {
+        void add(CoapCallback call, const CoapRoute &route) {
             for (int i = 0; i < COAP_MAX_CALLBACK; i++)
-                if (c[i] != NULL && u[i].equals(url)) {
+                if (c[i] != NULL && r[i].hash == route.hash && strcmp(r[i].path, route.path) == 0) {
                     c[i] = call;
                     return ;
                 }
             for (int i = 0; i < COAP_MAX_CALLBACK; i++) {
                 if (c[i] == NULL) {
                     c[i] = call;
-                    u[i] = url;
+                    r[i] = route;
                     return;
                 }
             }
         };
-        CoapCallback find(String url) {
-            for (int i = 0; i < COAP_MAX_CALLBACK; i++) if (c[i] != NULL && u[i].equals(url)) return c[i];
+        // pointer into the slot, copying a std::function could allocate
+        CoapCallback* find(CoapPacket &packet, uint32_t hash) {
+            for (int i = 0; i < COAP_MAX_CALLBACK; i++)
+                if (c[i] != NULL && r[i].hash == hash && coapRouteMatch(r[i], packet)) return &c[i];
             return NULL;
         } ;
 };
@@ -176,6 +307,11 @@ class Coap {
         UDP *_udp;
         CoapUri uri;
         CoapCallback resp;
+        CoapTransmit transmit = NULL;
+        CoapMessageId message_id = NULL;
+        CoapBlockResource block_resources[COAP_MAX_BLOCK_RESOURCES];
+        CoapObservable observables[COAP_MAX_OBSERVABLES];
+        CoapTransfer transfer;
         int _port;
         int coap_buf_size;
         uint8_t *tx_buffer = NULL;
@@ -183,7 +319,23 @@ class Coap {
 
         uint16_t sendPacket(CoapPacket &packet, IPAddress ip);
         uint16_t sendPacket(CoapPacket &packet, IPAddress ip, int port);
+        uint16_t encodePacket(CoapPacket &packet, uint8_t *buffer, size_t buffer_size);
         int parseOption(CoapOption *option, uint16_t *running_delta, uint8_t **buf, size_t buflen);
+        void addUriOptions(CoapPacket &packet, const char *host, const char *url);
+        uint16_t nextMessageId();
+        uint16_t sendBlockRequest(COAP_METHOD method, uint8_t option, bool more, const uint8_t *payload, size_t payloadlen);
+        bool sendUploadBlock();
+        void handleTransferResponse(CoapPacket &packet);
+        void finishTransfer(uint8_t code);
+        void handleBlockRequest(CoapBlockResource *resource, CoapPacket &packet, IPAddress ip, int port);
+        uint16_t sendBlockResponse(IPAddress ip, int port, CoapPacket &request, COAP_RESPONSE_CODE code,
+            uint8_t option, uint32_t num, bool more, uint8_t szx, const uint8_t *payload, size_t payloadlen);
+        static uint8_t encodeUint(uint32_t value, uint8_t *buffer);
+        void handleObserveRequest(CoapObservable *resource, CoapPacket &packet, IPAddress ip, int port);
+        uint16_t sendObserveResponse(CoapObservable *resource, IPAddress ip, int port, COAP_TYPE type, uint16_t messageid,
+            const uint8_t *token, uint8_t tokenlen, bool observe);
+        void dropObserver(IPAddress ip, int port, uint16_t messageid);
+        void observeHeartbeat();
 
     public:
         Coap(
@@ -194,8 +346,33 @@ class Coap {
         bool start();
         bool start(int port);
         void response(CoapCallback c) { resp = c; }
+        // encoded datagrams go to the transmitter instead of the socket, e.g. for a retransmission layer
+        void transmitter(CoapTransmit t) { transmit = t; }
+        bool sendDatagram(const uint8_t *datagram, size_t len, IPAddress ip, int port);
+        uint16_t sendEmpty(IPAddress ip, int port, COAP_TYPE type, uint16_t messageid);
+        void messageIds(CoapMessageId source) { message_id = source; }
+
+        // RFC 7959 block-wise transfers
+        static uint8_t encodeBlock(uint32_t num, bool more, uint8_t szx, uint8_t *buffer);
+        static bool parseBlock(CoapPacket &packet, uint8_t number, uint32_t *num, bool *more, uint8_t *szx);
+        uint8_t maxBlockSzx();
+        bool serverBlock(const char *url, CoapBlockSink sink, CoapBlockSource source);
+        bool upload(IPAddress ip, int port, const char *url, const uint8_t *token, uint8_t tokenlen, uint8_t szx,
+            CoapBlockSource source, CoapTransferDone done);
+        bool download(IPAddress ip, int port, const char *url, const uint8_t *token, uint8_t tokenlen, uint8_t szx,
+            CoapBlockSink sink, CoapTransferDone done);
+        bool transferActive() { return transfer.active; }
+        void abortTransfer(uint16_t messageid);
+        void abortTransfer() { if (transfer.active) finishTransfer(0); }
+        void exchangeFailed(uint16_t messageid, IPAddress ip, int port) { abortTransfer(messageid); dropObserver(ip, port, messageid); }
 
-        void server(CoapCallback c, String url) { uri.add(c, url); }
+        // RFC 7641 Observe, server side
+        bool serverObservable(const char *url, uint32_t max_age, COAP_CONTENT_TYPE content_type = COAP_NONE);
+        CoapObservable* observable(const char *url);
+        uint8_t notify(CoapObservable *resource, const uint8_t *payload, size_t payloadlen, bool confirmable = false);
+
+        void server(CoapCallback c, const char *url) { uri.add(c, CoapRoute{url, coapPathHash(url)}); }
+        void server(CoapCallback c, const CoapRoute &route) { uri.add(c, route); }
         uint16_t sendResponse(IPAddress ip, int port, uint16_t messageid);
         uint16_t sendResponse(IPAddress ip, int port, uint16_t messageid, const char *payload);
         uint16_t sendResponse(IPAddress ip, int port, uint16_t messageid, const char *payload, size_t payloadlen);
@@ -208,6 +385,10 @@ class Coap {
         uint16_t send(IPAddress ip, int port, const char *url, COAP_TYPE type, COAP_METHOD method, const uint8_t *token, uint8_t tokenlen, const uint8_t *payload, size_t payloadlen, COAP_CONTENT_TYPE content_type);
         uint16_t send(IPAddress ip, int port, const char *url, COAP_TYPE type, COAP_METHOD method, const uint8_t *token, uint8_t tokenlen, const uint8_t *payload, size_t payloadlen, COAP_CONTENT_TYPE content_type, uint16_t messageid);
 
+        bool prepare(CoapTemplate &request, IPAddress ip, int port, const char *url, COAP_TYPE type, COAP_METHOD method,
+            uint8_t tokenlen, COAP_CONTENT_TYPE content_type = COAP_NONE);
+        uint16_t send(CoapTemplate &request, uint16_t messageid, const uint8_t *token, const uint8_t *payload, size_t payloadlen);
+
         bool loop();
 };
 
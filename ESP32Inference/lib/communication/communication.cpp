@@ -1,7 +1,13 @@
 #include "communication.h"
 #include "esp_log.h"
+#include "trace.h"
+#include "energy.h"
+#include <Preferences.h>
 static const char* TAG = "COMM";
 
+// RTC copy survives deep sleep, NVS copy survives power cycles and is only rewritten on changes
+RTC_DATA_ATTR static WiFiCache cache;
+
 #define RESOLVE_CODE(code) RESPONSE_CODE(code >> 5, code & 0x1F)
 
 Communication* Communication::instance = nullptr;
@@ -10,41 +16,345 @@ Communication::Communication(const char *ssid, const char *pass, IPAddress coap_
     ssid(ssid),
     pass(pass),
     coap_server(coap_server_ip), 
-    coap_port(coap_port)
+    coap_port(coap_port),
+    reliable(&Communication::sendDatagram, this)
 { 
     instance = this;
     udp = new WiFiUDP();
     coap = new Coap(*udp);
+    reliable.seed(esp_random());
+    reliable.onFailed(&Communication::exchangeFailed);
+    // confirmable messages are copied into the pending table and sent from there, ACKs go out directly,
+    // both end in sendDatagram() which charges the airtime
+    coap->transmitter([this](const uint8_t *datagram, size_t len, IPAddress ip, int port) {
+        if(((datagram[0] >> 4) & 0x03) == COAP_CON)
+            return reliable.enqueue(datagram, len, (uint32_t)ip, port, millis());
+        return sendDatagram(datagram, len, (uint32_t)ip, port, this);
+    });
+    coap->messageIds([this]() { return reliable.nextMessageId(); });
 }
 
+// Starts connecting in the background, update() has to be called from the loop
 void Communication::begin()
 {
-    WiFi.begin(ssid, pass);
-    Serial.print("Connecting");
-    while(WiFi.status() != WL_CONNECTED)
+    static bool events_registered = false;
+    if(!events_registered)
+    {
+        WiFi.onEvent(&Communication::handleWiFiEvent);
+        events_registered = true;
+    }
+    if(cache.magic != WIFI_CACHE_MAGIC)
+    {
+        Preferences nvs;
+        nvs.begin("wifi", true);
+        if(nvs.getBytes("cache", &cache, sizeof(cache)) != sizeof(cache) || cache.magic != WIFI_CACHE_MAGIC)
+            memset(&cache, 0, sizeof(cache));
+        nvs.end();
+    }
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(false); //reconnects are paced by update()
+    started = true;
+    online = false;
+    link_up = false;
+    radioState();
+    retry_delay = WIFI_RETRY_MIN_MS;
+    cached_attempt = cache.magic == WIFI_CACHE_MAGIC;
+    connect();
+}
+
+void Communication::connect()
+{
+    link_dropped = false;
+    if(cached_attempt)
+    {
+        // lease is reused as a static IP, a failed attempt falls back to scan and DHCP
+        WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+        WiFi.begin(ssid, pass, cache.channel, cache.bssid);
+    }
+    else
     {
-        delay(100);
-        Serial.print(".");
+        WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+        WiFi.begin(ssid, pass);
     }
-    Serial.printf("\nWIFI Connected! SSID: %s\n", ssid);
+    connect_start = millis();
+    connecting = true;
+}
+
+void Communication::connected()
+{
+    Serial.printf("WIFI Connected! SSID: %s, %s in %u ms\n", ssid,
+        cached_attempt ? "cached BSSID/IP" : "scan/DHCP", millis() - connect_start);
+    connecting = false;
+    online = true;
+    retry_delay = WIFI_RETRY_MIN_MS;
+    if(!cached_attempt)
+        saveCache();
+    cached_attempt = true;
+    radioState();
     coap->response(&Communication::handleResponse);
     coap->start();
 }
 
+void Communication::saveCache()
+{
+    WiFiCache current;
+    current.magic = WIFI_CACHE_MAGIC;
+    memcpy(current.bssid, WiFi.BSSID(), sizeof(current.bssid));
+    current.channel = WiFi.channel();
+    current.ip = WiFi.localIP();
+    current.gateway = WiFi.gatewayIP();
+    current.subnet = WiFi.subnetMask();
+    current.dns = WiFi.dnsIP();
+    if(!memcmp(&current, &cache, sizeof(cache)))
+        return;
+    cache = current;
+    Preferences nvs;
+    nvs.begin("wifi", false);
+    nvs.putBytes("cache", &cache, sizeof(cache));
+    nvs.end();
+}
+
+void Communication::end()
+{
+    if(!idle())
+        ESP_LOGE(TAG, "Radio off with %u unacknowledged messages", reliable.queued());
+    reliable.clear();
+    coap->abortTransfer();
+    started = false;
+    connecting = false;
+    online = false;
+    WiFi.disconnect(true); //radio off until the next begin()
+    radioState();
+}
+
+void Communication::setPowerSave(wifi_ps_type_t mode)
+{
+    WiFi.setSleep(mode);
+    power_save = mode != WIFI_PS_NONE;
+    radioState();
+}
+
+// Not associated the radio listens all the time, associated power save lets it sleep between beacons
+void Communication::radioState()
+{
+    ENERGY_STATE(radio(!started ? RADIO_OFF : online && power_save ? RADIO_MODEM_SLEEP : RADIO_RX));
+}
+
+// Runs the connection state machine and the CoAP client
 void Communication::update()
 {
-    coap->loop();
+    if(link_up)
+    {
+        if(!online)
+            connected();
+        coap->loop();
+        reliable.poll(millis());
+        return;
+    }
+    if(!started)
+        return;
+    uint32_t now = millis();
+    if(online)
+    {
+        ESP_LOGE(TAG, "WiFi link lost");
+        online = false;
+        next_retry = now;
+        radioState();
+    }
+    else if(connecting && (link_dropped || now - connect_start > WIFI_CONNECT_TIMEOUT))
+    {
+        connecting = false;
+        if(cached_attempt)
+        {
+            ESP_LOGE(TAG, "Cached reconnect failed, scanning");
+            cached_attempt = false;
+            next_retry = now;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "WiFi connect failed, retry in %u ms", retry_delay);
+            next_retry = now + retry_delay;
+            retry_delay = retry_delay * 2 > WIFI_RETRY_MAX_MS ? WIFI_RETRY_MAX_MS : retry_delay * 2;
+        }
+    }
+    if(!connecting && (int32_t)(now - next_retry) >= 0)
+        connect();
+}
+
+bool Communication::waitConnected(uint32_t timeout_ms)
+{
+    uint32_t start = millis();
+    while(!online && millis() - start < timeout_ms)
+    {
+        update();
+        delay(10);
+    }
+    return online;
 }
 
+// Waits for a free slot in the pending table
+bool Communication::waitSendSlot(uint32_t timeout_ms)
+{
+    uint32_t start = millis();
+    while(online && !canSend() && millis() - start < timeout_ms)
+    {
+        update();
+        delay(5);
+    }
+    return canSend();
+}
 
-void Communication::sendData(const char* resource, Data* data)
+// Waits until every confirmable message was acknowledged or has failed
+bool Communication::flush(uint32_t timeout_ms)
 {
-    coap->send(coap_server, coap_port, resource, COAP_CON, COAP_POST, nullptr, 0, (uint8_t*)data, sizeof(Data));
+    uint32_t start = millis();
+    while(online && !idle() && millis() - start < timeout_ms)
+    {
+        update();
+        delay(5);
+    }
+    return idle();
 }
 
-void Communication::sendPrediction(const char* resource, Prediction* data)
+// Uplink is gated on the link state and the pending table, false if nothing was queued
+bool Communication::post(const char* resource, const uint8_t *payload, size_t len)
 {
-    coap->send(coap_server, coap_port, resource, COAP_CON, COAP_POST, nullptr, 0, (uint8_t*)data, sizeof(Prediction));
+    if(!canSend())
+        return false;
+    uint8_t token[COAP_TOKEN_LENGTH];
+    uint8_t token_len = reliable.nextToken(token);
+    CoapTemplate *request = requestTemplate(resource);
+    if(request && request->tokenlen == token_len)
+        return coap->send(*request, reliable.nextMessageId(), token, payload, len) != 0;
+    return coap->send(coap_server, coap_port, resource, COAP_CON, COAP_POST, token, token_len, payload, len,
+        COAP_NONE, reliable.nextMessageId()) != 0;
+}
+
+// POST header and options per resource are encoded on first use, the resource strings are constants
+CoapTemplate* Communication::requestTemplate(const char* resource)
+{
+    for(int i = 0; i < COMM_TEMPLATES; i++)
+    {
+        if(template_resource[i] == resource || (template_resource[i] && strcmp(template_resource[i], resource) == 0))
+            return &templates[i];
+        if(!template_resource[i])
+        {
+            if(!coap->prepare(templates[i], coap_server, coap_port, resource, COAP_CON, COAP_POST, COAP_TOKEN_LENGTH))
+                return nullptr;
+            template_resource[i] = resource;
+            return &templates[i];
+        }
+    }
+    return nullptr;
+}
+
+bool Communication::sendData(const char* resource, Data* data)
+{
+    return post(resource, (uint8_t*)data, sizeof(Data));
+}
+
+bool Communication::sendReport(const char* resource, ReportedData* data)
+{
+    return post(resource, (uint8_t*)data, sizeof(ReportedData));
+}
+
+bool Communication::sendPrediction(const char* resource, Prediction* data)
+{
+    return post(resource, (uint8_t*)data, sizeof(Prediction));
+}
+
+bool Communication::sendInference(const char* resource, InferenceRecord* record)
+{
+    return post(resource, (uint8_t*)record, sizeof(InferenceRecord));
+}
+
+// Device side resource observed by dashboards (RFC 7641), served on the CoAP port while the link is up
+bool Communication::observable(const char* resource, uint32_t max_age_s)
+{
+    return coap->serverObservable(resource, max_age_s, COAP_APPLICATION_OCTET_STREAM);
+}
+
+// Observers only hear about changes, unchanged values are covered by the max-age heartbeat
+uint8_t Communication::publishPrediction(const char* resource, Prediction* prediction)
+{
+    CoapObservable *observed = coap->observable(resource);
+    if(!observed || !online)
+        return 0;
+    if(observed->payloadlen == sizeof(Prediction) && !memcmp(observed->payload, prediction, sizeof(Prediction)))
+        return 0;
+    return coap->notify(observed, (uint8_t*)prediction, sizeof(Prediction));
+}
+
+bool Communication::sendDatagram(const uint8_t *datagram, size_t len, uint32_t addr, uint16_t port, void *ctx)
+{
+    ENERGY_STATE(transmit(len));
+    return ((Communication*)ctx)->coap->sendDatagram(datagram, len, IPAddress(addr), port);
+}
+
+// Error responses of block transfers are handled by coap-simple itself
+void Communication::exchangeFailed(uint16_t message_id, uint8_t code, uint32_t addr, uint16_t port, void *ctx)
+{
+    if(code)
+    {
+        ESP_LOGE(TAG, "Message %u was rejected with %u.%02u", message_id, code >> 5, code & 0x1F);
+        return;
+    }
+    ESP_LOGE(TAG, "Message %u was not acknowledged, dropped", message_id);
+    ((Communication*)ctx)->coap->exchangeFailed(message_id, IPAddress(addr), port);
+}
+
+// Block-wise transfers (RFC 7959) for payloads above the CoAP buffer, one at a time,
+// blocks go through the pending table like any other confirmable message
+bool Communication::upload(const char* resource, CoapBlockSource source, CoapTransferDone done)
+{
+    if(!canSend() || coap->transferActive())
+        return false;
+    uint8_t token[COAP_TOKEN_LENGTH];
+    uint8_t token_len = reliable.nextToken(token);
+    return coap->upload(coap_server, coap_port, resource, token, token_len, coap->maxBlockSzx(), source, done);
+}
+
+bool Communication::download(const char* resource, CoapBlockSink sink, CoapTransferDone done)
+{
+    if(!canSend() || coap->transferActive())
+        return false;
+    uint8_t token[COAP_TOKEN_LENGTH];
+    uint8_t token_len = reliable.nextToken(token);
+    return coap->download(coap_server, coap_port, resource, token, token_len, coap->maxBlockSzx(), sink, done);
+}
+
+void Communication::report()
+{
+    const CoapStats *stats = reliable.getStats();
+    Serial.printf("CoAP: %u requests, %u acknowledged, %u failed, %u retransmissions, %u duplicates, %u rejected\n",
+        stats->requests, stats->completed, stats->failed, stats->retransmissions, stats->duplicates, stats->rejected);
+
+    const CoapRttHistogram *rtt = reliable.getRttHistogram();
+    uint32_t samples = 0;
+    for(int i = 0; i < COAP_RTT_BUCKETS; i++)
+        samples += rtt->buckets[i];
+    Serial.printf("RTT: RTO %u ms, %u strong/%u weak samples, min %u ms, avg %u ms, max %u ms\n",
+        reliable.rto((uint32_t)coap_server, coap_port), rtt->strong, rtt->weak, rtt->min,
+        samples ? (uint32_t)(rtt->sum / samples) : 0, rtt->max);
+    for(int i = 0; i < COAP_RTT_BUCKETS; i++)
+        if(rtt->buckets[i])
+            Serial.printf("  %s %5u ms: %u\n", i < COAP_RTT_BUCKETS - 1 ? "< " : ">=",
+                CoapReliable::bucketLimit(i < COAP_RTT_BUCKETS - 1 ? i : i - 1), rtt->buckets[i]);
+}
+
+// Runs in the Wi-Fi event task, only flags the link state for update()
+void Communication::handleWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info)
+{
+    TRACE_INSTANT(TRACE_WIFI_EVENT, event);
+    if(!instance)
+        return;
+    if(event == ARDUINO_EVENT_WIFI_STA_GOT_IP)
+        instance->link_up = true;
+    else if(event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED || event == ARDUINO_EVENT_WIFI_STA_LOST_IP)
+    {
+        instance->link_up = false;
+        instance->link_dropped = true;
+    }
 }
 
 
@@ -54,9 +364,17 @@ void Communication::handleResponse(CoapPacket &packet, IPAddress ip, int port)
     uint8_t code = RESOLVE_CODE(packet.code);
     if(instance)
     {
+        CoapRx rx = instance->reliable.received(packet.type, packet.code, packet.messageid, packet.token, packet.tokenlen,
+            (uint32_t)ip, port, millis());
+        if(packet.type == COAP_CON) //separate response, acknowledged again if it is a duplicate
+            instance->coap->sendEmpty(ip, port, COAP_ACK, packet.messageid);
+        if(rx.result != COAP_RX_NEW)
+            return;
+        if(packet.code == 0)
+            return; //empty ACK, the response follows separately and is matched by its token
 
         if(code == COAP_CREATED || code == COAP_CHANGED)
-            Serial.println("Server Response: OK");
+            Serial.printf("Server Response: OK (message %u, %u ms, %u retransmits)\n", rx.message_id, rx.rtt, rx.retransmits);
         else
             ESP_LOGE(TAG,"Server Response code: %d", code);
     }
@@ -2,35 +2,25 @@
 #include <WiFi.h>
 #include <WiFiUdp.h>
 #include "coap-simple.h"
+#include "coap-reliable.h"
+#include "records.h"
 
-typedef struct {
-
-    uint16_t co2_ppm;
-    uint16_t tvoc_ppm;
-    float bmp280_temperature;
-    float bmp280_pressure;
-    float mlx_object_temperature;
-    float mlx_ambient_temperature;
-    float humidity_dht;
-    float temperature_dht;
-    float pir_uptime;
-
-    void print() 
-    {
-        Serial.printf("Temperature (BMP280): %.2f degC\n", bmp280_temperature);
-        Serial.printf("Pressure (BMP280): %.3f Pa\n", bmp280_pressure);
-        Serial.printf("Object Temperature (MLX IR): %.3f degC\n", mlx_object_temperature);
-        Serial.printf("Ambient Temperature (MLX IR): %.3f degC\n", mlx_ambient_temperature);
-        Serial.printf("Humidity (DHT): %.2f %\n", humidity_dht);
-        Serial.printf("Temperature (DHT): %.2f degC\n", temperature_dht);
-        Serial.printf("PIR last uptime: %.2f\n", pir_uptime);
-    }
-} __attribute__((packed)) Data;
+#define WIFI_CONNECT_TIMEOUT 8000 //ms per attempt before it counts as failed
+#define WIFI_RETRY_MIN_MS 500     //reconnect backoff, doubled after every failed attempt
+#define WIFI_RETRY_MAX_MS 60000
+#define WIFI_CACHE_MAGIC 0x57494649
+#define COMM_TEMPLATES 4          //resources with a prepared request
 
+// Last association and DHCP lease, a cached reconnect skips the scan and DHCP
 typedef struct {
-    float human_count = 0;
-    int32_t ventilation_tag = 1;
-} __attribute__((packed)) Prediction;
+    uint32_t magic;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+} WiFiCache;
 
 class Communication {
 
@@ -40,15 +30,57 @@ class Communication {
     const int coap_port;
     WiFiUDP *udp;
     Coap *coap;
+    CoapReliable reliable;
+    bool started = false;          // between begin() and end()
+    bool connecting = false;
+    bool online = false;           // link up was handled by update()
+    bool cached_attempt = false;
+    volatile bool link_up = false; // set from the Wi-Fi event task
+    volatile bool link_dropped = false;
+    bool power_save = true;        // Arduino associates with WIFI_PS_MIN_MODEM
+    uint32_t connect_start = 0;
+    uint32_t next_retry = 0;
+    uint32_t retry_delay = WIFI_RETRY_MIN_MS;
+    CoapTemplate templates[COMM_TEMPLATES];
+    const char* template_resource[COMM_TEMPLATES] = {};
 
     static Communication* instance;
+    static void handleWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info);
+    static bool sendDatagram(const uint8_t *datagram, size_t len, uint32_t addr, uint16_t port, void *ctx);
+    static void exchangeFailed(uint16_t message_id, uint8_t code, uint32_t addr, uint16_t port, void *ctx);
+    bool post(const char* resource, const uint8_t *payload, size_t len);
+    CoapTemplate* requestTemplate(const char* resource);
+    void connect();
+    void connected();
+    void saveCache();
+    void radioState();
 
     public:
         Communication(const char* ssid, const char* pass, IPAddress coap_server_ip, int coap_port);
         ~Communication() { delete udp; WiFi.disconnect(); delete coap; }
         static void handleResponse(CoapPacket &packet, IPAddress ip, int port);
         void begin();
+        void end();
         void update();
-        void sendData(const char* resource, Data* data);
-        void sendPrediction(const char* resource, Prediction* data);
+        void setPowerSave(wifi_ps_type_t mode);
+        bool isConnected() { return online; }
+        bool waitConnected(uint32_t timeout_ms);
+        bool canSend() { return online && !reliable.full(); }
+        bool idle() { return reliable.queued() == 0; }
+        uint32_t failedRequests() { return reliable.getStats()->failed_requests; }
+        const CoapStats* coapStats() { return reliable.getStats(); }
+        bool waitSendSlot(uint32_t timeout_ms);
+        bool flush(uint32_t timeout_ms);
+        void report();
+        bool sendData(const char* resource, Data* data);
+        bool sendReport(const char* resource, ReportedData* data);
+        bool sendBatch(const char* resource, const uint8_t *batch, size_t len) { return post(resource, batch, len); }
+        bool sendPrediction(const char* resource, Prediction* data);
+        bool sendInference(const char* resource, InferenceRecord* record);
+        bool upload(const char* resource, CoapBlockSource source, CoapTransferDone done);
+        bool download(const char* resource, CoapBlockSink sink, CoapTransferDone done);
+        bool transferActive() { return coap->transferActive(); }
+        bool serveBlock(const char* resource, CoapBlockSource source) { return coap->serverBlock(resource, NULL, source); }
+        bool observable(const char* resource, uint32_t max_age_s);
+        uint8_t publishPrediction(const char* resource, Prediction* prediction);
 };
\ No newline at end of file
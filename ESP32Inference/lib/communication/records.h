@@ -0,0 +1,49 @@
+#pragma once
+#include <Arduino.h>
+
+// Uplink payloads, the server unpacks them with the same layout (CoapServer/server.py)
+typedef struct {
+
+    uint16_t co2_ppm;
+    uint16_t tvoc_ppm;
+    float bmp280_temperature;
+    float bmp280_pressure;
+    float mlx_object_temperature;
+    float mlx_ambient_temperature;
+    float humidity_dht;
+    float temperature_dht;
+    float pir_uptime;
+
+    void print() 
+    {
+        Serial.printf("Temperature (BMP280): %.2f degC\n", bmp280_temperature);
+        Serial.printf("Pressure (BMP280): %.3f Pa\n", bmp280_pressure);
+        Serial.printf("Object Temperature (MLX IR): %.3f degC\n", mlx_object_temperature);
+        Serial.printf("Ambient Temperature (MLX IR): %.3f degC\n", mlx_ambient_temperature);
+        Serial.printf("Humidity (DHT): %.2f %\n", humidity_dht);
+        Serial.printf("Temperature (DHT): %.2f degC\n", temperature_dht);
+        Serial.printf("PIR last uptime: %.2f\n", pir_uptime);
+    }
+} __attribute__((packed)) Data;
+
+typedef struct {
+    float human_count = 0;
+    int32_t ventilation_tag = 1;
+} __attribute__((packed)) Prediction;
+
+// Data with its place in the sample series, samples inside the uplink deadbands are not sent (lib/uplinkfilter)
+typedef struct {
+    Data data;
+    uint32_t sequence;    // sample counter since boot, a gap of n means n samples held the previous values
+    uint32_t elapsed_ms;  // since the previous reported sample
+    uint64_t time_ms;     // capture time, device clock ms (lib/devclock), Unix ms on the wire (0 if never synced)
+} __attribute__((packed)) ReportedData;
+
+// One inference mode poll in one datagram: the sample, the latest prediction and what made it
+typedef struct {
+    ReportedData sample;
+    Prediction prediction;
+    uint32_t model_version;  // CRC32 of the deployed .tflite model
+    uint32_t inference_us;   // interpreter run time of the prediction
+    uint8_t has_prediction;  // 0 while the window warms up or the inference task is still busy
+} __attribute__((packed)) InferenceRecord;
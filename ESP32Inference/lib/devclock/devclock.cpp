@@ -0,0 +1,76 @@
+#include "devclock.h"
+#include <inttypes.h>
+#include "esp_sntp.h"
+#include "esp_log.h"
+static const char* TAG = "CLOCK";
+
+RTC_DATA_ATTR static ClockState state;
+DeviceClock* DeviceClock::instance = nullptr;
+
+// Replaces the weak default of the SNTP client, which would step the system time
+extern "C" void sntp_sync_time(struct timeval *tv)
+{
+    DeviceClock::synchronized(tv);
+    sntp_set_sync_status(SNTP_SYNC_STATUS_COMPLETED);
+}
+
+DeviceClock::DeviceClock()
+{
+    instance = this;
+}
+
+// The offset survives deep sleep, a power on reset restarts the device clock and the clock is unsynced again
+void DeviceClock::begin(const char* ntp_server)
+{
+    if(state.magic != CLOCK_MAGIC || now() < state.synced_at)
+    {
+        memset(&state, 0, sizeof(state));
+        state.magic = CLOCK_MAGIC;
+    }
+    sntp_set_sync_interval(CLOCK_SYNC_INTERVAL);
+    configTime(0, 0, ntp_server); //polls once the link is up
+}
+
+uint64_t DeviceClock::now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+bool DeviceClock::synced()
+{
+    return state.synced;
+}
+
+uint64_t DeviceClock::toUnix(uint64_t device_ms)
+{
+    return state.synced ? device_ms + state.offset_ms : 0;
+}
+
+void DeviceClock::synchronized(struct timeval *tv)
+{
+    if(!instance)
+        return;
+    uint64_t device_ms = instance->now();
+    int64_t offset = (int64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000 - (int64_t)device_ms;
+    state.correction_ms = state.synced ? (int32_t)(offset - state.offset_ms) : 0;
+    if(state.synced && device_ms > state.synced_at)
+        ESP_LOGI(TAG, "Clock corrected by %d ms (%.1f ppm)", state.correction_ms,
+            state.correction_ms * 1e6 / (double)(device_ms - state.synced_at));
+    state.offset_ms = offset;
+    state.synced_at = device_ms;
+    state.synced = true;
+    state.syncs++;
+}
+
+void DeviceClock::report()
+{
+    if(!state.synced)
+    {
+        Serial.printf("Clock: not synced, device time %" PRIu64 " ms\n", now());
+        return;
+    }
+    Serial.printf("Clock: %u syncs, last %" PRIu64 " s ago, last correction %d ms\n", state.syncs,
+        (now() - state.synced_at) / 1000, state.correction_ms);
+}
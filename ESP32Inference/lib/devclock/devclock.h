@@ -0,0 +1,35 @@
+#pragma once
+#include <Arduino.h>
+#include <sys/time.h>
+
+// Device clock: ms since the first boot, kept by the RTC timer through deep sleep, and its offset to Unix time
+// learned from SNTP. SNTP no longer steps the system time (the duty cycle schedules polls with it), the
+// offset is applied when a record is sent, so samples taken before the first sync get the right time too.
+#define CLOCK_NTP_SERVER "pool.ntp.org"
+#define CLOCK_SYNC_INTERVAL 3600000 //ms between SNTP requests
+#define CLOCK_MAGIC 0x434C4F43
+
+typedef struct {
+    uint32_t magic;
+    bool synced;
+    int64_t offset_ms;       // Unix ms minus device ms
+    uint64_t synced_at;      // device ms of the last sync
+    int32_t correction_ms;   // offset change at the last sync
+    uint32_t syncs;
+} ClockState;
+
+class DeviceClock {
+
+    static DeviceClock* instance;
+
+    public:
+        DeviceClock();
+        static void synchronized(struct timeval *tv);
+        void begin(const char* ntp_server = CLOCK_NTP_SERVER);
+        uint64_t now();
+        bool synced();
+        uint64_t toUnix(uint64_t device_ms); // 0 until the first sync
+        uint64_t unixNow() { return toUnix(now()); }
+        uint32_t unixSeconds() { return unixNow() / 1000; }
+        void report();
+};
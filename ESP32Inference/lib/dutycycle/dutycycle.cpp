@@ -0,0 +1,305 @@
+#include "dutycycle.h"
+#include "esp_log.h"
+#include "energy.h"
+static const char* TAG = "DUTY";
+
+RTC_DATA_ATTR static DutyCycleState state;
+
+DutyCycle::DutyCycle(PowerManager *power, uint8_t mode, uint32_t interval_ms, uint16_t upload_every, uint8_t pir_pin):
+    power(power),
+    mode(mode),
+    interval(interval_ms),
+    upload_every(upload_every > DUTY_QUEUE_SIZE ? DUTY_QUEUE_SIZE : upload_every),
+    pir_pin(pir_pin)
+{ }
+
+// System time is kept by the RTC timer during deep sleep, unlike millis()
+int64_t DutyCycle::rtcTimeUs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// Returns true if the state of a previous duty cycle was restored from RTC memory
+bool DutyCycle::begin()
+{
+    wake_time = 0;
+    esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+    bool restored = state.magic == DUTY_MAGIC && state.active &&
+        (cause == ESP_SLEEP_WAKEUP_TIMER || cause == ESP_SLEEP_WAKEUP_EXT1);
+    if(!enabled() || restored)
+        return restored;
+
+    state.magic = DUTY_MAGIC;
+    state.active = true;
+    state.samples = 0;
+    state.queued = 0;
+    state.sequence = 0;
+    state.next_sample_us = rtcTimeUs();
+    state.pir_trigger_us = -1;
+    return false;
+}
+
+// A PIR wake only marks the motion, the device sleeps again until the next poll
+bool DutyCycle::handlePIRWake()
+{
+    if(mode != DUTY_DEEP_SLEEP || esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_EXT1 || state.magic != DUTY_MAGIC)
+        return false;
+    if(state.pir_trigger_us < 0)
+        state.pir_trigger_us = rtcTimeUs();
+    int64_t remaining = state.next_sample_us - rtcTimeUs();
+    if(remaining <= 0)
+        return false; //poll is due anyway
+    armWakeSources(remaining);
+    ENERGY_STATE(cpu(CPU_DEEP_SLEEP));
+    esp_deep_sleep_start();
+    return true;
+}
+
+// Sleep time left until the next poll, 0 if no duty cycle is running
+uint64_t DutyCycle::remainingSleep()
+{
+    if(!enabled() || state.magic != DUTY_MAGIC || !state.active)
+        return 0;
+    int64_t remaining = state.next_sample_us - rtcTimeUs();
+    return remaining > 0 ? remaining : 1;
+}
+
+void DutyCycle::stop()
+{
+    state.active = false;
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_EXT1);
+}
+
+// PIR output stays high for its hold time after motion, so the time since the first trigger is counted as uptime
+float DutyCycle::pirUptime()
+{
+    if(state.pir_trigger_us < 0)
+        return 0;
+    float uptime = (float)(rtcTimeUs() - state.pir_trigger_us) / 1000000;
+    float max_uptime = (float)interval / 1000;
+    return uptime > max_uptime ? max_uptime : uptime;
+}
+
+DutySample* DutyCycle::push(Data *data, uint64_t time_ms)
+{
+    if(state.queued >= DUTY_QUEUE_SIZE)
+    {
+        ESP_LOGE(TAG, "Upload queue full, dropping the oldest sample");
+        memmove(state.queue, state.queue + 1, sizeof(DutySample) * (DUTY_QUEUE_SIZE - 1));
+        state.queued--;
+        state.sequence++;
+    }
+    DutySample *sample = &state.queue[state.queued++];
+    memset(sample, 0, sizeof(DutySample));
+    sample->data = *data;
+    sample->time_ms = time_ms;
+    return sample;
+}
+
+void DutyCycle::append(Data *data, uint64_t time_ms)
+{
+    push(data, time_ms);
+}
+
+// Sample and prediction of an inference mode poll go out as one record, like InferenceRecords of loop()
+void DutyCycle::appendInference(InferenceRecord *record, uint64_t time_ms)
+{
+    DutySample *sample = push(&record->sample.data, time_ms);
+    sample->inference = true;
+    sample->predicted = record->has_prediction;
+    sample->prediction = record->prediction;
+    sample->model_version = record->model_version;
+    sample->inference_us = record->inference_us;
+}
+
+bool DutyCycle::sampleDue()
+{
+    return rtcTimeUs() >= state.next_sample_us;
+}
+
+// Schedules the next poll on a fixed grid, so the interval does not drift with the awake time
+void DutyCycle::sampleTaken()
+{
+    int64_t now = rtcTimeUs();
+    sampled = true;
+    state.samples++;
+    state.pir_trigger_us = -1;
+    state.next_sample_us += (int64_t)interval * 1000;
+    if(state.next_sample_us <= now)
+        state.next_sample_us = now + (int64_t)interval * 1000; //missed polls are not caught up
+}
+
+// Polls taken while asleep (e.g. by the wake stub) move the grid without a full boot
+void DutyCycle::samplesSkipped(uint16_t n)
+{
+    state.samples += n;
+    state.next_sample_us += (int64_t)interval * 1000 * n;
+}
+
+void DutyCycle::setPIRTrigger(uint64_t age_us)
+{
+    int64_t trigger = rtcTimeUs() - (int64_t)age_us;
+    if(state.pir_trigger_us < 0 || trigger < state.pir_trigger_us)
+        state.pir_trigger_us = trigger;
+}
+
+// Device clock ms of the n-th poll from the next one on, the wake stub takes them on this grid
+uint64_t DutyCycle::pollTime(uint16_t n)
+{
+    return state.next_sample_us / 1000 + (uint64_t)interval * n;
+}
+
+bool DutyCycle::uploadDue()
+{
+    return state.samples >= upload_every || state.queued >= DUTY_QUEUE_SIZE;
+}
+
+uint16_t DutyCycle::pollsUntilUpload()
+{
+    return state.samples >= upload_every ? 1 : upload_every - state.samples;
+}
+
+// Samples go out with their capture time, converted to Unix time if the clock was synced by now
+bool DutyCycle::upload(Communication *comm, DeviceClock *clock)
+{
+    uint32_t start = millis();
+    comm->begin();
+    if(!comm->waitConnected(DUTY_CONNECT_TIMEOUT))
+    {
+        ESP_LOGE(TAG, "No link, %d samples kept for the next upload", state.queued);
+        comm->end();
+        state.samples = 0; //retried after the next batch of polls
+        wake_time += millis() - start;
+        return false;
+    }
+    // at most NSTART messages are outstanding, the rest waits for acknowledgements
+    uint16_t sent = 0;
+    while(sent < state.queued && comm->waitSendSlot(DUTY_FLUSH_TIMEOUT))
+    {
+        DutySample *sample = &state.queue[sent];
+        InferenceRecord record = {};
+        record.sample.data = sample->data;
+        record.sample.sequence = state.sequence + sent;
+        record.sample.elapsed_ms = sent ? sample->time_ms - state.queue[sent - 1].time_ms : 0;
+        record.sample.time_ms = clock->toUnix(sample->time_ms);
+        if(sample->inference)
+        {
+            record.prediction = sample->prediction;
+            record.model_version = sample->model_version;
+            record.inference_us = sample->inference_us;
+            record.has_prediction = sample->predicted;
+        }
+        if(!(sample->inference ? comm->sendInference("inference", &record) : comm->sendReport("data", &record.sample)))
+            break;
+        sent++;
+    }
+    if(!comm->flush(DUTY_FLUSH_TIMEOUT))
+        ESP_LOGE(TAG, "Upload ended with unacknowledged messages");
+    comm->end();
+    Serial.printf("Uploaded %d of %d samples in %u ms\n", sent, state.queued, millis() - start);
+
+    state.queued -= sent; //unsent samples are kept for the next upload
+    memmove(state.queue, state.queue + sent, sizeof(DutySample) * state.queued);
+    state.sequence += sent;
+    state.samples = 0;
+    uint32_t upload_ms = millis() - start;
+    state.upload_ms = state.upload_ms ? (3 * state.upload_ms + upload_ms) / 4 : upload_ms;
+    wake_time += upload_ms; //kept out of the per sample awake time
+    report();
+    return true;
+}
+
+void DutyCycle::armWakeSources(int64_t sleep_us)
+{
+    esp_sleep_enable_timer_wakeup(sleep_us);
+    // Level triggered, an already active PIR would wake the chip right away
+    if(state.pir_trigger_us < 0 && digitalRead(pir_pin) == LOW)
+        esp_sleep_enable_ext1_wakeup(1ULL << pir_pin, ESP_EXT1_WAKEUP_ANY_HIGH);
+    else
+    {
+        if(state.pir_trigger_us < 0)
+            state.pir_trigger_us = rtcTimeUs();
+        esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_EXT1);
+    }
+}
+
+// Sleeps until the next poll, returns only in light sleep mode
+void DutyCycle::sleep()
+{
+    if(sampled)
+    {
+        uint32_t awake_ms = millis() - wake_time;
+        state.sample_ms = state.sample_ms ? (3 * state.sample_ms + awake_ms) / 4 : awake_ms;
+        sampled = false;
+    }
+    power->sleepSensors();
+
+    if(mode == DUTY_DEEP_SLEEP)
+    {
+        int64_t remaining = state.next_sample_us - rtcTimeUs();
+        armWakeSources(remaining > 0 ? remaining : 1);
+        if(deep_sleep_callback)
+            deep_sleep_callback(remaining > 0 ? remaining : 1);
+        Serial.flush();
+        ENERGY_STATE(cpu(CPU_DEEP_SLEEP));
+        esp_deep_sleep_start();
+    }
+
+    while(true)
+    {
+        int64_t remaining = state.next_sample_us - rtcTimeUs();
+        if(remaining <= 0)
+            break;
+        armWakeSources(remaining);
+        Serial.flush();
+        ENERGY_STATE(cpu(CPU_LIGHT_SLEEP));
+        esp_light_sleep_start();
+        ENERGY_STATE(cpu(CPU_ACTIVE));
+        esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+        if(cause == ESP_SLEEP_WAKEUP_EXT1 && state.pir_trigger_us < 0)
+            state.pir_trigger_us = rtcTimeUs();
+        else if(cause == ESP_SLEEP_WAKEUP_EXT0)
+            break; //button, handled by the main loop
+    }
+    wake_time = millis();
+    power->resumeSensors();
+}
+
+// Average current and upload latency for different upload cadences, based on the measured awake times
+void DutyCycle::report()
+{
+    const uint16_t cadences[] = {1, 2, 5, 10, 30};
+    float sleep_ua = power->estimateSleepCurrent(false);
+    if(mode == DUTY_LIGHT_SLEEP)
+        sleep_ua += ESP32_LIGHT_SLEEP_UA - ESP32_DEEP_SLEEP_UA;
+    float sample_ms = state.sample_ms ? state.sample_ms : DUTY_DEFAULT_SAMPLE_MS;
+    float upload_ms = state.upload_ms ? state.upload_ms : DUTY_DEFAULT_UPLOAD_MS;
+    float period_ms = interval;
+
+    Serial.printf("Duty cycle report: poll %u ms, awake %.0f ms/sample, upload %.0f ms, sleep %.1f uA\n",
+        interval, sample_ms, upload_ms, sleep_ua);
+    bool configured_listed = false;
+    for(size_t i = 0; i <= sizeof(cadences) / sizeof(cadences[0]); i++)
+    {
+        uint16_t n = i < sizeof(cadences) / sizeof(cadences[0]) ? cadences[i] : upload_every;
+        if(n == upload_every)
+        {
+            if(configured_listed)
+                break;
+            configured_listed = true;
+        }
+        float upload_share = upload_ms / n;
+        float sleep_ms = period_ms - sample_ms - upload_share;
+        if(sleep_ms < 0)
+            sleep_ms = 0;
+        float avg_ua = (sample_ms * ESP32_ACTIVE_UA + upload_share * ESP32_WIFI_UA + sleep_ms * sleep_ua) / period_ms;
+        // a sample waits for the remaining polls of its batch plus the upload itself
+        float avg_latency = ((n - 1) * period_ms / 2 + upload_ms) / 1000;
+        float max_latency = ((n - 1) * period_ms + upload_ms) / 1000;
+        Serial.printf("  N=%2u: %.2f mA avg, latency %.1f s avg / %.1f s max%s\n",
+            n, avg_ua / 1000, avg_latency, max_latency, n == upload_every ? " <- configured" : "");
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <Arduino.h>
+#include <esp_sleep.h>
+#include <sys/time.h>
+#include "power.h"
+#include "communication.h"
+#include "devclock.h"
+
+//Operating modes
+#define DUTY_OFF 0         //always awake between polls
+#define DUTY_LIGHT_SLEEP 1 //light sleep between polls, RAM and Wi-Fi driver kept
+#define DUTY_DEEP_SLEEP 2  //deep sleep between polls, state kept in RTC memory
+
+#ifndef DUTY_QUEUE_SIZE
+#define DUTY_QUEUE_SIZE 32 //samples kept in RTC memory until the next upload
+#endif
+#define DUTY_FLUSH_TIMEOUT 5000 //ms an upload waits for acknowledgements (and retransmissions)
+#define DUTY_CONNECT_TIMEOUT 10000 //ms an upload waits for the link, the queue is kept on failure
+#define DUTY_MAGIC 0x44555459
+
+// Currents in uA used for the duty cycle report (ESP32 datasheet, typical)
+#define ESP32_ACTIVE_UA 40000.0      // CPU running, radio off
+#define ESP32_WIFI_UA 120000.0       // Wi-Fi connecting and transmitting
+#define ESP32_LIGHT_SLEEP_UA 800.0
+#define DUTY_DEFAULT_SAMPLE_MS 500   // used by the report until awake times were measured
+#define DUTY_DEFAULT_UPLOAD_MS 3000
+
+// One queued poll, inference mode polls keep the rest of their InferenceRecord
+typedef struct {
+    Data data;
+    uint64_t time_ms;            // capture time, device clock ms
+    bool inference;              // uploaded to /inference with the fields below, otherwise to /data
+    bool predicted;
+    Prediction prediction;
+    uint32_t model_version;
+    uint32_t inference_us;
+} DutySample;
+
+typedef struct {
+    uint32_t magic;
+    bool active;                 // false after the button turned the device off
+    uint32_t samples;            // samples since the last upload
+    int64_t next_sample_us;      // RTC time of the next poll
+    int64_t pir_trigger_us;      // RTC time of the first PIR wake in this interval, -1 if none
+    uint16_t queued;
+    DutySample queue[DUTY_QUEUE_SIZE];
+    uint32_t sequence;           // of the oldest queued sample
+    uint32_t sample_ms;          // running average of awake time per sample
+    uint32_t upload_ms;          // running average of time spent in upload()
+} DutyCycleState;
+
+class DutyCycle {
+
+    PowerManager *power;
+    uint8_t mode;
+    uint32_t interval;
+    uint16_t upload_every;
+    uint8_t pir_pin;
+    uint32_t wake_time = 0;
+    bool sampled = false;        // a poll happened since the last sleep
+    void (*deep_sleep_callback)(uint64_t sleep_us) = nullptr;
+
+    static int64_t rtcTimeUs();
+    DutySample* push(Data *data, uint64_t time_ms);
+    void armWakeSources(int64_t sleep_us);
+
+    public:
+        DutyCycle(PowerManager *power, uint8_t mode, uint32_t interval_ms, uint16_t upload_every, uint8_t pir_pin);
+        bool enabled() { return mode != DUTY_OFF; }
+        bool begin();
+        bool handlePIRWake();
+        uint64_t remainingSleep();
+        void stop();
+        float pirUptime();
+        void append(Data *data, uint64_t time_ms);
+        void appendInference(InferenceRecord *record, uint64_t time_ms);
+        uint64_t pollTime(uint16_t n);
+        bool sampleDue();
+        void sampleTaken();
+        void samplesSkipped(uint16_t n);
+        void setPIRTrigger(uint64_t age_us);
+        void onDeepSleep(void (*callback)(uint64_t sleep_us)) { deep_sleep_callback = callback; }
+        bool uploadDue();
+        uint16_t pollsUntilUpload();
+        bool upload(Communication *comm, DeviceClock *clock);
+        void sleep();
+        void report();
+};
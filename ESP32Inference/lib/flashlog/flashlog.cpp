@@ -0,0 +1,336 @@
+#include "flashlog.h"
+#include <string.h>
+
+#define LOG_ERASED_LENGTH 0xFFFF
+
+FlashLog::FlashLog(FlashDevice *flash, uint32_t retention_s):
+    flash(flash),
+    retention_s(retention_s)
+{ }
+
+// CRC-32 (IEEE), bitwise, records are short and written once per sample
+uint32_t FlashLog::crc32(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    crc = ~crc;
+    while(len--)
+    {
+        crc ^= *bytes++;
+        for(uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+uint32_t FlashLog::sectorCrc(LogSectorHeader *header)
+{
+    LogSectorHeader copy = *header;
+    copy.crc = 0;
+    return crc32(0, &copy, sizeof(copy));
+}
+
+bool FlashLog::readSector(uint16_t sector, LogSectorHeader *header)
+{
+    if(!flash->read(address(sector, 0), header, sizeof(LogSectorHeader)))
+        return false;
+    return header->magic == LOG_SECTOR_MAGIC && header->crc == sectorCrc(header);
+}
+
+// 1 valid record, 0 erased flash (end of the sector), -1 torn or damaged record
+int8_t FlashLog::readRecord(uint16_t sector, uint32_t offset, LogRecordHeader *header, uint8_t *payload, size_t size)
+{
+    if(offset + sizeof(LogRecordHeader) > LOG_SECTOR_SIZE)
+        return 0;
+    if(!flash->read(address(sector, offset), header, sizeof(LogRecordHeader)))
+        return -1;
+    if(header->length == LOG_ERASED_LENGTH && header->id == 0xFFFFFFFF && header->crc == 0xFFFFFFFF)
+        return 0;
+    if(header->length > LOG_MAX_PAYLOAD || offset + recordSize(header->length) > LOG_SECTOR_SIZE)
+        return -1;
+    uint8_t buffer[LOG_MAX_PAYLOAD];
+    if(!flash->read(address(sector, offset + sizeof(LogRecordHeader)), buffer, header->length))
+        return -1;
+    LogRecordHeader copy = *header;
+    copy.crc = 0;
+    uint32_t crc = crc32(crc32(0, &copy, sizeof(copy)), buffer, header->length);
+    if(crc != header->crc)
+        return -1;
+    if(payload)
+        memcpy(payload, buffer, header->length < size ? header->length : size);
+    return 1;
+}
+
+// Rest of the sector still erased, anything else is a write cut short by a reset
+bool FlashLog::erased(uint16_t sector, uint32_t offset)
+{
+    uint32_t words[16];
+    while(offset < LOG_SECTOR_SIZE)
+    {
+        size_t len = LOG_SECTOR_SIZE - offset < sizeof(words) ? LOG_SECTOR_SIZE - offset : sizeof(words);
+        if(!flash->read(address(sector, offset), words, len))
+            return false;
+        for(size_t i = 0; i < len / sizeof(uint32_t); i++)
+            if(words[i] != 0xFFFFFFFF)
+                return false;
+        offset += len;
+    }
+    return true;
+}
+
+// Start of the oldest sector still holding records, the one after the head unless its erase was cut short
+LogCursor FlashLog::oldest()
+{
+    LogSectorHeader header;
+    for(uint16_t i = 1; i < sectors; i++)
+    {
+        uint16_t sector = (head + i) % sectors;
+        if(readSector(sector, &header) && header.sequence <= head_sequence && header.sequence + sectors > head_sequence)
+            return {sector, header.sequence, sizeof(LogSectorHeader)};
+    }
+    return {head, head_sequence, sizeof(LogSectorHeader)};
+}
+
+// Sector sequence numbers map to sectors round robin, so a cursor is stale once its sector was recycled
+bool FlashLog::cursorValid(LogCursor *cursor)
+{
+    return cursor->sequence <= head_sequence && cursor->sequence + sectors > head_sequence &&
+        cursor->sector < sectors && cursor->offset >= sizeof(LogSectorHeader);
+}
+
+// The old magic is cleared before the erase, a reset during the erase can't leave a half erased sector
+// that still looks valid
+bool FlashLog::openSector(uint16_t sector, uint32_t sequence)
+{
+    LogSectorHeader header;
+    if(readSector(sector, &header))
+    {
+        LogRecordHeader record;
+        uint32_t offset = sizeof(LogSectorHeader);
+        while(readRecord(sector, offset, &record, nullptr, 0) == 1)
+        {
+            if(record.type != LOG_ACK && record.id > acked)
+                stats.dropped++;
+            offset += recordSize(record.length);
+        }
+        uint32_t zero = 0;
+        flash->write(address(sector, 0), &zero, sizeof(zero));
+    }
+    stats.erases++;
+    if(!flash->erase(address(sector, 0)))
+        return false;
+    header.magic = LOG_SECTOR_MAGIC;
+    header.sequence = sequence;
+    header.first_id = next_id;
+    header.acked = acked;
+    header.reserved = 0xFFFFFFFF;
+    header.crc = sectorCrc(&header);
+    if(!flash->write(address(sector, 0), &header, sizeof(header)))
+        return false;
+    stats.bytes += sizeof(header);
+    head = sector;
+    head_sequence = sequence;
+    head_offset = sizeof(LogSectorHeader);
+    if(!cursorValid(&tail))
+        tail = oldest();
+    return true;
+}
+
+bool FlashLog::write(uint8_t type, uint32_t id, const void *payload, uint16_t length, uint32_t stamp)
+{
+    uint8_t buffer[sizeof(LogRecordHeader) + LOG_MAX_PAYLOAD + LOG_ALIGN];
+    uint32_t size = recordSize(length);
+    LogRecordHeader *header = (LogRecordHeader *)buffer;
+    header->length = length;
+    header->type = type;
+    header->reserved = 0xFF;
+    header->id = id;
+    header->stamp = stamp;
+    header->crc = 0;
+    memcpy(buffer + sizeof(LogRecordHeader), payload, length);
+    memset(buffer + sizeof(LogRecordHeader) + length, 0xFF, size - sizeof(LogRecordHeader) - length);
+    header->crc = crc32(0, buffer, sizeof(LogRecordHeader) + length);
+    if(!flash->write(address(head, head_offset), buffer, size))
+    {
+        head_offset = LOG_SECTOR_SIZE; //the next record starts a fresh sector
+        return false;
+    }
+    head_offset += size;
+    stats.bytes += size;
+    return true;
+}
+
+// Finds the head and rebuilds ids and acknowledgements, formats the partition if no sector is valid
+bool FlashLog::mount()
+{
+    sectors = flash->size() / LOG_SECTOR_SIZE;
+    if(sectors < 2)
+        return false;
+    LogSectorHeader header, head_header = {};
+    bool found = false;
+    for(uint16_t sector = 0; sector < sectors; sector++)
+        if(readSector(sector, &header) && (!found || header.sequence > head_sequence))
+        {
+            found = true;
+            head = sector;
+            head_sequence = header.sequence;
+            head_header = header;
+        }
+    mounted = false;
+    if(!found)
+    {
+        acked = 0;
+        next_id = 1;
+        head = sectors - 1;
+        head_sequence = 0;
+        mounted = openSector(0, 1);
+        return mounted;
+    }
+
+    // the head holds every acknowledgement and id since it was opened, records after a damaged one are lost
+    acked = head_header.acked;
+    next_id = head_header.first_id;
+    LogRecordHeader record;
+    uint32_t ack_id;
+    uint32_t offset = sizeof(LogSectorHeader);
+    int8_t result;
+    while((result = readRecord(head, offset, &record, (uint8_t *)&ack_id, sizeof(ack_id))) == 1)
+    {
+        if(record.type == LOG_ACK && ack_id > acked)
+            acked = ack_id;
+        else if(record.type != LOG_ACK && record.id >= next_id)
+            next_id = record.id + 1;
+        offset += recordSize(record.length);
+    }
+    head_offset = offset;
+    bool clean = result == 0 && erased(head, offset);
+    if(!clean)
+        stats.corrupt++;
+
+    // tail: the newest sector that started at or before the first unconfirmed id
+    tail = oldest();
+    for(LogCursor cursor = tail; cursor.sector != head;)
+    {
+        cursor.sector = (cursor.sector + 1) % sectors;
+        cursor.sequence++;
+        if(readSector(cursor.sector, &header) && header.sequence == cursor.sequence && header.first_id <= acked + 1)
+            tail = cursor;
+    }
+    mounted = true;
+    LogCursor cursor = tail; //moves the tail up to the first unconfirmed record
+    next(&cursor, 0, &record, nullptr, 0);
+    if(!clean) //torn write at the head, never append behind it
+        return openSector((head + 1) % sectors, head_sequence + 1);
+    return true;
+}
+
+bool FlashLog::append(uint8_t type, const void *payload, uint16_t length, uint32_t stamp, uint32_t *id)
+{
+    if(!mounted || type == LOG_ACK || length > LOG_MAX_PAYLOAD)
+        return false;
+    if(head_offset + recordSize(length) > LOG_SECTOR_SIZE && !openSector((head + 1) % sectors, head_sequence + 1))
+        return false;
+    if(!write(type, next_id, payload, length, stamp))
+        return false;
+    if(id)
+        *id = next_id;
+    next_id++;
+    stats.appended++;
+    return true;
+}
+
+// Confirms every record up to id, nothing is rewritten, the acknowledgement is a record of its own
+bool FlashLog::ack(uint32_t id)
+{
+    if(!mounted || id <= acked)
+        return true;
+    if(id >= next_id)
+        id = next_id - 1;
+    if(head_offset + recordSize(sizeof(id)) > LOG_SECTOR_SIZE)
+    {
+        acked = id; //goes into the header of the new sector
+        if(!openSector((head + 1) % sectors, head_sequence + 1))
+            return false;
+    }
+    else if(!write(LOG_ACK, 0, &id, sizeof(id), 0))
+        return false;
+    acked = id;
+    if(acked == next_id - 1)
+        tail = {head, head_sequence, head_offset};
+    return true;
+}
+
+// Next unconfirmed record at or after the cursor, skips records older than the retention.
+// payload can be null to only read the header.
+bool FlashLog::next(LogCursor *cursor, uint32_t now_s, LogRecordHeader *header, uint8_t *payload, size_t size)
+{
+    if(!mounted)
+        return false;
+    if(!cursorValid(cursor))
+        *cursor = tail;
+    LogSectorHeader sector_header;
+    while(true)
+    {
+        bool at_tail = cursor->sector == tail.sector && cursor->offset == tail.offset;
+        if(cursor->sector == head && cursor->offset >= head_offset)
+            return false;
+        int8_t result = readRecord(cursor->sector, cursor->offset, header, payload, size);
+        if(result != 1)
+        {
+            if(cursor->sector == head)
+                return false;
+            do
+            {
+                cursor->sector = (cursor->sector + 1) % sectors;
+                cursor->sequence++;
+                cursor->offset = sizeof(LogSectorHeader);
+            } while(cursor->sector != head &&
+                (!readSector(cursor->sector, &sector_header) || sector_header.sequence != cursor->sequence));
+            if(cursor->sector == head)
+                cursor->sequence = head_sequence;
+            if(at_tail)
+                tail = *cursor;
+            continue;
+        }
+        cursor->offset += recordSize(header->length);
+        if(header->type == LOG_ACK || header->id <= acked)
+        {
+            if(at_tail)
+                tail = *cursor;
+            continue;
+        }
+        if(retention_s && now_s && header->stamp && now_s > header->stamp && now_s - header->stamp > retention_s)
+        {
+            stats.expired++;
+            continue;
+        }
+        return true;
+    }
+}
+
+// Raw sectors from the oldest to the head for a bulk download, the head is cut at its last record.
+// Not a snapshot, a download running while the log wraps around gets sectors of both rounds.
+size_t FlashLog::readRaw(uint32_t offset, uint8_t *buffer, size_t size, bool *more)
+{
+    *more = false;
+    if(!mounted)
+        return 0;
+    uint16_t first = oldest().sector;
+    uint16_t count = (head + sectors - first) % sectors + 1;
+    uint32_t total = (uint32_t)(count - 1) * LOG_SECTOR_SIZE + head_offset;
+    if(offset >= total)
+        return 0;
+    size_t len = total - offset < size ? total - offset : size;
+    size_t done = 0;
+    while(done < len)
+    {
+        uint32_t position = offset + done;
+        uint16_t sector = (first + position / LOG_SECTOR_SIZE) % sectors;
+        uint32_t in_sector = position % LOG_SECTOR_SIZE;
+        size_t chunk = LOG_SECTOR_SIZE - in_sector < len - done ? LOG_SECTOR_SIZE - in_sector : len - done;
+        if(!flash->read(address(sector, in_sector), buffer + done, chunk))
+            return done;
+        done += chunk;
+    }
+    *more = offset + len < total;
+    return len;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Append-only circular sample log in a flash partition, records survive reboots and power cuts until the
+// server confirmed them. Platform independent behind FlashDevice, the host runs it on a file backed emulator.
+//
+// Every sector starts with a header carrying an increasing sector sequence number, the sector with the highest
+// one is the head. Records never cross a sector, each has a CRC over header and payload, so a write torn by a
+// power cut is detected at mount and the head moves on to a fresh sector. Acknowledgements are records too
+// (highest confirmed id), nothing is ever rewritten in place. Sector headers repeat the first id and the
+// acknowledgement at the time the sector was opened, so mount only scans the head sector. When the head wraps
+// around, the oldest sector is erased, unconfirmed records in it are lost (counted as dropped).
+#define LOG_SECTOR_SIZE 4096
+#define LOG_SECTOR_MAGIC 0x474F4C53  //"SLOG"
+#define LOG_MAX_PAYLOAD 240
+#define LOG_ALIGN 4
+
+//Record types, the log doesn't interpret payloads except acknowledgements
+#define LOG_ACK 0x00
+#define LOG_DATA 0x01
+#define LOG_PREDICTION 0x02
+#define LOG_INFERENCE 0x03
+
+class FlashDevice {
+
+    public:
+        virtual ~FlashDevice() {}
+        virtual uint32_t size() = 0;
+        virtual bool read(uint32_t address, void *buffer, size_t len) = 0;
+        virtual bool write(uint32_t address, const void *buffer, size_t len) = 0; // NOR, bits only go from 1 to 0
+        virtual bool erase(uint32_t address) = 0;                                 // one LOG_SECTOR_SIZE sector
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t first_id;   // id of the first record written to the sector
+    uint32_t acked;      // highest confirmed id when the sector was opened
+    uint32_t crc;
+    uint32_t reserved;
+} LogSectorHeader;
+
+typedef struct {
+    uint16_t length;     // payload bytes, 0xFFFF is erased flash
+    uint8_t type;
+    uint8_t reserved;
+    uint32_t id;         // increasing per record, 0 for acknowledgements
+    uint32_t stamp;      // caller's time in s, 0 if unknown (never expires)
+    uint32_t crc;        // over header (crc field zero) and payload
+} LogRecordHeader;
+
+// Read position, restarts from the tail if the sector was recycled meanwhile
+typedef struct {
+    uint16_t sector;
+    uint32_t sequence;
+    uint32_t offset;
+} LogCursor;
+
+typedef struct {
+    uint32_t appended;
+    uint32_t bytes;          // written to flash, headers and padding included
+    uint32_t erases;
+    uint32_t dropped;        // unconfirmed records overwritten by the wrap around
+    uint32_t expired;        // skipped by the retention
+    uint32_t corrupt;        // torn or damaged record at the head found at mount
+} LogStats;
+
+class FlashLog {
+
+    FlashDevice *flash;
+    uint32_t retention_s;
+    uint16_t sectors = 0;
+    uint16_t head = 0;           // sector written to
+    uint32_t head_sequence = 0;
+    uint32_t head_offset = 0;
+    uint32_t next_id = 1;
+    uint32_t acked = 0;          // highest confirmed id
+    LogCursor tail = {0, 0, 0};  // no unconfirmed record before it, moved on lazily by next()
+    bool mounted = false;
+    LogStats stats = {};
+
+    static uint32_t crc32(uint32_t crc, const void *data, size_t len);
+    static uint32_t sectorCrc(LogSectorHeader *header);
+    static uint32_t recordSize(uint16_t length) { return (sizeof(LogRecordHeader) + length + LOG_ALIGN - 1) & ~(LOG_ALIGN - 1); }
+    uint32_t address(uint16_t sector, uint32_t offset) { return (uint32_t)sector * LOG_SECTOR_SIZE + offset; }
+    bool readSector(uint16_t sector, LogSectorHeader *header);
+    int8_t readRecord(uint16_t sector, uint32_t offset, LogRecordHeader *header, uint8_t *payload, size_t size);
+    bool erased(uint16_t sector, uint32_t offset);
+    bool openSector(uint16_t sector, uint32_t sequence);
+    bool write(uint8_t type, uint32_t id, const void *payload, uint16_t length, uint32_t stamp);
+    LogCursor oldest();
+    bool cursorValid(LogCursor *cursor);
+
+    public:
+        FlashLog(FlashDevice *flash, uint32_t retention_s);
+        bool mount();
+        bool append(uint8_t type, const void *payload, uint16_t length, uint32_t stamp, uint32_t *id = nullptr);
+        bool ack(uint32_t id);
+        LogCursor begin() { return tail; }
+        bool next(LogCursor *cursor, uint32_t now_s, LogRecordHeader *header, uint8_t *payload, size_t size);
+        size_t readRaw(uint32_t offset, uint8_t *buffer, size_t size, bool *more);
+        uint32_t nextId() { return next_id; }
+        uint32_t ackedId() { return acked; }
+        bool pending() { return mounted && next_id - 1 > acked; }
+        const LogStats* getStats() { return &stats; }
+};
@@ -0,0 +1,26 @@
+#include "partitionflash.h"
+#include "esp_log.h"
+static const char* TAG = "LOG";
+
+bool PartitionFlash::begin()
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if(!partition)
+        ESP_LOGE(TAG, "No %s partition, check partitions.csv", label);
+    return partition != nullptr;
+}
+
+bool PartitionFlash::read(uint32_t address, void *buffer, size_t len)
+{
+    return partition && esp_partition_read(partition, address, buffer, len) == ESP_OK;
+}
+
+bool PartitionFlash::write(uint32_t address, const void *buffer, size_t len)
+{
+    return partition && esp_partition_write(partition, address, buffer, len) == ESP_OK;
+}
+
+bool PartitionFlash::erase(uint32_t address)
+{
+    return partition && esp_partition_erase_range(partition, address, LOG_SECTOR_SIZE) == ESP_OK;
+}
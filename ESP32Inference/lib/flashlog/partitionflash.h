@@ -0,0 +1,18 @@
+#pragma once
+#include "esp_partition.h"
+#include "flashlog.h"
+
+// FlashLog storage on a data partition of partitions.csv, found by label
+class PartitionFlash : public FlashDevice {
+
+    const char* label;
+    const esp_partition_t *partition = nullptr;
+
+    public:
+        PartitionFlash(const char* label): label(label) {}
+        bool begin();
+        uint32_t size() override { return partition ? partition->size : 0; }
+        bool read(uint32_t address, void *buffer, size_t len) override;
+        bool write(uint32_t address, const void *buffer, size_t len) override;
+        bool erase(uint32_t address) override;
+};
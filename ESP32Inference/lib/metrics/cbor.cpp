@@ -0,0 +1,37 @@
+#include "cbor.h"
+#include <string.h>
+
+// Major type in the top 3 bits, the value inline below 24 or in the next 1, 2, 4 or 8 bytes, big endian
+void CborWriter::head(uint8_t major, uint64_t value)
+{
+    uint8_t bytes = value < 24 ? 0 : value <= 0xFF ? 1 : value <= 0xFFFF ? 2 : value <= 0xFFFFFFFF ? 4 : 8;
+    if(overflow || len + 1 + bytes > size)
+    {
+        overflow = true;
+        return;
+    }
+    buffer[len++] = (major << 5) | (bytes == 0 ? value : bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27);
+    for(int i = bytes - 1; i >= 0; i--)
+        buffer[len++] = value >> (8 * i);
+}
+
+void CborWriter::integer(int64_t value)
+{
+    if(value >= 0)
+        head(0, value);
+    else
+        head(1, -1 - value);
+}
+
+void CborWriter::text(const char *value)
+{
+    size_t n = strlen(value);
+    head(3, n);
+    if(overflow || len + n > size)
+    {
+        overflow = true;
+        return;
+    }
+    memcpy(buffer + len, value, n);
+    len += n;
+}
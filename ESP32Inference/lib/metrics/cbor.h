@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Minimal CBOR (RFC 8949) encoder into a caller buffer: unsigned and negative integers, text, arrays and maps of
+// known length. A value that doesn't fit marks the writer as overflowed, length() is 0 then.
+class CborWriter {
+
+    uint8_t *buffer;
+    size_t size;
+    size_t len = 0;
+    bool overflow = false;
+
+    void head(uint8_t major, uint64_t value);
+
+    public:
+        CborWriter(uint8_t *buffer, size_t size) : buffer(buffer), size(size) {}
+        void uint(uint64_t value) { head(0, value); }
+        void integer(int64_t value);
+        void text(const char *value);
+        void array(uint32_t items) { head(4, items); }
+        void map(uint32_t pairs) { head(5, pairs); }
+        size_t length() { return overflow ? 0 : len; }
+};
@@ -0,0 +1,128 @@
+#include "metrics.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "perf.h"
+
+// Every task of the system needs the trace facility, its run time the run time stats (both off in the host build)
+#if configUSE_TRACE_FACILITY == 1
+#define METRICS_SYSTEM_TASKS 1
+#else
+#define METRICS_SYSTEM_TASKS 0
+#endif
+#if METRICS_SYSTEM_TASKS && configGENERATE_RUN_TIME_STATS == 1
+#define METRICS_RUNTIME 1
+#else
+#define METRICS_RUNTIME 0
+#endif
+
+void Metrics::watchTask(const char* name, TaskHandle_t task)
+{
+    if(task_count < METRICS_MAX_TASKS)
+    {
+        task_names[task_count] = name;
+        tasks[task_count++] = task;
+    }
+}
+
+void Metrics::encodeTasks(CborWriter *cbor)
+{
+#if METRICS_SYSTEM_TASKS
+    static TaskStatus_t status[METRICS_MAX_SYSTEM_TASKS];
+    uint32_t total = 0;
+    UBaseType_t n = uxTaskGetNumberOfTasks() <= METRICS_MAX_SYSTEM_TASKS ?
+        uxTaskGetSystemState(status, METRICS_MAX_SYSTEM_TASKS, &total) : 0;
+    cbor->array(n);
+    for(UBaseType_t i = 0; i < n; i++)
+    {
+        cbor->array(METRICS_RUNTIME ? 3 : 2);
+        cbor->text(status[i].pcTaskName);
+        cbor->uint(status[i].usStackHighWaterMark);
+#if METRICS_RUNTIME
+        cbor->uint(status[i].ulRunTimeCounter);
+#endif
+    }
+#if METRICS_RUNTIME
+    cbor->uint(METRIC_RUNTIME_TOTAL);
+    cbor->uint(total);
+#endif
+#else
+    cbor->array(task_count);
+    for(uint8_t i = 0; i < task_count; i++)
+    {
+        cbor->array(2);
+        cbor->text(task_names[i]);
+        cbor->uint(uxTaskGetStackHighWaterMark(tasks[i]));
+    }
+#endif
+}
+
+size_t Metrics::encode(uint8_t *buffer, size_t size)
+{
+    CborWriter cbor(buffer, size);
+    const CoapStats *coap = comm->coapStats();
+    PerfSummary invoke;
+    Perf::summary(PERF_MODEL_INVOKE, &invoke);
+
+    cbor.map((METRICS_RUNTIME ? 15 : 14) + (ENERGY_ACCOUNTING ? 2 : 0));
+    cbor.uint(METRIC_UPTIME);
+    cbor.uint(esp_timer_get_time() / 1000000);
+    cbor.uint(METRIC_HEAP_FREE);
+    cbor.uint(heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    cbor.uint(METRIC_HEAP_MIN_FREE);
+    cbor.uint(heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+    cbor.uint(METRIC_HEAP_LARGEST_BLOCK);
+    cbor.uint(heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    cbor.uint(METRIC_TASKS);
+    encodeTasks(&cbor);
+    cbor.uint(METRIC_RSSI);
+    cbor.integer(comm->isConnected() ? WiFi.RSSI() : 0);
+    cbor.uint(METRIC_I2C_ERRORS);
+    cbor.uint(counters.i2c_errors);
+    cbor.uint(METRIC_DHT_ERRORS);
+    cbor.uint(counters.dht_errors);
+    cbor.uint(METRIC_COAP_TRANSMISSIONS);
+    cbor.uint(coap->transmissions);
+    cbor.uint(METRIC_COAP_RETRANSMISSIONS);
+    cbor.uint(coap->retransmissions);
+    cbor.uint(METRIC_COAP_FAILED);
+    cbor.uint(coap->failed);
+    cbor.uint(METRIC_INFERENCES);
+    cbor.uint(counters.inferences);
+    cbor.uint(METRIC_INFERENCE_US);
+    cbor.array(4);
+    cbor.uint(counters.inference_us);
+    cbor.uint(invoke.p50_ns / 1000);
+    cbor.uint(invoke.p99_ns / 1000);
+    cbor.uint(invoke.max_ns / 1000);
+#if ENERGY_ACCOUNTING
+    double hours = 0;
+    cbor.uint(METRIC_ENERGY);
+    cbor.array(ENERGY_SUBSYSTEM_COUNT);
+    for(int i = 0; i < ENERGY_SUBSYSTEM_COUNT; i++)
+    {
+        cbor.array(2);
+        cbor.text(Energy::name((EnergySubsystem)i));
+        cbor.uint(Energy::averageMa((EnergySubsystem)i, &hours) * 1000);
+    }
+    cbor.uint(METRIC_ENERGY_WINDOW);
+    cbor.uint(hours * 3600);
+#endif
+    cbor.uint(METRIC_POWER_MANAGEMENT);
+    cbor.array(3);
+    cbor.uint(PowerLocks::getMode());
+    cbor.uint(PowerLocks::getMode() == PM_FIXED ? getCpuFrequencyMhz() : PM_MIN_MHZ);
+    cbor.uint(PowerLocks::getMode() == PM_FIXED ? getCpuFrequencyMhz() : PM_MAX_MHZ);
+    return cbor.length();
+}
+
+// One snapshot per download, the blocks of a transfer stay consistent
+size_t Metrics::read(uint32_t offset, uint8_t *buffer, size_t size, bool *more)
+{
+    if(offset == 0)
+        snapshot_len = encode(snapshot, sizeof(snapshot));
+    size_t n = offset < snapshot_len ? snapshot_len - offset : 0;
+    n = n < size ? n : size;
+    memcpy(buffer, snapshot + offset, n);
+    *more = offset + n < snapshot_len;
+    return n;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "communication.h"
+#include "cbor.h"
+#include "energy.h"
+#include "pm.h"
+
+// Device health for GET /metrics: one CBOR map with small integer keys, rendered when a download starts and
+// served block-wise from that snapshot. CoapServer/metrics_collector.py polls and decodes it. Values are taken
+// from counters and the ESP-IDF heap and FreeRTOS calls, so a poll every few seconds costs about a millisecond.
+//   0 uptime s, 1 free heap, 2 minimum free heap since boot, 3 largest free heap block (bytes)
+//   4 tasks [[name, free stack bytes at the high-water mark, run time counter]...], the run time only with
+//     configGENERATE_RUN_TIME_STATS, all tasks with configUSE_TRACE_FACILITY, else the watched ones
+//   5 total run time counter (with the run time stats, CPU % per task is the delta ratio of two polls)
+//   6 Wi-Fi RSSI dBm (0 while offline), 7 I2C sensor read errors, 8 DHT read errors
+//   9 CoAP transmissions, 10 retransmissions, 11 failed exchanges
+//   12 inferences, 13 inference us [last, p50, p99, max] (percentiles from lib/perf)
+//   14 energy [[subsystem, average uA since power on]...], 15 seconds since power on they cover (lib/power/energy.h,
+//     left out with ENERGY_ACCOUNTING=0), 16 power management [mode, min MHz, max MHz] (lib/power/pm.h)
+#define METRICS_SIZE 512
+#define METRICS_MAX_TASKS 4      //watched without the trace facility
+#define METRICS_MAX_SYSTEM_TASKS 24
+
+typedef enum {
+    METRIC_UPTIME,
+    METRIC_HEAP_FREE,
+    METRIC_HEAP_MIN_FREE,
+    METRIC_HEAP_LARGEST_BLOCK,
+    METRIC_TASKS,
+    METRIC_RUNTIME_TOTAL,
+    METRIC_RSSI,
+    METRIC_I2C_ERRORS,
+    METRIC_DHT_ERRORS,
+    METRIC_COAP_TRANSMISSIONS,
+    METRIC_COAP_RETRANSMISSIONS,
+    METRIC_COAP_FAILED,
+    METRIC_INFERENCES,
+    METRIC_INFERENCE_US,
+    METRIC_ENERGY,
+    METRIC_ENERGY_WINDOW,
+    METRIC_POWER_MANAGEMENT
+} MetricKey;
+
+typedef struct {
+    uint32_t i2c_errors;
+    uint32_t dht_errors;
+    uint32_t inferences;
+    uint32_t inference_us;   // latest
+} MetricCounters;
+
+class Metrics {
+
+    Communication *comm;
+    const char* task_names[METRICS_MAX_TASKS];
+    TaskHandle_t tasks[METRICS_MAX_TASKS];
+    uint8_t task_count = 0;
+    uint8_t snapshot[METRICS_SIZE];
+    size_t snapshot_len = 0;
+
+    void encodeTasks(CborWriter *cbor);
+
+    public:
+        MetricCounters counters = {};
+
+        Metrics(Communication *comm) : comm(comm) {}
+        void watchTask(const char* name, TaskHandle_t task);
+        size_t encode(uint8_t *buffer, size_t size);
+        size_t read(uint32_t offset, uint8_t *buffer, size_t size, bool *more); // CoapBlockSource of GET /metrics
+};
@@ -0,0 +1,125 @@
+#include "perf.h"
+#include <stdio.h>
+#include <string.h>
+#include <Arduino.h>
+#include "esp_cpu.h"
+#include "esp32/rom/ets_sys.h"
+
+PerfHistogram Perf::histograms[PERF_TIMER_COUNT];
+
+uint32_t Perf::ticks()
+{
+    return esp_cpu_get_ccount();
+}
+
+// Elapsed cycles at the current CPU frequency, CCOUNT wraps after 17 s at 240 MHz
+void Perf::record(PerfTimer timer, uint32_t start_ticks)
+{
+    uint32_t cycles = esp_cpu_get_ccount() - start_ticks;
+    uint64_t ns = (uint64_t)cycles * 1000 / ets_get_cpu_frequency();
+    PerfHistogram *histogram = &histograms[timer];
+    if(histogram->count == UINT32_MAX) //halving keeps the percentiles, the counts don't wrap
+    {
+        histogram->count = 0;
+        for(int i = 0; i < PERF_BUCKETS; i++)
+        {
+            histogram->buckets[i] /= 2;
+            histogram->count += histogram->buckets[i];
+        }
+        histogram->total_ns /= 2;
+    }
+    histogram->buckets[bucket(ns)]++;
+    histogram->count++;
+    histogram->total_ns += ns;
+    if(ns > histogram->max_ns)
+        histogram->max_ns = ns;
+}
+
+// Power of two of the time, then PERF_SUB_BITS below the leading one
+uint8_t Perf::bucket(uint64_t ns)
+{
+    if(ns < (1ULL << PERF_MIN_SHIFT))
+        return 0;
+    int octave = 63 - __builtin_clzll(ns);
+    if(octave >= PERF_MIN_SHIFT + PERF_OCTAVES)
+        return PERF_BUCKETS - 1;
+    uint32_t sub = (ns >> (octave - PERF_SUB_BITS)) & (PERF_SUB_BUCKETS - 1);
+    return 1 + (octave - PERF_MIN_SHIFT) * PERF_SUB_BUCKETS + sub;
+}
+
+uint64_t Perf::bucketEdge(uint8_t bucket)
+{
+    if(bucket == 0)
+        return 1ULL << PERF_MIN_SHIFT;
+    int octave = (bucket - 1) / PERF_SUB_BUCKETS + PERF_MIN_SHIFT;
+    uint64_t sub = (bucket - 1) % PERF_SUB_BUCKETS;
+    return (PERF_SUB_BUCKETS + sub + 1) << (octave - PERF_SUB_BITS);
+}
+
+uint64_t Perf::percentile(const PerfHistogram *histogram, uint32_t count, uint32_t permille)
+{
+    uint64_t rank = ((uint64_t)count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for(int i = 0; i < PERF_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if(seen >= rank)
+        {
+            uint64_t edge = bucketEdge(i);
+            return edge < histogram->max_ns ? edge : histogram->max_ns;
+        }
+    }
+    return histogram->max_ns; //a sample was being added
+}
+
+void Perf::summary(PerfTimer timer, PerfSummary *summary)
+{
+    const PerfHistogram *histogram = &histograms[timer];
+    *summary = {};
+    summary->count = histogram->count;
+    if(!summary->count)
+        return;
+    summary->p50_ns = percentile(histogram, summary->count, 500);
+    summary->p99_ns = percentile(histogram, summary->count, 990);
+    summary->max_ns = histogram->max_ns;
+    summary->mean_ns = histogram->total_ns / summary->count;
+}
+
+const char* Perf::name(PerfTimer timer)
+{
+    static const char* names[PERF_TIMER_COUNT] = PERF_TIMER_NAMES;
+    return timer < PERF_TIMER_COUNT ? names[timer] : "?";
+}
+
+void Perf::reset()
+{
+    memset(histograms, 0, sizeof(histograms));
+}
+
+size_t Perf::report(char *buffer, size_t size)
+{
+    size_t len = snprintf(buffer, size, "timer,count,p50_us,p99_us,max_us,mean_us\n");
+    for(int i = 0; i < PERF_TIMER_COUNT && len < size; i++)
+    {
+        PerfSummary s;
+        summary((PerfTimer)i, &s);
+        if(!s.count)
+            continue;
+        len += snprintf(buffer + len, size - len, "%s,%u,%.1f,%.1f,%.1f,%.1f\n", name((PerfTimer)i), s.count,
+            s.p50_ns / 1000.0, s.p99_ns / 1000.0, s.max_ns / 1000.0, s.mean_ns / 1000.0);
+    }
+    return len < size ? len : size - 1;
+}
+
+void Perf::print()
+{
+    Serial.printf("%-20s %8s %10s %10s %10s %10s\n", "timer", "count", "p50 us", "p99 us", "max us", "mean us");
+    for(int i = 0; i < PERF_TIMER_COUNT; i++)
+    {
+        PerfSummary s;
+        summary((PerfTimer)i, &s);
+        if(s.count)
+            Serial.printf("%-20s %8u %10.1f %10.1f %10.1f %10.1f\n", name((PerfTimer)i), s.count, s.p50_ns / 1000.0,
+                s.p99_ns / 1000.0, s.max_ns / 1000.0, s.mean_ns / 1000.0);
+    }
+}
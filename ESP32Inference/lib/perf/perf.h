@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Scoped timers on the hot paths: PERF_SCOPE(timer) measures until the end of the enclosing block with the CPU
+// cycle counter (CCOUNT, steady_clock in the host build) and adds the time to a histogram of that timer. The
+// histograms are static, log scale with PERF_SUB_BUCKETS per power of two (at most 25 % wide), so p50/p99/max can be
+// read at any time (Perf::summary, GET /perf) without stopping anything. Each timer has one writing task, a
+// reader may see a sample half added. With frequency scaling (lib/power/pm.h) CCOUNT follows the CPU clock and is
+// converted at the frequency of the scope's end, a scope across a switch is off, model_invoke runs under the CPU
+// lock. PERF_TIMERS=0 compiles the scopes out.
+#ifndef PERF_TIMERS
+#define PERF_TIMERS 1
+#endif
+#define PERF_SUB_BITS 2
+#define PERF_SUB_BUCKETS (1 << PERF_SUB_BITS)
+#define PERF_MIN_SHIFT 8     //first bucket holds everything below 256 ns
+#define PERF_OCTAVES 27      //up to 2^35 ns (34 s), longer times land in the last bucket
+#define PERF_BUCKETS (1 + PERF_OCTAVES * PERF_SUB_BUCKETS)
+
+typedef enum {
+    PERF_LOOP,               // loop() when always awake
+    PERF_POLL,               // sampling branch of loop(), read to queued
+    PERF_READ_SENSORS,
+    PERF_TX_UPDATE,
+    PERF_BMP280_READ,
+    PERF_MLX90614_READ,
+    PERF_CCS811_READ,
+    PERF_DHT_READ,
+    PERF_PIR_READ,
+    PERF_COAP_SEND,          // Coap::sendPacket and the template send(), encode and hand over
+    PERF_COAP_LOOP,
+    PERF_MODEL_SET_SEQUENCES,
+    PERF_MODEL_PRINT_BUFFERS,
+    PERF_MODEL_DELTAS,
+    PERF_MODEL_SCALE,
+    PERF_MODEL_SET_INPUTS,
+    PERF_MODEL_INVOKE,
+    PERF_MODEL_SHIFT,
+    PERF_TIMER_COUNT
+} PerfTimer;
+
+#define PERF_TIMER_NAMES {"loop", "poll", "read_sensors", "tx_update", "bmp280_read", "mlx90614_read", \
+    "ccs811_read", "dht_read", "pir_read", "coap_send", "coap_loop", "model_set_sequences", "model_print_buffers", \
+    "model_deltas", "model_scale", "model_set_inputs", "model_invoke", "model_shift"}
+
+typedef struct {
+    uint32_t buckets[PERF_BUCKETS];
+    uint32_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} PerfHistogram;
+
+typedef struct {
+    uint32_t count;
+    uint64_t p50_ns;         // upper edge of the bucket, at most max_ns
+    uint64_t p99_ns;
+    uint64_t max_ns;
+    uint64_t mean_ns;
+} PerfSummary;
+
+class Perf {
+
+    static PerfHistogram histograms[PERF_TIMER_COUNT];
+    static uint8_t bucket(uint64_t ns);
+    static uint64_t bucketEdge(uint8_t bucket);
+    static uint64_t percentile(const PerfHistogram *histogram, uint32_t count, uint32_t permille);
+
+    public:
+        static uint32_t ticks();
+        static void record(PerfTimer timer, uint32_t start_ticks);
+        static void summary(PerfTimer timer, PerfSummary *summary);
+        static const char* name(PerfTimer timer);
+        static void reset();
+        static size_t report(char *buffer, size_t size); // CSV, timer,count,p50_us,p99_us,max_us,mean_us
+        static void print();
+};
+
+class ScopedTimer {
+
+    PerfTimer timer;
+    uint32_t start;
+
+    public:
+        ScopedTimer(PerfTimer timer) : timer(timer), start(Perf::ticks()) {}
+        ~ScopedTimer() { Perf::record(timer, start); }
+};
+
+#define PERF_CONCAT_(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT_(a, b)
+#if PERF_TIMERS
+#define PERF_SCOPE(timer) ScopedTimer PERF_CONCAT(scoped_timer_, __LINE__)(timer)
+#else
+#define PERF_SCOPE(timer)
+#endif
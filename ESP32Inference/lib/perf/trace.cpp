@@ -0,0 +1,158 @@
+#include "trace.h"
+#include <string.h>
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "esp32/rom/ets_sys.h"
+
+#define TRACE_PRINT_BYTES 32 //per serial line
+
+TraceEvent Trace::rings[TRACE_CORES][TRACE_RING_SIZE];
+uint32_t Trace::heads[TRACE_CORES];
+uint32_t Trace::tails[TRACE_CORES];
+uint32_t Trace::ends[TRACE_CORES];
+uint32_t Trace::dropped[TRACE_CORES];
+void *Trace::task_handles[TRACE_MAX_TASKS];
+char Trace::task_names[TRACE_MAX_TASKS][TRACE_TASK_NAME];
+uint8_t Trace::task_count = 0;
+TraceHeader Trace::header;
+
+void Trace::nameTask(const char *name)
+{
+    if(task_count == TRACE_MAX_TASKS)
+        return;
+    strncpy(task_names[task_count], name, TRACE_TASK_NAME - 1);
+    task_handles[task_count] = xTaskGetCurrentTaskHandle();
+    __atomic_store_n(&task_count, task_count + 1, __ATOMIC_RELEASE);
+}
+
+uint8_t Trace::task()
+{
+    void *current = xTaskGetCurrentTaskHandle();
+    uint8_t count = __atomic_load_n(&task_count, __ATOMIC_ACQUIRE);
+    for(uint8_t i = 0; i < count; i++)
+        if(task_handles[i] == current)
+            return i;
+    return TRACE_TASK_OTHER;
+}
+
+// Runs in ISRs too (the button), so it stays in IRAM and doesn't touch FreeRTOS there
+void IRAM_ATTR Trace::record(TraceType type, TraceEventId event, uint8_t arg)
+{
+    uint32_t ccount = esp_cpu_get_ccount();
+    uint32_t us = esp_timer_get_time();
+    bool isr = xPortInIsrContext();
+    uint8_t core = xPortGetCoreID() % TRACE_CORES;
+    uint32_t head = __atomic_load_n(&heads[core], __ATOMIC_RELAXED);
+    do
+    {
+        if(head - __atomic_load_n(&tails[core], __ATOMIC_ACQUIRE) >= TRACE_RING_SIZE)
+        {
+            __atomic_fetch_add(&dropped[core], 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while(!__atomic_compare_exchange_n(&heads[core], &head, head + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    TraceEvent *slot = &rings[core][head % TRACE_RING_SIZE];
+    slot->ccount = ccount;
+    slot->us = us;
+    slot->event = event;
+    slot->arg = arg;
+    slot->task = isr ? TRACE_TASK_ISR : task();
+    __atomic_store_n(&slot->type, (uint8_t)type, __ATOMIC_RELEASE);
+}
+
+// The dump ends at the first slot a preempted writer hasn't published yet, it comes with the next one
+void Trace::freeze()
+{
+    header = {TRACE_MAGIC, ets_get_cpu_frequency(), {}, {}, TRACE_CORES, task_count, 0};
+    for(int core = 0; core < TRACE_CORES; core++)
+    {
+        uint32_t head = __atomic_load_n(&heads[core], __ATOMIC_ACQUIRE);
+        uint32_t end = tails[core];
+        while(end != head && __atomic_load_n(&rings[core][end % TRACE_RING_SIZE].type, __ATOMIC_ACQUIRE) != TRACE_NONE)
+            end++;
+        ends[core] = end;
+        header.events[core] = end - tails[core];
+        header.dropped[core] = __atomic_load_n(&dropped[core], __ATOMIC_RELAXED);
+    }
+}
+
+// Frees the dumped slots for the writers, cleared first so a reused slot reads as unpublished
+void Trace::release()
+{
+    for(int core = 0; core < TRACE_CORES; core++)
+    {
+        for(uint32_t i = tails[core]; i != ends[core]; i++)
+            __atomic_store_n(&rings[core][i % TRACE_RING_SIZE].type, (uint8_t)TRACE_NONE, __ATOMIC_RELAXED);
+        __atomic_store_n(&tails[core], ends[core], __ATOMIC_RELEASE);
+    }
+}
+
+// Bytes of the dump at offset and how many follow contiguously, nullptr past the end
+const uint8_t* Trace::source(uint32_t offset, size_t *len)
+{
+    if(offset < sizeof(header))
+    {
+        *len = sizeof(header) - offset;
+        return (const uint8_t *)&header + offset;
+    }
+    offset -= sizeof(header);
+    if(offset < header.tasks * TRACE_TASK_NAME)
+    {
+        *len = header.tasks * TRACE_TASK_NAME - offset;
+        return (const uint8_t *)task_names + offset;
+    }
+    offset -= header.tasks * TRACE_TASK_NAME;
+    for(int core = 0; core < TRACE_CORES; core++)
+    {
+        uint32_t bytes = header.events[core] * sizeof(TraceEvent);
+        if(offset < bytes)
+        {
+            uint32_t index = (tails[core] + offset / sizeof(TraceEvent)) % TRACE_RING_SIZE;
+            *len = sizeof(TraceEvent) - offset % sizeof(TraceEvent);
+            return (const uint8_t *)&rings[core][index] + offset % sizeof(TraceEvent);
+        }
+        offset -= bytes;
+    }
+    return nullptr;
+}
+
+// One snapshot per download: the events end where offset 0 found them, the slots are freed after the last block.
+// A download that is abandoned and restarted hands out the same events again.
+size_t Trace::read(uint32_t offset, uint8_t *buffer, size_t size, bool *more)
+{
+    if(offset == 0)
+        freeze();
+    size_t n = 0, len;
+    const uint8_t *bytes;
+    while(n < size && (bytes = source(offset + n, &len)))
+    {
+        len = len < size - n ? len : size - n;
+        memcpy(buffer + n, bytes, len);
+        n += len;
+    }
+    size_t rest;
+    *more = source(offset + n, &rest) != nullptr;
+    if(!*more)
+        release();
+    return n;
+}
+
+void Trace::print()
+{
+    uint8_t line[TRACE_PRINT_BYTES];
+    uint32_t offset = 0;
+    bool more = true;
+    while(more)
+    {
+        size_t n = read(offset, line, sizeof(line), &more);
+        Serial.print("TRACE ");
+        for(size_t i = 0; i < n; i++)
+            Serial.printf("%02x", line[i]);
+        Serial.println();
+        offset += n;
+    }
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "perf.h"
+
+// Event trace of the task interactions: begin/end and instant events stamped with CCOUNT and the esp_timer us
+// (the cores' cycle counters aren't in step, the us line them up) go into a ring per core. Writers reserve a slot
+// with a compare and swap and publish it by writing its type last, so tasks and ISRs never block each other; a
+// full ring drops the new event and counts it. GET /trace (block-wise) and Trace::print() (hex lines on serial)
+// hand out the events since the last complete dump in the binary form below, CoapServer/trace_to_perfetto.py
+// turns either into Chrome/Perfetto JSON. TRACE_EVENTS=0 compiles the events out, they follow PERF_TIMERS.
+//   TraceHeader, TraceHeader.tasks names of TRACE_TASK_NAME bytes, the events of core 0, then of core 1
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS PERF_TIMERS
+#endif
+#define TRACE_RING_SIZE 256      //events per core
+#define TRACE_CORES 2
+#define TRACE_MAX_TASKS 8
+#define TRACE_TASK_NAME 16
+#define TRACE_MAGIC 0x31435254   //"TRC1"
+#define TRACE_TASK_OTHER 0xFE    //task that didn't call Trace::nameTask
+#define TRACE_TASK_ISR 0xFF
+
+typedef enum {
+    TRACE_NONE,              // slot reserved, not written yet
+    TRACE_BEGIN,
+    TRACE_END,
+    TRACE_INSTANT
+} TraceType;
+
+typedef enum {
+    TRACE_WAIT_DATA_SET,     // run_model blocked until loop() hands over a window
+    TRACE_WAIT_PREDICTION,   // loop() blocked until PREDICTION_READY
+    TRACE_SET_DATA_SET,      // instant
+    TRACE_SET_PREDICTION_READY,
+    TRACE_BMP280_READ,
+    TRACE_MLX90614_READ,
+    TRACE_CCS811_READ,
+    TRACE_DHT_READ,
+    TRACE_UDP_SEND,          // Coap encode and hand over to the socket
+    TRACE_UDP_RECEIVE,       // instant, arg: datagram length (255 for longer)
+    TRACE_INVOKE,
+    TRACE_WIFI_EVENT,        // instant, arg: Arduino event id
+    TRACE_BUTTON,            // instant from the ISR
+    TRACE_EVENT_COUNT
+} TraceEventId;
+
+#define TRACE_EVENT_NAMES {"wait_data_set", "wait_prediction", "set_data_set", "set_prediction_ready", \
+    "bmp280_read", "mlx90614_read", "ccs811_read", "dht_read", "udp_send", "udp_receive", "invoke", "wifi_event", \
+    "button"}
+
+typedef struct {
+    uint32_t ccount;
+    uint32_t us;             // esp_timer_get_time(), low 32 bits
+    uint8_t type;            // TraceType
+    uint8_t event;           // TraceEventId
+    uint8_t task;            // index into the task names, TRACE_TASK_OTHER or TRACE_TASK_ISR
+    uint8_t arg;
+} TraceEvent;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t cpu_mhz;        // CCOUNT rate at the dump
+    uint32_t dropped[TRACE_CORES]; // since boot
+    uint16_t events[TRACE_CORES];  // in this dump
+    uint8_t cores;
+    uint8_t tasks;
+    uint16_t reserved;
+} TraceHeader;
+
+class Trace {
+
+    static TraceEvent rings[TRACE_CORES][TRACE_RING_SIZE];
+    static uint32_t heads[TRACE_CORES];  // reserved by writers
+    static uint32_t tails[TRACE_CORES];  // handed out by the last complete dump
+    static uint32_t ends[TRACE_CORES];   // end of the dump in progress
+    static uint32_t dropped[TRACE_CORES];
+    static void *task_handles[TRACE_MAX_TASKS];
+    static char task_names[TRACE_MAX_TASKS][TRACE_TASK_NAME];
+    static uint8_t task_count;
+    static TraceHeader header;
+
+    static uint8_t task();
+    static void freeze();
+    static void release();
+    static const uint8_t* source(uint32_t offset, size_t *len);
+
+    public:
+        static void record(TraceType type, TraceEventId event, uint8_t arg = 0);
+        static void nameTask(const char *name); // the calling task, before its first event
+        static size_t read(uint32_t offset, uint8_t *buffer, size_t size, bool *more); // CoapBlockSource of GET /trace
+        static void print();
+};
+
+class ScopedTrace {
+
+    TraceEventId event;
+
+    public:
+        ScopedTrace(TraceEventId event) : event(event) { Trace::record(TRACE_BEGIN, event); }
+        ~ScopedTrace() { Trace::record(TRACE_END, event); }
+};
+
+#if TRACE_EVENTS
+#define TRACE_SCOPE(event) ScopedTrace PERF_CONCAT(scoped_trace_, __LINE__)(event)
+#define TRACE_INSTANT(event, arg) Trace::record(TRACE_INSTANT, event, arg)
+#else
+#define TRACE_SCOPE(event)
+#define TRACE_INSTANT(event, arg)
+#endif
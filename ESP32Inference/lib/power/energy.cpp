@@ -0,0 +1,161 @@
+#include "energy.h"
+#include <stdio.h>
+#include <sys/time.h>
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include "esp_attr.h"
+#include "power.h"
+
+RTC_DATA_ATTR static EnergyState state;
+static portMUX_TYPE energy_lock = portMUX_INITIALIZER_UNLOCKED;
+static const char* subsystem_names[ENERGY_SUBSYSTEM_COUNT] = ENERGY_SUBSYSTEM_NAMES;
+
+// RTC time like the duty cycle, SNTP doesn't step it
+static int64_t rtcTimeUs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// Charge of the old state up to now, then the new current
+void Energy::set(EnergySubsystem subsystem, float current_ua)
+{
+    int64_t now = rtcTimeUs();
+    portENTER_CRITICAL(&energy_lock);
+    state.charge_uas[subsystem] += state.current_ua[subsystem] * (now - state.since_us[subsystem]) / 1e6;
+    state.since_us[subsystem] = now;
+    state.current_ua[subsystem] = current_ua;
+    portEXIT_CRITICAL(&energy_lock);
+}
+
+// Power on starts from the reset states: sensors as they come up, CCS811 idle, BMP280 asleep. After a deep sleep
+// wake the boot until here counts as sleep.
+void Energy::begin()
+{
+    if(state.magic != ENERGY_MAGIC)
+    {
+        int64_t now = rtcTimeUs();
+        state = {};
+        state.magic = ENERGY_MAGIC;
+        state.start_us = now;
+        for(int i = 0; i < ENERGY_SUBSYSTEM_COUNT; i++)
+            state.since_us[i] = now;
+        state.current_ua[ENERGY_CCS811] = CCS811_IDLE_UA;
+        state.current_ua[ENERGY_BMP280] = BMP280_SLEEP_UA;
+        state.current_ua[ENERGY_MLX90614] = MLX90614_AWAKE_UA;
+        state.current_ua[ENERGY_MPU9250] = MPU9250_AWAKE_UA;
+        state.current_ua[ENERGY_DHT_PIR] = DHT11_STANDBY_UA + PIR_QUIESCENT_UA;
+    }
+    state.cpu_mhz = getCpuFrequencyMhz();
+    cpu(CPU_ACTIVE);
+    radio(RADIO_OFF);
+}
+
+float Energy::cpuCurrent()
+{
+    if(state.cpu_state == CPU_DEEP_SLEEP)
+        return ESP32_DEEP_SLEEP_UA; //power.h, with the sensor coefficients
+    if(state.cpu_state == CPU_LIGHT_SLEEP)
+        return ESP32_CPU_LIGHT_SLEEP_UA;
+    if(state.cpu_mhz >= 240)
+        return ESP32_CPU_240MHZ_UA;
+    return state.cpu_mhz >= 160 ? ESP32_CPU_160MHZ_UA : ESP32_CPU_80MHZ_UA; //below 80 MHz the APB clock drops too
+}
+
+// Deep sleep powers the radio down, light sleep keeps its state (modem sleep wakes for beacons)
+void Energy::cpu(EnergyCpuState cpu_state)
+{
+    state.cpu_state = cpu_state;
+    set(ENERGY_CPU, cpuCurrent());
+    if(cpu_state == CPU_DEEP_SLEEP)
+        set(ENERGY_RADIO, 0);
+}
+
+void Energy::cpuFrequency(uint32_t mhz)
+{
+    state.cpu_mhz = mhz;
+    set(ENERGY_CPU, cpuCurrent());
+}
+
+void Energy::radio(EnergyRadioState radio_state)
+{
+    const float current[] = {0, ESP32_RADIO_RX_UA, ESP32_RADIO_MODEM_SLEEP_UA};
+    set(ENERGY_RADIO, current[radio_state]);
+}
+
+// Frames are too short for a state change, their airtime is charged right away
+void Energy::transmit(size_t bytes)
+{
+    float airtime_us = ESP32_RADIO_TX_BASE_US + bytes * ESP32_RADIO_TX_BYTE_US;
+    portENTER_CRITICAL(&energy_lock);
+    state.charge_uas[ENERGY_RADIO] += ESP32_RADIO_TX_UA * airtime_us / 1e6;
+    portEXIT_CRITICAL(&energy_lock);
+}
+
+void Energy::ccs811(uint8_t mode)
+{
+    set(ENERGY_CCS811, PowerManager::estimateCCSCurrent(mode));
+}
+
+void Energy::bmp280(uint8_t config, uint8_t ctrl_meas)
+{
+    set(ENERGY_BMP280, PowerManager::estimateBMPCurrent(config, ctrl_meas)); //forced mode counts as sleep
+}
+
+void Energy::mlx90614(bool awake)
+{
+    set(ENERGY_MLX90614, awake ? MLX90614_AWAKE_UA : MLX90614_SLEEP_UA);
+}
+
+void Energy::mpu9250(bool awake)
+{
+    set(ENERGY_MPU9250, awake ? MPU9250_AWAKE_UA : MPU9250_SLEEP_UA);
+}
+
+// Average current since power on in mA, which is also the mAh drawn per hour
+float Energy::averageMa(EnergySubsystem subsystem, double *hours)
+{
+    int64_t now = rtcTimeUs();
+    portENTER_CRITICAL(&energy_lock);
+    double charge_uas = state.charge_uas[subsystem];
+    charge_uas += state.current_ua[subsystem] * (now - state.since_us[subsystem]) / 1e6;
+    double elapsed_s = (now - state.start_us) / 1e6;
+    portEXIT_CRITICAL(&energy_lock);
+    if(hours)
+        *hours = elapsed_s / 3600;
+    return elapsed_s > 0 ? charge_uas / elapsed_s / 1000 : 0;
+}
+
+const char* Energy::name(EnergySubsystem subsystem)
+{
+    return subsystem < ENERGY_SUBSYSTEM_COUNT ? subsystem_names[subsystem] : "?";
+}
+
+size_t Energy::report(char *buffer, size_t size)
+{
+    double hours = 0, total = 0;
+    int len = snprintf(buffer, size, "subsystem,mAh_per_h,mAh\n");
+    for(int i = 0; i < ENERGY_SUBSYSTEM_COUNT && len >= 0 && (size_t)len < size; i++)
+    {
+        float average = averageMa((EnergySubsystem)i, &hours);
+        total += average;
+        len += snprintf(buffer + len, size - len, "%s,%.3f,%.3f\n", name((EnergySubsystem)i), average, average * hours);
+    }
+    if(len >= 0 && (size_t)len < size)
+        len += snprintf(buffer + len, size - len, "total,%.3f,%.3f\n", total, total * hours);
+    return len < 0 ? 0 : (size_t)len < size ? len : size - 1;
+}
+
+void Energy::print()
+{
+    double hours = 0, total = 0;
+    for(int i = 0; i < ENERGY_SUBSYSTEM_COUNT; i++)
+        total += averageMa((EnergySubsystem)i, &hours);
+    Serial.printf("Energy estimate over %.2f h: %.3f mAh/h\n", hours, total);
+    for(int i = 0; i < ENERGY_SUBSYSTEM_COUNT; i++)
+    {
+        float average = averageMa((EnergySubsystem)i, &hours);
+        Serial.printf("  %-10s %9.3f mAh/h %9.3f mAh\n", name((EnergySubsystem)i), average, average * hours);
+    }
+}
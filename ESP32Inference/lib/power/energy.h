@@ -0,0 +1,104 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Energy estimate per subsystem: the drivers, Communication and the sleep paths report state changes, each state
+// has a current coefficient (the sensor ones in power.h, the ESP32 ones below) and the charge is integrated over
+// the RTC time, which runs on through deep sleep, so the totals in RTC memory cover every boot since power on.
+// mAh per hour (the average current in mA) per subsystem goes to GET /metrics, Energy::print() and the host
+// build, where it runs on the virtual clock and configurations compare in seconds. ENERGY_ACCOUNTING=0 compiles
+// the hooks out. The coefficients are datasheet typicals at 3.3 V, override them with -D for a measured board.
+#ifndef ENERGY_ACCOUNTING
+#define ENERGY_ACCOUNTING 1
+#endif
+#ifndef ESP32_CPU_240MHZ_UA
+#define ESP32_CPU_240MHZ_UA 40000.0  // both cores, radio off
+#endif
+#ifndef ESP32_CPU_160MHZ_UA
+#define ESP32_CPU_160MHZ_UA 31000.0
+#endif
+#ifndef ESP32_CPU_80MHZ_UA
+#define ESP32_CPU_80MHZ_UA 22000.0
+#endif
+#ifndef ESP32_CPU_LIGHT_SLEEP_UA
+#define ESP32_CPU_LIGHT_SLEEP_UA 800.0
+#endif
+#ifndef ESP32_RADIO_RX_UA
+#define ESP32_RADIO_RX_UA 60000.0    // on top of the CPU: scanning, associating, listening without power save
+#endif
+#ifndef ESP32_RADIO_MODEM_SLEEP_UA
+#define ESP32_RADIO_MODEM_SLEEP_UA 5000.0 // associated with power save, average over the beacon wakes
+#endif
+#ifndef ESP32_RADIO_TX_UA
+#define ESP32_RADIO_TX_UA 140000.0   // on top of the CPU while a frame is on air
+#endif
+#ifndef ESP32_RADIO_TX_BASE_US
+#define ESP32_RADIO_TX_BASE_US 250   //preamble, MAC ACK and contention per datagram
+#endif
+#ifndef ESP32_RADIO_TX_BYTE_US
+#define ESP32_RADIO_TX_BYTE_US 0.3   //802.11g/n at the rates a room AP keeps
+#endif
+#define ENERGY_MAGIC 0x454E5247      //"ENRG"
+#define ENERGY_REPORT_SIZE 512
+
+typedef enum {
+    ENERGY_CPU,
+    ENERGY_RADIO,
+    ENERGY_CCS811,
+    ENERGY_BMP280,
+    ENERGY_MLX90614,
+    ENERGY_MPU9250,
+    ENERGY_DHT_PIR,          // always powered
+    ENERGY_SUBSYSTEM_COUNT
+} EnergySubsystem;
+
+#define ENERGY_SUBSYSTEM_NAMES {"cpu", "radio", "ccs811", "bmp280", "mlx90614", "mpu9250", "dht_pir"}
+
+typedef enum {
+    CPU_ACTIVE,              // at the current CPU frequency
+    CPU_LIGHT_SLEEP,
+    CPU_DEEP_SLEEP
+} EnergyCpuState;
+
+typedef enum {
+    RADIO_OFF,
+    RADIO_RX,                // connecting or associated without power save
+    RADIO_MODEM_SLEEP
+} EnergyRadioState;
+
+typedef struct {
+    uint32_t magic;
+    int64_t start_us;                               // RTC time at power on
+    int64_t since_us[ENERGY_SUBSYSTEM_COUNT];       // RTC time of the last state change
+    float current_ua[ENERGY_SUBSYSTEM_COUNT];
+    double charge_uas[ENERGY_SUBSYSTEM_COUNT];      // uA s up to since_us
+    uint8_t cpu_state;
+    uint16_t cpu_mhz;
+} EnergyState;
+
+class Energy {
+
+    static void set(EnergySubsystem subsystem, float current_ua);
+    static float cpuCurrent();
+
+    public:
+        static void begin();     // every boot, ends a deep sleep
+        static void cpu(EnergyCpuState state);
+        static void cpuFrequency(uint32_t mhz);
+        static void radio(EnergyRadioState state);
+        static void transmit(size_t bytes);
+        static void ccs811(uint8_t mode);
+        static void bmp280(uint8_t config, uint8_t ctrl_meas);
+        static void mlx90614(bool awake);
+        static void mpu9250(bool awake);
+        static float averageMa(EnergySubsystem subsystem, double *hours = nullptr); // mAh per hour since power on
+        static const char* name(EnergySubsystem subsystem);
+        static size_t report(char *buffer, size_t size); // CSV, subsystem,mAh_per_h,mAh
+        static void print();
+};
+
+#if ENERGY_ACCOUNTING
+#define ENERGY_STATE(call) Energy::call
+#else
+#define ENERGY_STATE(call)
+#endif
@@ -0,0 +1,119 @@
+#include "pm.h"
+#include <Arduino.h>
+#include <driver/gpio.h>
+#include <freertos/FreeRTOS.h>
+#include "esp_log.h"
+#include "energy.h"
+static const char* TAG = "PM";
+
+esp_pm_lock_handle_t PowerLocks::locks[PM_LOCK_COUNT] = {};
+uint16_t PowerLocks::held[PM_LOCK_COUNT] = {};
+uint8_t PowerLocks::mode = PM_FIXED;
+bool PowerLocks::idling = false;
+uint64_t PowerLocks::wake_pins = 0;
+static portMUX_TYPE pm_lock = portMUX_INITIALIZER_UNLOCKED;
+static const char* mode_names[] = PM_MODE_NAMES;
+
+// Steps down from the requested mode until the IDF accepts one: without tickless idle there's no automatic light
+// sleep, without CONFIG_PM_ENABLE no power management at all
+uint8_t PowerLocks::begin(uint64_t pins, uint8_t requested)
+{
+    for(mode = requested; mode != PM_FIXED; mode--)
+    {
+        esp_pm_config_esp32_t config = {PM_MAX_MHZ, PM_MIN_MHZ, mode == PM_DFS_LIGHT_SLEEP};
+        if(esp_pm_configure(&config) == ESP_OK)
+            break;
+        ESP_LOGE(TAG, "Power management mode %s not supported", name(mode));
+    }
+    if(mode != PM_FIXED && !locks[PM_LOCK_CPU] &&
+        (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "cpu", &locks[PM_LOCK_CPU]) != ESP_OK ||
+        esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "apb", &locks[PM_LOCK_APB]) != ESP_OK))
+    {
+        ESP_LOGE(TAG, "Failed to create the power management locks");
+        esp_pm_config_esp32_t config = {PM_MAX_MHZ, PM_MAX_MHZ, false};
+        esp_pm_configure(&config);
+        mode = PM_FIXED;
+    }
+    if(mode == PM_DFS_LIGHT_SLEEP && pins)
+    {
+        wake_pins = pins;
+        for(uint8_t pin = 0; pin < 64; pin++)
+            wakeOnChange(pin);
+        esp_sleep_enable_gpio_wakeup();
+    }
+    if(mode == PM_FIXED)
+        Serial.printf("Power management: %s, %u MHz\n", name(mode), frequency());
+    else
+        Serial.printf("Power management: %s, %u-%u MHz\n", name(mode), PM_MIN_MHZ, PM_MAX_MHZ);
+    account();
+    return mode;
+}
+
+// Frequency and automatic light sleep for the energy estimate, the IDF switches on its own
+void PowerLocks::account()
+{
+    portENTER_CRITICAL(&pm_lock);
+    uint32_t mhz = frequency();
+    bool sleeping = mode == PM_DFS_LIGHT_SLEEP && idling && !held[PM_LOCK_CPU] && !held[PM_LOCK_APB];
+    portEXIT_CRITICAL(&pm_lock);
+    ENERGY_STATE(cpuFrequency(mhz));
+    ENERGY_STATE(cpu(sleeping ? CPU_LIGHT_SLEEP : CPU_ACTIVE));
+}
+
+void PowerLocks::acquire(PmLock lock)
+{
+    if(mode == PM_FIXED)
+        return;
+    esp_pm_lock_acquire(locks[lock]);
+    portENTER_CRITICAL(&pm_lock);
+    held[lock]++;
+    portEXIT_CRITICAL(&pm_lock);
+    account();
+}
+
+void PowerLocks::release(PmLock lock)
+{
+    if(mode == PM_FIXED)
+        return;
+    portENTER_CRITICAL(&pm_lock);
+    held[lock]--;
+    portEXIT_CRITICAL(&pm_lock);
+    esp_pm_lock_release(locks[lock]);
+    account();
+}
+
+// Only the calling task blocks, another one holding a lock keeps the CPU awake meanwhile
+void PowerLocks::idle(uint32_t ms)
+{
+    if(mode == PM_FIXED)
+        return;
+    for(uint8_t pin = 0; pin < 64 && wake_pins; pin++)
+        wakeOnChange(pin);
+    idling = true;
+    account();
+    delay(ms);
+    idling = false;
+    account();
+}
+
+// GPIO wake up is level triggered, waking on the opposite of the current level catches the next change. The IDF
+// sets the pin interrupt to that level, so a pin with an ISR has to re-arm from it or the level fires it again.
+void IRAM_ATTR PowerLocks::wakeOnChange(uint8_t pin)
+{
+    if(pin < 64 && (wake_pins >> pin) & 1)
+        gpio_wakeup_enable((gpio_num_t)pin, digitalRead(pin) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+}
+
+uint32_t PowerLocks::frequency()
+{
+    if(mode == PM_FIXED)
+        return getCpuFrequencyMhz();
+    if(held[PM_LOCK_CPU])
+        return PM_MAX_MHZ;
+    return held[PM_LOCK_APB] && PM_MIN_MHZ < PM_APB_MHZ ? PM_APB_MHZ : PM_MIN_MHZ;
+}
+
+const char* PowerLocks::name(uint8_t pm_mode)
+{
+    return pm_mode <= PM_DFS_LIGHT_SLEEP ? mode_names[pm_mode] : "?";
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <stdint.h>
+#include "esp_pm.h"
+
+// Dynamic frequency scaling with ESP-IDF power management: the CPU runs at PM_MIN_MHZ and, with PM_DFS_LIGHT_SLEEP,
+// sleeps automatically whenever every task blocks (Wi-Fi modem sleep keeps the association through it).
+// PM_CPU_SCOPE() raises the CPU to PM_MAX_MHZ until the end of the enclosing block, around preprocessing and
+// Predict. PM_APB_SCOPE() keeps the APB clock at 80 MHz for I2C and RMT transfers, which only changes anything with
+// PM_MIN_MHZ below 80 (the IDF drivers take the same lock). Either lock holds off automatic light sleep. The lock
+// changes go to the energy estimate (energy.h), so configurations compare by their mAh per hour.
+// Needs CONFIG_PM_ENABLE and for light sleep CONFIG_FREERTOS_USE_TICKLESS_IDLE, begin() falls back to frequency
+// scaling alone, then to the fixed clock. PM_MODE=PM_FIXED keeps the fixed clock and compiles the scopes out.
+// GPIO edge interrupts don't fire in light sleep, so the wake pins given to begin() wake it on any level change.
+#define PM_FIXED 0
+#define PM_DFS 1
+#define PM_DFS_LIGHT_SLEEP 2
+#ifndef PM_MODE
+#define PM_MODE PM_DFS_LIGHT_SLEEP
+#endif
+#ifndef PM_MIN_MHZ
+#define PM_MIN_MHZ 80                //40 (XTAL) also slows the APB clock, the peripherals need their lock then
+#endif
+#ifndef PM_MAX_MHZ
+#define PM_MAX_MHZ 240
+#endif
+#define PM_APB_MHZ 80
+#define PM_MODE_NAMES {"fixed", "dfs", "dfs_light_sleep"}
+
+typedef enum {
+    PM_LOCK_CPU,
+    PM_LOCK_APB,
+    PM_LOCK_COUNT
+} PmLock;
+
+class PowerLocks {
+
+    static esp_pm_lock_handle_t locks[PM_LOCK_COUNT];
+    static uint16_t held[PM_LOCK_COUNT];
+    static uint8_t mode;
+    static bool idling;
+    static uint64_t wake_pins;
+
+    static void account();
+
+    public:
+        static uint8_t begin(uint64_t wake_pins = 0, uint8_t mode = PM_MODE); // the mode the IDF accepted
+        static void wakeOnChange(uint8_t pin); // re-arms a wake pin, from its ISR too (the wake level replaces its edge)
+        static void acquire(PmLock lock);
+        static void release(PmLock lock);
+        static void idle(uint32_t ms);   // blocks, the time automatic light sleep has; returns at once with PM_FIXED
+        static uint8_t getMode() { return mode; }
+        static uint32_t frequency();     // CPU MHz the held locks ask for
+        static const char* name(uint8_t mode);
+};
+
+class ScopedPmLock {
+
+    PmLock lock;
+
+    public:
+        ScopedPmLock(PmLock lock) : lock(lock) { PowerLocks::acquire(lock); }
+        ~ScopedPmLock() { PowerLocks::release(lock); }
+};
+
+#define PM_CONCAT_(a, b) a##b
+#define PM_CONCAT(a, b) PM_CONCAT_(a, b)
+#if PM_MODE != PM_FIXED
+#define PM_CPU_SCOPE() ScopedPmLock PM_CONCAT(pm_lock_, __LINE__)(PM_LOCK_CPU)
+#define PM_APB_SCOPE() ScopedPmLock PM_CONCAT(pm_lock_, __LINE__)(PM_LOCK_APB)
+#else
+#define PM_CPU_SCOPE()
+#define PM_APB_SCOPE()
+#endif
@@ -0,0 +1,192 @@
+#include "power.h"
+#include "esp_log.h"
+#include "energy.h"
+#include "pm.h"
+static const char* TAG = "POWER";
+
+PowerManager::PowerManager(BMP280 *bmp, MLX90614 *mlx, CCS811 *ccs, uint8_t sda, uint8_t scl, uint8_t nwake, uint8_t mpu_addr):
+    bmp(bmp),
+    mlx(mlx),
+    ccs(ccs),
+    sda(sda),
+    scl(scl),
+    nwake(nwake),
+    mpu_addr(mpu_addr)
+{
+    latency = {0, 0, 0, 0};
+}
+
+bool PowerManager::wasAsleep()
+{
+    return esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED;
+}
+
+// Sequences every sensor into its lowest state, MLX goes last since its sleep command releases the bus
+void PowerManager::sleepSensors()
+{
+    PM_APB_SCOPE();
+    bmp_ctrl_meas = bmp->GetCtrlMeas();
+    if(config.bmp_sleep && !bmp->SetOperationMode(SLEEP))
+        ESP_LOGE(TAG, "Failed to put BMP280 to sleep");
+
+    if(config.mpu_sleep)
+        bmp->MPUToSleep(mpu_addr);
+
+    if(!ccs->start(config.ccs_mode))
+        ESP_LOGE(TAG, "Failed to switch CCS811 to mode %d", config.ccs_mode);
+
+    // nWAKE would float during deep sleep and keep the CCS811 interface powered
+    gpio_hold_en((gpio_num_t)nwake);
+    gpio_deep_sleep_hold_en();
+
+    if(config.mlx_sleep)
+        mlx->sleep();
+    measuring = false;
+}
+
+void PowerManager::deepSleep()
+{
+    sleepSensors();
+    estimateSleepCurrent();
+    Serial.println("Sensors are asleep, going to deep sleep....");
+    Serial.flush();
+    ENERGY_STATE(cpu(CPU_DEEP_SLEEP));
+    esp_deep_sleep_start();
+}
+
+// nWAKE stays latched high after deep sleep until the hold is released, so the CCS811
+// driver could not pull it low and the sensor would not answer
+void PowerManager::releaseHolds()
+{
+    gpio_hold_dis((gpio_num_t)nwake);
+    gpio_deep_sleep_hold_dis();
+}
+
+// Restores the sensors after CCS811 and BMP280 were restarted, so their warm up
+// overlaps with the 40 ms SCL low pulse the MLX90614 needs to leave sleep mode.
+void PowerManager::wakeSensors()
+{
+    releaseHolds();
+    if(wasAsleep() && config.mlx_sleep)
+        mlx->awake(sda, scl);
+
+    ccs_running = wasAsleep() && config.ccs_mode != CCS811_MODE_IDLE;
+    latency = {0, 0, 0, 0};
+    wake_time = 0; // millis() starts with the application, bootloader time is not included
+    last_check = 0;
+    measuring = true;
+}
+
+// Light sleep keeps the sensor objects, so the modes from before sleepSensors() are restored
+// directly instead of running the begin() sequence again.
+void PowerManager::resumeSensors()
+{
+    PM_APB_SCOPE();
+    wake_time = millis();
+    releaseHolds();
+    if(config.ccs_mode != ccs_mode && !ccs->start(ccs_mode))
+        ESP_LOGE(TAG, "Failed to switch CCS811 to mode %d", ccs_mode);
+    if(config.bmp_sleep && !bmp->SetOperationMode(bmp_ctrl_meas & 0x03))
+        ESP_LOGE(TAG, "Failed to wake BMP280");
+    if(config.mlx_sleep)
+        mlx->awake(sda, scl);
+
+    ccs_running = config.ccs_mode != CCS811_MODE_IDLE;
+    latency = {0, 0, 0, 0};
+    last_check = 0;
+    measuring = true;
+}
+
+// Polls the sensors after wake up until each of them returns its first valid sample
+void PowerManager::update()
+{
+    if(!measuring)
+        return;
+    uint32_t now = millis();
+    if(now - last_check < SENSOR_POLL_INTERVAL)
+        return;
+    last_check = now;
+    checkSensors();
+}
+
+void PowerManager::checkSensors()
+{
+    uint32_t elapsed = millis() - wake_time;
+    if(!elapsed)
+        elapsed = 1; // zero marks a sensor that is not valid yet
+
+    if(!latency.bmp_ms && bmp->read(false))
+        latency.bmp_ms = elapsed;
+
+    if(!latency.mlx_ms && !isnan(mlx->readAmbientTempC()))
+        latency.mlx_ms = elapsed;
+
+    if(!latency.ccs_ms)
+    {
+        uint16_t errstat;
+        ccs->read(nullptr, nullptr, &errstat, nullptr);
+        bool has_data = ccs_running ? (errstat & CCS811_ERRSTAT_FW_MODE) : (errstat & CCS811_ERRSTAT_DATA_READY);
+        if(has_data && !(errstat & CCS811_ERRSTAT_ERRORS))
+            latency.ccs_ms = elapsed;
+    }
+
+    if(latency.bmp_ms && latency.mlx_ms && latency.ccs_ms)
+    {
+        latency.total_ms = elapsed;
+        measuring = false;
+        Serial.printf("Wake up latency: BMP280 %u ms, MLX90614 %u ms, CCS811 %u ms, all sensors %u ms\n",
+            latency.bmp_ms, latency.mlx_ms, latency.ccs_ms, latency.total_ms);
+    }
+}
+
+// Average BMP280 current in normal mode, from the measurement time (datasheet 3.8.1) and standby time
+float PowerManager::estimateBMPCurrent(uint8_t config, uint8_t ctrl_meas)
+{
+    const float standby_ms[8] = {0.5, 62.5, 125., 250., 500., 1000., 2000., 4000.};
+    uint8_t mode = ctrl_meas & 0x03;
+    if(mode != NORM)
+        return BMP280_SLEEP_UA;
+
+    uint8_t osrs_t = (ctrl_meas >> 5) & 0x07;
+    uint8_t osrs_p = (ctrl_meas >> 2) & 0x07;
+    float t_meas = 1.25;
+    if(osrs_t)
+        t_meas += 2.3 * (1 << ((osrs_t > X16 ? X16 : osrs_t) - 1)); // codes above X16 also mean x16
+    if(osrs_p)
+        t_meas += 2.3 * (1 << ((osrs_p > X16 ? X16 : osrs_p) - 1)) + 0.575;
+    float t_sb = standby_ms[(config >> 5) & 0x07];
+    return (t_meas * BMP280_MEASURE_UA + t_sb * BMP280_STANDBY_UA) / (t_meas + t_sb);
+}
+
+float PowerManager::estimateCCSCurrent(uint8_t mode)
+{
+    switch(mode)
+    {
+        case CCS811_MODE_1SEC: return CCS811_MODE_1SEC_UA;
+        case CCS811_MODE_10SEC: return CCS811_MODE_10SEC_UA;
+        case CCS811_MODE_60SEC: return CCS811_MODE_60SEC_UA;
+        default: return CCS811_IDLE_UA;
+    }
+}
+
+float PowerManager::estimateSleepCurrent(bool print)
+{
+    float bmp_ua = config.bmp_sleep ? BMP280_SLEEP_UA : estimateBMPCurrent(bmp->GetConfig(), bmp->GetCtrlMeas());
+    float mpu_ua = config.mpu_sleep ? MPU9250_SLEEP_UA : MPU9250_AWAKE_UA;
+    float mlx_ua = config.mlx_sleep ? MLX90614_SLEEP_UA : MLX90614_AWAKE_UA;
+    float ccs_ua = estimateCCSCurrent(config.ccs_mode);
+    float total = ESP32_DEEP_SLEEP_UA + bmp_ua + mpu_ua + mlx_ua + ccs_ua + DHT11_STANDBY_UA + PIR_QUIESCENT_UA;
+
+    if(print)
+    {
+        Serial.printf("Estimated sleep current:\n");
+        Serial.printf("  ESP32 deep sleep: %.1f uA\n", ESP32_DEEP_SLEEP_UA);
+        Serial.printf("  BMP280: %.1f uA\n", bmp_ua);
+        Serial.printf("  MPU9250: %.1f uA\n", mpu_ua);
+        Serial.printf("  MLX90614: %.1f uA\n", mlx_ua);
+        Serial.printf("  CCS811 (mode %d): %.1f uA\n", config.ccs_mode, ccs_ua);
+        Serial.printf("  DHT11 + PIR: %.1f uA\n", DHT11_STANDBY_UA + PIR_QUIESCENT_UA);
+        Serial.printf("  Total: %.1f uA\n", total);
+    }
+    return total;
+}
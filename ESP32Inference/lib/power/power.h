@@ -0,0 +1,77 @@
+#pragma once
+#include <Arduino.h>
+#include <Wire.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include "BMP280.h"
+#include "MLX90614.h"
+#include "CCS811.h"
+
+// Typical supply currents in uA (datasheet values at 3.3 V), used for sleep current estimation
+#define ESP32_DEEP_SLEEP_UA 10.0      // RTC timer + RTC memory retained
+#define BMP280_SLEEP_UA 0.1
+#define BMP280_STANDBY_UA 0.2
+#define BMP280_MEASURE_UA 720.0       // peak current during pressure measurement
+#define MPU9250_SLEEP_UA 8.0
+#define MPU9250_AWAKE_UA 3700.0
+#define MLX90614_SLEEP_UA 2.5
+#define MLX90614_AWAKE_UA 1300.0
+#define CCS811_IDLE_UA 19.0           // nWAKE high, idle mode
+#define CCS811_MODE_1SEC_UA 14000.0   // 46 mW constant heating
+#define CCS811_MODE_10SEC_UA 2100.0   // 7 mW pulse heating
+#define CCS811_MODE_60SEC_UA 360.0    // 1.2 mW low power pulse heating
+#define DHT11_STANDBY_UA 150.0        // always powered, no sleep control
+#define PIR_QUIESCENT_UA 65.0         // always powered, no sleep control
+
+#define SENSOR_POLL_INTERVAL 50 //ms between readiness checks after wake up
+
+typedef struct {
+    bool bmp_sleep = true;               // BMP280 into SLEEP mode, otherwise keeps its current mode
+    bool mpu_sleep = true;               // MPU9250 on the GY-91 board into sleep
+    bool mlx_sleep = true;               // MLX90614 into SMBus sleep (needs 40 ms SCL low on wake up)
+    uint8_t ccs_mode = CCS811_MODE_IDLE; // CCS811 drive mode kept during sleep
+} SensorSleepConfig;
+
+typedef struct {
+    uint32_t bmp_ms;    // wake up -> first valid BMP280 sample
+    uint32_t mlx_ms;    // wake up -> first valid MLX90614 sample
+    uint32_t ccs_ms;    // wake up -> first CCS811 sample with DATA_READY
+    uint32_t total_ms;  // wake up -> all sensors valid
+} WakeLatency;
+
+class PowerManager {
+
+    BMP280 *bmp;
+    MLX90614 *mlx;
+    CCS811 *ccs;
+    uint8_t sda, scl, nwake, mpu_addr;
+    SensorSleepConfig config;
+    uint8_t ccs_mode = CCS811_MODE_1SEC; // CCS811 mode while awake
+    uint8_t bmp_ctrl_meas = 0;           // BMP280 ctrl_meas before sleep, restored after light sleep
+    bool ccs_running = false;            // CCS811 kept measuring during sleep, its last result is valid
+
+    uint32_t wake_time = 0;
+    uint32_t last_check = 0;
+    bool measuring = false;
+    WakeLatency latency;
+
+    void checkSensors();
+
+    public:
+        PowerManager(BMP280 *bmp, MLX90614 *mlx, CCS811 *ccs, uint8_t sda, uint8_t scl, uint8_t nwake, uint8_t mpu_addr);
+        void setSleepConfig(SensorSleepConfig sleep_config) { config = sleep_config; }
+        SensorSleepConfig getSleepConfig() { return config; }
+        void setCCSMode(uint8_t mode) { ccs_mode = mode; }
+        void sleepSensors();
+        void deepSleep();
+        bool wasAsleep();
+        void releaseHolds();
+        void wakeSensors();
+        void resumeSensors();
+        void update();
+        bool wakeComplete() { return !measuring; }
+        WakeLatency getWakeLatency() { return latency; }
+        float estimateSleepCurrent(bool print = true);
+        static float estimateBMPCurrent(uint8_t config, uint8_t ctrl_meas);
+        static float estimateCCSCurrent(uint8_t mode);
+};
@@ -0,0 +1,242 @@
+#include "tsbatch.h"
+#include <string.h>
+#include <math.h>
+
+static const float scales[BATCH_CHANNELS] = BATCH_SCALES;
+
+static void putU32(uint8_t *p, uint32_t value)
+{
+    for(int i = 0; i < 4; i++)
+        p[i] = value >> (8 * i);
+}
+
+static uint32_t getU32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void putU64(uint8_t *p, uint64_t value)
+{
+    putU32(p, (uint32_t)value);
+    putU32(p + 4, (uint32_t)(value >> 32));
+}
+
+static uint64_t getU64(const uint8_t *p)
+{
+    return getU32(p) | ((uint64_t)getU32(p + 4) << 32);
+}
+
+static uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+int32_t BatchEncoder::quantize(Data *data, uint8_t channel)
+{
+    float value;
+    switch(channel)
+    {
+        case 0: value = data->co2_ppm; break;
+        case 1: value = data->tvoc_ppm; break;
+        case 2: value = data->bmp280_temperature; break;
+        case 3: value = data->bmp280_pressure; break;
+        case 4: value = data->mlx_object_temperature; break;
+        case 5: value = data->mlx_ambient_temperature; break;
+        case 6: value = data->humidity_dht; break;
+        case 7: value = data->temperature_dht; break;
+        default: value = data->pir_uptime; break;
+    }
+    float scaled = value * scales[channel];
+    if(isnan(scaled))
+        return BATCH_NAN;
+    if(scaled >= BATCH_LIMIT)
+        return BATCH_LIMIT;
+    if(scaled <= -BATCH_LIMIT)
+        return -BATCH_LIMIT;
+    return (int32_t)lroundf(scaled);
+}
+
+static void dequantize(Data *data, uint8_t channel, int32_t value)
+{
+    float v = value == BATCH_NAN ? NAN : value / scales[channel];
+    switch(channel)
+    {
+        case 0: data->co2_ppm = value; break;
+        case 1: data->tvoc_ppm = value; break;
+        case 2: data->bmp280_temperature = v; break;
+        case 3: data->bmp280_pressure = v; break;
+        case 4: data->mlx_object_temperature = v; break;
+        case 5: data->mlx_ambient_temperature = v; break;
+        case 6: data->humidity_dht = v; break;
+        case 7: data->temperature_dht = v; break;
+        default: data->pir_uptime = v; break;
+    }
+}
+
+BatchEncoder::BatchEncoder(uint8_t *buffer, size_t size):
+    buffer(buffer),
+    size(size)
+{
+    begin();
+}
+
+void BatchEncoder::begin()
+{
+    bit = BATCH_HEADER_SIZE * 8;
+    count = 0;
+    last_delta = 0;
+    memset(last, 0, sizeof(last));
+}
+
+// Bits are set and cleared explicitly, so a rolled back sample leaves nothing behind
+bool BatchEncoder::writeBits(uint32_t value, uint8_t bits)
+{
+    if(bit + bits > size * 8)
+        return false;
+    for(int i = bits - 1; i >= 0; i--, bit++)
+    {
+        uint8_t mask = 0x80 >> (bit & 7);
+        if((value >> i) & 1)
+            buffer[bit >> 3] |= mask;
+        else
+            buffer[bit >> 3] &= ~mask;
+    }
+    return true;
+}
+
+bool BatchEncoder::writeValue(int32_t value)
+{
+    uint32_t z = zigzag(value);
+    if(z == 0)
+        return writeBits(0, 1);
+    if(z < 16)
+        return writeBits(0x2, 2) && writeBits(z, 4);
+    if(z < 256)
+        return writeBits(0x6, 3) && writeBits(z, 8);
+    if(z < 65536)
+        return writeBits(0xE, 4) && writeBits(z, 16);
+    return writeBits(0xF, 4) && writeBits(z, 32);
+}
+
+// False if the sample doesn't fit, the batch then ends with the previous one.
+// Times of one batch share a time base, the ms between samples have to fit 32 bits.
+bool BatchEncoder::add(ReportedData *sample)
+{
+    if(count >= BATCH_MAX_SAMPLES || size < BATCH_HEADER_SIZE)
+        return false;
+    size_t start = bit;
+    int32_t delta = count ? (int32_t)(sample->time_ms - last_time) : 0;
+    bool ok = writeValue(delta - last_delta) &&
+        writeValue(count ? (int32_t)(sample->sequence - last_sequence - 1) : 0);
+    int32_t values[BATCH_CHANNELS];
+    for(uint8_t c = 0; c < BATCH_CHANNELS && ok; c++)
+    {
+        values[c] = quantize(&sample->data, c);
+        ok = writeValue(values[c] - last[c]);
+    }
+    if(!ok)
+    {
+        bit = start;
+        return false;
+    }
+    if(count == 0)
+    {
+        first_time = sample->time_ms;
+        putU64(buffer + 2, sample->time_ms);
+        putU32(buffer + 10, sample->sequence);
+    }
+    last_delta = delta;
+    last_time = sample->time_ms;
+    last_sequence = sample->sequence;
+    memcpy(last, values, sizeof(last));
+    count++;
+    return true;
+}
+
+// Completes the header, returns the payload length
+size_t BatchEncoder::finish(uint64_t now_ms, bool unix_time)
+{
+    if(count == 0)
+        return 0;
+    buffer[0] = BATCH_VERSION | (unix_time ? BATCH_UNIX_TIME : 0);
+    buffer[1] = count;
+    putU32(buffer + 14, now_ms > first_time ? (uint32_t)(now_ms - first_time) : 0);
+    return (bit + 7) / 8;
+}
+
+BatchDecoder::BatchDecoder(const uint8_t *buffer, size_t size):
+    buffer(buffer),
+    size(size)
+{
+    memset(last, 0, sizeof(last));
+}
+
+bool BatchDecoder::valid()
+{
+    return size >= BATCH_HEADER_SIZE && (buffer[0] & ~BATCH_UNIX_TIME) == BATCH_VERSION;
+}
+
+uint32_t BatchDecoder::encodedAfter()
+{
+    return getU32(buffer + 14);
+}
+
+bool BatchDecoder::readBits(uint8_t bits, uint32_t *value)
+{
+    if(bit + bits > size * 8)
+        return false;
+    *value = 0;
+    for(int i = 0; i < bits; i++, bit++)
+        *value = (*value << 1) | ((buffer[bit >> 3] >> (7 - (bit & 7))) & 1);
+    return true;
+}
+
+bool BatchDecoder::readValue(int32_t *value)
+{
+    uint32_t z = 0, b;
+    uint8_t ones = 0;
+    while(ones < 4)
+    {
+        if(!readBits(1, &b))
+            return false;
+        if(!b)
+            break;
+        ones++;
+    }
+    static const uint8_t widths[] = {0, 4, 8, 16, 32};
+    if(widths[ones] && !readBits(widths[ones], &z))
+        return false;
+    *value = unzigzag(z);
+    return true;
+}
+
+bool BatchDecoder::next(ReportedData *sample)
+{
+    if(!valid() || index >= samples())
+        return false;
+    int32_t dod, gap;
+    if(!readValue(&dod) || !readValue(&gap))
+        return false;
+    int32_t delta = last_delta + dod;
+    sample->time_ms = index ? last_time + delta : getU64(buffer + 2);
+    sample->sequence = index ? last_sequence + 1 + gap : getU32(buffer + 10);
+    sample->elapsed_ms = index ? delta : 0;
+    for(uint8_t c = 0; c < BATCH_CHANNELS; c++)
+    {
+        int32_t diff;
+        if(!readValue(&diff))
+            return false;
+        last[c] = (int32_t)((uint32_t)last[c] + (uint32_t)diff); //wraps instead of overflowing on a corrupt batch
+        dequantize(&sample->data, c, last[c]);
+    }
+    last_delta = delta;
+    last_time = sample->time_ms;
+    last_sequence = sample->sequence;
+    index++;
+    return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "records.h"
+
+// Compressed batch of samples for one uplink, decoded by the batch resource of CoapServer/server.py.
+// Header (little endian): version (BATCH_UNIX_TIME set if the times are Unix ms, else device clock ms),
+// sample count, time of the first sample (64 bit, the epoch base), sequence of the first sample, ms from
+// the first sample to the encoding (lets the server place device clock batches by their arrival). Then a bit stream, MSB first, per sample: timestamp delta of delta,
+// sequence gap and the 9 Data fields, each quantized to a fixed point integer and coded as the zigzag
+// difference to the previous sample in one of these buckets:
+//   0 -> 0, 10 + 4 bits, 110 + 8 bits, 1110 + 16 bits, 1111 + 32 bits
+// The first sample is coded against zero. The encoder writes into a caller buffer and never allocates.
+#define BATCH_VERSION 2
+#define BATCH_UNIX_TIME 0x80
+#define BATCH_HEADER_SIZE 18
+#define BATCH_CHANNELS 9
+#define BATCH_MAX_SAMPLES 255
+
+// Fixed point scale per Data field, in struct order
+#define BATCH_SCALES {1, 1, 100, 10, 100, 100, 10, 10, 100}
+// Quantized values are clamped to +-BATCH_LIMIT, so the difference of two always fits 32 bits.
+// A failed read (NaN) is sent as BATCH_NAN and decoded back to NaN.
+#define BATCH_LIMIT 0x3FFFFFFF
+#define BATCH_NAN (-BATCH_LIMIT - 1)
+
+class BatchEncoder {
+
+    uint8_t *buffer;
+    size_t size;
+    size_t bit = 0;
+    uint8_t count = 0;
+    uint64_t first_time = 0;
+    uint64_t last_time = 0;
+    int32_t last_delta = 0;
+    uint32_t last_sequence = 0;
+    int32_t last[BATCH_CHANNELS];
+
+    bool writeBits(uint32_t value, uint8_t bits);
+    bool writeValue(int32_t value);
+
+    public:
+        BatchEncoder(uint8_t *buffer, size_t size);
+        void begin();
+        bool add(ReportedData *sample);
+        size_t finish(uint64_t now_ms, bool unix_time);
+        uint8_t samples() { return count; }
+        static int32_t quantize(Data *data, uint8_t channel);
+};
+
+class BatchDecoder {
+
+    const uint8_t *buffer;
+    size_t size;
+    size_t bit = BATCH_HEADER_SIZE * 8;
+    uint8_t index = 0;
+    uint64_t last_time = 0;
+    int32_t last_delta = 0;
+    uint32_t last_sequence = 0;
+    int32_t last[BATCH_CHANNELS];
+
+    bool readBits(uint8_t bits, uint32_t *value);
+    bool readValue(int32_t *value);
+
+    public:
+        BatchDecoder(const uint8_t *buffer, size_t size);
+        bool valid();
+        uint8_t samples() { return size >= BATCH_HEADER_SIZE ? buffer[1] : 0; }
+        bool unixTime() { return buffer[0] & BATCH_UNIX_TIME; }
+        uint32_t encodedAfter();
+        bool next(ReportedData *sample);
+};
@@ -0,0 +1,400 @@
+#include "txscheduler.h"
+#include "esp_log.h"
+static const char* TAG = "TX";
+
+TxScheduler::TxScheduler(Communication *comm, uint8_t radio_mode, uint32_t window_ms, float urgent_delta):
+    comm(comm),
+    radio_mode(radio_mode),
+    window(window_ms),
+    urgent_delta(urgent_delta)
+{ }
+
+// Queued records are appended to the log and confirmed once a window got them all acknowledged,
+// after a reboot or a failed window the unconfirmed backlog is replayed before the queue
+void TxScheduler::setLog(FlashLog *log, const char* data_resource, const char* prediction_resource,
+    const char* inference_resource)
+{
+    this->log = log;
+    log_data_resource = data_resource;
+    log_prediction_resource = prediction_resource;
+    log_inference_resource = inference_resource;
+}
+
+void TxScheduler::begin()
+{
+    if(radio_mode == TX_MODEM_SLEEP)
+        comm->begin(); //associates once in the background, power save is set after the first window
+    else
+        WiFi.mode(WIFI_OFF);
+}
+
+bool TxScheduler::push(TxRecord *record)
+{
+    bool dropped = false;
+    if(queued >= TX_QUEUE_SIZE && sending)
+    {
+        ESP_LOGE(TAG, "Transmit queue full during a burst, record dropped");
+        return false;
+    }
+    if(queued >= TX_QUEUE_SIZE)
+    {
+        ESP_LOGE(TAG, "Transmit queue full, dropping the oldest record");
+        memmove(queue, queue + 1, sizeof(TxRecord) * (TX_QUEUE_SIZE - 1));
+        queued--;
+        dropped = true;
+    }
+    record->log_id = 0;
+    uint32_t stamp = clock ? clock->unixSeconds() : 0;
+    if(log && record->type == LOG_INFERENCE)
+    {
+        InferenceRecord inference;
+        toInference(record, &inference);
+        log->append(LOG_INFERENCE, &inference, sizeof(InferenceRecord), stamp, &record->log_id);
+    }
+    else if(log && record->type == LOG_PREDICTION)
+        log->append(LOG_PREDICTION, &record->prediction, sizeof(Prediction), stamp, &record->log_id);
+    else if(log)
+        log->append(LOG_DATA, &record->data, sizeof(ReportedData), stamp, &record->log_id);
+    queue[queued++] = *record;
+    if(queued >= TX_QUEUE_SIZE)
+        urgent = true;
+    return !dropped;
+}
+
+bool TxScheduler::queueData(const char* resource, ReportedData *data)
+{
+    TxRecord record;
+    record.resource = resource;
+    record.type = LOG_DATA;
+    record.data = *data;
+    return push(&record);
+}
+
+// Occupancy changes open a window early, unchanged predictions wait for the cadence
+void TxScheduler::checkUrgent(Prediction *prediction)
+{
+    if(!has_prediction || fabsf(prediction->human_count - last_prediction.human_count) >= urgent_delta ||
+        prediction->ventilation_tag != last_prediction.ventilation_tag)
+        urgent = true;
+    last_prediction = *prediction;
+    has_prediction = true;
+}
+
+bool TxScheduler::queuePrediction(const char* resource, Prediction *prediction)
+{
+    checkUrgent(prediction);
+    TxRecord record;
+    record.resource = resource;
+    record.type = LOG_PREDICTION;
+    record.prediction = *prediction;
+    return push(&record);
+}
+
+// Sample and prediction of one poll as one record, the sample time is converted like a single report
+bool TxScheduler::queueInference(const char* resource, InferenceRecord *inference)
+{
+    if(inference->has_prediction)
+        checkUrgent(&inference->prediction);
+    TxRecord record;
+    record.resource = resource;
+    record.type = LOG_INFERENCE;
+    record.data = inference->sample;
+    record.prediction = inference->prediction;
+    record.model_version = inference->model_version;
+    record.inference_us = inference->inference_us;
+    record.predicted = inference->has_prediction;
+    return push(&record);
+}
+
+void TxScheduler::toInference(TxRecord *record, InferenceRecord *inference)
+{
+    inference->sample = record->data;
+    inference->prediction = record->prediction;
+    inference->model_version = record->model_version;
+    inference->inference_us = record->inference_us;
+    inference->has_prediction = record->predicted;
+}
+
+void TxScheduler::wakeRadio()
+{
+    wakes++;
+    state = TX_WAKING;
+    state_start = millis();
+    window_failed = false;
+    ack_until = 0;
+    failed_at_wake = comm->failedRequests();
+    replaying = log && log->pending();
+    if(replaying)
+    {
+        replay_cursor = log->begin();
+        replay_until = queued && queue[0].log_id ? queue[0].log_id : log->nextId();
+        has_replay = false;
+    }
+    if(radio_mode == TX_MODEM_SLEEP)
+        comm->setPowerSave(WIFI_PS_NONE); //full speed for the burst and the acknowledgements
+    else
+        comm->begin();
+}
+
+void TxScheduler::sleepRadio()
+{
+    uint32_t now = millis();
+    if(sending) //records that made it out before the link dropped
+    {
+        sent += sending;
+        queued -= sending;
+        memmove(queue, queue + sending, sizeof(TxRecord) * queued);
+        sending = 0;
+    }
+    radio_on_ms += now - state_start;
+    last_window = now;
+    state = TX_IDLE;
+    if(radio_mode == TX_MODEM_SLEEP)
+        comm->setPowerSave(WIFI_PS_MAX_MODEM);
+    else
+        comm->end();
+    if(wakes % TX_REPORT_EVERY == 0)
+        report();
+}
+
+// Capture time of the replayed sample in Unix ms, 0 if unknown. The device clock time is only trusted if the
+// clock didn't restart since (power loss), checked against the Unix seconds the log stamped it with.
+// Inference records start with their sample.
+uint64_t TxScheduler::replayTime()
+{
+    ReportedData *data = (ReportedData *)replay_payload;
+    uint64_t unix_ms = clock && data->time_ms <= clock->now() ? unixTime(data->time_ms) : 0;
+    uint64_t stamp_ms = (uint64_t)replay_header.stamp * 1000;
+    if(unix_ms && (!stamp_ms || (unix_ms + 2000 > stamp_ms && unix_ms < stamp_ms + 2000)))
+        return unix_ms;
+    return stamp_ms;
+}
+
+// Next unconfirmed log record that isn't in the queue
+bool TxScheduler::nextReplay()
+{
+    if(!has_replay)
+        has_replay = log->next(&replay_cursor, clock ? clock->unixSeconds() : 0, &replay_header, replay_payload,
+            sizeof(replay_payload)) &&
+            replay_header.id < replay_until;
+    return has_replay;
+}
+
+// Backlog from the log first, in the order it was recorded, true once it is out
+bool TxScheduler::replay()
+{
+    while(replaying && comm->canSend())
+    {
+        if(!nextReplay())
+        {
+            replaying = false;
+            break;
+        }
+        bool ok;
+        if(replay_header.type == LOG_DATA && batch_resource && replayTime())
+            ok = replayBatch();
+        else
+        {
+            if(replay_header.type == LOG_PREDICTION)
+                ok = comm->sendPrediction(log_prediction_resource, (Prediction *)replay_payload);
+            else if(replay_header.type == LOG_INFERENCE)
+                ok = sendInference(log_inference_resource, (InferenceRecord *)replay_payload, replayTime());
+            else
+                ok = sendReport(log_data_resource, (ReportedData *)replay_payload, replayTime());
+            if(ok)
+                ack_until = replay_header.id;
+            has_replay = false;
+            replayed++;
+        }
+        if(!ok)
+        {
+            window_failed = true; //the window isn't confirmed, the backlog goes again next time
+            replaying = false;
+        }
+    }
+    return !replaying;
+}
+
+// Consecutive logged data records with a known time into one Unix time batch, the record that didn't fit
+// stays for the next one
+bool TxScheduler::replayBatch()
+{
+    uint8_t payload[TX_BATCH_PAYLOAD];
+    BatchEncoder encoder(payload, sizeof(payload));
+    uint32_t last = 0;
+    uint8_t count = 0;
+    uint64_t time;
+    while(nextReplay() && replay_header.type == LOG_DATA && (time = replayTime()))
+    {
+        ReportedData sample = *(ReportedData *)replay_payload;
+        sample.time_ms = time;
+        if(!encoder.add(&sample))
+            break;
+        last = replay_header.id;
+        has_replay = false;
+        count++;
+    }
+    size_t len = encoder.finish(clock->unixNow(), true);
+    if(!len || !comm->sendBatch(batch_resource, payload, len))
+        return false;
+    ack_until = last;
+    replayed += count;
+    batches++;
+    batched_samples += count;
+    batch_bytes += len;
+    return true;
+}
+
+// Everything sent in the window got a 2.xx response, the log can let go of it. Only the uplink requests count,
+// a confirmable notification to an observer that left fails without saying anything about the records.
+void TxScheduler::confirm()
+{
+    if(log && ack_until && !window_failed && comm->failedRequests() == failed_at_wake)
+        log->ack(ack_until);
+}
+
+// Sends as many records as the pending table takes, true once the whole queue is out
+bool TxScheduler::flush()
+{
+    if(!replay())
+        return false;
+    while(sending < queued && comm->canSend())
+    {
+        TxRecord *record = &queue[sending];
+        uint8_t records = 1;
+        bool ok;
+        if(record->type == LOG_PREDICTION)
+            ok = comm->sendPrediction(record->resource, &record->prediction);
+        else if(record->type == LOG_INFERENCE)
+        {
+            InferenceRecord inference;
+            toInference(record, &inference);
+            ok = sendInference(record->resource, &inference, unixTime(record->data.time_ms));
+        }
+        else if(batch_resource)
+            ok = sendBatch(&records);
+        else
+            ok = sendReport(record->resource, &record->data, unixTime(record->data.time_ms));
+        if(!ok)
+            break;
+        sending += records;
+        if(queue[sending - 1].log_id)
+            ack_until = queue[sending - 1].log_id;
+    }
+    if(sending < queued)
+        return false;
+    Serial.printf("Sent %u records after %u ms radio wake up\n", queued, millis() - state_start);
+    sent += queued;
+    queued = 0;
+    sending = 0;
+    urgent = false;
+    return true;
+}
+
+// Single sample with its capture time in Unix ms, 0 lets the server stamp it on arrival
+bool TxScheduler::sendReport(const char* resource, ReportedData *data, uint64_t unix_ms)
+{
+    ReportedData report = *data;
+    report.time_ms = unix_ms;
+    return comm->sendReport(resource, &report);
+}
+
+bool TxScheduler::sendInference(const char* resource, InferenceRecord *record, uint64_t unix_ms)
+{
+    InferenceRecord inference = *record;
+    inference.sample.time_ms = unix_ms;
+    return comm->sendInference(resource, &inference);
+}
+
+// Consecutive data records from the next one on, as many as fit into one datagram. Times are Unix ms once the
+// clock is synced, device clock ms before (the server places those by the arrival time).
+bool TxScheduler::sendBatch(uint8_t *records)
+{
+    uint8_t payload[TX_BATCH_PAYLOAD];
+    BatchEncoder encoder(payload, sizeof(payload));
+    bool unix_time = clock && clock->synced();
+    uint8_t i = sending;
+    while(i < queued && queue[i].type == LOG_DATA)
+    {
+        ReportedData sample = queue[i].data;
+        if(unix_time)
+            sample.time_ms = unixTime(sample.time_ms);
+        if(!encoder.add(&sample))
+            break;
+        i++;
+    }
+    size_t len = encoder.finish(unix_time ? clock->unixNow() : clock ? clock->now() : millis(), unix_time);
+    if(!len || !comm->sendBatch(batch_resource, payload, len))
+        return false;
+    *records = i - sending;
+    batches++;
+    batched_samples += *records;
+    batch_bytes += len;
+    return true;
+}
+
+void TxScheduler::update()
+{
+    comm->update();
+    uint32_t now = millis();
+    switch(state)
+    {
+        case TX_IDLE:
+            if(queued && (urgent || now - last_window >= window))
+                wakeRadio();
+            break;
+        case TX_WAKING:
+            if(comm->isConnected())
+                state = TX_SENDING;
+            else if(now - state_start > TX_CONNECT_TIMEOUT)
+            {
+                ESP_LOGE(TAG, "No link, %u records kept for the next window", queued);
+                failed_wakes++;
+                urgent = false; //a full queue must not keep the radio on
+                sleepRadio();
+            }
+            break;
+        case TX_SENDING:
+            if(flush())
+            {
+                state = TX_DRAIN;
+                drain_start = now;
+            }
+            else if(!comm->isConnected() && now - state_start > TX_CONNECT_TIMEOUT)
+            {
+                ESP_LOGE(TAG, "Link lost, %u records kept for the next window", queued - sending);
+                failed_wakes++;
+                urgent = false;
+                sleepRadio();
+            }
+            break;
+        case TX_DRAIN:
+            if(comm->idle())
+                confirm();
+            if(comm->idle() || now - drain_start >= TX_FLUSH_TIMEOUT)
+                sleepRadio();
+            break;
+    }
+}
+
+// Radio on time only counts the transmit windows, not the DTIM wake ups in modem sleep
+void TxScheduler::report()
+{
+    float on_ms_per_wake = wakes ? (float)radio_on_ms / wakes : 0;
+    float mj_per_record = sent ? radio_on_ms * TX_RADIO_MA * TX_SUPPLY_V / 1000 / sent : 0;
+    Serial.printf("Radio: %u wakes (%u failed), %u ms on, %.0f ms/wake, %.1f records/wake, %.2f mJ/record\n",
+        wakes, failed_wakes, radio_on_ms, on_ms_per_wake, wakes ? (float)sent / wakes : 0, mj_per_record);
+    if(batches)
+        Serial.printf("Batches: %u, %.1f samples/batch, %.1f bytes/sample\n", batches, (float)batched_samples / batches,
+            (float)batch_bytes / batched_samples);
+    if(log)
+    {
+        const LogStats *stats = log->getStats();
+        Serial.printf("Sample log: %u appended, %u replayed, %u unconfirmed, %u dropped, %u expired, %u erases, %u corrupt\n",
+            stats->appended, replayed, log->nextId() - 1 - log->ackedId(), stats->dropped, stats->expired, stats->erases,
+            stats->corrupt);
+    }
+    if(clock)
+        clock->report();
+    comm->report();
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+#include "communication.h"
+#include "tsbatch.h"
+#include "flashlog.h"
+#include "devclock.h"
+
+//Radio handling between transmit windows
+#define TX_MODEM_SLEEP 0 //stays associated, max modem power save (radio wakes for DTIM beacons only)
+#define TX_RADIO_OFF 1   //Wi-Fi off, cached fast reconnect for every window
+
+#ifndef TX_QUEUE_SIZE
+#define TX_QUEUE_SIZE 16 //a full queue opens a window early
+#endif
+#define TX_CONNECT_TIMEOUT 10000 //ms a window waits for the link, the queue is kept on failure
+#define TX_FLUSH_TIMEOUT 5000    //ms the radio stays on for acknowledgements (and retransmissions) after a burst
+#define TX_REPORT_EVERY 10       //windows between radio reports
+#define TX_RADIO_MA 120.0        //Wi-Fi active current (ESP32 datasheet, typical) for the energy estimate
+#define TX_SUPPLY_V 3.3
+#define TX_BATCH_PAYLOAD 80      //compressed batch per datagram, fits the 128 byte CoAP buffer with the options
+
+//Scheduler states
+#define TX_IDLE 0
+#define TX_WAKING 1
+#define TX_SENDING 2 //queue is fed into the CoAP pending table as slots free up
+#define TX_DRAIN 3
+
+typedef struct {
+    const char* resource;
+    uint8_t type;                 // LOG_DATA, LOG_PREDICTION or LOG_INFERENCE, as in the sample log
+    uint32_t log_id;              // 0 without a sample log
+    ReportedData data;
+    Prediction prediction;
+    uint32_t model_version;       // rest of an InferenceRecord, data and prediction hold its sample and prediction
+    uint32_t inference_us;
+    bool predicted;
+} TxRecord;
+
+class TxScheduler {
+
+    Communication *comm;
+    uint8_t radio_mode;
+    uint32_t window;
+    float urgent_delta;
+    uint8_t state = TX_IDLE;
+    bool urgent = true;           // first record goes out right away, boot to first uplink
+    uint32_t last_window = 0;
+    uint32_t state_start = 0;     // radio wake up
+    uint32_t drain_start = 0;
+    TxRecord queue[TX_QUEUE_SIZE];
+    uint8_t queued = 0;
+    uint8_t sending = 0;          // next record of the burst
+    Prediction last_prediction;
+    bool has_prediction = false;
+    const char* batch_resource = nullptr; // data records go out compressed (lib/tsbatch) instead of one per datagram
+    DeviceClock *clock = nullptr; // capture times are sent as Unix time once synced
+    uint32_t batches = 0;
+    uint32_t batched_samples = 0;
+    uint32_t batch_bytes = 0;
+    FlashLog *log = nullptr;      // store and forward, records stay in flash until a window confirmed them
+    const char* log_data_resource = nullptr;
+    const char* log_prediction_resource = nullptr;
+    const char* log_inference_resource = nullptr;
+    LogCursor replay_cursor;
+    uint32_t replay_until = 0;    // unconfirmed records below this id aren't in the queue any more
+    bool replaying = false;
+    bool has_replay = false;      // record read from the log, not sent yet
+    LogRecordHeader replay_header;
+    uint8_t replay_payload[LOG_MAX_PAYLOAD];
+    bool window_failed = false;
+    uint32_t failed_at_wake = 0;
+    uint32_t ack_until = 0;       // highest log id sent in this window
+    uint32_t replayed = 0;
+
+    uint32_t wakes = 0;
+    uint32_t failed_wakes = 0;
+    uint32_t sent = 0;
+    uint32_t radio_on_ms = 0;
+
+    bool push(TxRecord *record);
+    void checkUrgent(Prediction *prediction);
+    static void toInference(TxRecord *record, InferenceRecord *inference);
+    void wakeRadio();
+    void sleepRadio();
+    bool flush();
+    bool sendBatch(uint8_t *records);
+    bool sendReport(const char* resource, ReportedData *data, uint64_t unix_ms);
+    bool sendInference(const char* resource, InferenceRecord *record, uint64_t unix_ms);
+    uint64_t unixTime(uint64_t device_ms) { return clock ? clock->toUnix(device_ms) : 0; }
+    uint64_t replayTime();
+    bool nextReplay();
+    bool replay();
+    bool replayBatch();
+    void confirm();
+
+    public:
+        TxScheduler(Communication *comm, uint8_t radio_mode, uint32_t window_ms, float urgent_delta);
+        void begin();
+        void setBatch(const char* resource) { batch_resource = resource; }
+        void setLog(FlashLog *log, const char* data_resource, const char* prediction_resource,
+            const char* inference_resource);
+        void setClock(DeviceClock *clock) { this->clock = clock; }
+        bool queueData(const char* resource, ReportedData *data);
+        bool queuePrediction(const char* resource, Prediction *prediction);
+        bool queueInference(const char* resource, InferenceRecord *inference);
+        void update();
+        uint32_t sentRecords() { return sent; }
+        void report();
+};
@@ -0,0 +1,54 @@
+#include "uplinkfilter.h"
+
+UplinkFilter::UplinkFilter(uint32_t max_silence_ms, Deadbands deadbands):
+    deadbands(deadbands),
+    max_silence(max_silence_ms)
+{ }
+
+// Compared with the last sent sample, not the previous one, so slow drifts still get through
+bool UplinkFilter::changed(Data *data)
+{
+    return outside(data->co2_ppm, last_sent.co2_ppm, deadbands.co2_ppm) ||
+        outside(data->tvoc_ppm, last_sent.tvoc_ppm, deadbands.tvoc_ppm) ||
+        outside(data->bmp280_pressure, last_sent.bmp280_pressure, deadbands.pressure_pa) ||
+        outside(data->bmp280_temperature, last_sent.bmp280_temperature, deadbands.temperature) ||
+        outside(data->mlx_object_temperature, last_sent.mlx_object_temperature, deadbands.temperature) ||
+        outside(data->mlx_ambient_temperature, last_sent.mlx_ambient_temperature, deadbands.temperature) ||
+        outside(data->temperature_dht, last_sent.temperature_dht, deadbands.temperature) ||
+        outside(data->humidity_dht, last_sent.humidity_dht, deadbands.humidity);
+}
+
+// True if the sample has to be sent, report is filled with the sample and its place in the series
+bool UplinkFilter::filter(Data *data, uint64_t now, ReportedData *report)
+{
+    uint32_t index = sequence++;
+    samples++;
+    uint8_t reason;
+    if(reported == 0)
+        reason = UPLINK_FIRST;
+    else if(data->pir_uptime > 0)
+        reason = UPLINK_PIR;
+    else if(changed(data))
+        reason = UPLINK_DEADBAND;
+    else if(now - last_sent_ms >= max_silence)
+        reason = UPLINK_SILENCE;
+    else
+        return false;
+
+    report->data = *data;
+    report->sequence = index;
+    report->elapsed_ms = reported ? now - last_sent_ms : 0;
+    report->time_ms = now;
+    last_sent = *data;
+    last_sent_ms = now;
+    reported++;
+    reasons[reason]++;
+    return true;
+}
+
+void UplinkFilter::report()
+{
+    Serial.printf("Uplink: %u of %u samples sent (%.1f %%), first %u, PIR %u, deadband %u, silence %u\n",
+        reported, samples, samples ? 100.0 * reported / samples : 0, reasons[UPLINK_FIRST], reasons[UPLINK_PIR],
+        reasons[UPLINK_DEADBAND], reasons[UPLINK_SILENCE]);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <Arduino.h>
+#include "records.h"
+
+// Report by exception: a sample is only sent when a field left its deadband around the last sent value,
+// the PIR saw motion, or nothing was sent for max_silence ms. The server holds the last values for the gaps.
+typedef struct {
+    float co2_ppm = 25;
+    float tvoc_ppm = 5;
+    float pressure_pa = 20;
+    float temperature = 0.3;  // degC, BMP280, MLX and DHT temperatures
+    float humidity = 2;       // %RH, DHT11 resolution is 1 %
+} Deadbands;
+
+//Why a sample was sent
+#define UPLINK_FIRST 0
+#define UPLINK_PIR 1
+#define UPLINK_DEADBAND 2
+#define UPLINK_SILENCE 3
+#define UPLINK_REASONS 4
+#define UPLINK_REPORT_EVERY 360 //samples between reports, an hour at the 10 s poll interval
+
+class UplinkFilter {
+
+    Deadbands deadbands;
+    uint32_t max_silence;
+    Data last_sent;
+    uint64_t last_sent_ms = 0;
+    uint32_t sequence = 0;
+    uint32_t samples = 0;
+    uint32_t reported = 0;
+    uint32_t reasons[UPLINK_REASONS] = {};
+
+    // a sensor failing (NaN) or coming back is a change, otherwise the field would stay frozen
+    bool outside(float value, float last, float deadband)
+    {
+        if(isnan(value) || isnan(last))
+            return isnan(value) != isnan(last);
+        return fabsf(value - last) >= deadband;
+    }
+    bool changed(Data *data);
+
+    public:
+        UplinkFilter(uint32_t max_silence_ms, Deadbands deadbands = Deadbands());
+        bool filter(Data *data, uint64_t now, ReportedData *report);
+        uint32_t sampleCount() { return samples; }
+        uint32_t reportedCount() { return reported; }
+        uint32_t reasonCount(uint8_t reason) { return reasons[reason]; }
+        void report();
+};
@@ -0,0 +1,393 @@
+#include "wakestub.h"
+#include "esp_log.h"
+#include "soc/rtc.h"
+#include "soc/rtc_cntl_reg.h"
+#include "soc/rtc_io_reg.h"
+#include "esp32/rom/rtc.h"
+#include "esp32/rom/ets_sys.h"
+static const char* TAG = "STUB";
+
+RTC_DATA_ATTR static WakeStubState stub;
+RTC_DATA_ATTR static uint8_t stub_phase = 0;   // 1 while waiting for MLX90614 and BMP280 between the two stub wakes
+RTC_DATA_ATTR static uint64_t settle_ticks = 0;
+
+#define SDA_BIT BIT(RTC_GPIO_OUT_DATA_W1TS_S + STUB_SDA_RTC)
+#define SCL_BIT BIT(RTC_GPIO_OUT_DATA_W1TS_S + STUB_SCL_RTC)
+#define PIR_BIT BIT(RTC_GPIO_IN_NEXT_S + STUB_PIR_RTC)
+#define STUB_I2C_HALF_PERIOD_US 5 //~100 kHz
+#define STUB_STRETCH_TIMEOUT_US 1000
+
+/* Everything below up to the class methods runs from RTC fast memory before the bootloader */
+
+static uint64_t RTC_IRAM_ATTR stub_time()
+{
+    SET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_UPDATE);
+    while(GET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_VALID) == 0)
+        ets_delay_us(1);
+    SET_PERI_REG_MASK(RTC_CNTL_INT_CLR_REG, RTC_CNTL_TIME_VALID_INT_CLR);
+    uint64_t t = READ_PERI_REG(RTC_CNTL_TIME0_REG);
+    t |= ((uint64_t)READ_PERI_REG(RTC_CNTL_TIME1_REG)) << 32;
+    return t;
+}
+
+// Open drain through the enable register, the lines are pulled up on the sensor boards
+static void RTC_IRAM_ATTR line_low(uint32_t bit)
+{
+    REG_WRITE(RTC_GPIO_OUT_W1TC_REG, bit);
+    REG_WRITE(RTC_GPIO_ENABLE_W1TS_REG, bit);
+}
+
+static void RTC_IRAM_ATTR line_release(uint32_t bit)
+{
+    REG_WRITE(RTC_GPIO_ENABLE_W1TC_REG, bit);
+}
+
+static bool RTC_IRAM_ATTR line_read(uint32_t bit)
+{
+    return REG_READ(RTC_GPIO_IN_REG) & bit;
+}
+
+static void RTC_IRAM_ATTR scl_high()
+{
+    line_release(SCL_BIT);
+    for(int i = 0; i < STUB_STRETCH_TIMEOUT_US && !line_read(SCL_BIT); i++) //clock stretching
+        ets_delay_us(1);
+}
+
+static void RTC_IRAM_ATTR i2c_start()
+{
+    line_release(SDA_BIT);
+    scl_high();
+    ets_delay_us(STUB_I2C_HALF_PERIOD_US);
+    line_low(SDA_BIT);
+    ets_delay_us(STUB_I2C_HALF_PERIOD_US);
+    line_low(SCL_BIT);
+}
+
+static void RTC_IRAM_ATTR i2c_stop()
+{
+    line_low(SDA_BIT);
+    ets_delay_us(STUB_I2C_HALF_PERIOD_US);
+    scl_high();
+    ets_delay_us(STUB_I2C_HALF_PERIOD_US);
+    line_release(SDA_BIT);
+    ets_delay_us(STUB_I2C_HALF_PERIOD_US);
+}
+
+static bool RTC_IRAM_ATTR i2c_write(uint8_t byte)
+{
+    for(int i = 7; i >= 0; i--)
+    {
+        if(byte & (1 << i))
+            line_release(SDA_BIT);
+        else
+            line_low(SDA_BIT);
+        ets_delay_us(STUB_I2C_HALF_PERIOD_US);
+        scl_high();
+        ets_delay_us(STUB_I2C_HALF_PERIOD_US);
+        line_low(SCL_BIT);
+    }
+    line_release(SDA_BIT);
+    ets_delay_us(STUB_I2C_HALF_PERIOD_US);
+    scl_high();
+    bool ack = !line_read(SDA_BIT);
+    ets_delay_us(STUB_I2C_HALF_PERIOD_US);
+    line_low(SCL_BIT);
+    return ack;
+}
+
+static uint8_t RTC_IRAM_ATTR i2c_read(bool ack)
+{
+    uint8_t byte = 0;
+    line_release(SDA_BIT);
+    for(int i = 0; i < 8; i++)
+    {
+        ets_delay_us(STUB_I2C_HALF_PERIOD_US);
+        scl_high();
+        byte = (byte << 1) | (line_read(SDA_BIT) ? 1 : 0);
+        ets_delay_us(STUB_I2C_HALF_PERIOD_US);
+        line_low(SCL_BIT);
+    }
+    if(ack)
+        line_low(SDA_BIT);
+    ets_delay_us(STUB_I2C_HALF_PERIOD_US);
+    scl_high();
+    ets_delay_us(STUB_I2C_HALF_PERIOD_US);
+    line_low(SCL_BIT);
+    line_release(SDA_BIT);
+    return byte;
+}
+
+static bool RTC_IRAM_ATTR i2c_read_reg(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len)
+{
+    i2c_start();
+    bool ok = i2c_write(addr << 1) && i2c_write(reg);
+    if(ok)
+    {
+        i2c_start(); //repeated start
+        ok = i2c_write((addr << 1) | 1);
+    }
+    for(int i = 0; ok && i < len; i++)
+        buf[i] = i2c_read(i < len - 1);
+    i2c_stop();
+    return ok;
+}
+
+static bool RTC_IRAM_ATTR i2c_write_reg(uint8_t addr, uint8_t reg, uint8_t data)
+{
+    i2c_start();
+    bool ok = i2c_write(addr << 1) && i2c_write(reg) && i2c_write(data);
+    i2c_stop();
+    return ok;
+}
+
+// SMBus PEC, same CRC-8 (X8+X2+X1+1) as MLX90614::crc8
+static uint8_t RTC_IRAM_ATTR stub_crc8(const uint8_t *data, uint8_t len)
+{
+    uint8_t crc = 0;
+    while(len--)
+    {
+        crc ^= *data++;
+        for(int i = 0; i < 8; i++)
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+static bool RTC_IRAM_ATTR mlx_read(uint8_t reg, uint16_t *value)
+{
+    uint8_t frame[6] = {(uint8_t)(stub.mlx_addr << 1), reg, (uint8_t)((stub.mlx_addr << 1) | 1), 0, 0, 0};
+    if(!i2c_read_reg(stub.mlx_addr, reg, frame + 3, 3))
+        return false;
+    if(stub_crc8(frame, 5) != frame[5])
+        return false;
+    *value = frame[3] | (frame[4] << 8);
+    return *value != 0;
+}
+
+static void RTC_IRAM_ATTR mlx_sleep()
+{
+    uint8_t frame[2] = {(uint8_t)(stub.mlx_addr << 1), SLEEP_CODE};
+    i2c_start();
+    i2c_write(stub.mlx_addr << 1);
+    i2c_write(SLEEP_CODE);
+    i2c_write(stub_crc8(frame, 2));
+    i2c_stop();
+}
+
+static void RTC_IRAM_ATTR pads_to_rtc()
+{
+    REG_WRITE(RTC_GPIO_ENABLE_W1TC_REG, SDA_BIT | SCL_BIT);
+    SET_PERI_REG_MASK(RTC_IO_PAD_DAC1_REG, RTC_IO_PDAC1_MUX_SEL | RTC_IO_PDAC1_FUN_IE);
+    SET_PERI_REG_MASK(RTC_IO_PAD_DAC2_REG, RTC_IO_PDAC2_MUX_SEL | RTC_IO_PDAC2_FUN_IE);
+    SET_PERI_REG_MASK(RTC_IO_XTAL_32K_PAD_REG, RTC_IO_X32N_MUX_SEL | RTC_IO_X32N_FUN_IE);
+}
+
+// Released lines, digital mux so Wire works again after a full boot
+static void RTC_IRAM_ATTR pads_to_digital()
+{
+    REG_WRITE(RTC_GPIO_ENABLE_W1TC_REG, SDA_BIT | SCL_BIT);
+    CLEAR_PERI_REG_MASK(RTC_IO_PAD_DAC1_REG, RTC_IO_PDAC1_MUX_SEL);
+    CLEAR_PERI_REG_MASK(RTC_IO_PAD_DAC2_REG, RTC_IO_PDAC2_MUX_SEL);
+}
+
+static void RTC_IRAM_ATTR stub_sleep(uint64_t wake_ticks, bool pir_wake)
+{
+    pads_to_digital();
+    WRITE_PERI_REG(RTC_CNTL_SLP_TIMER0_REG, wake_ticks & UINT32_MAX);
+    WRITE_PERI_REG(RTC_CNTL_SLP_TIMER1_REG, wake_ticks >> 32);
+
+    uint32_t wake_sources = REG_GET_FIELD(RTC_CNTL_WAKEUP_STATE_REG, RTC_CNTL_WAKEUP_ENA);
+    if(pir_wake)
+    {
+        REG_SET_FIELD(RTC_CNTL_EXT_WAKEUP1_REG, RTC_CNTL_EXT_WAKEUP1_SEL, BIT(STUB_PIR_RTC));
+        REG_SET_FIELD(RTC_CNTL_EXT_WAKEUP_CONF_REG, RTC_CNTL_EXT_WAKEUP1_LV, 1); //any high
+        wake_sources |= RTC_EXT1_TRIG_EN;
+    }
+    else
+        wake_sources &= ~RTC_EXT1_TRIG_EN;
+    REG_SET_FIELD(RTC_CNTL_WAKEUP_STATE_REG, RTC_CNTL_WAKEUP_ENA, wake_sources);
+    REG_SET_BIT(RTC_CNTL_EXT_WAKEUP1_REG, RTC_CNTL_EXT_WAKEUP1_STATUS_CLR);
+
+    REG_WRITE(RTC_ENTRY_ADDR_REG, (uint32_t)(uintptr_t)&esp_wake_deep_sleep);
+    set_rtc_memory_crc();
+    CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+    SET_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+    while(true); //sleep starts within a few cycles
+}
+
+// Returning from the stub continues with the normal boot
+void RTC_IRAM_ATTR esp_wake_deep_sleep(void)
+{
+    esp_default_wake_deep_sleep();
+    if(stub.magic != STUB_MAGIC || !stub.armed)
+        return;
+
+    uint32_t cause = REG_GET_FIELD(RTC_CNTL_WAKEUP_STATE_REG, RTC_CNTL_WAKEUP_CAUSE);
+    uint64_t now = stub_time();
+    if(cause & RTC_EXT1_TRIG_EN) //PIR motion, only timestamped
+    {
+        if(!stub.pir_trigger_ticks)
+            stub.pir_trigger_ticks = now;
+        stub_sleep(stub.next_wake_ticks, false);
+    }
+    if(!(cause & RTC_TIMER_TRIG_EN)) //button
+    {
+        stub_phase = 0;
+        return;
+    }
+
+    if(stub_phase == 0)
+    {
+        if(stub.wakes + 1 >= stub.full_boot_every || stub.count >= STUB_RING_SIZE)
+            return; //full boot for inference and uplink
+        // Start a forced BMP280 conversion and wake the MLX90614, then sleep through their settling time
+        pads_to_rtc();
+        bool ok = i2c_write_reg(stub.bmp_addr, CTRL_MEAS_REG, stub.bmp_ctrl_meas);
+        if(stub.mlx_asleep)
+        {
+            line_low(SCL_BIT);
+            ets_delay_us(STUB_MLX_WAKE_MS * 1000);
+            line_release(SCL_BIT);
+            stub.mlx_asleep = false;
+        }
+        if(!ok)
+        {
+            pads_to_digital();
+            return;
+        }
+        stub_phase = 1;
+        stub_sleep(now + settle_ticks, false);
+    }
+
+    stub_phase = 0;
+    pads_to_rtc();
+    StubSample *sample = &stub.ring[stub.count];
+    uint8_t raw[6];
+    bool ok = i2c_read_reg(stub.bmp_addr, START, raw, 6);
+    sample->adc_P = ((int32_t)raw[0] << 12) | ((int32_t)raw[1] << 4) | (raw[2] >> 4);
+    sample->adc_T = ((int32_t)raw[3] << 12) | ((int32_t)raw[4] << 4) | (raw[5] >> 4);
+    ok = ok && mlx_read(MLX90614_TA, &sample->mlx_ambient) && mlx_read(MLX90614_TOBJ1, &sample->mlx_object);
+    mlx_sleep();
+    stub.mlx_asleep = true;
+    bool pir_active = line_read(PIR_BIT) || stub.pir_trigger_ticks;
+    sample->ticks = now;
+
+    int32_t change = (int32_t)sample->mlx_object - stub.mlx_reference;
+    if(!ok || pir_active || change > STUB_MLX_DELTA || change < -STUB_MLX_DELTA)
+    {
+        pads_to_digital();
+        return; //significant change, the full boot takes its own sample
+    }
+
+    stub.count++;
+    stub.wakes++;
+    stub.stub_wakes++;
+    stub.next_wake_ticks += stub.interval_ticks;
+    if(stub.next_wake_ticks <= now)
+        stub.next_wake_ticks = now + stub.interval_ticks;
+    stub_sleep(stub.next_wake_ticks, true);
+}
+
+/* Normal application side */
+
+WakeStub::WakeStub(BMP280 *bmp, MLX90614 *mlx, uint16_t full_boot_every, uint32_t interval_ms):
+    bmp(bmp),
+    mlx(mlx),
+    full_boot_every(full_boot_every),
+    interval(interval_ms)
+{ }
+
+// Slow clock period is stored by the IDF as Q13.19 microseconds
+uint64_t WakeStub::ticksToUs(uint64_t ticks)
+{
+    uint32_t cal = REG_READ(RTC_SLOW_CLK_CAL_REG);
+    return (ticks * cal) >> RTC_CLK_CAL_FRACT;
+}
+
+// Called right before the deep sleep of a duty cycle, last is the sample of this full boot
+void WakeStub::arm(uint64_t sleep_us, uint16_t polls_until_upload, uint8_t bmp_addr, uint8_t bmp_ctrl_meas, uint8_t mlx_addr, Data *last)
+{
+    uint32_t cal = REG_READ(RTC_SLOW_CLK_CAL_REG);
+    if(!cal)
+    {
+        ESP_LOGE(TAG, "No slow clock calibration, wake stub disabled");
+        return;
+    }
+    uint8_t osrs_t = (bmp_ctrl_meas >> 5) & 0x07;
+    uint8_t osrs_p = (bmp_ctrl_meas >> 2) & 0x07;
+    float t_meas_ms = 1.25 + (osrs_t ? 2.3 * (1 << ((osrs_t > X16 ? X16 : osrs_t) - 1)) : 0) +
+        (osrs_p ? 2.3 * (1 << ((osrs_p > X16 ? X16 : osrs_p) - 1)) + 0.575 : 0);
+    uint32_t settle_ms = STUB_MLX_SETTLE_MS > t_meas_ms ? STUB_MLX_SETTLE_MS : (uint32_t)t_meas_ms + 1;
+
+    if(stub.magic != STUB_MAGIC)
+    {
+        memset(&stub, 0, sizeof(stub));
+        stub.magic = STUB_MAGIC;
+    }
+    stub.bmp_addr = bmp_addr;
+    stub.bmp_ctrl_meas = (bmp_ctrl_meas & ~0x03) | FORCED;
+    stub.mlx_addr = mlx_addr;
+    stub.mlx_asleep = true;
+    stub.mlx_reference = (uint16_t)((last->mlx_object_temperature + 273.15) / .02);
+    stub.full_boot_every = polls_until_upload < full_boot_every ? polls_until_upload : full_boot_every;
+    stub.wakes = 0;
+    stub.pir_trigger_ticks = 0;
+    stub.last = *last;
+    stub.full_boots++;
+    stub.interval_ticks = ((uint64_t)interval * 1000 << RTC_CLK_CAL_FRACT) / cal;
+    stub.next_wake_ticks = rtc_time_get() + (sleep_us << RTC_CLK_CAL_FRACT) / cal;
+    settle_ticks = ((uint64_t)settle_ms * 1000 << RTC_CLK_CAL_FRACT) / cal;
+    stub_phase = 0;
+    stub.armed = true;
+}
+
+void WakeStub::disarm()
+{
+    stub.armed = false;
+    stub.count = 0;
+}
+
+uint16_t WakeStub::pending()
+{
+    return stub.magic == STUB_MAGIC ? stub.count : 0;
+}
+
+// Converts a stub sample, values the stub doesn't read are carried from the last full sample
+bool WakeStub::get(uint16_t index, Data *data)
+{
+    if(index >= pending())
+        return false;
+    StubSample *sample = &stub.ring[index];
+    *data = stub.last;
+    if(bmp->compensate(sample->adc_T, sample->adc_P))
+    {
+        data->bmp280_temperature = bmp->getTemperature();
+        data->bmp280_pressure = bmp->getPressure();
+    }
+    data->mlx_ambient_temperature = MLX90614::rawToC(sample->mlx_ambient);
+    data->mlx_object_temperature = MLX90614::rawToC(sample->mlx_object);
+    data->pir_uptime = 0; //samples with motion are left to a full boot
+    return true;
+}
+
+// Time since the PIR woke the stub in this interval, 0 if it didn't
+uint64_t WakeStub::pirTriggerAgeUs()
+{
+    if(stub.magic != STUB_MAGIC || !stub.pir_trigger_ticks)
+        return 0;
+    return ticksToUs(rtc_time_get() - stub.pir_trigger_ticks);
+}
+
+void WakeStub::clear()
+{
+    stub.count = 0;
+    stub.pir_trigger_ticks = 0;
+}
+
+void WakeStub::report()
+{
+    if(stub.magic != STUB_MAGIC)
+        return;
+    Serial.printf("Wake stub: %u stub samples, %u full boots\n", stub.stub_wakes, stub.full_boots);
+}
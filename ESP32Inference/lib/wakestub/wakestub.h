@@ -0,0 +1,71 @@
+#pragma once
+#include <Arduino.h>
+#include <esp_sleep.h>
+#include "BMP280.h"
+#include "MLX90614.h"
+#include "communication.h"
+
+// The stub runs before the bootloader and can't use the GPIO or I2C drivers,
+// the bus is bit-banged through the RTC IO registers of these pads.
+#define STUB_SDA_GPIO 25 // RTC_GPIO6, DAC1 pad
+#define STUB_SCL_GPIO 26 // RTC_GPIO7, DAC2 pad
+#define STUB_PIR_GPIO 33 // RTC_GPIO8, 32K_XN pad
+#define STUB_SDA_RTC 6
+#define STUB_SCL_RTC 7
+#define STUB_PIR_RTC 8
+
+#ifndef STUB_RING_SIZE
+#define STUB_RING_SIZE 32 //raw samples kept between full boots
+#endif
+#define STUB_MLX_WAKE_MS 40    //SCL low to leave MLX90614 sleep mode
+#define STUB_MLX_SETTLE_MS 250 //first valid MLX90614 data after wake up
+#define STUB_MLX_DELTA 25      //object temperature change forcing a full boot, 0.02 K steps (0.5 K)
+#define STUB_MAGIC 0x5354554B
+
+typedef struct {
+    int32_t adc_T;
+    int32_t adc_P;
+    uint16_t mlx_ambient;
+    uint16_t mlx_object;
+    uint64_t ticks;       // RTC time of the sample
+} StubSample;
+
+typedef struct {
+    uint32_t magic;
+    bool armed;
+    uint8_t bmp_addr;
+    uint8_t bmp_ctrl_meas;    // forced mode ctrl_meas
+    uint8_t mlx_addr;
+    bool mlx_asleep;
+    uint16_t mlx_reference;   // object temperature at the last full boot
+    uint16_t full_boot_every;
+    uint16_t wakes;           // stub wakes since the last full boot
+    uint64_t interval_ticks;
+    uint64_t next_wake_ticks;
+    uint64_t pir_trigger_ticks; // 0 if no PIR wake in this interval
+    uint16_t count;
+    StubSample ring[STUB_RING_SIZE];
+    Data last;                // last full sample, carries CCS811 and DHT values that the stub doesn't read
+    uint32_t full_boots;
+    uint32_t stub_wakes;
+} WakeStubState;
+
+class WakeStub {
+
+    BMP280 *bmp;
+    MLX90614 *mlx;
+    uint16_t full_boot_every;
+    uint32_t interval;
+
+    static uint64_t ticksToUs(uint64_t ticks);
+
+    public:
+        WakeStub(BMP280 *bmp, MLX90614 *mlx, uint16_t full_boot_every, uint32_t interval_ms);
+        void arm(uint64_t sleep_us, uint16_t polls_until_upload, uint8_t bmp_addr, uint8_t bmp_ctrl_meas, uint8_t mlx_addr, Data *last);
+        void disarm();
+        uint16_t pending();
+        bool get(uint16_t index, Data *data);
+        uint64_t pirTriggerAgeUs();
+        void clear();
+        void report();
+};
@@ -9,6 +9,18 @@
 #include "communication.h"
 #include "button.h"
 #include "infer.h"
+#include "power.h"
+#include "dutycycle.h"
+#include "wakestub.h"
+#include "txscheduler.h"
+#include "uplinkfilter.h"
+#include "partitionflash.h"
+#include "devclock.h"
+#include "perf.h"
+#include "metrics.h"
+#include "trace.h"
+#include "energy.h"
+#include "pm.h"
 
 static const char* TAG = "main";
 
@@ -29,11 +41,42 @@ static const char* TAG = "main";
 #define POLL_INVERVAL 10000
 #define TIME_TO_WAKEUP 1000
 
+//Low power operation: DUTY_OFF stays awake between polls, DUTY_LIGHT_SLEEP/DUTY_DEEP_SLEEP sleep between them
+#ifndef DUTY_CYCLE_MODE
+#define DUTY_CYCLE_MODE DUTY_OFF
+#endif
+#define UPLOAD_EVERY_N 6 //polls per Wi-Fi upload when duty cycling
+#define WAKE_TIMEOUT 2000 //max wait for valid sensor samples after wake up
+#define INFERENCE_TIMEOUT 5000
+#define WAKE_STUB_SAMPLING true //deep sleep polls between uploads are taken by the wake stub without a full boot
+#define CCS_MODE (DUTY_CYCLE_MODE == DUTY_OFF ? CCS811_MODE_1SEC : CCS811_MODE_60SEC) //CCS keeps measuring through duty cycle sleeps
+
+#if WAKE_STUB_SAMPLING && (SDA != STUB_SDA_GPIO || SCL != STUB_SCL_GPIO || PIR_PIN != STUB_PIR_GPIO)
+#error "Wake stub bit-bangs I2C and reads the PIR on fixed RTC pads, see wakestub.h"
+#endif
+
 //Networking
+#define TX_WINDOW 60000 //ms between transmit windows when always awake, records are queued meanwhile
+#define TX_RADIO_MODE TX_MODEM_SLEEP //TX_RADIO_OFF turns Wi-Fi off between windows
+#define OCCUPANCY_URGENT_DELTA 1.0 //human count change sent without waiting for the window
+#define REPORT_BY_EXCEPTION true //data collection only sends samples that left their deadbands (lib/uplinkfilter)
+#define UPLINK_MAX_SILENCE 300000 //ms, a sample is sent at least this often
+#define UPLINK_BATCH true //samples of a transmit window go out as compressed batches (lib/tsbatch) to /batch
+#define SAMPLE_LOG true //queued records are kept in the samplelog partition until a window confirmed them (lib/flashlog)
+#define SAMPLE_LOG_RETENTION 604800 //s, older unconfirmed records aren't replayed any more
+#define OCCUPANCY_MAX_AGE 300 //s between heartbeats to /occupancy observers when the prediction doesn't change
+#define PERF_REPORT_SIZE 1024 //GET /perf, timer histograms of lib/perf as CSV
+#define TRACE_SERIAL false //duty cycle prints the event trace of lib/perf as hex lines with every upload
+#define METRICS_POLLING true //GET /metrics, heap, stacks, CPU and error counters as CBOR (lib/metrics)
+#define LOOP_IDLE_MS 10 //loop() blocks this long when always awake, automatic light sleep of lib/power/pm.h needs it
 #define WIFI_SSID "*********"
 #define WIFI_PASS "*********"
+#ifndef COAP_IP
 #define COAP_IP IPAddress(192,168,1,178) //192.168.1.178:5683
+#endif
+#ifndef COAP_PORT
 #define COAP_PORT 5683
+#endif
 
 BMP280 BMP;
 MLX90614 MLX;
@@ -41,73 +84,189 @@ CCS811 CCS(NWAKE, CCS_ADDR);
 DHT DHT11(DHT_PIN);
 PIR _PIR(PIR_PIN);
 Communication comm(WIFI_SSID, WIFI_PASS, COAP_IP, COAP_PORT);
+TxScheduler tx(&comm, TX_RADIO_MODE, TX_WINDOW, OCCUPANCY_URGENT_DELTA);
+UplinkFilter uplink(REPORT_BY_EXCEPTION ? UPLINK_MAX_SILENCE : 0);
+UplinkFilter inference_series(0); //inference mode uploads every sample, with the prediction of the poll
+DeviceClock device_clock;
+PartitionFlash log_flash("samplelog");
+FlashLog sample_log(&log_flash, SAMPLE_LOG_RETENTION);
 Button button(BUTTON_PIN, TIME_TO_WAKEUP);
 Inference model;
+PowerManager power(&BMP, &MLX, &CCS, SDA, SCL, NWAKE, MPU_ADDR);
+DutyCycle duty(&power, DUTY_CYCLE_MODE, POLL_INVERVAL, UPLOAD_EVERY_N, PIR_PIN);
+WakeStub stub(&BMP, &MLX, UPLOAD_EVERY_N, POLL_INVERVAL);
 SensorDataBatch data_pointer_array;
+Metrics metrics(&comm);
+
+//Inference window and fed back labels live in RTC memory, so the warm up survives duty cycle deep sleep
+RTC_DATA_ATTR Data window[BATCH_SIZE][SEQUENCE_LENGTH];
+RTC_DATA_ATTR uint8_t window_head = 0; //oldest sample, ShiftSequences rotates the pointers by one
+RTC_DATA_ATTR float window_counts[BATCH_SIZE][SEQUENCE_LENGTH];
+RTC_DATA_ATTR int32_t window_tags[BATCH_SIZE][SEQUENCE_LENGTH];
+RTC_DATA_ATTR uint32_t calibration_counter = 0;
+RTC_DATA_ATTR bool inference_mode = false;
+RTC_DATA_ATTR Prediction last_prediction; //labels the stub samples, which skip inference
 
 #define DATA_SET 1 << 0
 #define PREDICTION_READY 1 << 1 
 EventGroupHandle_t events;
-//float *human_counts[BATCH_SIZE];
-//int32_t *ventilation_tags[BATCH_SIZE];
+float *human_counts[BATCH_SIZE];
+int32_t *ventilation_tags[BATCH_SIZE];
+Data data;
 
 void run_model(void*); //inference process
+void duty_cycle_loop();
+void drain_stub_samples();
 
 void setup() {
-  button.system_start();
+  ENERGY_STATE(begin());
+  Trace::nameTask("loopTask");
+  button.system_start(duty.remainingSleep());
+  duty.handlePIRWake(); //motion during duty cycle sleep, back to sleep right away
   Serial.begin(115200);
   Serial.println("System is starting...");
+  PowerLocks::begin((1ULL << BUTTON_PIN) | (1ULL << PIR_PIN)); //80 MHz, 240 MHz only around inference
+  bool restored = duty.begin();
+  power.releaseHolds(); //before any CCS811 access, nWAKE is still held from sleepSensors()
+  if(!restored)
+  {
+    calibration_counter = 0; //stale window, warm up again
+    window_head = 0;
+  }
+  if(duty.enabled())
+  {
+    SensorSleepConfig sleep_config;
+    sleep_config.ccs_mode = CCS_MODE;
+    power.setSleepConfig(sleep_config);
+    power.setCCSMode(CCS_MODE);
+  }
   Wire.begin(SDA, SCL);
-  comm.begin();
+  device_clock.begin(); //samples are stamped with the device clock, SNTP maps it to Unix time once the link is up
+  if(!duty.enabled())
+  {
+    tx.setClock(&device_clock);
+    comm.observable("occupancy", OCCUPANCY_MAX_AGE); //predictions are pushed to observers on change
+    if(UPLINK_BATCH)
+      tx.setBatch("batch");
+    if(SAMPLE_LOG && log_flash.begin() && sample_log.mount())
+    {
+      tx.setLog(&sample_log, "data", "predictions", "inference");
+      comm.serveBlock("log", [](uint32_t offset, uint8_t *buffer, size_t size, bool *more) {
+        return sample_log.readRaw(offset, buffer, size, more); //GET /log downloads the raw sectors block-wise
+      });
+      Serial.printf("Sample log: %u records to replay\n", sample_log.nextId() - 1 - sample_log.ackedId());
+    }
+    comm.serveBlock("perf", [](uint32_t offset, uint8_t *buffer, size_t size, bool *more) {
+      static char report[PERF_REPORT_SIZE];
+      static size_t len = 0;
+      if(offset == 0) //one snapshot per download, the timers keep running
+        len = Perf::report(report, sizeof(report));
+      size_t n = offset < len ? len - offset : 0;
+      n = n < size ? n : size;
+      memcpy(buffer, report + offset, n);
+      *more = offset + n < len;
+      return n;
+    });
+    comm.serveBlock("trace", [](uint32_t offset, uint8_t *buffer, size_t size, bool *more) {
+      return Trace::read(offset, buffer, size, more); //events since the last complete download
+    });
+    if(METRICS_POLLING)
+      comm.serveBlock("metrics", [](uint32_t offset, uint8_t *buffer, size_t size, bool *more) {
+        return metrics.read(offset, buffer, size, more);
+      });
+    tx.begin(); //connects in the background, duty cycle connects only for uploads
+  }
   model.GetInputBuffers();
   events = xEventGroupCreate();
   xEventGroupClearBits(events, (DATA_SET) | (PREDICTION_READY));
 
-  BMP.i2cScanner(Wire); //discovering the devices
+  if(!restored)
+    BMP.i2cScanner(Wire); //discovering the devices
+
+  //CCS811 heater takes the longest to settle, so it is started first
+  if(restored && CCS.resume())
+    Serial.println("CCS811 resumed");
+  else if(!CCS.begin())
+    ESP_LOGE(TAG, "Failed to init the CSS811 sensor");
+  else
+    CCS.start(CCS_MODE);
 
   if(!BMP.begin(BMP_ADDR, &Wire, ConfigPresets::ElevatorFloor_ChangeDetection.config, ConfigPresets::ElevatorFloor_ChangeDetection.ctrl_meas))  //inits sensor configuration, wakes it up
     ESP_LOGE(TAG, "Failed to init BMP280");
   else
     BMP.MPUToSleep(MPU_ADDR); //disabling MPU sensor on GY-91 board (don't neeed it)
 
+  power.wakeSensors(); //MLX needs SCL low for 40 ms after sleep, CCS and BMP are already measuring meanwhile
   if(!MLX.begin(MLX_ADDR, &Wire))
     ESP_LOGE(TAG, "Failed to init MLX90614"); //tests the connection obtains id.
-
-  if(!CCS.begin())
-    ESP_LOGE(TAG, "Failed to init the CSS811 sensor");
-  else
-    CCS.start(CCS811_MODE_1SEC);
+  button.onSleep([]() { duty.stop(); stub.disarm(); power.sleepSensors(); power.estimateSleepCurrent(); });
+  if(DUTY_CYCLE_MODE == DUTY_DEEP_SLEEP && WAKE_STUB_SAMPLING)
+    duty.onDeepSleep([](uint64_t sleep_us) {
+      stub.arm(sleep_us, duty.pollsUntilUpload(), BMP_ADDR, ConfigPresets::ElevatorFloor_ChangeDetection.ctrl_meas, MLX_ADDR, &data);
+    });
   delay(10);
   
-  //Allocation of pointers
+  //Window pointers start at the oldest retained sample
   for (int i = 0; i < BATCH_SIZE; i++) 
+  {
     for (int k = 0; k < SEQUENCE_LENGTH; k++)
-        data_pointer_array[i][k] = new Data();
+        data_pointer_array[i][k] = &window[i][(window_head + k) % SEQUENCE_LENGTH];
+    human_counts[i] = window_counts[i];
+    ventilation_tags[i] = window_tags[i];
+  }
+  if(calibration_counter >= SEQUENCE_LENGTH)
+    model.SetShiftedOutputs(human_counts, ventilation_tags);
+  if(restored)
+    drain_stub_samples();
+  else
+    stub.clear();
 
-  xTaskCreate(&run_model,"Inference", 2048, nullptr, 5, nullptr); //creating inference process thread
+  TaskHandle_t inference_task = nullptr;
+  xTaskCreate(&run_model,"Inference", 2048, nullptr, 5, &inference_task); //creating inference process thread
+  metrics.watchTask("loopTask", xTaskGetCurrentTaskHandle());
+  metrics.watchTask("Inference", inference_task);
 }
 
 
-Data data;
 uint16_t ccs_stat;
 uint32_t last_poll = 0;
-uint32_t calibration_counter = 0;
-bool inference_mode = false;
-
+uint32_t first_sample_ms = 0; //boot timing, millis() restarts with every deep sleep wake
+uint32_t first_uplink_ms = 0;
 
-void loop() {
-  uint32_t now = millis();
-  if (last_poll + POLL_INVERVAL <= now)
+void boot_timing(bool uplink)
+{
+  if(!first_sample_ms)
+    first_sample_ms = millis();
+  if(uplink && !first_uplink_ms)
   {
+    first_uplink_ms = millis();
+    Serial.printf("Boot to first sample: %u ms, boot to first uplink: %u ms\n", first_sample_ms, first_uplink_ms);
+  }
+}
+
+void read_sensors()
+{
+    PERF_SCOPE(PERF_READ_SENSORS);
     Serial.printf("--------------------------\n");
 
     if(!BMP.read(false))
+    {
+      metrics.counters.i2c_errors++;
       ESP_LOGE(TAG, "BMP280 SENSOR ERROR");
+    }
 
     if(!DHT11.read())
+    {
+      metrics.counters.dht_errors++;
       ESP_LOGE(TAG, "DHT SENSOR ERROR");
+    }
 
-    CCS.read(&data.co2_ppm, &data.tvoc_ppm, &ccs_stat, nullptr);
+    uint16_t co2_ppm, tvoc_ppm; //Data is packed, its fields can't be passed by pointer
+    CCS.read(&co2_ppm, &tvoc_ppm, &ccs_stat, nullptr);
+    data.co2_ppm = co2_ppm;
+    data.tvoc_ppm = tvoc_ppm;
+    if(ccs_stat & CCS811_ERRSTAT_I2CFAIL)
+      metrics.counters.i2c_errors++;
     if(ccs_stat == (CCS811_ERRSTAT_FW_MODE | CCS811_ERRSTAT_APP_VALID |CCS811_ERRSTAT_DATA_READY))
       Serial.printf("CO2: %d ppm, TVOC: %d ppm\n", data.co2_ppm, data.tvoc_ppm);
     else if (!(ccs_stat & CCS811_ERRSTAT_DATA_READY))
@@ -119,21 +278,57 @@ void loop() {
     data.bmp280_pressure = BMP.getPressure();
     data.mlx_ambient_temperature = MLX.readAmbientTempC();
     data.mlx_object_temperature = MLX.readObjectTempC();
+    if(isnan(data.mlx_ambient_temperature) || isnan(data.mlx_object_temperature))
+      metrics.counters.i2c_errors++;
     data.humidity_dht = DHT11.getHumidity();
     data.temperature_dht = DHT11.getTemperature();
     data.pir_uptime = (float)_PIR.read()/1000;
+}
+
+//Window slot of the prediction that was just made is free again, mirrors the shift into RTC memory
+void window_shifted()
+{
+  window_head = (window_head + 1) % SEQUENCE_LENGTH;
+  model.GetShiftedOutputs(human_counts, ventilation_tags);
+}
+
+void loop() {
+  if(duty.enabled())
+  {
+    duty_cycle_loop();
+    return;
+  }
+  PERF_SCOPE(PERF_LOOP);
+  uint32_t now = millis();
+  if (last_poll + POLL_INVERVAL <= now)
+  {
+    PERF_SCOPE(PERF_POLL);
+    read_sensors();
+    uint64_t captured = device_clock.now();
     last_poll = millis();
+    boot_timing(false);
     data.print();
     if(!inference_mode)
-      comm.sendData("data", &data);
+    {
+      ReportedData report;
+      if(uplink.filter(&data, captured, &report))
+        tx.queueData("data", &report);
+      if(uplink.sampleCount() % UPLINK_REPORT_EVERY == 0)
+        uplink.report();
+    }
     else
     {
+      //sample and prediction of the poll go out as one record, the raw series keeps growing for retraining
+      InferenceRecord record = {};
+      inference_series.filter(&data, captured, &record.sample);
+      record.model_version = model.GetModelVersion();
       if(calibration_counter < SEQUENCE_LENGTH)
       {
         *(data_pointer_array[0][calibration_counter]) = data;
         if(calibration_counter == (SEQUENCE_LENGTH - 1))
         {
             model.SetDefaultLabels(0, 0);
+            TRACE_INSTANT(TRACE_SET_DATA_SET, 0);
             xEventGroupSetBits(events, DATA_SET);
             Serial.println("Calibration data ready.");
         }
@@ -145,38 +340,182 @@ void loop() {
           if(model_state & PREDICTION_READY)
           {
             xEventGroupClearBits(events, PREDICTION_READY);
+            window_shifted();
             *(data_pointer_array[0][SEQUENCE_LENGTH - 1]) = data;
             Prediction pred = model.GetRecentPrediction();
+            record.prediction = pred;
+            record.inference_us = model.GetLatencyUs();
+            record.has_prediction = 1;
+            TRACE_INSTANT(TRACE_SET_DATA_SET, 0);
             xEventGroupSetBits(events, DATA_SET);
             Serial.printf("Human count: %.2f, Ventilation: %d\n", pred.human_count, pred.ventilation_tag);
-            comm.sendPrediction("predictions", &pred);
+            comm.publishPrediction("occupancy", &pred);
           }
         }
+      tx.queueInference("inference", &record);
     }
   }
   _PIR.update();
-  comm.update();
+  power.update();
+  {
+    PERF_SCOPE(PERF_TX_UPDATE);
+    tx.update();
+  }
+  if(tx.sentRecords())
+    boot_timing(true);
+  button.buttonCtrl(250, &inference_mode, &calibration_counter);
+  PowerLocks::idle(LOOP_IDLE_MS);
+}
+
+//One poll per wake up: sample, predict once the window is warm, upload every UPLOAD_EVERY_N polls, sleep
+void duty_cycle_loop()
+{
   button.buttonCtrl(250, &inference_mode, &calibration_counter);
+  if(!duty.sampleDue()) //woken by the button
+  {
+    duty.sleep();
+    return;
+  }
+
+  uint32_t start = millis();
+  while(!power.wakeComplete() && millis() - start < WAKE_TIMEOUT)
+  {
+    _PIR.update();
+    power.update();
+    delay(10);
+  }
+  read_sensors();
+  uint64_t captured = device_clock.now();
+  boot_timing(false);
+  float pir_uptime = duty.pirUptime();
+  if(pir_uptime > data.pir_uptime)
+    data.pir_uptime = pir_uptime;
+  data.print();
+
+  if(!inference_mode)
+    duty.append(&data, captured);
+  else
+  {
+    //sample and prediction of the poll are queued as one record, like tx.queueInference() in loop()
+    InferenceRecord record = {};
+    record.sample.data = data;
+    record.model_version = model.GetModelVersion();
+    if(calibration_counter < SEQUENCE_LENGTH)
+    {
+      *(data_pointer_array[0][calibration_counter++]) = data;
+      if(calibration_counter == SEQUENCE_LENGTH)
+      {
+        model.SetDefaultLabels(0, 0);
+        Serial.println("Calibration data ready.");
+      }
+    }
+    else
+      *(data_pointer_array[0][SEQUENCE_LENGTH - 1]) = data;
+
+    if(calibration_counter == SEQUENCE_LENGTH) //inference is due once the window is warm
+    {
+      TRACE_INSTANT(TRACE_SET_DATA_SET, 0);
+      xEventGroupSetBits(events, DATA_SET);
+      EventBits_t bits;
+      {
+        TRACE_SCOPE(TRACE_WAIT_PREDICTION);
+        bits = xEventGroupWaitBits(events, PREDICTION_READY, pdTRUE, pdTRUE, pdMS_TO_TICKS(INFERENCE_TIMEOUT));
+      }
+      if(bits & PREDICTION_READY)
+      {
+        window_shifted();
+        Prediction pred = model.GetRecentPrediction();
+        Serial.printf("Human count: %.2f, Ventilation: %d\n", pred.human_count, pred.ventilation_tag);
+        record.prediction = pred;
+        record.inference_us = model.GetLatencyUs();
+        record.has_prediction = 1;
+        last_prediction = pred;
+      }
+      else
+        ESP_LOGE(TAG, "Inference timed out");
+    }
+    duty.appendInference(&record, captured);
+  }
+  duty.sampleTaken();
+  if(duty.uploadDue())
+  {
+    if(duty.upload(&comm, &device_clock))
+      boot_timing(true);
+    stub.report();
+    device_clock.report();
+    Perf::print();
+    if(ENERGY_ACCOUNTING)
+      Energy::print();
+    if(TRACE_SERIAL)
+      Trace::print();
+  }
+  duty.sleep();
+}
+
+
+//Polls the wake stub took while the device stayed in deep sleep
+void drain_stub_samples()
+{
+  uint16_t n = stub.pending();
+  Data sample;
+  model.SetRecentPrediction(last_prediction);
+  InferenceRecord record = {}; //stub samples are not predicted, they are queued with the sample alone
+  record.model_version = model.GetModelVersion();
+  for(uint16_t i = 0; i < n && stub.get(i, &sample); i++)
+  {
+    if(!inference_mode)
+    {
+      duty.append(&sample, duty.pollTime(i)); //the stub polled on the duty cycle grid
+      continue;
+    }
+    record.sample.data = sample;
+    duty.appendInference(&record, duty.pollTime(i));
+    if(calibration_counter < SEQUENCE_LENGTH - 1) //last slot is left to a full boot poll, which starts inference
+      *(data_pointer_array[0][calibration_counter++]) = sample;
+    else if(calibration_counter == SEQUENCE_LENGTH)
+    {
+      *(data_pointer_array[0][SEQUENCE_LENGTH - 1]) = sample;
+      model.ShiftSequences(data_pointer_array); //no inference for stub samples, the last prediction is fed back instead
+      window_shifted();
+    }
+  }
+  if(n)
+    Serial.printf("%u samples from the wake stub\n", n);
+  duty.samplesSkipped(n);
+  uint64_t pir_age = stub.pirTriggerAgeUs();
+  if(pir_age)
+    duty.setPIRTrigger(pir_age);
+  stub.clear();
 }
 
 
 void run_model(void*)
 {
+    Trace::nameTask("Inference");
     while(true)
     {
-      xEventGroupWaitBits(events, DATA_SET, pdTRUE, pdTRUE, portMAX_DELAY);
-      model.SetSequences(data_pointer_array);
-      model.PrintBuffers();
-      model.ComputeSensorDeltas();
-      model.ScaleData();
-      model.SetInputBuffers();
-      if(!model.Predict())
       {
-        ESP_LOGE(TAG, "Inference error, process is aborted.");
-        break;
+        TRACE_SCOPE(TRACE_WAIT_DATA_SET);
+        xEventGroupWaitBits(events, DATA_SET, pdTRUE, pdTRUE, portMAX_DELAY);
+      }
+      {
+        PM_CPU_SCOPE(); //preprocessing and Invoke at full clock, the rest of the time at the minimum
+        model.SetSequences(data_pointer_array);
+        model.PrintBuffers();
+        model.ComputeSensorDeltas();
+        model.ScaleData();
+        model.SetInputBuffers();
+        if(!model.Predict())
+        {
+          ESP_LOGE(TAG, "Inference error, process is aborted.");
+          break;
+        }
       }
+      metrics.counters.inferences++;
+      metrics.counters.inference_us = model.GetLatencyUs();
       model.ShiftSequences(data_pointer_array);
       Serial.println("Prediction ready.");
+      TRACE_INSTANT(TRACE_SET_PREDICTION_READY, 0);
       xEventGroupSetBits(events, PREDICTION_READY);
     }
 }